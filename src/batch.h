@@ -0,0 +1,1053 @@
+#ifndef BATCH_H__
+#define BATCH_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file batch.h definition of batch executor: evaluates a compiled program
+/// over arrays of input values
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "execution.h"
+#include "vm.h"
+#include "def_rte.h"
+#include "exception.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Type of column elements.
+  enum element_type { FLOAT32, FLOAT64 };
+
+  /// Maps C++ type to element type; defined for float and double only.
+  template < class E > struct element_type_of;
+
+  /// float --> FLOAT32.
+  template <> struct element_type_of< float > {
+    static const element_type value = FLOAT32; ///< Element type
+  };
+
+  /// double --> FLOAT64.
+  template <> struct element_type_of< double > {
+    static const element_type value = FLOAT64; ///< Element type
+  };
+
+  //----------------------------------------------------------------------------
+  /// Input column: array of values, one per row; elements of a type
+  /// different from T are converted when read.
+  template < class T >
+  struct column {
+    /// Address of first element.
+    const void* data;
+    /// Element type.
+    element_type type;
+    /// Distance between two consecutive elements, in number of elements.
+    size_t stride;
+    /// Default constructor.
+    column() : data( 0 ), type( element_type_of< T >::value ), stride( 1 ) {}
+    /// Constructor.
+    /// @param d address of first element, float or double
+    /// @param s stride
+    template < class E >
+    column( const E* d, size_t s = 1 )
+      : data( d ), type( element_type_of< E >::value ), stride( s ) {}
+    /// Copies n elements starting at element i into array d.
+    /// @param i index of first element
+    /// @param n number of elements
+    /// @param d output array
+    void read( size_t i, size_t n, T* d ) const
+    {
+      if( type == FLOAT32 ) read( static_cast< const float* >( data ), i, n, d );
+      else read( static_cast< const double* >( data ), i, n, d );
+    }
+    /// Copies the elements of n rows into array d.
+    /// @param rows row indices
+    /// @param n number of rows
+    /// @param d output array
+    void gather( const size_t* rows, size_t n, T* d ) const
+    {
+      if( type == FLOAT32 ) gather( static_cast< const float* >( data ), rows, n, d );
+      else gather( static_cast< const double* >( data ), rows, n, d );
+    }
+    /// Returns element i.
+    T operator[]( size_t i ) const
+    {
+      return type == FLOAT32
+             ? T( static_cast< const float* >( data )[ i * stride ] )
+             : T( static_cast< const double* >( data )[ i * stride ] );
+    }
+  private:
+    /// Copies and converts elements.
+    template < class E >
+    void read( const E* s, size_t i, size_t n, T* d ) const
+    {
+      s += i * stride;
+      if( stride == 1 ) for( size_t k = 0; k != n; ++k ) d[ k ] = T( s[ k ] );
+      else for( size_t k = 0; k != n; ++k ) d[ k ] = T( s[ k * stride ] );
+    }
+    /// Copies and converts the elements of selected rows.
+    template < class E >
+    void gather( const E* s, const size_t* rows, size_t n, T* d ) const
+    {
+      for( size_t k = 0; k != n; ++k ) d[ k ] = T( s[ rows[ k ] * stride ] );
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Evaluates a program over a range of rows: input variables are bound to
+  /// columns and the values left on the stack by the program are written
+  /// to output arrays.
+  /// The program is translated at construction time into a sequence of
+  /// operations each applied to a block of rows at a time: the value stack
+  /// holds one array of values per stack slot and functions created through
+  /// the unary_function and binary_function adaptors are invoked in a tight
+  /// loop over the block. Functions of any other type are invoked once per
+  /// row through a local run-time environment.
+  /// Assignments compiled into store_vars or pop_vars instructions write
+  /// one array of values per variable, read back by the following loads;
+  /// the variables hold the values of the last row when a block ends.
+  /// Programs which cannot be evaluated one block at a time (e.g. programs
+  /// calling the assignment operator, which needs the instruction pointer,
+  /// or reading a variable before assigning it, which reads the value
+  /// assigned in the previous row) are run row by row through a vm, in this
+  /// case bound variables are updated at each row.
+  /// Conditionals compiled into forward jumps are evaluated with per row
+  /// masks: a jump_if removes the rows meeting its condition from the set of
+  /// active rows, a jump removes all the active rows saving the values they
+  /// carry, and the rows are merged back where the jumps end, the carried
+  /// values being blended into the stack slots; the operations of both
+  /// branches are applied to whole blocks, and skipped when no row of the
+  /// block is active. Variables assigned inside a branch are written for
+  /// the active rows only; programs reading them after the next jump or
+  /// merge, or containing backward jumps, are run row by row.
+  /// Variables not bound to a column are read from the variable table once
+  /// per block.
+  /// A program computing a predicate selects rows: select() compacts the
+  /// indices of the rows for which the predicate is not zero into a
+  /// selection vector, and run_selection() evaluates a program over the
+  /// selected rows only, gathering the values of its bound columns, e.g.
+  /// to evaluate an expensive expression only where a cheap test passes.
+  /// Parameters (see load_param) and constants are invariant: operations
+  /// whose inputs are all invariant are evaluated once per block and their
+  /// results are broadcast to all the rows only when read by an operation
+  /// on values varying across rows.
+  /// @warning the batch executor references the instructions and variables
+  /// of the program: the program must outlive the executor.
+  template < class T > class batch_executor {
+  public:
+
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+
+    /// Pointer to value type.
+    typedef typename rte< T >::ValPtrT val_ptr_type;
+
+    /// Default number of rows evaluated at once.
+    static const size_t DEFAULT_BLOCK = 256;
+
+    /// Class name.
+    static const std::string CLS_NAME;
+
+    //--------------------------------------------------------------------------
+    /// Thrown when the program cannot be evaluated e.g. stack underflow.
+    class invalid_program : public exception_base {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      invalid_program( const std::string& fun,
+                       unsigned long lineno,
+                       const std::string& data = "" )
+        : exception_base( NS_NAME, batch_executor::CLS_NAME, fun, lineno, data )
+      {}
+    };
+
+    //--------------------------------------------------------------------------
+    /// Constructor.
+    /// @param prog program
+    /// @param block maximum number of rows evaluated at once
+    batch_executor( const prog_type& prog, size_t block = DEFAULT_BLOCK )
+      : prog_( &prog ), block_( block ? block : 1 ), depth_( 0 ),
+        results_( 0 ), row_mode_( false ), vm_( rte< T >() )
+    {
+      lower();
+      stack_.resize( depth_ * block_ );
+      regs_.resize( reg_vars_.size() * block_ );
+      stored_.resize( reg_vars_.size() );
+      active_.resize( block_ );
+      deferred_.resize( jumps_.size() );
+      masks_.resize( jumps_.size() * block_ );
+      saved_.resize( jumps_.empty() ? 0
+                     : ( jumps_.back().saved + size_t( jumps_.back().values ) ) * block_ );
+      if( row_mode_ ) rows_.resize( results_ * block_ );
+      results_p_.resize( results_ );
+    }
+
+    /// Binds variable to column.
+    /// @param v variable
+    /// @param c column
+    /// @throw invalid_program if v is a parameter read by the program
+    void bind( const val_ptr_type& v, const column< T >& c )
+    {
+      for( size_t i = 0; i != bindings_.size(); ++i )
+      {
+        if( bindings_[ i ].var == ptr( v ) )
+        {
+          bindings_[ i ].col = c;
+          return;
+        }
+      }
+      // checked on the program: in row mode there are no lowered operations
+      for( typename prog_type::const_iterator i = prog_->begin(); i != prog_->end(); ++i )
+      {
+        const load_param< T >* lp = dynamic_cast< const load_param< T >* >( ptr( *i ) );
+        if( lp && ptr( lp->val_p ) == ptr( v ) )
+        {
+          throw invalid_program( "bind", __LINE__,
+                                 "parameter " + v->name + " cannot be bound" );
+        }
+      }
+      binding b = { ptr( v ), c };
+      bindings_.push_back( b );
+      for( size_t i = 0; i != ops_.size(); ++i )
+      {
+        if( ops_[ i ].var == ptr( v ) ) ops_[ i ].binding = int( bindings_.size() - 1 );
+      }
+    }
+
+    /// Binds variable with given name to column.
+    /// @param rt run-time environment containing variable
+    /// @param name variable name
+    /// @param c column
+    /// @return false if variable not found
+    bool bind( const rte< T >& rt, const std::string& name, const column< T >& c )
+    {
+      const val_ptr_type v = rt.variable_p( name );
+      if( !v ) return false;
+      bind( v, c );
+      return true;
+    }
+
+    /// Removes all bindings.
+    void unbind()
+    {
+      bindings_.clear();
+      for( size_t i = 0; i != ops_.size(); ++i ) ops_[ i ].binding = -1;
+    }
+
+    /// Returns number of values left on the stack by the program, i.e.
+    /// number of output arrays.
+    size_t results() const { return results_; }
+
+    /// Returns true if the program is evaluated row by row.
+    bool row_mode() const { return row_mode_; }
+
+    /// Returns maximum number of rows evaluated at once.
+    size_t block() const { return block_; }
+
+    /// Evaluates rows [first, first + rows).
+    /// Bound columns are read at index first + i, result k of row
+    /// first + i is written at out[ k ][ i * out_stride ].
+    /// @param first index of first row
+    /// @param rows number of rows
+    /// @param out output arrays, one per result; null arrays are skipped
+    /// @param out_stride distance between two consecutive output values
+    void run( size_t first, size_t rows, T* const* out, size_t out_stride = 1 )
+    {
+      if( row_mode_ )
+      {
+        run_rows( first, rows, out, out_stride );
+        return;
+      }
+      for( size_t b = 0; b < rows; b += block_ )
+      {
+        const size_t n = std::min( block_, rows - b );
+        run_block( first + b, n );
+        for( size_t k = 0; k != results_; ++k )
+        {
+          if( !out[ k ] ) continue;
+          const T* s = slot( k );
+          T* o = out[ k ] + b * out_stride;
+          for( size_t i = 0; i != n; ++i ) o[ i * out_stride ] = s[ i ];
+        }
+      }
+    }
+
+    /// Appends to a selection vector the indices of the rows in
+    /// [first, first + rows) for which the value on top of the stack is not
+    /// zero, as jump_if does; reserve space in sel to avoid allocations.
+    /// @param first index of first row
+    /// @param rows number of rows
+    /// @param[in,out] sel selection vector: row indices in increasing order
+    /// @return number of selected rows
+    size_t select( size_t first, size_t rows, std::vector< size_t >& sel )
+    {
+      if( !results_ )
+      {
+        throw invalid_program( "select", __LINE__, "program computes no value" );
+      }
+      const size_t begin = sel.size();
+      sel.resize( begin + rows );
+      size_t* d = sel.data() + begin;
+      size_t k = 0;
+      fold( first, rows, [ d, &k, this ]( size_t row, size_t n, const T* const* v )
+            {
+              // branch free compaction: rows not selected are overwritten
+              const T* p = v[ results_ - 1 ];
+              for( size_t i = 0; i != n; ++i )
+              {
+                d[ k ] = row + i;
+                k += p[ i ] != T();
+              }
+            } );
+      sel.resize( begin + k );
+      return k;
+    }
+
+    /// Evaluates selected rows: bound columns are read at index rows[ i ],
+    /// result k of row rows[ i ] is written at out[ k ][ i * out_stride ],
+    /// i.e. outputs are compacted.
+    /// @param rows row indices, e.g. computed by select()
+    /// @param n number of rows
+    /// @param out output arrays, one per result; null arrays are skipped
+    /// @param out_stride distance between two consecutive output values
+    void run_selection( const size_t* rows, size_t n, T* const* out,
+                        size_t out_stride = 1 )
+    {
+      if( row_mode_ )
+      {
+        run_rows( 0, n, out, out_stride, rows );
+        return;
+      }
+      for( size_t b = 0; b < n; b += block_ )
+      {
+        const size_t m = std::min( block_, n - b );
+        run_block( 0, m, rows + b );
+        for( size_t k = 0; k != results_; ++k )
+        {
+          if( !out[ k ] ) continue;
+          const T* s = slot( k );
+          T* o = out[ k ] + b * out_stride;
+          for( size_t i = 0; i != m; ++i ) o[ i * out_stride ] = s[ i ];
+        }
+      }
+    }
+
+    /// Evaluates rows [first, first + rows) one block at a time, passing the
+    /// results of each block to a sink instead of writing them to output
+    /// arrays: sink( row, n, values ) is called with the index of the first
+    /// row of the block, the number of rows and one array of n values per
+    /// result, valid during the call only. E.g. reductions fold the values
+    /// without storing them (see reduction.h).
+    /// @param first index of first row
+    /// @param rows number of rows
+    /// @param sink function object
+    template < class S >
+    void fold( size_t first, size_t rows, S sink )
+    {
+      // results of each block: stack slots, or rows written by the vm
+      for( size_t k = 0; k != results_; ++k )
+      {
+        results_p_[ k ] = row_mode_ ? &rows_[ k * block_ ] : slot( k );
+      }
+      for( size_t b = 0; b < rows; b += block_ )
+      {
+        const size_t n = std::min( block_, rows - b );
+        if( row_mode_ ) run_rows( first + b, n, results_p_.data(), 1 );
+        else run_block( first + b, n );
+        sink( first + b, n, static_cast< const T* const* >( results_p_.data() ) );
+      }
+    }
+
+  private:
+
+    /// Maximum number of input or output values of vector functions
+    /// evaluated over columns; functions with more values are called on
+    /// each row.
+    static const int MAX_VECTOR_VALUES = 8;
+
+    /// Operation kinds.
+    enum op_kind { LOAD_VAL, LOAD_VAR, LOAD_REG, STORE, DROP, BROADCAST, ADD,
+                   SUB, MUL, DIV, NEG, UNARY, BINARY, VECTOR, CALL, JUMP_IF,
+                   JUMP, LABEL };
+
+    /// Block operation.
+    struct op {
+      /// Kind.
+      op_kind kind;
+      /// Value for LOAD_VAL.
+      T val;
+      /// Variable for LOAD_VAR.
+      value< T >* var;
+      /// Index of binding for LOAD_VAR, -1 if variable not bound.
+      int binding;
+      /// Function for UNARY.
+      T ( *unary )( T );
+      /// Function for BINARY.
+      T ( *binary )( T, T );
+      /// Function for CALL.
+      const function_i< T >* fun;
+      /// Function for VECTOR.
+      const vector_function_i< T >* vector;
+      /// Register for LOAD_REG and STORE, jump for JUMP_IF and JUMP, list
+      /// of jumps for LABEL.
+      int reg;
+      /// Distance of stored value from top of stack for STORE and
+      /// BROADCAST, number of removed values for DROP and JUMP, stack depth
+      /// for LABEL.
+      int offset;
+      /// If true the operation is evaluated on the first row only.
+      bool uniform;
+      /// For JUMP_IF: if true rows jump when the value is not zero.
+      bool when;
+    };
+
+    /// Jump state.
+    struct jump_state {
+      /// Number of values carried by the jumping rows.
+      int values;
+      /// Index of the first array of saved values.
+      size_t saved;
+    };
+
+    /// Variable binding.
+    struct binding {
+      /// Variable.
+      value< T >* var;
+      /// Column.
+      column< T > col;
+    };
+
+    /// Returns operation initialized with given kind.
+    static op make_op( op_kind k )
+    {
+      op o = { k, T(), 0, -1, 0, 0, 0, 0, -1, 0, false, false };
+      return o;
+    }
+
+    /// Translates program into block operations; switches to row mode if
+    /// an instruction cannot be translated.
+    void lower()
+    {
+      typedef unary_function< T > uf_type;
+      typedef binary_function< T > bf_type;
+      int depth = 0;
+      int max_depth = 0;
+      // variables read before being assigned
+      std::vector< const value< T >* > read;
+      // stack slots holding the same value in all the rows
+      std::vector< bool > uniform;
+      const size_t size = prog_->size();
+      // jumps ending at each instruction, and number of branches containing
+      // each instruction
+      std::vector< std::vector< size_t > > targets( size + 1 );
+      std::vector< int > nested( size, 0 );
+      for( size_t i = 0; i != size; ++i )
+      {
+        const branch< T >* b =
+          dynamic_cast< const branch< T >* >( ptr( ( *prog_ )[ i ] ) );
+        if( !b ) continue;
+        if( b->offset < 0 || size_t( b->offset ) >= size - i )
+        {
+          row_mode_ = true;
+          continue;
+        }
+        const size_t t = i + 1 + size_t( b->offset );
+        targets[ t ].push_back( i );
+        for( size_t k = i + 1; k != t; ++k ) ++nested[ k ];
+      }
+      // jump state of each jump instruction
+      std::vector< int > jump_ids( size, -1 );
+      // variables assigned inside a branch, and those assigned since the
+      // last jump or merge
+      std::vector< const value< T >* > masked;
+      std::vector< const value< T >* > segment;
+      for( size_t i = 0; i != size; ++i )
+      {
+        const instruction< T >* in = ptr( ( *prog_ )[ i ] );
+        int pop = 0;
+        int push = 1;
+        if( !targets[ i ].empty() )
+        {
+          label( targets[ i ], jump_ids, depth, uniform );
+          segment.clear();
+        }
+        if( const load_val< T >* lv = dynamic_cast< const load_val< T >* >( in ) )
+        {
+          op o = make_op( LOAD_VAL );
+          o.val = lv->val;
+          o.uniform = true;
+          ops_.push_back( o );
+        }
+        else if( const load_var< T >* lr =
+                   dynamic_cast< const load_var< T >* >( in ) )
+        {
+          op o = make_op( LOAD_VAR );
+          o.reg = reg( ptr( lr->val_p ) );
+          if( o.reg >= 0 )
+          {
+            o.kind = LOAD_REG;
+            // rows not assigned by the branch would read a stale value
+            const value< T >* v = reg_vars_[ size_t( o.reg ) ];
+            if( std::find( masked.begin(), masked.end(), v ) != masked.end()
+                && std::find( segment.begin(), segment.end(), v ) == segment.end() )
+            {
+              row_mode_ = true;
+            }
+          }
+          else
+          {
+            o.var = ptr( lr->val_p );
+            o.uniform = dynamic_cast< const load_param< T >* >( lr ) != 0;
+            read.push_back( o.var );
+          }
+          ops_.push_back( o );
+        }
+        else if( const store_vars< T >* sv =
+                   dynamic_cast< const store_vars< T >* >( in ) )
+        {
+          pop = push = int( sv->vars.size() );
+          broadcast( uniform, pop );
+          store( sv->vars, read );
+          if( nested[ i ] ) assigned( sv->vars, masked, segment );
+        }
+        else if( const pop_vars< T >* pv =
+                   dynamic_cast< const pop_vars< T >* >( in ) )
+        {
+          pop = int( pv->vars.size() );
+          push = 0;
+          broadcast( uniform, pop );
+          store( pv->vars, read );
+          if( nested[ i ] ) assigned( pv->vars, masked, segment );
+          op o = make_op( DROP );
+          o.offset = pop;
+          ops_.push_back( o );
+        }
+        else if( const call_fun< T >* cf =
+                   dynamic_cast< const call_fun< T >* >( in ) )
+        {
+          const function_i< T >* f = ptr( cf->fun_p );
+          pop = f->values_in;
+          push = f->values_out;
+          // assignments read the previous instructions through the
+          // instruction pointer
+          if( f->name == "=" ) row_mode_ = true;
+          op o = make_op( CALL );
+          o.fun = f;
+          if( const function< uf_type, T >* u =
+                dynamic_cast< const function< uf_type, T >* >( f ) )
+          {
+            o.unary = u->fun.f;
+            o.kind = o.unary == &neg< T > ? NEG : UNARY;
+          }
+          else if( const vector_function_i< T >* v =
+                     dynamic_cast< const vector_function_i< T >* >( f ) )
+          {
+            if( std::max( pop, push ) > MAX_VECTOR_VALUES ) o.kind = CALL;
+            else
+            {
+              o.vector = v;
+              o.kind = VECTOR;
+            }
+          }
+          else if( const function< bf_type, T >* b =
+                     dynamic_cast< const function< bf_type, T >* >( f ) )
+          {
+            o.binary = b->fun.f;
+            o.kind = o.binary == &add< T > ? ADD
+                   : o.binary == &sub< T > ? SUB
+                   : o.binary == &mul< T > ? MUL
+                   : o.binary == &div< T > ? DIV : BINARY;
+          }
+          // scalar functions of invariant values are evaluated once
+          o.uniform = o.kind != CALL && o.kind != VECTOR && depth >= pop;
+          for( int k = depth - pop; o.uniform && k != depth; ++k ) o.uniform = uniform[ k ];
+          if( !o.uniform ) broadcast( uniform, pop );
+          ops_.push_back( o );
+        }
+        else if( const jump_if< T >* ji = dynamic_cast< const jump_if< T >* >( in ) )
+        {
+          pop = 1;
+          push = 0;
+          broadcast( uniform, pop );
+          op o = make_op( JUMP_IF );
+          o.when = ji->when;
+          o.reg = jump_ids[ i ] = add_jump( 0 );
+          ops_.push_back( o );
+          segment.clear();
+        }
+        else if( const jump< T >* j = dynamic_cast< const jump< T >* >( in ) )
+        {
+          pop = j->values;
+          push = 0;
+          broadcast( uniform, pop );
+          op o = make_op( JUMP );
+          o.offset = pop;
+          o.reg = jump_ids[ i ] = add_jump( pop );
+          ops_.push_back( o );
+          segment.clear();
+        }
+        else
+        {
+          // unknown instructions
+          row_mode_ = true;
+          if( !stack_effect( in, pop, push ) ) pop = push = 0;
+        }
+        if( depth < pop )
+        {
+          throw invalid_program( "lower", __LINE__, "stack underflow" );
+        }
+        const bool u = !ops_.empty() && ops_.back().uniform;
+        uniform.resize( size_t( depth - pop ) );
+        uniform.resize( size_t( depth - pop + push ), u );
+        depth += push - pop;
+        max_depth = std::max( max_depth, depth );
+      }
+      if( !targets[ size ].empty() ) label( targets[ size ], jump_ids, depth, uniform );
+      // results are written for all the rows
+      broadcast( uniform, depth );
+      depth_ = size_t( max_depth );
+      results_ = size_t( depth );
+      if( row_mode_ )
+      {
+        ops_.clear();
+        reg_vars_.clear();
+        jumps_.clear();
+        labels_.clear();
+      }
+    }
+
+    /// Adds jump state.
+    /// @param values number of values carried by the jumping rows
+    /// @return index of jump state
+    int add_jump( int values )
+    {
+      jump_state j = { values, 0 };
+      if( !jumps_.empty() )
+      {
+        j.saved = jumps_.back().saved + size_t( jumps_.back().values );
+      }
+      jumps_.push_back( j );
+      return int( jumps_.size() - 1 );
+    }
+
+    /// Adds LABEL operation merging the rows of the jumps ending at an
+    /// instruction.
+    /// @param sources jump instructions
+    /// @param ids jump state of each jump instruction
+    /// @param depth stack depth
+    /// @param uniform invariant stack slots, updated
+    void label( const std::vector< size_t >& sources, const std::vector< int >& ids,
+                int depth, std::vector< bool >& uniform )
+    {
+      std::vector< int > l;
+      int values = 0;
+      for( size_t k = 0; k != sources.size(); ++k )
+      {
+        const int j = ids[ sources[ k ] ];
+        if( j < 0 ) continue;
+        l.push_back( j );
+        values = std::max( values, jumps_[ size_t( j ) ].values );
+      }
+      // carried values are blended with the values of all the rows
+      broadcast( uniform, values );
+      op o = make_op( LABEL );
+      o.reg = int( labels_.size() );
+      o.offset = depth;
+      labels_.push_back( l );
+      ops_.push_back( o );
+    }
+
+    /// Records variables assigned inside a branch.
+    void assigned( const std::vector< val_ptr_type >& vars,
+                   std::vector< const value< T >* >& masked,
+                   std::vector< const value< T >* >& segment ) const
+    {
+      for( size_t k = 0; k != vars.size(); ++k )
+      {
+        masked.push_back( ptr( vars[ k ] ) );
+        segment.push_back( ptr( vars[ k ] ) );
+      }
+    }
+
+    /// Adds BROADCAST operations copying the first row of the invariant
+    /// values among the n values on top of the stack to all the rows.
+    /// @param uniform invariant stack slots, updated
+    /// @param n number of values
+    void broadcast( std::vector< bool >& uniform, int n )
+    {
+      const int depth = int( uniform.size() );
+      for( int k = std::max( depth - n, 0 ); k < depth; ++k )
+      {
+        if( !uniform[ k ] ) continue;
+        op o = make_op( BROADCAST );
+        o.offset = depth - 1 - k;
+        ops_.push_back( o );
+        uniform[ k ] = false;
+      }
+    }
+
+    /// Returns register holding the values of a variable, -1 if variable
+    /// not assigned.
+    int reg( const value< T >* v ) const
+    {
+      for( size_t r = 0; r != reg_vars_.size(); ++r )
+      {
+        if( reg_vars_[ r ] == v ) return int( r );
+      }
+      return -1;
+    }
+
+    /// Adds STORE operations, the last variable receiving the value on top
+    /// of the stack; switches to row mode if a variable was read before.
+    void store( const std::vector< val_ptr_type >& vars,
+                const std::vector< const value< T >* >& read )
+    {
+      for( size_t k = 0; k != vars.size(); ++k )
+      {
+        value< T >* v = ptr( vars[ k ] );
+        if( std::find( read.begin(), read.end(), v ) != read.end() ) row_mode_ = true;
+        op o = make_op( STORE );
+        o.reg = reg( v );
+        if( o.reg < 0 )
+        {
+          o.reg = int( reg_vars_.size() );
+          reg_vars_.push_back( v );
+        }
+        o.offset = int( vars.size() - 1 - k );
+        ops_.push_back( o );
+      }
+    }
+
+    /// Returns address of register.
+    T* reg_slot( int r ) { return &regs_[ size_t( r ) * block_ ]; }
+
+    /// Returns address of stack slot.
+    T* slot( size_t s ) { return &stack_[ s * block_ ]; }
+
+    /// Returns address of the mask of the rows taking a jump.
+    char* mask( int j ) { return &masks_[ size_t( j ) * block_ ]; }
+
+    /// Returns address of array of saved values.
+    T* saved( size_t s ) { return &saved_[ s * block_ ]; }
+
+    /// Evaluates block of n rows starting at row first, or of the n rows
+    /// selected by sel; results are left in the first results() stack slots.
+    void run_block( size_t first, size_t n, const size_t* sel = 0 )
+    {
+      size_t sp = 0;
+      // number of active rows
+      size_t live = n;
+      std::fill( active_.begin(), active_.begin() + n, char( 1 ) );
+      std::fill( deferred_.begin(), deferred_.end(), size_t( 0 ) );
+      std::fill( stored_.begin(), stored_.end(), size_t( 0 ) );
+      for( typename std::vector< op >::const_iterator o = ops_.begin();
+           o != ops_.end();
+           ++o )
+      {
+        // branches taken by no row are skipped
+        if( !live && o->kind != LABEL ) continue;
+        // invariant values are computed on the first row only
+        const size_t m = o->uniform ? 1 : n;
+        switch( o->kind )
+        {
+        case LOAD_VAL:
+          {
+            std::fill( slot( sp ), slot( sp ) + m, o->val );
+            ++sp;
+            break;
+          }
+        case LOAD_REG:
+          {
+            const T* r = reg_slot( o->reg );
+            std::copy( r, r + n, slot( sp ) );
+            ++sp;
+            break;
+          }
+        case STORE:
+          {
+            const T* a = slot( sp - 1 - o->offset );
+            T* r = reg_slot( o->reg );
+            size_t& last = stored_[ size_t( o->reg ) ];
+            if( live == n )
+            {
+              std::copy( a, a + n, r );
+              last = n;
+              break;
+            }
+            for( size_t i = 0; i != n; ++i )
+            {
+              r[ i ] = active_[ i ] ? a[ i ] : r[ i ];
+              if( active_[ i ] ) last = std::max( last, i + 1 );
+            }
+            break;
+          }
+        case DROP:
+          {
+            sp -= o->offset;
+            break;
+          }
+        case BROADCAST:
+          {
+            T* a = slot( sp - 1 - o->offset );
+            std::fill( a + 1, a + n, a[ 0 ] );
+            break;
+          }
+        case LOAD_VAR:
+          {
+            T* d = slot( sp );
+            if( o->binding < 0 ) std::fill( d, d + m, o->var->val );
+            else if( sel ) bindings_[ o->binding ].col.gather( sel, n, d );
+            else bindings_[ o->binding ].col.read( first, n, d );
+            ++sp;
+            break;
+          }
+        case ADD:
+          {
+            T* a = slot( sp - 2 ); const T* b = slot( sp - 1 );
+            for( size_t i = 0; i != m; ++i ) a[ i ] = a[ i ] + b[ i ];
+            --sp;
+            break;
+          }
+        case SUB:
+          {
+            T* a = slot( sp - 2 ); const T* b = slot( sp - 1 );
+            for( size_t i = 0; i != m; ++i ) a[ i ] = a[ i ] - b[ i ];
+            --sp;
+            break;
+          }
+        case MUL:
+          {
+            T* a = slot( sp - 2 ); const T* b = slot( sp - 1 );
+            for( size_t i = 0; i != m; ++i ) a[ i ] = a[ i ] * b[ i ];
+            --sp;
+            break;
+          }
+        case DIV:
+          {
+            T* a = slot( sp - 2 ); const T* b = slot( sp - 1 );
+            for( size_t i = 0; i != m; ++i ) a[ i ] = a[ i ] / b[ i ];
+            --sp;
+            break;
+          }
+        case NEG:
+          {
+            T* a = slot( sp - 1 );
+            for( size_t i = 0; i != m; ++i ) a[ i ] = -a[ i ];
+            break;
+          }
+        case UNARY:
+          {
+            T* a = slot( sp - 1 );
+            T ( *f )( T ) = o->unary;
+            for( size_t i = 0; i != m; ++i ) a[ i ] = f( a[ i ] );
+            break;
+          }
+        case BINARY:
+          {
+            T* a = slot( sp - 2 ); const T* b = slot( sp - 1 );
+            T ( *f )( T, T ) = o->binary;
+            for( size_t i = 0; i != m; ++i ) a[ i ] = f( a[ i ], b[ i ] );
+            --sp;
+            break;
+          }
+        case VECTOR:
+          {
+            // components are consecutive slots: evaluate over columns
+            const size_t in = size_t( o->vector->values_in );
+            const size_t out = size_t( o->vector->values_out );
+            T* s[ MAX_VECTOR_VALUES ];
+            for( size_t k = 0; k != std::max( in, out ); ++k )
+            {
+              s[ k ] = slot( sp - in + k );
+            }
+            o->vector->eval_block( s, n );
+            sp = sp - in + out;
+            break;
+          }
+        case CALL:
+          {
+            const size_t in = size_t( o->fun->values_in );
+            const size_t out = size_t( o->fun->values_out );
+            typename rte< T >::stack_type& s = local_.stack;
+            for( size_t i = 0; i != n; ++i )
+            {
+              // functions may have side effects: inactive rows are skipped
+              if( !active_[ i ] ) continue;
+              for( size_t k = sp - in; k != sp; ++k ) s.push( slot( k )[ i ] );
+              ( *o->fun )( local_ );
+              for( size_t k = sp - in + out; k != sp - in; --k )
+              {
+                slot( k - 1 )[ i ] = s.top();
+                s.pop();
+              }
+            }
+            sp = sp - in + out;
+            break;
+          }
+        case JUMP_IF:
+          {
+            // active rows meeting the condition skip the branch
+            const T* c = slot( --sp );
+            char* d = mask( o->reg );
+            size_t k = 0;
+            for( size_t i = 0; i != n; ++i )
+            {
+              const char t = char( active_[ i ] & ( ( c[ i ] != T() ) == o->when ) );
+              d[ i ] = t;
+              active_[ i ] = char( active_[ i ] & !t );
+              k += size_t( t );
+            }
+            deferred_[ size_t( o->reg ) ] = k;
+            live -= k;
+            break;
+          }
+        case JUMP:
+          {
+            // all the active rows skip the other branch carrying their values
+            const jump_state& j = jumps_[ size_t( o->reg ) ];
+            std::copy( active_.begin(), active_.begin() + n, mask( o->reg ) );
+            for( int k = 0; k != j.values; ++k )
+            {
+              const T* a = slot( sp - size_t( j.values - k ) );
+              std::copy( a, a + n, saved( j.saved + size_t( k ) ) );
+            }
+            std::fill( active_.begin(), active_.begin() + n, char( 0 ) );
+            deferred_[ size_t( o->reg ) ] = live;
+            live = 0;
+            sp -= size_t( j.values );
+            break;
+          }
+        case LABEL:
+          {
+            // rows jumping here are active again: the values they carry are
+            // blended into the stack slots
+            sp = size_t( o->offset );
+            const std::vector< int >& l = labels_[ size_t( o->reg ) ];
+            for( size_t s = 0; s != l.size(); ++s )
+            {
+              const size_t j = size_t( l[ s ] );
+              if( !deferred_[ j ] ) continue;
+              const char* d = mask( int( j ) );
+              const int values = jumps_[ j ].values;
+              for( int k = 0; k != values; ++k )
+              {
+                T* a = slot( sp - size_t( values - k ) );
+                const T* b = saved( jumps_[ j ].saved + size_t( k ) );
+                if( deferred_[ j ] == n ) std::copy( b, b + n, a );
+                else for( size_t i = 0; i != n; ++i ) a[ i ] = d[ i ] ? b[ i ] : a[ i ];
+              }
+              for( size_t i = 0; i != n; ++i ) active_[ i ] = char( active_[ i ] | d[ i ] );
+              live += deferred_[ j ];
+              deferred_[ j ] = 0;
+            }
+            break;
+          }
+        default:
+          break;
+        }
+      }
+      // assigned variables hold the values of the last row assigning them
+      for( size_t r = 0; r != reg_vars_.size(); ++r )
+      {
+        if( stored_[ r ] ) reg_vars_[ r ]->val = reg_slot( int( r ) )[ stored_[ r ] - 1 ];
+      }
+    }
+
+    /// Evaluates rows one at a time through a vm: rows first + i, or the
+    /// rows selected by sel.
+    void run_rows( size_t first, size_t rows, T* const* out, size_t out_stride,
+                   const size_t* sel = 0 )
+    {
+      vm_.prog( const_cast< prog_type* >( prog_ ) );
+      typename rte< T >::stack_type& s = vm_.rte().stack;
+      for( size_t i = 0; i != rows; ++i )
+      {
+        for( size_t b = 0; b != bindings_.size(); ++b )
+        {
+          bindings_[ b ].var->val = bindings_[ b ].col[ sel ? sel[ i ] : first + i ];
+        }
+        vm_.run();
+        for( size_t k = results_; k != 0; --k )
+        {
+          if( out[ k - 1 ] ) out[ k - 1 ][ i * out_stride ] = s.top();
+          s.pop();
+        }
+      }
+    }
+
+    /// Program.
+    const prog_type* prog_;
+    /// Maximum number of rows evaluated at once.
+    size_t block_;
+    /// Maximum stack depth.
+    size_t depth_;
+    /// Number of values left on the stack.
+    size_t results_;
+    /// If true program is evaluated row by row.
+    bool row_mode_;
+    /// Block operations.
+    std::vector< op > ops_;
+    /// Variable bindings.
+    std::vector< binding > bindings_;
+    /// Value stack: depth_ slots of block_ values each.
+    std::vector< T > stack_;
+    /// Assigned variables, one register each.
+    std::vector< value< T >* > reg_vars_;
+    /// Registers: block_ values per assigned variable.
+    std::vector< T > regs_;
+    /// One past the last row assigned in the current block, per register.
+    std::vector< size_t > stored_;
+    /// Jump states.
+    std::vector< jump_state > jumps_;
+    /// Jumps merged by each LABEL operation.
+    std::vector< std::vector< int > > labels_;
+    /// Active rows of the current block.
+    std::vector< char > active_;
+    /// Number of rows which took each jump and are not merged yet.
+    std::vector< size_t > deferred_;
+    /// Rows which took each jump: block_ values per jump.
+    std::vector< char > masks_;
+    /// Values carried by the rows taking a jump: block_ values per value.
+    std::vector< T > saved_;
+    /// Results of a block evaluated row by row: block_ values per result.
+    std::vector< T > rows_;
+    /// Addresses of the results of a block.
+    std::vector< T* > results_p_;
+    /// Local run-time environment used to invoke functions one row at a time.
+    rte< T > local_;
+    /// Virtual machine used in row mode.
+    vm< rte< T > > vm_;
+  };
+
+  /// Definition of class name variable.
+  template < class T >
+  const std::string batch_executor< T >::CLS_NAME( "batch_executor" );
+
+  /// Definition of default block size.
+  template < class T >
+  const size_t batch_executor< T >::DEFAULT_BLOCK;
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // BATCH_H__
@@ -0,0 +1,685 @@
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file batch_tool.cpp command line program evaluating expressions over
+/// the rows of a CSV, binary or memory mapped columnar input file
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+
+#include "compiler.h"
+#include "execution.h"
+#include "def_rte.h"
+#include "math_parser.h"
+#include "batch.h"
+#include "column_file.h"
+#include "optimizer.h"
+#include "expression_set.h"
+#include "validation.h"
+#include "reduction.h"
+#include "tool_utility.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+
+/// Global instance of MemTracer class; it prints by default to std::clog stream
+MemTracer NewTrace;
+#endif
+
+//-----------------------------------------------------------------------------
+
+using namespace mmath_plus;
+using std::vector;
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::istream;
+using std::ostream;
+
+//-----------------------------------------------------------------------------
+/// Input/output format.
+enum format { CSV, BINARY, COLUMNAR };
+
+/// Program configuration.
+struct config {
+  /// Expressions in the form [name:]expression.
+  vector< string > exprs;
+  /// Input file, "-" for standard input.
+  string input;
+  /// Output file, "-" for standard output.
+  string output;
+  /// Input format.
+  format in_format;
+  /// Output format.
+  format out_format;
+  /// Column names, required for binary input.
+  vector< string > columns;
+  /// Parameters: ( name, value ) pairs.
+  vector< std::pair< string, double > > params;
+  /// Number of rows read at once.
+  size_t chunk;
+  /// Number of rows evaluated at once by the batch executor.
+  size_t block;
+  /// Evaluation precision.
+  precision prec;
+  /// Validate expressions only.
+  bool validate;
+  /// Number of validation and reduction threads, 0 for one per hardware
+  /// thread.
+  unsigned threads;
+  /// Reduce the values of each expression instead of writing them.
+  bool reduce;
+  /// Summation algorithm of reductions.
+  summation sum;
+  /// Histogram range.
+  double lo, hi;
+  /// Number of histogram bins, 0 for no histogram.
+  size_t bins;
+  /// Predicate selecting the rows evaluated, empty for all the rows.
+  string filter;
+  /// Constructor: default values.
+  config() : output( "-" ), in_format( CSV ), out_format( CSV ),
+             chunk( 1 << 16 ), block( batch_executor< double >::DEFAULT_BLOCK ),
+             prec( DOUBLE ), validate( false ), threads( 0 ), reduce( false ),
+             sum( KAHAN_SUM ), lo( 0 ), hi( 0 ), bins( 0 )
+  {}
+};
+
+//-----------------------------------------------------------------------------
+/// Reads expressions from file: one [name:]expression per line, empty lines
+/// and lines starting with '#' are ignored.
+void read_expressions( const string& fname, vector< string >& ev )
+{
+  std::ifstream is( fname.c_str() );
+  if( !is ) throw std::runtime_error( "cannot open expression file " + fname );
+  string line;
+  while( std::getline( is, line ) )
+  {
+    line = trim( line );
+    if( line.empty() || line[ 0 ] == '#' ) continue;
+    ev.push_back( line );
+  }
+}
+
+/// Returns true if host is little endian.
+inline bool little_endian()
+{
+  const unsigned short v = 1;
+  return *reinterpret_cast< const unsigned char* >( &v ) == 1;
+}
+
+/// Reverses bytes of each value in array.
+template < class T >
+void swap_bytes( T* d, size_t n )
+{
+  for( size_t i = 0; i != n; ++i )
+  {
+    unsigned char* b = reinterpret_cast< unsigned char* >( d + i );
+    std::reverse( b, b + sizeof( T ) );
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Reads up to n rows into row-major buffer.
+/// @param is input stream
+/// @param f input format
+/// @param cols number of columns
+/// @param n maximum number of rows
+/// @param buf buffer, resized to rows * cols
+/// @param line current line number, used in error messages
+/// @return number of rows read
+size_t read_chunk( istream& is, format f, size_t cols, size_t n,
+                   vector< double >& buf, size_t& line )
+{
+  buf.resize( n * cols );
+  if( f == BINARY )
+  {
+    is.read( reinterpret_cast< char* >( &buf[ 0 ] ),
+             std::streamsize( buf.size() * sizeof( double ) ) );
+    const size_t values = size_t( is.gcount() ) / sizeof( double );
+    if( values % cols )
+    {
+      throw std::runtime_error( "truncated binary input" );
+    }
+    if( !little_endian() ) swap_bytes( &buf[ 0 ], values );
+    return values / cols;
+  }
+  size_t rows = 0;
+  string s;
+  while( rows != n && std::getline( is, s ) )
+  {
+    ++line;
+    if( trim( s ).empty() ) continue;
+    const char* p = s.c_str();
+    for( size_t c = 0; c != cols; ++c )
+    {
+      char* e = 0;
+      buf[ rows * cols + c ] = std::strtod( p, &e );
+      if( e == p || ( c + 1 != cols && *e != ',' ) )
+      {
+        std::ostringstream os;
+        os << "invalid CSV row at line " << line;
+        throw std::runtime_error( os.str() );
+      }
+      p = e + 1;
+    }
+    ++rows;
+  }
+  return rows;
+}
+
+/// Writes n rows from row-major buffer; CSV rows start with the row index
+/// base + rows[ r ] if rows is not null.
+template < class T >
+void write_chunk( ostream& os, format f, size_t cols, size_t n,
+                  vector< T >& buf, const size_t* rows = 0, size_t base = 0 )
+{
+  if( f == BINARY )
+  {
+    if( !little_endian() ) swap_bytes( &buf[ 0 ], n * cols );
+    os.write( reinterpret_cast< const char* >( &buf[ 0 ] ),
+              std::streamsize( n * cols * sizeof( T ) ) );
+    return;
+  }
+  for( size_t r = 0; r != n; ++r )
+  {
+    if( rows ) os << base + rows[ r ] << ',';
+    for( size_t c = 0; c != cols; ++c )
+    {
+      os << ( c ? "," : "" ) << buf[ r * cols + c ];
+    }
+    os << '\n';
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Splits [name:]expression into name and expression; the default name of
+/// expression i is fi.
+std::pair< string, string > named_expression( const string& s, size_t i )
+{
+  const string::size_type p = s.find( ':' );
+  if( p != string::npos ) return std::make_pair( trim( s.substr( 0, p ) ), s.substr( p + 1 ) );
+  std::ostringstream n;
+  n << 'f' << i;
+  return std::make_pair( n.str(), s );
+}
+
+/// Adds input columns not already in the default variable table as
+/// variables and sets parameters.
+template < class T >
+void define_names( const config& cfg, const vector< string >& columns, rte< T >& rt )
+{
+  for( size_t i = 0; i != columns.size(); ++i )
+  {
+    if( !rt.variable_p( columns[ i ] ) )
+    {
+      rt.var_tab.push_back(
+        typename rte< T >::ValPtrT( new value< T >( columns[ i ] ) ) );
+    }
+  }
+  // parameters are invariant across rows
+  for( size_t i = 0; i != cfg.params.size(); ++i )
+  {
+    rt.set_parameter( cfg.params[ i ].first, T( cfg.params[ i ].second ) );
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Parses and compiles all expressions in parallel without evaluating them;
+/// writes one line per expression: name, "ok" and number of instructions or
+/// error. Names are resolved against the default variables, the columns
+/// passed with -c and the parameters.
+/// @param cfg configuration
+/// @param rt run-time environment
+/// @param os output stream
+/// @return number of invalid expressions
+template < class T >
+size_t validate( const config& cfg, rte< T > rt, ostream& os )
+{
+  define_names( cfg, cfg.columns, rt );
+  const vector< operator_type > ops = generate_def_operators();
+  const math_parser mp( ops, math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  const compiler< T > c( compiler< T >::COUNT_ARGS, compiler< T >::DONT_CREATE_VARS );
+  vector< string > names( cfg.exprs.size() );
+  vector< string > sources( cfg.exprs.size() );
+  for( size_t i = 0; i != cfg.exprs.size(); ++i )
+  {
+    const std::pair< string, string > e = named_expression( cfg.exprs[ i ], i );
+    names[ i ] = e.first;
+    sources[ i ] = e.second;
+  }
+  const vector< validation > v = validate_expressions( mp, c, rt, sources, cfg.threads );
+  size_t invalid = 0;
+  for( size_t i = 0; i != v.size(); ++i )
+  {
+    os << names[ i ] << '\t';
+    if( v[ i ].compiled() ) os << "ok\t" << v[ i ].instructions << '\n';
+    else
+    {
+      os << v[ i ].error << '\n';
+      ++invalid;
+    }
+  }
+  return invalid;
+}
+
+//-----------------------------------------------------------------------------
+/// Returns empty reduction configured as requested.
+template < class T >
+reduction< T > make_reduction( const config& cfg )
+{
+  reduction< T > r( cfg.sum );
+  if( cfg.bins ) r.histogram( T( cfg.lo ), T( cfg.hi ), cfg.bins );
+  return r;
+}
+
+/// Writes one CSV line per expression: name, number of values and of NaN
+/// values, sum, mean, minimum, maximum and their rows, then the number of
+/// values below and above the histogram range and the histogram bins.
+template < class T >
+void write_reductions( ostream& os, const config& cfg, const expression_set< T >& es,
+                       const vector< reduction< T > >& r )
+{
+  os << "name,count,nan,sum,mean,min,argmin,max,argmax";
+  if( cfg.bins ) os << ",below,above";
+  for( size_t b = 0; b != cfg.bins; ++b ) os << ",h" << b;
+  os << '\n';
+  for( size_t i = 0; i != r.size(); ++i )
+  {
+    os << es.name( i ) << ',' << r[ i ].count() << ',' << r[ i ].nans() << ','
+       << r[ i ].sum() << ',' << r[ i ].mean() << ',' << r[ i ].min() << ','
+       << r[ i ].argmin() << ',' << r[ i ].max() << ',' << r[ i ].argmax();
+    if( cfg.bins ) os << ',' << r[ i ].below() << ',' << r[ i ].above();
+    for( size_t b = 0; b != r[ i ].bins().size(); ++b ) os << ',' << r[ i ].bins()[ b ];
+    os << '\n';
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Evaluates all expressions over input, returns number of rows evaluated.
+/// @param cfg configuration
+/// @param rt run-time environment
+/// @param is input stream, not used for columnar input
+/// @param os output stream
+template < class T >
+size_t evaluate( const config& cfg, rte< T > rt, istream& is, ostream& os )
+{
+  vector< string > columns = cfg.columns;
+  size_t line = 0;
+  shared_ptr< column_file > cf;
+  if( cfg.in_format == COLUMNAR )
+  {
+    cf = shared_ptr< column_file >( new column_file( cfg.input ) );
+    columns.clear();
+    for( size_t i = 0; i != cf->columns().size(); ++i )
+    {
+      columns.push_back( cf->columns()[ i ].name );
+    }
+  }
+  else if( cfg.in_format == CSV )
+  {
+    string header;
+    if( !std::getline( is, header ) ) throw std::runtime_error( "empty input" );
+    ++line;
+    columns = split( header, ',' );
+    for( size_t i = 0; i != columns.size(); ++i ) columns[ i ] = trim( columns[ i ] );
+  }
+  if( columns.empty() ) throw std::runtime_error( "no input columns" );
+
+  // input columns are variables
+  define_names( cfg, columns, rt );
+
+  // all expressions are compiled into one program evaluated by a single
+  // batch executor, which writes one output column per expression
+  const vector< operator_type > ops = generate_def_operators();
+  math_parser mp( ops, math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< T > c( compiler< T >::COUNT_ARGS, compiler< T >::DONT_CREATE_VARS );
+  expression_set< T > es;
+  for( size_t i = 0; i != cfg.exprs.size(); ++i )
+  {
+    const std::pair< string, string > e = named_expression( cfg.exprs[ i ], i );
+    es.add( e.first, e.second );
+  }
+  typename rte< T >::prog_type program = es.compile( mp, c, rt );
+  // only the expression values are written
+  dead_code_eliminator< T >( es.size(), vector< typename rte< T >::ValPtrT >() )( program );
+  batch_executor< T > b( program, cfg.block );
+  os << std::setprecision( std::numeric_limits< T >::max_digits10 );
+
+  if( cfg.reduce )
+  {
+    // values are folded block by block, never written
+    const reduction< T > init = make_reduction< T >( cfg );
+    vector< reduction< T > > r( es.size(), init );
+    if( cf )
+    {
+      // rows are split across threads, each one evaluating its own program
+      vector< string > sources;
+      for( size_t i = 0; i != es.size(); ++i ) sources.push_back( es.source( i ) );
+      vector< std::pair< string, column< T > > > inputs;
+      for( size_t i = 0; i != cf->columns().size(); ++i )
+      {
+        inputs.push_back( std::make_pair( cf->columns()[ i ].name, cf->get< T >( i ) ) );
+      }
+      r = reduce_expressions( mp, c, rt, sources, inputs, cf->rows(), init,
+                              cfg.threads, cfg.chunk, cfg.block );
+      write_reductions( os, cfg, es, r );
+      return cf->rows();
+    }
+    vector< double > in;
+    size_t total = 0;
+    size_t n = 0;
+    while( ( n = read_chunk( is, cfg.in_format, columns.size(), cfg.chunk, in, line ) ) != 0 )
+    {
+      for( size_t i = 0; i != columns.size(); ++i )
+      {
+        b.bind( rt, columns[ i ], column< T >( &in[ i ], columns.size() ) );
+      }
+      b.fold( 0, n, [ &r, total ]( size_t first, size_t m, const T* const* v )
+                    {
+                      for( size_t e = 0; e != r.size(); ++e ) r[ e ].add( v[ e ], m, total + first );
+                    } );
+      total += n;
+    }
+    write_reductions( os, cfg, es, r );
+    return total;
+  }
+
+  // the expressions are evaluated only on the rows selected by the filter
+  typename rte< T >::prog_type predicate;
+  shared_ptr< batch_executor< T > > pb;
+  if( !cfg.filter.empty() )
+  {
+    const function_signatures< T > functions( rt );
+    predicate = c.compile( mp.parse( cfg.filter, &functions ), rt );
+    pb = shared_ptr< batch_executor< T > >( new batch_executor< T >( predicate, cfg.block ) );
+  }
+  vector< size_t > sel;
+  sel.reserve( pb ? cfg.chunk : 0 );
+
+  if( cfg.out_format == CSV )
+  {
+    if( pb ) os << "row,";
+    for( size_t i = 0; i != es.size(); ++i ) os << ( i ? "," : "" ) << es.name( i );
+    os << '\n';
+  }
+
+  const size_t cols = columns.size();
+  const size_t outs = es.size();
+  vector< T > out( cfg.chunk * outs );
+  vector< T* > o( outs );
+  for( size_t e = 0; e != outs; ++e ) o[ e ] = &out[ e ];
+  if( cf )
+  {
+    // columns are read in place from the mapped file: bind once and
+    // evaluate ranges of rows
+    cf->bind( b, rt );
+    if( pb ) cf->bind( *pb, rt );
+    for( size_t first = 0; first < cf->rows(); first += cfg.chunk )
+    {
+      const size_t n = std::min( cfg.chunk, cf->rows() - first );
+      if( pb )
+      {
+        sel.clear();
+        pb->select( first, n, sel );
+        b.run_selection( sel.data(), sel.size(), &o[ 0 ], outs );
+        write_chunk( os, cfg.out_format, outs, sel.size(), out, sel.data() );
+      }
+      else
+      {
+        b.run( first, n, &o[ 0 ], outs );
+        write_chunk( os, cfg.out_format, outs, n, out );
+      }
+    }
+    return cf->rows();
+  }
+  vector< double > in;
+  size_t total = 0;
+  size_t n = 0;
+  while( ( n = read_chunk( is, cfg.in_format, cols, cfg.chunk, in, line ) ) != 0 )
+  {
+    for( size_t i = 0; i != cols; ++i )
+    {
+      b.bind( rt, columns[ i ], column< T >( &in[ i ], cols ) );
+      if( pb ) pb->bind( rt, columns[ i ], column< T >( &in[ i ], cols ) );
+    }
+    if( pb )
+    {
+      sel.clear();
+      pb->select( 0, n, sel );
+      b.run_selection( sel.data(), sel.size(), &o[ 0 ], outs );
+      write_chunk( os, cfg.out_format, outs, sel.size(), out, sel.data(), total );
+    }
+    else
+    {
+      b.run( 0, n, &o[ 0 ], outs );
+      write_chunk( os, cfg.out_format, outs, n, out );
+    }
+    total += n;
+  }
+  return total;
+}
+
+//-----------------------------------------------------------------------------
+/// Prints usage.
+void print_usage()
+{
+  cout << "usage: mmbatch [options] <input file | ->\n"
+       << "       mmbatch -V [options]\n"
+       << "  -e <[name:]expr>  expression, can be repeated\n"
+       << "  -f <file>         file with one [name:]expression per line\n"
+       << "  -i csv|bin|col    input format (default csv): CSV with header\n"
+       << "                    line, raw little endian doubles, row-major\n"
+       << "                    or memory mapped columnar file\n"
+       << "  -c <x,y,...>      column names, required for binary input\n"
+       << "  -P <name=value>   parameter, constant across rows, can be\n"
+       << "                    repeated\n"
+       << "  -o <file>         output file (default stdout)\n"
+       << "  -O csv|bin        output format (default csv); binary output\n"
+       << "                    values have the evaluation precision\n"
+       << "  -p double|float|mixed  evaluation precision (default double);\n"
+       << "                    mixed: float values, double precision\n"
+       << "                    functions and products\n"
+       << "  -n <rows>         rows read at once (default 65536)\n"
+       << "  -b <rows>         rows evaluated at once (default "
+       << batch_executor< double >::DEFAULT_BLOCK << ")\n"
+       << "  -V                validate expressions without evaluating them:\n"
+       << "                    one line per expression with the number of\n"
+       << "                    instructions or the error; names are the\n"
+       << "                    default variables, -c columns and parameters\n"
+       << "  -t <threads>      validation threads, and reduction threads\n"
+       << "                    with columnar input (default: one per core)\n"
+       << "  -R                reduce the values of each expression instead\n"
+       << "                    of writing them: one line per expression with\n"
+       << "                    count, NaN count, sum, mean, min, argmin, max,\n"
+       << "                    argmax\n"
+       << "  -S naive|kahan|pairwise  summation of -R (default kahan)\n"
+       << "  -H <lo,hi,bins>   add histogram of bins bins over [lo,hi) to -R\n"
+       << "  -F <predicate>    evaluate and write only the rows for which\n"
+       << "                    predicate is not zero; CSV rows start with\n"
+       << "                    the row index\n"
+       << "Each expression generates one output column holding the value\n"
+       << "on top of the stack; expressions are evaluated in order, in one\n"
+       << "pass, sharing common subexpressions. Rows/s are reported on\n"
+       << "stderr." << endl;
+}
+
+/// Parses summation name.
+summation parse_summation( const string& s )
+{
+  if( s == "naive" ) return NAIVE_SUM;
+  if( s == "kahan" ) return KAHAN_SUM;
+  if( s == "pairwise" ) return PAIRWISE_SUM;
+  throw std::runtime_error( "unknown summation " + s );
+}
+
+/// Parses lo,hi,bins histogram definition.
+void parse_histogram( const string& s, config& cfg )
+{
+  const vector< string > v = split( s, ',' );
+  char* e = 0;
+  if( v.size() == 3 )
+  {
+    cfg.lo = std::strtod( v[ 0 ].c_str(), &e );
+    if( !*e ) cfg.hi = std::strtod( v[ 1 ].c_str(), &e );
+    if( !*e ) cfg.bins = size_t( std::strtoul( v[ 2 ].c_str(), &e, 10 ) );
+  }
+  if( v.size() != 3 || *e || !cfg.bins || !( cfg.lo < cfg.hi ) )
+  {
+    throw std::runtime_error( "invalid histogram " + s );
+  }
+}
+
+/// Parses format name.
+format parse_format( const string& s )
+{
+  if( s == "csv" ) return CSV;
+  if( s == "bin" ) return BINARY;
+  if( s == "col" ) return COLUMNAR;
+  throw std::runtime_error( "unknown format " + s );
+}
+
+/// Entry point.
+int main( int argc, char** argv )
+{
+  config cfg;
+  try
+  {
+    for( int i = 1; i < argc; ++i )
+    {
+      const string a = argv[ i ];
+      const bool has_value = i + 1 < argc;
+      if( a == "-e" && has_value ) cfg.exprs.push_back( argv[ ++i ] );
+      else if( a == "-f" && has_value ) read_expressions( argv[ ++i ], cfg.exprs );
+      else if( a == "-i" && has_value ) cfg.in_format = parse_format( argv[ ++i ] );
+      else if( a == "-O" && has_value ) cfg.out_format = parse_format( argv[ ++i ] );
+      else if( a == "-p" && has_value ) cfg.prec = parse_precision( argv[ ++i ] );
+      else if( a == "-c" && has_value ) cfg.columns = split( argv[ ++i ], ',' );
+      else if( a == "-P" && has_value ) cfg.params.push_back( parse_parameter( argv[ ++i ] ) );
+      else if( a == "-o" && has_value ) cfg.output = argv[ ++i ];
+      else if( a == "-n" && has_value ) cfg.chunk = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-b" && has_value ) cfg.block = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-t" && has_value ) cfg.threads = unsigned( std::atol( argv[ ++i ] ) );
+      else if( a == "-S" && has_value ) cfg.sum = parse_summation( argv[ ++i ] );
+      else if( a == "-H" && has_value )
+      {
+        parse_histogram( argv[ ++i ], cfg );
+        cfg.reduce = true;
+      }
+      else if( a == "-R" ) cfg.reduce = true;
+      else if( a == "-F" && has_value ) cfg.filter = argv[ ++i ];
+      else if( a == "-V" ) cfg.validate = true;
+      else if( a[ 0 ] != '-' || a == "-" ) cfg.input = a;
+      else
+      {
+        print_usage();
+        return a == "-h" ? 0 : 1;
+      }
+    }
+    if( cfg.validate && !cfg.exprs.empty() )
+    {
+      std::ofstream ofs;
+      if( cfg.output != "-" )
+      {
+        ofs.open( cfg.output.c_str() );
+        if( !ofs ) throw std::runtime_error( "cannot open " + cfg.output );
+      }
+      ostream& os = cfg.output != "-" ? static_cast< ostream& >( ofs ) : cout;
+      const std::chrono::steady_clock::time_point t =
+                                            std::chrono::steady_clock::now();
+      size_t invalid = 0;
+      if( cfg.prec == DOUBLE )
+      {
+        invalid = validate( cfg, generate_default_rte< double >(), os );
+      }
+      else if( cfg.prec == FLOAT )
+      {
+        invalid = validate( cfg, generate_default_rte< float >(), os );
+      }
+      else invalid = validate( cfg, generate_mixed_rte(), os );
+      os.flush();
+      const double s = std::chrono::duration< double >(
+                         std::chrono::steady_clock::now() - t ).count();
+      cerr << cfg.exprs.size() << " expressions, " << invalid << " invalid, in "
+           << s << " s" << endl;
+      return invalid ? 2 : 0;
+    }
+    if( cfg.input.empty() || cfg.exprs.empty() || !cfg.chunk )
+    {
+      print_usage();
+      return 1;
+    }
+    if( cfg.reduce && !cfg.filter.empty() )
+    {
+      throw std::runtime_error( "-F cannot be combined with -R or -H" );
+    }
+
+    const std::ios::openmode bin = std::ios::in | std::ios::binary;
+    std::ifstream ifs;
+    if( cfg.out_format == COLUMNAR )
+    {
+      throw std::runtime_error( "columnar output not supported" );
+    }
+    if( cfg.in_format == COLUMNAR && cfg.input == "-" )
+    {
+      throw std::runtime_error( "columnar input cannot be read from stdin" );
+    }
+    if( cfg.input != "-" && cfg.in_format != COLUMNAR )
+    {
+      ifs.open( cfg.input.c_str(), cfg.in_format == BINARY ? bin : std::ios::in );
+      if( !ifs ) throw std::runtime_error( "cannot open " + cfg.input );
+    }
+    std::ofstream ofs;
+    if( cfg.output != "-" )
+    {
+      ofs.open( cfg.output.c_str(), cfg.out_format == BINARY
+                    ? std::ios::out | std::ios::binary : std::ios::out );
+      if( !ofs ) throw std::runtime_error( "cannot open " + cfg.output );
+    }
+    istream& is = cfg.input != "-" ? static_cast< istream& >( ifs ) : std::cin;
+    ostream& os = cfg.output != "-" ? static_cast< ostream& >( ofs ) : cout;
+
+    const std::chrono::steady_clock::time_point t =
+                                            std::chrono::steady_clock::now();
+    size_t rows = 0;
+    if( cfg.prec == DOUBLE )
+    {
+      rows = evaluate( cfg, generate_default_rte< double >(), is, os );
+    }
+    else if( cfg.prec == FLOAT )
+    {
+      rows = evaluate( cfg, generate_default_rte< float >(), is, os );
+    }
+    else rows = evaluate( cfg, generate_mixed_rte(), is, os );
+    os.flush();
+    const double s = std::chrono::duration< double >(
+                       std::chrono::steady_clock::now() - t ).count();
+    cerr << rows << " rows in " << s << " s: "
+         << ( s > 0 ? double( rows ) / s : 0 ) << " rows/s" << endl;
+  }
+  catch( const exception_base& eb )
+  {
+    cerr << eb;
+    return 1;
+  }
+  catch( const std::exception& e )
+  {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
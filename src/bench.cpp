@@ -0,0 +1,554 @@
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file bench.cpp benchmark of parse, compile and execution steps over a
+/// corpus of expressions and a set of synthetic expressions
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+#include <cstdlib>
+
+#include "compiler.h"
+#include "execution.h"
+#include "vm.h"
+#include "def_rte.h"
+#include "math_parser.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+
+/// Global instance of MemTracer class; it prints by default to std::clog stream
+MemTracer NewTrace;
+#endif
+
+//-----------------------------------------------------------------------------
+
+using namespace mmath_plus;
+using std::vector;
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::ostream;
+
+//-----------------------------------------------------------------------------
+/// Benchmark configuration.
+struct config {
+  /// Corpus file, one expression per line; empty lines and lines starting
+  /// with '#' are ignored.
+  string corpus;
+  /// JSON output file, "-" for standard output.
+  string json;
+  /// Add synthetic expressions.
+  bool synthetic;
+  /// Sizes used by synthetic generators.
+  vector< int > sizes;
+  /// Number of warm-up iterations.
+  int warmup;
+  /// Number of timed repetitions.
+  int reps;
+  /// Number of program runs per throughput measure.
+  int batch;
+  /// Abort if a program allocates memory after warm-up (see NoAllocation).
+  bool no_alloc;
+  /// Constructor: default values.
+  config() : synthetic( false ), warmup( 10 ), reps( 100 ), batch( 100000 ),
+             no_alloc( false )
+  {
+    sizes.push_back( 8 ); sizes.push_back( 32 ); sizes.push_back( 128 );
+  }
+};
+
+/// Named expression.
+struct bench_expr {
+  /// Name: "corpus:<line>" or "<generator>:<size>".
+  string name;
+  /// Expression.
+  string expr;
+};
+
+/// Summary of a set of timings in nanoseconds.
+struct stats {
+  double min;  ///< Minimum
+  double p50;  ///< Median
+  double p90;  ///< 90th percentile
+  double p99;  ///< 99th percentile
+  double max;  ///< Maximum
+  double mean; ///< Average
+};
+
+/// Benchmark result for a single expression.
+struct result {
+  /// Expression.
+  bench_expr e;
+  /// Number of tokens.
+  size_t tokens;
+  /// Number of instructions.
+  size_t instructions;
+  /// Parse time.
+  stats parse;
+  /// Compile time.
+  stats compile;
+  /// Single evaluation latency.
+  stats eval;
+  /// Batch throughput in program runs per second.
+  double throughput;
+  /// Number of allocations performed by program runs after warm-up; always
+  /// 0 unless built with MMP_DEBUG_MEMORY.
+  size_t allocations;
+  /// Error message, empty if no error.
+  string error;
+  /// Constructor.
+  result() : tokens( 0 ), instructions( 0 ), throughput( 0 ), allocations( 0 )
+  {}
+};
+
+//-----------------------------------------------------------------------------
+/// Clock used for all measures.
+typedef std::chrono::steady_clock bench_clock;
+
+/// Returns number of nanoseconds elapsed since t.
+inline double elapsed_ns( const bench_clock::time_point& t )
+{
+  return double( std::chrono::duration_cast< std::chrono::nanoseconds >(
+                                          bench_clock::now() - t ).count() );
+}
+
+/// Returns percentile p in range [0, 100] of sorted sample array.
+double percentile( const vector< double >& s, double p )
+{
+  if( s.empty() ) return 0;
+  const size_t i = size_t( p / 100.0 * double( s.size() - 1 ) + 0.5 );
+  return s[ std::min( i, s.size() - 1 ) ];
+}
+
+/// Computes statistics from samples.
+stats compute_stats( vector< double > s )
+{
+  stats st = { 0, 0, 0, 0, 0, 0 };
+  if( s.empty() ) return st;
+  std::sort( s.begin(), s.end() );
+  double sum = 0;
+  for( size_t i = 0; i != s.size(); ++i ) sum += s[ i ];
+  st.min  = s.front();
+  st.max  = s.back();
+  st.p50  = percentile( s, 50 );
+  st.p90  = percentile( s, 90 );
+  st.p99  = percentile( s, 99 );
+  st.mean = sum / double( s.size() );
+  return st;
+}
+
+//-----------------------------------------------------------------------------
+/// Synthetic generators: each one returns an expression whose size grows
+/// linearly with n and stresses a different part of the parser.
+
+/// Deep nesting: (((x+1)+1)+1)...
+string gen_nested( int n )
+{
+  string s( n, '(' );
+  s += 'x';
+  for( int i = 0; i != n; ++i ) s += "+1)";
+  return s;
+}
+
+/// Long sum: x*1+x*2+...+x*n
+string gen_sum( int n )
+{
+  std::ostringstream os;
+  for( int i = 1; i <= n; ++i ) os << ( i > 1 ? "+" : "" ) << "x*" << i;
+  return os.str();
+}
+
+/// Same value as gen_sum computed by a loop: sum(i,1,n,x*i); the
+/// expression does not grow with n, the evaluation time does.
+string gen_loop( int n )
+{
+  std::ostringstream os;
+  os << "sum(i,1," << n << ",x*i)";
+  return os.str();
+}
+
+/// Wide tuple: (x+1,x+2,...,x+n)
+string gen_tuple( int n )
+{
+  std::ostringstream os;
+  os << '(';
+  for( int i = 1; i <= n; ++i ) os << ( i > 1 ? "," : "" ) << "x+" << i;
+  os << ')';
+  return os.str();
+}
+
+/// Many variables: v1+v2+...+vn
+string gen_vars( int n )
+{
+  std::ostringstream os;
+  for( int i = 1; i <= n; ++i ) os << ( i > 1 ? "+" : "" ) << 'v' << i;
+  return os.str();
+}
+
+/// Generator table.
+struct generator_t {
+  const char* name;     ///< Generator name
+  string ( *f )( int ); ///< Generator function
+};
+
+/// Available generators.
+const generator_t generators[] =
+{
+  { "nested", gen_nested }, { "sum", gen_sum },
+  { "loop", gen_loop },     { "tuple", gen_tuple },
+  { "vars", gen_vars }
+};
+
+//-----------------------------------------------------------------------------
+/// Reads expressions from corpus file.
+/// @param fname file name
+/// @param ev expression array to which expressions are appended
+void read_corpus( const string& fname, vector< bench_expr >& ev )
+{
+  std::ifstream is( fname.c_str() );
+  if( !is ) throw std::runtime_error( "cannot open corpus file " + fname );
+  string line;
+  int n = 0;
+  while( std::getline( is, line ) )
+  {
+    ++n;
+    if( line.empty() || line[ 0 ] == '#' ) continue;
+    if( line.find_first_not_of( " \t\r" ) == string::npos ) continue;
+    std::ostringstream os;
+    os << "corpus:" << n;
+    bench_expr e = { os.str(), line };
+    ev.push_back( e );
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Returns number of allocations performed so far by the calling thread,
+/// 0 if the memory tracer is not enabled.
+inline size_t allocations()
+{
+#ifdef MMP_DEBUG_MEMORY
+  return MemTracer::ThreadAllocations();
+#else
+  return 0;
+#endif
+}
+
+/// Removes all values from stack.
+template < class StackT > void clear_stack( StackT& s )
+{
+  while( !s.empty() ) s.pop();
+}
+
+/// Runs all benchmarks on a single expression.
+/// @param e expression
+/// @param ops operator table
+/// @param cfg configuration
+result run_bench( const bench_expr& e,
+                  const vector< operator_type >& ops,
+                  const config& cfg )
+{
+  result r;
+  r.e = e;
+  try
+  {
+    rte< double > rt = generate_default_rte< double >();
+    math_parser mp( ops, math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+    compiler< double > c( compiler< double >::COUNT_ARGS,
+                          compiler< double >::CREATE_VARS );
+
+    const int iterations = cfg.warmup + cfg.reps;
+    vector< double > samples;
+    samples.reserve( cfg.reps );
+
+    // parse
+    math_parser::Tokens vt;
+    for( int i = 0; i != iterations; ++i )
+    {
+      const bench_clock::time_point t = bench_clock::now();
+      vt = mp.parse( e.expr );
+      const double ns = elapsed_ns( t );
+      if( i >= cfg.warmup ) samples.push_back( ns );
+    }
+    r.parse = compute_stats( samples );
+    r.tokens = vt.size();
+
+    // compile; the first compilation creates the variables
+    rte< double >::prog_type program;
+    samples.clear();
+    for( int i = 0; i != iterations; ++i )
+    {
+      const bench_clock::time_point t = bench_clock::now();
+      program = c.compile( vt, rt );
+      const double ns = elapsed_ns( t );
+      if( i >= cfg.warmup ) samples.push_back( ns );
+    }
+    r.compile = compute_stats( samples );
+    r.instructions = program.size();
+
+    // single evaluation latency; allocations are counted in the timed runs
+    // after warm-up and in the throughput measure
+    vm< rte< double > > m( rt );
+    m.prog( &program );
+    for( int i = 0; i != cfg.warmup; ++i )
+    {
+      m.run();
+      clear_stack( m.rte().stack );
+    }
+    samples.clear();
+    const rte< double >::ValPtrT x = rt.variable_p( "x" );
+    double ns = 0;
+    const size_t allocs = allocations();
+    const auto timed = [ & ]()
+    {
+      for( int i = 0; i != cfg.reps; ++i )
+      {
+        const bench_clock::time_point t = bench_clock::now();
+        m.run();
+        samples.push_back( elapsed_ns( t ) );
+        clear_stack( m.rte().stack );
+      }
+      // batch throughput: x changes at each run
+      const bench_clock::time_point t = bench_clock::now();
+      for( int i = 0; i != cfg.batch; ++i )
+      {
+        if( x ) x->val = double( i );
+        m.run();
+        clear_stack( m.rte().stack );
+      }
+      ns = elapsed_ns( t );
+    };
+#ifdef MMP_DEBUG_MEMORY
+    if( cfg.no_alloc )
+    {
+      // an allocation aborts the program, reporting its call site
+      const NoAllocation forbid;
+      timed();
+    }
+    else timed();
+#else
+    timed();
+#endif
+    r.allocations = allocations() - allocs;
+    r.eval = compute_stats( samples );
+    r.throughput = ns > 0 ? 1E9 * double( cfg.batch ) / ns : 0;
+  }
+  catch( const exception_base& eb )
+  {
+    r.error = eb.cls + "::" + eb.fun + ": " + eb.data;
+  }
+  catch( const std::exception& ex )
+  {
+    r.error = ex.what();
+  }
+  return r;
+}
+
+//-----------------------------------------------------------------------------
+/// Writes string as JSON string literal.
+void json_string( ostream& os, const string& s )
+{
+  os << '"';
+  for( string::const_iterator i = s.begin(); i != s.end(); ++i )
+  {
+    switch( *i )
+    {
+    case '"':  os << "\\\""; break;
+    case '\\': os << "\\\\"; break;
+    case '\t': os << "\\t";  break;
+    case '\n': os << "\\n";  break;
+    case '\r': os << "\\r";  break;
+    default:   os << *i;     break;
+    }
+  }
+  os << '"';
+}
+
+/// Writes statistics as JSON object.
+void json_stats( ostream& os, const stats& s )
+{
+  os << "{ \"min\": " << s.min << ", \"p50\": " << s.p50
+     << ", \"p90\": " << s.p90 << ", \"p99\": " << s.p99
+     << ", \"max\": " << s.max << ", \"mean\": " << s.mean << " }";
+}
+
+/// Writes results in JSON format; all times are in nanoseconds.
+void write_json( ostream& os, const config& cfg, const vector< result >& rv )
+{
+  os << "{\n  \"config\": { \"warmup\": " << cfg.warmup
+     << ", \"reps\": " << cfg.reps << ", \"batch\": " << cfg.batch
+     << ", \"unit\": \"ns\" },\n  \"results\": [\n";
+  for( size_t i = 0; i != rv.size(); ++i )
+  {
+    const result& r = rv[ i ];
+    os << "    { \"name\": ";
+    json_string( os, r.e.name );
+    os << ", \"expr\": ";
+    json_string( os, r.e.expr );
+    if( !r.error.empty() )
+    {
+      os << ", \"error\": ";
+      json_string( os, r.error );
+    }
+    else
+    {
+      os << ", \"tokens\": " << r.tokens
+         << ", \"instructions\": " << r.instructions
+         << ",\n      \"parse\": ";
+      json_stats( os, r.parse );
+      os << ",\n      \"compile\": ";
+      json_stats( os, r.compile );
+      os << ",\n      \"eval\": ";
+      json_stats( os, r.eval );
+      os << ",\n      \"throughput\": " << r.throughput;
+#ifdef MMP_DEBUG_MEMORY
+      os << ", \"allocations\": " << r.allocations;
+#endif
+    }
+    os << " }" << ( i + 1 != rv.size() ? "," : "" ) << '\n';
+  }
+  os << "  ]\n}\n";
+}
+
+/// Prints results as a table.
+void print_table( ostream& os, const vector< result >& rv )
+{
+  os << "name\ttokens\tinstr\tparse p50\tcompile p50\teval p50\teval p99"
+        "\truns/s\n";
+  for( size_t i = 0; i != rv.size(); ++i )
+  {
+    const result& r = rv[ i ];
+    os << r.e.name << '\t';
+    if( !r.error.empty() )
+    {
+      os << "ERROR: " << r.error << '\n';
+      continue;
+    }
+    os << r.tokens << '\t' << r.instructions << '\t'
+       << r.parse.p50 << '\t' << r.compile.p50 << '\t'
+       << r.eval.p50 << '\t' << r.eval.p99 << '\t'
+       << r.throughput << '\n';
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Prints usage.
+void print_usage()
+{
+  cout << "usage: mmbench [options]\n"
+       << "  -c <file>     corpus file, one expression per line\n"
+       << "  -g            add synthetic expressions\n"
+       << "  -n <n,n,...>  sizes of synthetic expressions (default 8,32,128)\n"
+       << "  -w <n>        warm-up iterations (default 10)\n"
+       << "  -r <n>        timed repetitions (default 100)\n"
+       << "  -b <n>        runs per throughput measure (default 100000)\n"
+       << "  -j <file>     write JSON results to file, '-' for stdout\n"
+       << "  -a            abort if a program allocates memory after warm-up,\n"
+       << "                reporting the allocation site\n"
+       << "                (requires a build with MMP_DEBUG_MEMORY)\n"
+       << "All times are in nanoseconds." << endl;
+}
+
+/// Parses comma separated list of integers.
+vector< int > parse_sizes( const string& s )
+{
+  vector< int > v;
+  std::istringstream is( s );
+  string n;
+  while( std::getline( is, n, ',' ) ) v.push_back( std::atoi( n.c_str() ) );
+  return v;
+}
+
+/// Entry point.
+int main( int argc, char** argv )
+{
+  config cfg;
+  for( int i = 1; i < argc; ++i )
+  {
+    const string a = argv[ i ];
+    const bool has_value = i + 1 < argc;
+    if( a == "-c" && has_value ) cfg.corpus = argv[ ++i ];
+    else if( a == "-g" ) cfg.synthetic = true;
+    else if( a == "-n" && has_value ) cfg.sizes = parse_sizes( argv[ ++i ] );
+    else if( a == "-w" && has_value ) cfg.warmup = std::atoi( argv[ ++i ] );
+    else if( a == "-r" && has_value ) cfg.reps = std::atoi( argv[ ++i ] );
+    else if( a == "-b" && has_value ) cfg.batch = std::atoi( argv[ ++i ] );
+    else if( a == "-j" && has_value ) cfg.json = argv[ ++i ];
+    else if( a == "-a" ) cfg.no_alloc = true;
+    else
+    {
+      print_usage();
+      return a == "-h" ? 0 : 1;
+    }
+  }
+
+#ifndef MMP_DEBUG_MEMORY
+  if( cfg.no_alloc )
+  {
+    cerr << "-a requires a build with MMP_DEBUG_MEMORY" << endl;
+    return 1;
+  }
+#endif
+
+  vector< bench_expr > ev;
+  try
+  {
+    if( !cfg.corpus.empty() ) read_corpus( cfg.corpus, ev );
+  }
+  catch( const std::exception& e )
+  {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  if( cfg.synthetic )
+  {
+    for( size_t g = 0; g != sizeof( generators ) / sizeof( generators[ 0 ] ); ++g )
+    {
+      for( size_t s = 0; s != cfg.sizes.size(); ++s )
+      {
+        std::ostringstream os;
+        os << generators[ g ].name << ':' << cfg.sizes[ s ];
+        bench_expr e = { os.str(), generators[ g ].f( cfg.sizes[ s ] ) };
+        ev.push_back( e );
+      }
+    }
+  }
+  if( ev.empty() )
+  {
+    print_usage();
+    return 1;
+  }
+
+  const vector< operator_type > ops = generate_def_operators();
+  vector< result > rv;
+  for( size_t i = 0; i != ev.size(); ++i )
+  {
+    rv.push_back( run_bench( ev[ i ], ops, cfg ) );
+    cerr << rv.back().e.name << ( rv.back().error.empty() ? "" : " ERROR" ) << endl;
+  }
+
+  print_table( cout, rv );
+  if( cfg.json == "-" ) write_json( cout, cfg, rv );
+  else if( !cfg.json.empty() )
+  {
+    std::ofstream os( cfg.json.c_str() );
+    if( !os )
+    {
+      cerr << "cannot open " << cfg.json << endl;
+      return 1;
+    }
+    write_json( os, cfg, rv );
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,242 @@
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file column_file.cpp implementation of column_file class
+
+#include <algorithm>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "column_file.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  using std::string;
+  using std::vector;
+
+  //============================================================================
+
+  /// Definition of class name.
+  const string column_file::CLS_NAME( "column_file" );
+
+  /// Definition of file signature.
+  const char column_file::MAGIC[ 8 ] = { 'M', 'M', 'P', 'C', 'O', 'L', '0', '1' };
+
+  //----------------------------------------------------------------------------
+  namespace {
+  /// Alignment of column arrays written by write_column_file.
+  const unsigned long long ALIGNMENT = 64;
+
+  /// Reads little endian unsigned integer of n bytes.
+  unsigned long long read_uint( const unsigned char* p, size_t n )
+  {
+    unsigned long long v = 0;
+    for( size_t i = n; i != 0; --i ) v = ( v << 8 ) | p[ i - 1 ];
+    return v;
+  }
+
+  /// Writes little endian unsigned integer of n bytes.
+  void write_uint( std::ostream& os, unsigned long long v, size_t n )
+  {
+    for( size_t i = 0; i != n; ++i )
+    {
+      os.put( char( v & 0xff ) );
+      v >>= 8;
+    }
+  }
+
+  /// Writes file; E is float or double.
+  template < class E >
+  void write_columns( const string& path,
+                      const vector< string >& names,
+                      const vector< const E* >& data,
+                      size_t rows )
+  {
+    if( names.size() != data.size() )
+    {
+      throw column_file::exception( "write_column_file", __LINE__,
+                                    "number of names != number of columns" );
+    }
+    std::ofstream os( path.c_str(), std::ios::out | std::ios::binary );
+    if( !os ) throw column_file::exception( "write_column_file", __LINE__, path );
+    // compute header size to place data after it
+    unsigned long long offset = sizeof( column_file::MAGIC ) + 8 + 4;
+    for( size_t i = 0; i != names.size(); ++i )
+    {
+      offset += 4 + 4 + names[ i ].size() + 8;
+    }
+    const unsigned long long bytes = rows * sizeof( E );
+    os.write( column_file::MAGIC, sizeof( column_file::MAGIC ) );
+    write_uint( os, rows, 8 );
+    write_uint( os, names.size(), 4 );
+    vector< unsigned long long > offsets;
+    for( size_t i = 0; i != names.size(); ++i )
+    {
+      offset = ( offset + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT;
+      offsets.push_back( offset );
+      write_uint( os, element_type_of< E >::value, 4 );
+      write_uint( os, names[ i ].size(), 4 );
+      os.write( names[ i ].data(), std::streamsize( names[ i ].size() ) );
+      write_uint( os, offset, 8 );
+      offset += bytes;
+    }
+    for( size_t i = 0; i != data.size(); ++i )
+    {
+      while( (unsigned long long)( os.tellp() ) < offsets[ i ] ) os.put( 0 );
+      os.write( reinterpret_cast< const char* >( data[ i ] ),
+                std::streamsize( bytes ) );
+    }
+    if( !os ) throw column_file::exception( "write_column_file", __LINE__, path );
+  }
+  }
+
+  //----------------------------------------------------------------------------
+  column_file::column_file( const string& path )
+    : base_( 0 ), size_( 0 ), rows_( 0 )
+  {
+#ifdef _WIN32
+    file_ = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+    if( file_ == INVALID_HANDLE_VALUE )
+    {
+      throw exception( "column_file", __LINE__, "cannot open " + path );
+    }
+    LARGE_INTEGER sz;
+    GetFileSizeEx( file_, &sz );
+    size_ = size_t( sz.QuadPart );
+    mapping_ = CreateFileMappingA( file_, 0, PAGE_READONLY, 0, 0, 0 );
+    if( !mapping_ )
+    {
+      CloseHandle( file_ );
+      throw exception( "column_file", __LINE__, "cannot map " + path );
+    }
+    base_ = static_cast< const unsigned char* >(
+                              MapViewOfFile( mapping_, FILE_MAP_READ, 0, 0, 0 ) );
+    if( !base_ )
+    {
+      CloseHandle( mapping_ );
+      CloseHandle( file_ );
+      throw exception( "column_file", __LINE__, "cannot map " + path );
+    }
+#else
+    const int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) throw exception( "column_file", __LINE__, "cannot open " + path );
+    struct stat st;
+    if( fstat( fd, &st ) != 0 )
+    {
+      close( fd );
+      throw exception( "column_file", __LINE__, "cannot stat " + path );
+    }
+    size_ = size_t( st.st_size );
+    void* p = size_ ? mmap( 0, size_, PROT_READ, MAP_SHARED, fd, 0 ) : MAP_FAILED;
+    close( fd );
+    if( p == MAP_FAILED ) throw exception( "column_file", __LINE__, "cannot map " + path );
+    base_ = static_cast< const unsigned char* >( p );
+#endif
+    try
+    {
+      read_header();
+    }
+    catch( ... )
+    {
+      unmap();
+      throw;
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  column_file::~column_file()
+  {
+    unmap();
+  }
+
+  //----------------------------------------------------------------------------
+  void column_file::unmap()
+  {
+    if( !base_ ) return;
+#ifdef _WIN32
+    UnmapViewOfFile( base_ );
+    CloseHandle( mapping_ );
+    CloseHandle( file_ );
+#else
+    munmap( const_cast< unsigned char* >( base_ ), size_ );
+#endif
+    base_ = 0;
+  }
+
+  //----------------------------------------------------------------------------
+  void column_file::read_header()
+  {
+    const size_t fixed = sizeof( MAGIC ) + 8 + 4;
+    if( size_ < fixed || !std::equal( MAGIC, MAGIC + sizeof( MAGIC ), base_ ) )
+    {
+      throw exception( "read_header", __LINE__, "invalid signature" );
+    }
+    rows_ = size_t( read_uint( base_ + 8, 8 ) );
+    const size_t ncols = size_t( read_uint( base_ + 16, 4 ) );
+    size_t p = fixed;
+    for( size_t i = 0; i != ncols; ++i )
+    {
+      if( p + 8 > size_ ) throw exception( "read_header", __LINE__, "truncated header" );
+      const unsigned long long type = read_uint( base_ + p, 4 );
+      const size_t len = size_t( read_uint( base_ + p + 4, 4 ) );
+      p += 8;
+      if( p + len + 8 > size_ ) throw exception( "read_header", __LINE__, "truncated header" );
+      column_info ci;
+      ci.name.assign( reinterpret_cast< const char* >( base_ + p ), len );
+      p += len;
+      const unsigned long long offset = read_uint( base_ + p, 8 );
+      p += 8;
+      if( type > FLOAT64 )
+      {
+        throw exception( "read_header", __LINE__, "unknown type of column " + ci.name );
+      }
+      ci.type = element_type( type );
+      const size_t es = ci.type == FLOAT32 ? sizeof( float ) : sizeof( double );
+      if( offset % es || offset > size_ || ( size_ - offset ) / es < rows_ )
+      {
+        throw exception( "read_header", __LINE__, "invalid extent of column " + ci.name );
+      }
+      ci.data = base_ + offset;
+      columns_.push_back( ci );
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  template <>
+  void write_column_file< float >( const string& path,
+                                   const vector< string >& names,
+                                   const vector< const float* >& data,
+                                   size_t rows )
+  {
+    write_columns( path, names, data, rows );
+  }
+
+  //----------------------------------------------------------------------------
+  template <>
+  void write_column_file< double >( const string& path,
+                                    const vector< string >& names,
+                                    const vector< const double* >& data,
+                                    size_t rows )
+  {
+    write_columns( path, names, data, rows );
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+//==============================================================================
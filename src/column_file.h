@@ -0,0 +1,193 @@
+#ifndef COLUMN_FILE_H__
+#define COLUMN_FILE_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file column_file.h declaration of column_file class: memory mapped
+/// columnar input files
+
+#include <string>
+#include <vector>
+
+#include "exception.h"
+#include "execution.h"
+#include "batch.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Read-only memory mapped columnar file: one contiguous array per column.
+  /// File layout, all integers are little endian:
+  /// <pre>
+  ///   char[ 8 ]  magic "MMPCOL01"
+  ///   uint64     number of rows
+  ///   uint32     number of columns
+  ///   per column:
+  ///     uint32   element type: 0 = float, 1 = double
+  ///     uint32   name length
+  ///     char[]   name
+  ///     uint64   offset of first element from beginning of file
+  ///   data
+  /// </pre>
+  /// Elements are stored in the native (little endian) floating point format;
+  /// write_column_file() aligns each array to a 64 byte boundary.
+  /// Columns are bound to program variables with the same name so that the
+  /// batch executor reads values directly from the mapped pages.
+  class column_file {
+  public:
+
+    /// Class name.
+    static const std::string CLS_NAME;
+
+    /// File signature.
+    static const char MAGIC[ 8 ];
+
+    //--------------------------------------------------------------------------
+    /// Thrown when the file cannot be opened or mapped or is not valid.
+    class exception : public exception_base {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      exception( const std::string& fun,
+                 unsigned long lineno,
+                 const std::string& data = "" )
+        : exception_base( NS_NAME, column_file::CLS_NAME, fun, lineno, data )
+      {}
+    };
+
+    /// Column descriptor.
+    struct column_info {
+      /// Name.
+      std::string name;
+      /// Element type.
+      element_type type;
+      /// Address of first element inside mapping.
+      const void* data;
+    };
+
+    /// Constructor: maps file in memory.
+    /// @param path file path
+    explicit column_file( const std::string& path );
+
+    /// Destructor: unmaps file.
+    ~column_file();
+
+    /// Number of rows.
+    size_t rows() const { return rows_; }
+
+    /// Column descriptors.
+    const std::vector< column_info >& columns() const { return columns_; }
+
+    /// Returns index of column with given name or -1 if not found.
+    int find( const std::string& name ) const
+    {
+      for( size_t i = 0; i != columns_.size(); ++i )
+      {
+        if( columns_[ i ].name == name ) return int( i );
+      }
+      return -1;
+    }
+
+    /// Returns column i.
+    template < class T >
+    column< T > get( size_t i ) const
+    {
+      if( columns_[ i ].type == FLOAT32 )
+      {
+        return column< T >( static_cast< const float* >( columns_[ i ].data ) );
+      }
+      return column< T >( static_cast< const double* >( columns_[ i ].data ) );
+    }
+
+    /// Binds each column to the variable with the same name; variables are
+    /// looked up with rte::variable_p(), columns not matching any variable
+    /// are ignored.
+    /// @param b batch executor
+    /// @param rt run-time environment holding the program variables
+    /// @return number of bound columns
+    template < class T >
+    size_t bind( batch_executor< T >& b, const rte< T >& rt ) const
+    {
+      size_t n = 0;
+      for( size_t i = 0; i != columns_.size(); ++i )
+      {
+        if( b.bind( rt, columns_[ i ].name, get< T >( i ) ) ) ++n;
+      }
+      return n;
+    }
+
+  private:
+    /// Not copyable.
+    column_file( const column_file& );
+    /// Not assignable.
+    column_file& operator=( const column_file& );
+
+    /// Reads header and validates column extents.
+    void read_header();
+
+    /// Releases mapping.
+    void unmap();
+
+    /// Mapped memory.
+    const unsigned char* base_;
+    /// Mapping size in bytes.
+    size_t size_;
+    /// Number of rows.
+    size_t rows_;
+    /// Columns.
+    std::vector< column_info > columns_;
+#ifdef _WIN32
+    /// File handle.
+    void* file_;
+    /// Mapping handle.
+    void* mapping_;
+#endif
+  };
+
+  //----------------------------------------------------------------------------
+  /// Writes columnar file readable by column_file.
+  /// @param path file path
+  /// @param names column names
+  /// @param data one array of rows elements per column
+  /// @param rows number of rows
+  template < class E >
+  void write_column_file( const std::string& path,
+                          const std::vector< std::string >& names,
+                          const std::vector< const E* >& data,
+                          size_t rows );
+
+  /// Writes columnar file: implementation for float.
+  template <>
+  void write_column_file< float >( const std::string& path,
+                                   const std::vector< std::string >& names,
+                                   const std::vector< const float* >& data,
+                                   size_t rows );
+
+  /// Writes columnar file: implementation for double.
+  template <>
+  void write_column_file< double >( const std::string& path,
+                                    const std::vector< std::string >& names,
+                                    const std::vector< const double* >& data,
+                                    size_t rows );
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // COLUMN_FILE_H__
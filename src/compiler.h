@@ -6,7 +6,10 @@
 /// @file compiler.h definition of compiler class
 
 #include <sstream>
+#include <algorithm>
 #include "execution.h"
+#include "def_rte.h"
+#include "vector_functions.h"
 #include "math_parser.h"
 #include "exception.h"
 
@@ -43,6 +46,9 @@ namespace mmath_plus {
     /// Utility constant.
     static const bool DONT_COUNT_ARGS = !COUNT_ARGS;
 
+    /// Default maximum number of instructions of inlined procedures.
+    static const size_t INLINE_SIZE = 32;
+
     /// Class name.
     static const std::string CLS_NAME;
 
@@ -91,34 +97,154 @@ namespace mmath_plus {
       {}
     };
     
+    //--------------------------------------------------------------------------
+    /// Thrown when a parameter is assigned.
+    class invalid_assignment : public exception {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      invalid_assignment( const std::string& fun,
+                          unsigned long lineno,
+                          const std::string& data = "" )
+      : exception( fun, lineno, data )
+      {}
+    };
+
+    //--------------------------------------------------------------------------
+    /// Thrown when the operands of a conditional or of a loop cannot be
+    /// separated, e.g. the branches of if(c,a,b) do not compute the same
+    /// number of values or the counter of sum(k,a,b,f) is not a name.
+    class invalid_arguments : public exception {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      invalid_arguments( const std::string& fun,
+                         unsigned long lineno,
+                         const std::string& data = "" )
+      : exception( fun, lineno, data )
+      {}
+    };
+
     //--------------------------------------------------------------------------
     /// Constructor.
     /// @param count_args if true selects function given name and number
     /// of arguments; if false only function name is used
     /// @param create_vars if true creates a new variable and initializes it
     /// to zero when a new name is found 
-    compiler( bool count_args = false, bool create_vars = false )
-      : create_variables_( create_vars ), count_args_( count_args )
+    /// @param inline_size maximum number of instructions of procedures
+    /// expanded at call sites, zero disables inlining
+    compiler( bool count_args = false, bool create_vars = false,
+              size_t inline_size = INLINE_SIZE )
+      : create_variables_( create_vars ), count_args_( count_args ),
+        inline_size_( inline_size )
     {}
     
     //--------------------------------------------------------------------------
     /// Returns instruction array given token list and run-time environment.
+    /// Assignments to variables are compiled into store_vars instructions;
+    /// calls to small procedures without side effects are replaced with
+    /// the procedure body. Constants are compiled into their values,
+    /// parameters (see rte::param_tab) are read at run time.
+    /// if(c,a,b) and the logical operators && and || are compiled into
+    /// jumps (see branch): only the branch taken and the operands needed
+    /// to compute the result are evaluated.
     /// @param tokens const reference to token pointers
     /// @param rt const reference to run-time environment
     /// @return compiled instruction array
+    /// @throw exception if a token cannot be compiled
     /// @todo use iterator instead of vector
     typename rte< T >::prog_type
     compile( const std::vector<  math_parser::TokenPtr >& tokens, rte< T >& rt )
     {
       typename rte< T >::prog_type program;
+      const status s = compile( tokens, rt, program );
+      if( !s.ok() ) raise( s );
+      return program;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Compiles token list, does not throw; see compile( tokens, rt ).
+    /// @param tokens const reference to token pointers
+    /// @param rt const reference to run-time environment
+    /// @param[out] program compiled instruction array
+    /// @return status; the message is the name causing the error, the
+    /// offset is not known (see compile_expression())
+    status compile( const std::vector<  math_parser::TokenPtr >& tokens,
+                    rte< T >& rt, typename rte< T >::prog_type& program )
+    {
+      program.clear();
+      status s;
+      // names not found may be the counters of loops, bound when the loop
+      // is compiled; variables are created only for the names read outside
+      // of the loops
+      bool loops = false;
+      for( std::vector< math_parser::TokenPtr >::const_iterator i = tokens.begin();
+            i != tokens.end() && !loops;
+            ++i )
+      {
+        loops = *i && ( *i )->type == math_parser::FUNCTION
+                && ( ( *i )->str == "sum" || ( *i )->str == "prod" );
+      }
+      std::vector< VPtr > counters;
       for( std::vector< math_parser::TokenPtr >::const_iterator i = tokens.begin();
             i != tokens.end();
             ++i )
       {
-        typename rte< T >::prog_type::value_type inst( compile( *i, rt ) );
-        program.push_back( inst );
+        if( conditional( *i, program, s ) || loop( *i, rt, program, s ) )
+        {
+          if( !s.ok() ) return s;
+          continue;
+        }
+        InstrPtr in( compile( *i, rt, s, !loops ) );
+        if( !in && loops && ( *i )->type == math_parser::NAME )
+        {
+          in = InstrPtr( new load_var< T >( counter( counters, ( *i )->str ) ) );
+          s = status();
+        }
+        if( !in ) return s;
+        if( const value< T >* p = assigned_parameter( program, ptr( in ) ) )
+        {
+          return status( INVALID_ASSIGNMENT, std::string::npos, p->name );
+        }
+        if( count_args_ && !operands( program, ptr( in ) ) )
+        {
+          return status( INVALID_ARGUMENTS, std::string::npos, ( *i )->str );
+        }
+        append( program, in );
       }
-      return program;
+      // counters read outside of the loops
+      for( typename prog_type::iterator i = program.begin(); i != program.end(); ++i )
+      {
+        const load_var< T >* lv = dynamic_cast< const load_var< T >* >( ptr( *i ) );
+        for( size_t k = 0; lv && k != counters.size(); ++k )
+        {
+          if( ptr( counters[ k ] ) != ptr( lv->val_p ) ) continue;
+          if( !create_variables_ )
+          {
+            return status( UNKNOWN_TOKEN, std::string::npos, lv->val_p->name );
+          }
+          VPtr v( rt.variable_p( counters[ k ]->name ) );
+          if( !v )
+          {
+            v = VPtr( new value< T >( counters[ k ]->name, T() ) );
+            rt.var_tab.push_back( v );
+          }
+          *i = InstrPtr( new load_var< T >( v ) );
+          break;
+        }
+      }
+      // operands miscounted by the parser must not corrupt the stack
+      const size_t u = stack_underflow( program );
+      if( u != program.size() )
+      {
+        const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( ptr( program[ u ] ) );
+        return status( STACK_UNDERFLOW, std::string::npos, cf ? cf->fun_p->name : "" );
+      }
+      return s;
     }
 
 	/// Returns value of <code>create_variables</code> variable.
@@ -156,6 +282,12 @@ namespace mmath_plus {
 	///  - function is called with a multidimensional parameter:
 	///    f((1,2,3)) is parsed as 1 2 3 f[1] NOT 1 2 3 f[3]
 	void count_args( bool ca ) { count_args_ = ca; }
+	/// Returns maximum number of instructions of inlined procedures.
+	size_t inline_size() const { return inline_size_; }
+	/// Sets maximum number of instructions of inlined procedures; procedures
+	/// are called through the run-time environment if zero.
+	/// @param is maximum procedure size
+	void inline_size( size_t is ) { inline_size_ = is; }
 
 	
   private:
@@ -167,15 +299,500 @@ namespace mmath_plus {
     /// Take into account number of arguments when compiling a function ?
     bool count_args_;
 
+    /// Maximum number of instructions of inlined procedures.
+    size_t inline_size_;
+
+    /// Instruction pointer type.
+    typedef typename rte< T >::InstrPtrT InstrPtr;
+
+    /// Instruction sequence type.
+    typedef typename rte< T >::prog_type prog_type;
+
+    /// Variable pointer type.
+    typedef typename rte< T >::ValPtrT VPtr;
+
+    //--------------------------------------------------------------------------
+    /// Appends instruction to program, expanding procedure calls and fusing
+    /// assignments.
+    /// @param program instructions compiled so far
+    /// @param in instruction
+    void append( prog_type& program, const InstrPtr& in ) const
+    {
+      if( inline_call( program, ptr( in ) ) ) return;
+      if( !fuse_assignment( program, ptr( in ) ) ) program.push_back( in );
+    }
+
+    //--------------------------------------------------------------------------
+    /// Returns true if instruction does not assign program variables;
+    /// pop_vars instructions only bind the arguments of inlined procedures.
+    static bool pure( const instruction< T >* in )
+    {
+      if( dynamic_cast< const store_vars< T >* >( in ) ) return false;
+      const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in );
+      return !cf || cf->fun_p->name != "=";
+    }
+
+    //--------------------------------------------------------------------------
+    /// Returns true if the instruction preceding position i jumps over it,
+    /// i.e. position i is inside a conditional; conditionals only jump
+    /// forward, from the instruction preceding each branch.
+    static bool skipped( const prog_type& program, typename prog_type::size_type i )
+    {
+      if( i == 0 ) return false;
+      const branch< T >* b = dynamic_cast< const branch< T >* >( ptr( program[ i - 1 ] ) );
+      return b && b->offset > 0;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Finds the first instruction of the sequence computing the n values
+    /// pushed by the instructions preceding position end; a conditional is
+    /// part of a sequence as a whole.
+    /// @param program instructions
+    /// @param end one past the last instruction of the sequence
+    /// @param n number of values
+    /// @param[out] begin first instruction of the sequence
+    /// @return false if the values are not computed by a separate sequence
+    static bool values( const prog_type& program,
+                        typename prog_type::size_type end, int n,
+                        typename prog_type::size_type& begin )
+    {
+      int need = n;
+      begin = end;
+      while( need > 0 || skipped( program, begin ) )
+      {
+        if( begin == 0 ) return false;
+        --begin;
+        int pop = 0;
+        int push = 0;
+        if( !stack_effect( ptr( program[ begin ] ), pop, push ) || push > need )
+        {
+          return false;
+        }
+        need += pop - push;
+      }
+      return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Returns false if the values read by a function call are not computed
+    /// by separate sequences of instructions for its left and right
+    /// operands, e.g. the values of a call returning three values read as
+    /// a scalar operand when the parser miscounted them; sequences of
+    /// instructions whose stack effect is not known are not checked.
+    /// @param program instructions compiled so far, ending with the
+    /// instructions computing the operands
+    /// @param in instruction appended to program
+    static bool operands( const prog_type& program, const instruction< T >* in )
+    {
+      const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in );
+      if( !cf ) return true;
+      const int n[] = { cf->fun_p->rvalues_in, cf->fun_p->lvalues_in };
+      typename prog_type::size_type begin = program.size();
+      for( int k = 0; k != 2; ++k )
+      {
+        int need = n[ k ];
+        while( need > 0 || ( n[ k ] > 0 && skipped( program, begin ) ) )
+        {
+          // missing values are reported by stack_underflow()
+          if( begin == 0 ) return true;
+          --begin;
+          int pop = 0;
+          int push = 0;
+          if( !stack_effect( ptr( program[ begin ] ), pop, push ) ) return true;
+          if( push > need ) return false;
+          need += pop - push;
+        }
+      }
+      return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Compiles a conditional into jumps over the instructions already
+    /// compiled for its operands:
+    ///  - if(c,a,b) --> c jump_if(zero) a jump b; both branches must compute
+    ///    the same number of values
+    ///  - a && b --> a jump_if(zero) b jump_if(zero) 1 jump 0
+    ///  - a || b --> a jump_if(not zero) b jump_if(not zero) 0 jump 1
+    /// @param t token
+    /// @param program instructions compiled so far, ending with the
+    /// instructions computing the operands
+    /// @param[out] s status, set if the operands cannot be separated
+    /// @return true if token is a conditional
+    bool conditional( const math_parser::TokenPtr& t, prog_type& program,
+                      status& s ) const
+    {
+      typedef typename prog_type::size_type size_type;
+      if( !t ) return false;
+      const bool logical = t->type == math_parser::OPERATOR
+                           && ( t->str == "&&" || t->str == "||" );
+      if( !logical && ( t->type != math_parser::FUNCTION || t->str != "if" ) )
+      {
+        return false;
+      }
+      const size_type end = program.size();
+      size_type first = 0;
+      size_type second = 0;
+      if( logical )
+      {
+        const math_parser::operator_token* o =
+          static_cast< const math_parser::operator_token* >( ptr( t ) );
+        if( o->largs > 1 || o->rargs > 1 || !values( program, end, 1, second )
+            || !values( program, second, 1, first ) )
+        {
+          s = status( INVALID_ARGUMENTS, std::string::npos, t->str );
+          return true;
+        }
+        const bool w = t->str == "||";
+        program.push_back( InstrPtr( new jump_if< T >( 2, w ) ) );
+        program.push_back( InstrPtr( new load_val< T >( T( w ? 0 : 1 ) ) ) );
+        program.push_back( InstrPtr( new jump< T >( 1, 1 ) ) );
+        program.push_back( InstrPtr( new load_val< T >( T( w ? 1 : 0 ) ) ) );
+        program.insert( program.begin() + second,
+                        InstrPtr( new jump_if< T >( int( end - second ) + 3, w ) ) );
+        return true;
+      }
+      const math_parser::function_token* ft =
+        static_cast< const math_parser::function_token* >( ptr( t ) );
+      // arguments not counted: one value per branch
+      const int args = ft->args > 0 ? ft->args : 3;
+      const int n = ( args - 1 ) / 2;
+      size_type c = 0;
+      if( args < 3 || args % 2 == 0 || !values( program, end, n, second )
+          || !values( program, second, n, first ) || !values( program, first, 1, c ) )
+      {
+        s = status( INVALID_ARGUMENTS, std::string::npos, t->str );
+        return true;
+      }
+      program.insert( program.begin() + second,
+                      InstrPtr( new jump< T >( int( end - second ), n ) ) );
+      program.insert( program.begin() + first,
+                      InstrPtr( new jump_if< T >( int( second - first ) + 1, false ) ) );
+      return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Compiles a summation or product into a loop over the instructions
+    /// already compiled for its operands:
+    ///  - sum(i,a,b,f) --> 0 a b pop_vars(i,n) L: i n <= jump_if(zero) f +
+    ///    i 1 + pop_vars(i) jump(L)
+    ///  - prod(i,a,b,f) --> 1 a b pop_vars(i,n) ... f * ...
+    /// i and n are variables local to the loop: the loads of the counter in
+    /// f are replaced with loads of i, so that the counter does not need to
+    /// be a variable of the run-time environment. The body is compiled once
+    /// and evaluated for i = a, a + 1, ... while i <= b; the value on top of
+    /// the stack is the partial sum (or product).
+    /// @param t token
+    /// @param rt run-time environment defining the <=, + and * operators
+    /// @param program instructions compiled so far, ending with the
+    /// instructions computing the operands
+    /// @param[out] s status, set if the operands cannot be separated or the
+    /// counter is not a name
+    /// @return true if token is a loop
+    bool loop( const math_parser::TokenPtr& t, const rte< T >& rt,
+               prog_type& program, status& s ) const
+    {
+      typedef typename prog_type::size_type size_type;
+      typedef shared_ptr< const function_i< T > > FPtr;
+      if( !t || t->type != math_parser::FUNCTION
+          || ( t->str != "sum" && t->str != "prod" ) ) return false;
+      const math_parser::function_token* ft =
+        static_cast< const math_parser::function_token* >( ptr( t ) );
+      const size_type end = program.size();
+      size_type body = 0;
+      size_type last = 0;
+      size_type first = 0;
+      size_type c = 0;
+      if( ft->args > 0 && ft->args != 4 ) c = end;
+      else if( !values( program, end, 1, body ) || !values( program, body, 1, last )
+               || !values( program, last, 1, first )
+               || !values( program, first, 1, c ) ) c = end;
+      const load_var< T >* lv = c + 1 == first
+        ? dynamic_cast< const load_var< T >* >( ptr( program[ c ] ) ) : 0;
+      if( !lv )
+      {
+        s = status( INVALID_ARGUMENTS, std::string::npos, t->str );
+        return true;
+      }
+      const bool product = t->str == "prod";
+      const FPtr le( rt.function_p( "<=", 1, 1 ) );
+      const FPtr add( rt.function_p( "+", 1, 1 ) );
+      const FPtr op( product ? FPtr( rt.function_p( "*", 1, 1 ) ) : add );
+      if( !le || !add || !op )
+      {
+        s = status( UNKNOWN_TOKEN, std::string::npos, !le ? "<=" : !add ? "+" : "*" );
+        return true;
+      }
+      const VPtr i( new value< T >( lv->val_p->name ) );
+      const VPtr n( new value< T >( lv->val_p->name + "_end" ) );
+      prog_type f( program.begin() + body, program.end() );
+      for( typename prog_type::iterator k = f.begin(); k != f.end(); ++k )
+      {
+        const load_var< T >* l = dynamic_cast< const load_var< T >* >( ptr( *k ) );
+        if( l && ptr( l->val_p ) == ptr( lv->val_p ) ) *k = InstrPtr( new load_var< T >( i ) );
+      }
+      program.erase( program.begin() + body, program.end() );
+      // the counter is replaced with the initial value of the result
+      program[ c ] = InstrPtr( new load_val< T >( T( product ? 1 : 0 ) ) );
+      std::vector< VPtr > bounds;
+      bounds.push_back( i );
+      bounds.push_back( n );
+      program.push_back( InstrPtr( new pop_vars< T >( bounds ) ) );
+      const size_type head = program.size();
+      program.push_back( InstrPtr( new load_var< T >( i ) ) );
+      program.push_back( InstrPtr( new load_var< T >( n ) ) );
+      program.push_back( InstrPtr( new call_fun< T >( le ) ) );
+      program.push_back( InstrPtr( new jump_if< T >( int( f.size() ) + 6, false ) ) );
+      program.insert( program.end(), f.begin(), f.end() );
+      program.push_back( InstrPtr( new call_fun< T >( op ) ) );
+      program.push_back( InstrPtr( new load_var< T >( i ) ) );
+      program.push_back( InstrPtr( new load_val< T >( T( 1 ) ) ) );
+      program.push_back( InstrPtr( new call_fun< T >( add ) ) );
+      program.push_back( InstrPtr( new pop_vars< T >( std::vector< VPtr >( 1, i ) ) ) );
+      program.push_back( InstrPtr( new jump< T >( int( head ) - int( program.size() ) - 1, 0 ) ) );
+      return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Returns the variable standing for a name not found, created on first
+    /// use; such names must be loop counters.
+    /// @param counters variables created so far
+    /// @param name name
+    static VPtr counter( std::vector< VPtr >& counters, const std::string& name )
+    {
+      for( size_t k = 0; k != counters.size(); ++k )
+      {
+        if( counters[ k ]->name == name ) return counters[ k ];
+      }
+      counters.push_back( VPtr( new value< T >( name ) ) );
+      return counters.back();
+    }
+
+    //--------------------------------------------------------------------------
+    /// Returns true if procedure can be expanded at call sites: the body is
+    /// not larger than inline_size(), does not assign variables and leaves
+    /// exactly one value on the stack.
+    bool inlinable( const procedure< T >& p ) const
+    {
+      const prog_type& body = p.program();
+      if( body.empty() || body.size() > inline_size_ || p.values_out != 1 )
+      {
+        return false;
+      }
+      for( int i = 0; i != p.values_in; ++i ) if( !p.parameter( i ) ) return false;
+      int depth = 0;
+      for( typename prog_type::const_iterator i = body.begin(); i != body.end(); ++i )
+      {
+        int pop = 0;
+        int push = 0;
+        if( !stack_effect( ptr( *i ), pop, push ) || !pure( ptr( *i ) )
+            || dynamic_cast< const pop_vars< T >* >( ptr( *i ) )
+            || dynamic_cast< const branch< T >* >( ptr( *i ) )
+            || depth < pop ) return false;
+        depth += push - pop;
+      }
+      return depth == 1;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Finds the first instruction of the sequence computing the value
+    /// pushed by the instruction preceding position end; the sequence
+    /// includes the pop_vars instructions binding the variables it reads
+    /// and whole conditionals.
+    /// @param program instructions
+    /// @param end one past the last instruction of the sequence
+    /// @param[out] begin first instruction of the sequence
+    /// @return false if the value is not computed by a separate sequence of
+    /// side effect free instructions
+    static bool argument( const prog_type& program,
+                          typename prog_type::size_type end,
+                          typename prog_type::size_type& begin )
+    {
+      int need = 1;
+      begin = end;
+      while( need > 0 || skipped( program, begin ) )
+      {
+        if( begin == 0 ) return false;
+        --begin;
+        int pop = 0;
+        int push = 0;
+        const instruction< T >* in = ptr( program[ begin ] );
+        if( !stack_effect( in, pop, push ) || !pure( in ) || push > need )
+        {
+          return false;
+        }
+        need += pop - push;
+        const pop_vars< T >* pv = !need && begin != 0
+          ? dynamic_cast< const pop_vars< T >* >( ptr( program[ begin - 1 ] ) ) : 0;
+        if( pv )
+        {
+          --begin;
+          need = int( pv->vars.size() );
+        }
+      }
+      return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Replaces a call to a procedure with the procedure body: parameters
+    /// used once are replaced with the instructions computing the argument,
+    /// other parameters are renamed to variables local to the call site
+    /// and bound with a pop_vars instruction.
+    /// @param program instructions compiled so far, ending with the
+    /// instructions computing the arguments
+    /// @param in instruction to be appended to program
+    /// @return true if call was expanded
+    bool inline_call( prog_type& program, const instruction< T >* in ) const
+    {
+      if( !inline_size_ ) return false;
+      const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in );
+      if( !cf ) return false;
+      const procedure< T >* p =
+        dynamic_cast< const procedure< T >* >( ptr( cf->fun_p ) );
+      if( !p || !inlinable( *p ) ) return false;
+      typedef typename prog_type::size_type size_type;
+      const int n = p->values_in;
+      // parameter i receives the i-th value from the top of the stack
+      std::vector< const value< T >* > params( n );
+      std::vector< int > uses( n, 0 );
+      for( int i = 0; i != n; ++i ) params[ i ] = ptr( p->parameter( i ) );
+      const prog_type& body = p->program();
+      for( typename prog_type::const_iterator i = body.begin(); i != body.end(); ++i )
+      {
+        const load_var< T >* lv = dynamic_cast< const load_var< T >* >( ptr( *i ) );
+        if( !lv ) continue;
+        for( int k = 0; k != n; ++k ) if( ptr( lv->val_p ) == params[ k ] ) ++uses[ k ];
+      }
+      // split argument instructions, last argument first
+      std::vector< prog_type > args( n );
+      size_type end = program.size();
+      bool split = true;
+      for( int k = 0; k != n && split; ++k )
+      {
+        size_type begin = 0;
+        split = argument( program, end, begin );
+        if( split ) args[ k ].assign( program.begin() + begin, program.begin() + end );
+        end = begin;
+      }
+      // parameters bound to call site variables
+      typedef shared_ptr< value< T > > VPtr;
+      std::vector< VPtr > locals( n );
+      if( split )
+      {
+        program.erase( program.begin() + end, program.end() );
+        for( int k = n - 1; k >= 0; --k )
+        {
+          if( uses[ k ] < 2 || args[ k ].size() == 1 ) continue;
+          locals[ k ] = VPtr( new value< T >( params[ k ]->name ) );
+          program.insert( program.end(), args[ k ].begin(), args[ k ].end() );
+          program.push_back( InstrPtr( new pop_vars< T >( std::vector< VPtr >( 1, locals[ k ] ) ) ) );
+        }
+      }
+      else
+      {
+        if( program.size() < size_type( n ) ) return false;
+        std::vector< VPtr > vars( n );
+        for( int k = 0; k != n; ++k )
+        {
+          locals[ k ] = VPtr( new value< T >( params[ k ]->name ) );
+          vars[ n - 1 - k ] = locals[ k ];
+        }
+        if( n ) program.push_back( InstrPtr( new pop_vars< T >( vars ) ) );
+      }
+      for( typename prog_type::const_iterator i = body.begin(); i != body.end(); ++i )
+      {
+        const load_var< T >* lv = dynamic_cast< const load_var< T >* >( ptr( *i ) );
+        int k = 0;
+        while( lv && k != n && ptr( lv->val_p ) != params[ k ] ) ++k;
+        if( !lv || k == n ) append( program, *i );
+        else if( locals[ k ] ) program.push_back( InstrPtr( new load_var< T >( locals[ k ] ) ) );
+        else program.insert( program.end(), args[ k ].begin(), args[ k ].end() );
+      }
+      return true;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Returns the parameter assigned by a call to an assignment function,
+    /// null if the instruction does not assign a parameter.
+    /// @param program instructions compiled so far
+    /// @param in instruction to be appended to program
+    static const value< T >* assigned_parameter( const prog_type& program,
+                                                 const instruction< T >* in )
+    {
+      const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in );
+      if( !cf || cf->fun_p->name != "=" ) return 0;
+      const size_t n = std::min( size_t( std::max( cf->fun_p->lvalues_in, 0 ) ),
+                                 program.size() );
+      for( size_t i = program.size() - n; i != program.size(); ++i )
+      {
+        const load_param< T >* lp =
+          dynamic_cast< const load_param< T >* >( ptr( program[ i ] ) );
+        if( lp ) return ptr( lp->val_p );
+      }
+      return 0;
+    }
+
+    //--------------------------------------------------------------------------
+    /// Throws the exception matching an error.
+    static void raise( const status& s )
+    {
+      switch( s.kind )
+      {
+      case NULL_TOKEN: throw null_token( "compile", __LINE__, s.message );
+      case INVALID_ASSIGNMENT: throw invalid_assignment( "compile", __LINE__, s.message );
+      case INVALID_ARGUMENTS: throw invalid_arguments( "compile", __LINE__, s.message );
+      default: throw unknown_token( "compile", __LINE__, s.message );
+      }
+    }
+
+    //--------------------------------------------------------------------------
+    /// Replaces the load_var instructions preceding a call to an assignment
+    /// function with a store_vars instruction, so that variables do not have
+    /// to be looked up through the instruction pointer at run time.
+    /// @param program instructions compiled so far
+    /// @param in instruction to be appended to program
+    /// @return true if program was modified and instruction must not be
+    /// appended
+    bool fuse_assignment( typename rte< T >::prog_type& program,
+                          instruction< T >* in ) const
+    {
+      const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in );
+      if( !cf || cf->fun_p->name != "=" ) return false;
+      const int n = cf->fun_p->lvalues_in;
+      if( n < 1 || n != cf->fun_p->rvalues_in || int( program.size() ) < 2 * n
+          || skipped( program, program.size() - n ) )
+      {
+        return false;
+      }
+      typedef shared_ptr< value< T > > VPtr;
+      std::vector< VPtr > vars;
+      for( typename rte< T >::prog_type::size_type i = program.size() - n;
+           i != program.size();
+           ++i )
+      {
+        const load_var< T >* lv =
+          dynamic_cast< const load_var< T >* >( ptr( program[ i ] ) );
+        if( !lv ) return false;
+        vars.push_back( lv->val_p );
+      }
+      program.erase( program.end() - n, program.end() );
+      program.push_back( typename rte< T >::InstrPtrT( new store_vars< T >( vars ) ) );
+      return true;
+    }
+
     //--------------------------------------------------------------------------
     /// Return instruction given token and run-time environment.
     /// @param t pointer to token
     /// @param rt const reference to run-time environment
-    instruction< T >* compile( math_parser::TokenPtr t, rte< T >& rt ) 
+    /// @param[out] s status
+    /// @param create_vars if false names not found are not created as
+    /// variables even if create_variables() is true
+    /// @return instruction, null in case of error
+    instruction< T >* compile( math_parser::TokenPtr t, rte< T >& rt, status& s,
+                               bool create_vars = true )
     {
       if( !t )
       {
-        throw null_token( "compile", __LINE__, "" );
+        s = status( NULL_TOKEN, std::string::npos, "" );
         return 0;
       }
               
@@ -183,7 +800,6 @@ namespace mmath_plus {
       {
       case math_parser::UNKNOWN:
         {
-          throw unknown_token( "compile", __LINE__, t->str );
           break;
         }          
       case math_parser::VALUE:
@@ -202,6 +818,13 @@ namespace mmath_plus {
           	const FPtr f( rt.function_p( ft->str,
 										count_args_ ? ft->args : -1 ) );
             if( f ) return new call_fun< T >( f );
+            // component selection e.g. zyx(v): created on first use
+            if( count_args_ && swizzle< T >::valid( ft->str, ft->args ) )
+            {
+              typename rte< T >::FunPtrT sf( new swizzle< T >( ft->str, ft->args ) );
+              rt.fun_tab.push_back( sf );
+              return new call_fun< T >( sf );
+            }
             break;
         }
       case math_parser::OPERATOR:
@@ -228,12 +851,15 @@ namespace mmath_plus {
           typedef shared_ptr< value< T > > VPtr;
           VPtr v( rt.variable_p( t->str ) );
           if( v ) return new load_var< T >( v );
+          // check if name is a parameter
+          VPtr p( rt.parameter_p( t->str ) );
+          if( p ) return new load_param< T >( p );
           // check if name is a constant
           typedef shared_ptr< const value< T > > CPtr;
           const CPtr c( rt.constant_p( t->str ) );
           if( c ) return new load_val< T >( c->val );
           // name is not a name nor a constant, if  requested create new variable.
-          if( create_variables_ )
+          if( create_variables_ && create_vars )
           {
           	typedef typename rte< T >::ValPtrT ptype;
           	ptype new_var( new value< T >( t->str, T() ) );
@@ -246,7 +872,7 @@ namespace mmath_plus {
           break;
       }
       // no known token found
-      throw unknown_token( "compile", __LINE__, t->str );
+      s = status( UNKNOWN_TOKEN, std::string::npos, t->str );
       return 0;
     }
   };
@@ -255,6 +881,54 @@ namespace mmath_plus {
   template < class T >
   const std::string compiler< T >::CLS_NAME( "compiler" );
 
+  //---------------------------------------------------------------------------
+  /// Signatures of the functions of a run-time environment, passed to the
+  /// parser to count the values returned by function calls; includes the
+  /// component selections created by the compiler on first use.
+  template < class T >
+  class function_signatures : public math_parser::signatures {
+  public:
+    /// Constructor.
+    /// @param rt run-time environment, referenced
+    function_signatures( const rte< T >& rt ) : rt_( rt ) {}
+    /// Returns number of values returned by a function.
+    /// @param name function name
+    /// @param args number of argument values
+    /// @return number of values, -1 if the function is not known
+    int values( const std::string& name, int args ) const
+    {
+      const typename rte< T >::FunPtrT f( rt_.function_p( name, args ) );
+      if( f ) return f->values_out;
+      return swizzle< T >::valid( name, args ) ? int( name.size() ) : -1;
+    }
+  private:
+    /// Run-time environment.
+    const rte< T >& rt_;
+  };
+
+  //---------------------------------------------------------------------------
+  /// Parses and compiles an expression without throwing.
+  /// @param mp parser
+  /// @param c compiler
+  /// @param expr expression
+  /// @param rt run-time environment
+  /// @param[out] program compiled instruction array
+  /// @return status; the offset of errors is an offset in expr, names not
+  /// found by the compiler are located at their first occurrence
+  template < class T >
+  status compile_expression( const math_parser& mp, compiler< T >& c,
+                             const std::string& expr, rte< T >& rt,
+                             typename rte< T >::prog_type& program )
+  {
+    math_parser::Tokens tokens;
+    const function_signatures< T > functions( rt );
+    status s = mp.parse( expr, tokens, &functions );
+    if( !s.ok() ) return s;
+    s = c.compile( tokens, rt, program );
+    if( !s.ok() && s.offset == std::string::npos ) s.offset = math_parser::offset( expr, s.message );
+    return s;
+  }
+
   //===========================================================================
 
 } // namespace mmath_plus
@@ -0,0 +1,544 @@
+#ifndef CUBATURE_H__
+#define CUBATURE_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file cubature.h parallel adaptive integration of compiled expressions
+/// over intervals and boxes of up to three dimensions
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "compiler.h"
+#include "execution.h"
+#include "math_parser.h"
+#include "batch.h"
+#include "exception.h"
+#include "reduction.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Result of an adaptive integration.
+  template < class T >
+  struct cubature_result {
+    /// Estimate of the integral.
+    T value;
+    /// Estimate of the absolute error.
+    T error;
+    /// Number of integrand evaluations.
+    size_t evaluations;
+    /// Number of regions the domain was split into.
+    size_t regions;
+    /// True if the requested tolerance was met.
+    bool converged;
+    /// Default constructor.
+    cubature_result() : value( T() ), error( T() ), evaluations( 0 ), regions( 0 ),
+                        converged( false )
+    {}
+  };
+
+  //----------------------------------------------------------------------------
+  /// Integration rule over boxes: 15 point Gauss-Kronrod rule, with the
+  /// embedded 7 point Gauss rule as error estimate, on intervals; degree 7
+  /// Genz-Malik rule, with the embedded degree 5 rule as error estimate, on
+  /// boxes of two or three dimensions. The nodes of many boxes are evaluated
+  /// at once by a batch_executor.
+  /// @warning the rule references the program and the variables of the
+  /// run-time environment: they must outlive the rule.
+  template < class T > class cubature_rule {
+  public:
+
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+
+    /// Maximum number of dimensions.
+    static const int MAX_DIMENSIONS = 3;
+
+    /// Class name.
+    static const std::string CLS_NAME;
+
+    //--------------------------------------------------------------------------
+    /// Thrown when the integrand or domain is not valid.
+    class invalid_integral : public exception_base {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      invalid_integral( const std::string& fun,
+                        unsigned long lineno,
+                        const std::string& data = "" )
+        : exception_base( NS_NAME, cubature_rule::CLS_NAME, fun, lineno, data )
+      {}
+    };
+
+    //--------------------------------------------------------------------------
+    /// Box: center and half widths, integral and error estimates and the
+    /// dimension along which it is split.
+    struct region {
+      /// Center.
+      T center[ MAX_DIMENSIONS ];
+      /// Half widths.
+      T half[ MAX_DIMENSIONS ];
+      /// Integral estimate.
+      T value;
+      /// Error estimate.
+      T error;
+      /// Dimension to split.
+      int split;
+      /// Orders regions by error.
+      bool operator<( const region& r ) const { return error < r.error; }
+    };
+
+    //--------------------------------------------------------------------------
+    /// Constructor.
+    /// @param rt run-time environment holding the integration variables
+    /// @param integrand program, the integrand is its top of stack value
+    /// @param vars integration variables, one per dimension
+    /// @param block maximum number of nodes evaluated at once
+    cubature_rule( const rte< T >& rt, const prog_type& integrand,
+                   const std::vector< std::string >& vars,
+                   size_t block = batch_executor< T >::DEFAULT_BLOCK )
+      : executor_( integrand, block ), dims_( int( vars.size() ) )
+    {
+      if( vars.empty() || vars.size() > size_t( MAX_DIMENSIONS ) )
+      {
+        throw invalid_integral( "cubature_rule", __LINE__,
+                                "one to three integration variables required" );
+      }
+      if( !executor_.results() )
+      {
+        throw invalid_integral( "cubature_rule", __LINE__,
+                                "integrand computes no value" );
+      }
+      for( int d = 0; d != dims_; ++d )
+      {
+        if( !rt.variable_p( vars[ d ] ) )
+        {
+          throw invalid_integral( "cubature_rule", __LINE__,
+                                  "unknown variable " + vars[ d ] );
+        }
+      }
+      rt_ = &rt;
+      vars_ = vars;
+      out_.assign( executor_.results(), 0 );
+      nodes();
+    }
+
+    /// Returns number of dimensions.
+    int dimensions() const { return dims_; }
+
+    /// Returns number of nodes of the rule.
+    size_t points() const { return offsets_.size() / size_t( dims_ ); }
+
+    /// Computes integral and error estimates of n regions; memory is
+    /// allocated only when evaluating more regions than ever before.
+    /// @param[in,out] r regions
+    /// @param n number of regions
+    void apply( region* r, size_t n )
+    {
+      const size_t p = points();
+      if( f_.size() < n * p )
+      {
+        f_.resize( n * p );
+        for( int d = 0; d != dims_; ++d )
+        {
+          x_[ d ].resize( n * p );
+          executor_.bind( *rt_, vars_[ d ], column< T >( x_[ d ].data() ) );
+        }
+        out_.back() = f_.data();
+      }
+      for( size_t i = 0; i != n; ++i )
+      {
+        for( size_t k = 0; k != p; ++k )
+        {
+          for( int d = 0; d != dims_; ++d )
+          {
+            x_[ d ][ i * p + k ] = r[ i ].center[ d ] + r[ i ].half[ d ] * offsets_[ k * dims_ + d ];
+          }
+        }
+      }
+      executor_.run( 0, n * p, out_.data() );
+      for( size_t i = 0; i != n; ++i )
+      {
+        if( dims_ == 1 ) kronrod( r[ i ], &f_[ i * p ] );
+        else genz_malik( r[ i ], &f_[ i * p ] );
+      }
+    }
+
+  private:
+
+    /// Computes the node offsets relative to the center, in units of half
+    /// widths.
+    void nodes()
+    {
+      if( dims_ == 1 )
+      {
+        for( int k = 0; k != 7; ++k )
+        {
+          offsets_.push_back( -xgk( k ) );
+          offsets_.push_back( xgk( k ) );
+        }
+        offsets_.push_back( T() );
+        return;
+      }
+      // center, +-l2 and +-l3 along each axis, +-l4 along each pair of axes,
+      // +-l5 along all the axes
+      const T l[ 4 ] = { T( std::sqrt( 9.0 / 70 ) ), T( std::sqrt( 9.0 / 10 ) ),
+                         T( std::sqrt( 9.0 / 10 ) ), T( std::sqrt( 9.0 / 19 ) ) };
+      std::vector< T > p( dims_, T() );
+      offsets_.insert( offsets_.end(), p.begin(), p.end() );
+      for( int k = 0; k != 2; ++k )
+      {
+        for( int d = 0; d != dims_; ++d )
+        {
+          for( int s = -1; s <= 1; s += 2 )
+          {
+            std::fill( p.begin(), p.end(), T() );
+            p[ d ] = T( s ) * l[ k ];
+            offsets_.insert( offsets_.end(), p.begin(), p.end() );
+          }
+        }
+      }
+      for( int i = 0; i != dims_; ++i )
+      {
+        for( int j = i + 1; j != dims_; ++j )
+        {
+          for( int s = 0; s != 4; ++s )
+          {
+            std::fill( p.begin(), p.end(), T() );
+            p[ i ] = s & 1 ? -l[ 2 ] : l[ 2 ];
+            p[ j ] = s & 2 ? -l[ 2 ] : l[ 2 ];
+            offsets_.insert( offsets_.end(), p.begin(), p.end() );
+          }
+        }
+      }
+      for( int s = 0; s != 1 << dims_; ++s )
+      {
+        for( int d = 0; d != dims_; ++d ) p[ d ] = s & ( 1 << d ) ? -l[ 3 ] : l[ 3 ];
+        offsets_.insert( offsets_.end(), p.begin(), p.end() );
+      }
+    }
+
+    /// Returns Kronrod node k, the Gauss nodes being the odd ones.
+    static T xgk( int k )
+    {
+      static const double x[ 7 ] = {
+        0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245 };
+      return T( x[ k ] );
+    }
+
+    /// Applies Gauss-Kronrod rule; f holds the values at -x0, x0, -x1, ...
+    /// and at the center.
+    void kronrod( region& r, const T* f ) const
+    {
+      static const double wgk[ 8 ] = {
+        0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649, 0.209482141084727828012999174891714 };
+      static const double wg[ 4 ] = {
+        0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975, 0.417959183673469387755102040816327 };
+      T k = T( wgk[ 7 ] ) * f[ 14 ];
+      T g = T( wg[ 3 ] ) * f[ 14 ];
+      for( int i = 0; i != 7; ++i )
+      {
+        const T s = f[ 2 * i ] + f[ 2 * i + 1 ];
+        k += T( wgk[ i ] ) * s;
+        if( i & 1 ) g += T( wg[ i / 2 ] ) * s;
+      }
+      // QUADPACK error estimate: the difference between the rules scaled by
+      // the variation of the integrand about its mean
+      const T mean = T( 0.5 ) * k;
+      T asc = T( wgk[ 7 ] ) * std::abs( f[ 14 ] - mean );
+      for( int i = 0; i != 7; ++i )
+      {
+        asc += T( wgk[ i ] ) * ( std::abs( f[ 2 * i ] - mean ) + std::abs( f[ 2 * i + 1 ] - mean ) );
+      }
+      const T h = std::abs( r.half[ 0 ] );
+      r.value = k * r.half[ 0 ];
+      r.error = std::abs( k - g ) * h;
+      asc *= h;
+      if( asc != T() && r.error != T() )
+      {
+        r.error = asc * std::min( T( 1 ), T( std::pow( T( 200 ) * r.error / asc, T( 1.5 ) ) ) );
+      }
+      r.split = 0;
+    }
+
+    /// Applies Genz-Malik rule; f holds the values at the nodes in the order
+    /// computed by nodes(). The region is split along the dimension with the
+    /// largest fourth difference, the longest one among equal differences.
+    void genz_malik( region& r, const T* f ) const
+    {
+      const int n = dims_;
+      const T w7[ 5 ] = { T( ( 12824.0 - 9120.0 * n + 400.0 * n * n ) / 19683 ),
+                          T( 980.0 / 6561 ), T( ( 1820.0 - 400.0 * n ) / 19683 ),
+                          T( 200.0 / 19683 ), T( 6859.0 / 19683 / ( 1 << n ) ) };
+      const T w5[ 4 ] = { T( ( 729.0 - 950.0 * n + 50.0 * n * n ) / 729 ),
+                          T( 245.0 / 486 ), T( ( 265.0 - 100.0 * n ) / 1458 ),
+                          T( 25.0 / 729 ) };
+      // ratio of the squares of l2 and l3
+      const T ratio = T( 1.0 / 7 );
+      const T f0 = f[ 0 ];
+      T s2 = T(), s3 = T(), s4 = T(), s5 = T();
+      T diff = T( -1 );
+      for( int d = 0; d != n; ++d )
+      {
+        const T a = f[ 1 + 2 * d ] + f[ 2 + 2 * d ];
+        const T b = f[ 1 + 2 * n + 2 * d ] + f[ 2 + 2 * n + 2 * d ];
+        s2 += a;
+        s3 += b;
+        const T dd = std::abs( a - T( 2 ) * f0 - ratio * ( b - T( 2 ) * f0 ) );
+        if( dd > diff || ( dd == diff && r.half[ d ] > r.half[ r.split ] ) )
+        {
+          diff = dd;
+          r.split = d;
+        }
+      }
+      const size_t p4 = 1 + 4 * size_t( n );
+      const size_t p5 = p4 + 2 * size_t( n ) * ( n - 1 );
+      for( size_t k = p4; k != p5; ++k ) s4 += f[ k ];
+      for( size_t k = p5; k != points(); ++k ) s5 += f[ k ];
+      T v = T( 1 );
+      for( int d = 0; d != n; ++d ) v *= T( 2 ) * r.half[ d ];
+      const T i7 = w7[ 0 ] * f0 + w7[ 1 ] * s2 + w7[ 2 ] * s3 + w7[ 3 ] * s4 + w7[ 4 ] * s5;
+      const T i5 = w5[ 0 ] * f0 + w5[ 1 ] * s2 + w5[ 2 ] * s3 + w5[ 3 ] * s4;
+      r.value = v * i7;
+      r.error = std::abs( v * ( i7 - i5 ) );
+    }
+
+  private:
+    /// Run-time environment holding the integration variables.
+    const rte< T >* rt_;
+    /// Integration variables.
+    std::vector< std::string > vars_;
+    /// Executor evaluating the integrand.
+    batch_executor< T > executor_;
+    /// Number of dimensions.
+    int dims_;
+    /// Node offsets, dims_ per node.
+    std::vector< T > offsets_;
+    /// Coordinates of the nodes evaluated, one array per dimension.
+    std::vector< T > x_[ MAX_DIMENSIONS ];
+    /// Integrand values.
+    std::vector< T > f_;
+    /// Output arrays of the executor: the top of stack only.
+    std::vector< T* > out_;
+  };
+
+  /// Definition of class name variable.
+  template < class T >
+  const std::string cubature_rule< T >::CLS_NAME( "cubature_rule" );
+
+  //----------------------------------------------------------------------------
+  /// Default number of regions split at each step of integrate_expression().
+  static const size_t CUBATURE_ROUND = 64;
+
+  //----------------------------------------------------------------------------
+  /// Integrates an expression over a box of one to three dimensions with
+  /// global adaptive subdivision: at each step the regions with the largest
+  /// error estimates are split in two, and the rules of the new regions are
+  /// evaluated by worker threads, started once per integration, each one
+  /// computing the nodes of a slice of the regions at once (see
+  /// cubature_rule), until the sum of the error estimates is not greater
+  /// than the tolerance. Each thread evaluates its own copy of the program
+  /// (see create_workers()). The regions split do not depend on the number
+  /// of threads, and neither do the results.
+  /// Smooth integrands converge quickly; discontinuous ones, e.g. indicator
+  /// functions of solids, need many splits along the discontinuity.
+  /// @code
+  /// std::vector< std::string > v( 1, "x" );
+  /// const double lo = 0, hi = 1;
+  /// cubature_result< double > r =
+  ///   integrate_expression( mp, c, rt, "exp(-x*x)", v, &lo, &hi, 1e-10 );
+  /// @endcode
+  /// @param mp parser
+  /// @param c compiler
+  /// @param rt run-time environment holding the integration variables
+  /// @param expr integrand
+  /// @param vars integration variables, one per dimension
+  /// @param lo lower bounds, one per dimension
+  /// @param hi upper bounds, one per dimension
+  /// @param abs_tol absolute tolerance
+  /// @param rel_tol tolerance relative to the absolute value of the integral
+  /// @param max_evaluations maximum number of integrand evaluations, 0 for
+  ///        no limit
+  /// @param threads number of threads, 0 for one per hardware thread
+  /// @param round number of regions split at each step
+  /// @param block number of nodes evaluated at once
+  /// @return integral and error estimates
+  template < class T >
+  cubature_result< T >
+  integrate_expression( const math_parser& mp, const compiler< T >& c,
+                        const rte< T >& rt, const std::string& expr,
+                        const std::vector< std::string >& vars,
+                        const T* lo, const T* hi, T abs_tol, T rel_tol = T(),
+                        size_t max_evaluations = 10000000, unsigned threads = 0,
+                        size_t round = CUBATURE_ROUND,
+                        size_t block = batch_executor< T >::DEFAULT_BLOCK )
+  {
+    typedef typename rte< T >::prog_type prog_type;
+    typedef typename cubature_rule< T >::region region;
+    // program, environment and rule private to a thread
+    struct worker {
+      rte< T > rt;
+      prog_type program;
+      shared_ptr< cubature_rule< T > > rule;
+    };
+    if( !round ) round = 1;
+    if( !threads ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+    const std::vector< shared_ptr< worker > > workers =
+      create_workers< worker >( rt, threads, [ & ]( worker& w )
+      {
+        compiler< T > lc( c );
+        const function_signatures< T > functions( w.rt );
+        w.program = lc.compile( mp.parse( expr, &functions ), w.rt );
+        w.rule = shared_ptr< cubature_rule< T > >(
+          new cubature_rule< T >( w.rt, w.program, vars, block ) );
+      } );
+    const int dims = int( vars.size() );
+    const size_t points = workers[ 0 ]->rule->points();
+    // regions form a heap, largest error first
+    std::vector< region > regions( 1 );
+    for( int d = 0; d != dims; ++d )
+    {
+      regions[ 0 ].center[ d ] = T( 0.5 ) * ( lo[ d ] + hi[ d ] );
+      regions[ 0 ].half[ d ] = T( 0.5 ) * ( hi[ d ] - lo[ d ] );
+    }
+    regions[ 0 ].split = 0;
+    workers[ 0 ]->rule->apply( &regions[ 0 ], 1 );
+    cubature_result< T > result;
+    result.evaluations = points;
+    std::vector< region > split;
+    // the threads are started once and apply the rule to a slice of the
+    // regions split at each step, signalled by incrementing step
+    size_t slice = 0;
+    const auto apply = [ & ]( size_t t )
+    {
+      const size_t first = t * slice;
+      if( first < split.size() )
+      {
+        workers[ t ]->rule->apply( &split[ first ], std::min( slice, split.size() - first ) );
+      }
+    };
+    std::mutex mutex;
+    std::condition_variable started, finished;
+    size_t step = 0;
+    size_t pending = 0;
+    bool stop = false;
+    const auto run = [ & ]( size_t t )
+    {
+      for( size_t done = 0; ; )
+      {
+        {
+          std::unique_lock< std::mutex > lock( mutex );
+          started.wait( lock, [ & ]() { return stop || step != done; } );
+          if( stop ) return;
+          done = step;
+        }
+        apply( t );
+        std::lock_guard< std::mutex > lock( mutex );
+        if( !--pending ) finished.notify_one();
+      }
+    };
+    std::vector< std::thread > pool;
+    for( size_t t = 1; t != workers.size(); ++t ) pool.push_back( std::thread( run, t ) );
+    const auto join = [ & ]()
+    {
+      {
+        std::lock_guard< std::mutex > lock( mutex );
+        stop = true;
+      }
+      started.notify_all();
+      for( size_t t = 0; t != pool.size(); ++t ) pool[ t ].join();
+    };
+    try
+    {
+      for( ;; )
+      {
+        result.value = T();
+        result.error = T();
+        for( size_t i = 0; i != regions.size(); ++i )
+        {
+          result.value += regions[ i ].value;
+          result.error += regions[ i ].error;
+        }
+        result.converged =
+          result.error <= std::max( abs_tol, rel_tol * std::abs( result.value ) );
+        if( result.converged || result.error != result.error ) break;
+        const size_t n = std::min( round, regions.size() );
+        if( max_evaluations && result.evaluations + 2 * n * points > max_evaluations ) break;
+        split.clear();
+        for( size_t i = 0; i != n; ++i )
+        {
+          std::pop_heap( regions.begin(), regions.end() );
+          region r = regions.back();
+          regions.pop_back();
+          const int d = r.split;
+          r.half[ d ] *= T( 0.5 );
+          r.center[ d ] -= r.half[ d ];
+          split.push_back( r );
+          r.center[ d ] += T( 2 ) * r.half[ d ];
+          split.push_back( r );
+        }
+        slice = ( split.size() + workers.size() - 1 ) / workers.size();
+        {
+          std::lock_guard< std::mutex > lock( mutex );
+          pending = pool.size();
+          ++step;
+        }
+        started.notify_all();
+        apply( 0 );
+        {
+          std::unique_lock< std::mutex > lock( mutex );
+          finished.wait( lock, [ & ]() { return !pending; } );
+        }
+        for( size_t i = 0; i != split.size(); ++i )
+        {
+          regions.push_back( split[ i ] );
+          std::push_heap( regions.begin(), regions.end() );
+        }
+        result.evaluations += split.size() * points;
+      }
+    }
+    catch( ... )
+    {
+      join();
+      throw;
+    }
+    join();
+    result.regions = regions.size();
+    return result;
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // CUBATURE_H__
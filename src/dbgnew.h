@@ -6,6 +6,7 @@
 /// @file dbgnew.h overloaded new & delete operators used to tace memory allocation in conjunction with MemTracer class
 
 #include <cstdlib>
+#include <new>
 
 #include "mem_tracer.h"
 
@@ -20,8 +21,8 @@ extern MemTracer NewTrace;
 /// @param fun __FUNCTION__
 inline void * operator new ( size_t size, char const * file, int line, const char* fun )
 {
-    void* p = std::malloc( size );
-    if( MemTracer::Ready ) NewTrace.Add( p, file, line, fun, size );
+    void* p = MemTracer::Allocate( size, file, line, fun );
+    if( !p ) throw std::bad_alloc();
     return p;
 }
 
@@ -30,25 +31,13 @@ inline void * operator new ( size_t size, char const * file, int line, const cha
 /// operator.
 inline void operator delete( void * p, char const * file, int line, const char* fun )
 {
-    if( MemTracer::Ready ) NewTrace.Remove( p );
-    std::free( p );
+    MemTracer::Release( p );
 }
 
-/// Overloaded operator new called from outside mmath_plus.
-/// @param size byte size of memory chunk to allocate
-inline void* operator new( size_t size )
-{
-	void* p = std::malloc( size );
-    if( MemTracer::Ready ) NewTrace.Add( p, "?", 0, 0, size );
-    return p;
-}
-
-/// Overloaded delete operator. 
-inline void operator delete( void* p )
-{
-    if( MemTracer::Ready ) NewTrace.Remove ( p );
-    free( p );
-}
+// The replaceable operator new( size_t ) and operator delete( void* ) are
+// defined in mem_tracer.cpp: replacement functions must not be inline, to be
+// used by the standard library as well; all the memory is then allocated
+// and released through MemTracer::Allocate and MemTracer::Release.
 
 // #define the following to use overloaded new(size, file, line, function)
 //#define new new( __FILE__, __LINE__, __FUNCTION__ )
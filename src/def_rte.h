@@ -10,6 +10,8 @@
 
 #include "execution.h"
 #include "adaptors.h"
+#include "math_parser.h"
+#include "vector_functions.h"
 
 #include "shared_ptr.h"
 
@@ -72,38 +74,186 @@ namespace mmath_plus {
   /// Divide.
   template < class T > T div( T v1, T v2) { return v1 / v2; }
 
+  /// Less than: 1 if true, 0 otherwise.
+  template < class T > T lt( T v1, T v2 ) { return T( v1 < v2 ); }
+  /// Less than or equal: 1 if true, 0 otherwise.
+  template < class T > T le( T v1, T v2 ) { return T( v1 <= v2 ); }
+  /// Greater than: 1 if true, 0 otherwise.
+  template < class T > T gt( T v1, T v2 ) { return T( v1 > v2 ); }
+  /// Greater than or equal: 1 if true, 0 otherwise.
+  template < class T > T ge( T v1, T v2 ) { return T( v1 >= v2 ); }
+  /// Equal: 1 if true, 0 otherwise.
+  template < class T > T eq( T v1, T v2 ) { return T( v1 == v2 ); }
+  /// Not equal: 1 if true, 0 otherwise.
+  template < class T > T ne( T v1, T v2 ) { return T( v1 != v2 ); }
+  /// Logical not: 1 if value is zero, 0 otherwise.
+  template < class T > T lnot( T v ) { return T( v == T() ); }
+
+  /// Evaluates double precision function F on single precision value.
+  template < double ( *F )( double ) >
+  float mixed_unary( float v ) { return float( F( v ) ); }
+  /// Evaluates double precision function F on single precision values.
+  template < double ( *F )( double, double ) >
+  float mixed_binary( float v1, float v2 ) { return float( F( v1, v2 ) ); }
+
   /// Default unary function table.
-  unary_function_t< double > unary_functions[] =
+  static unary_function_t< double > unary_functions[] =
   {
     { "abs",   fabs,  0 }, { "acos", acos, 0 }, { "asin",  asin,  0 }, { "atan", atan, 0 },
     { "ceil",  ceil,  0 }, { "cos",  cos,  0 }, { "cosh",  cosh,  0 }, { "exp",  exp,  0 },
     { "floor", floor, 0 }, { "log",  log,  0 }, { "log10", log10, 0 }, { "sin",  sin,  0 },
     { "sinh",  sinh,  0 }, { "sqrt", sqrt, 0 }, { "tan",   tan,   0 }, { "inv",  inv,  0 },
-    { "-",     neg,   1 }
+    { "-",     neg,   0 }, { "!",    lnot, 0 }
   };
 
   /// Default binary function table.
-  binary_function_t< double > binary_functions[] =
+  static binary_function_t< double > binary_functions[] =
   {
     { "^",   pow, 1 }, { "*",     mul,   1 }, { "/", div, 1 },   { "+", add, 1 },
     { "-",   sub, 1 }, { "%",     fmod,  1 },
     { "add", add, 0 }, { "sub",   sub,   0 }, { "div", div, 0 }, { "mul", mul, 0 },
-    { "pow", pow, 0 }, { "atan2", atan2, 0 }
+    { "pow", pow, 0 }, { "atan2", atan2, 0 },
+    { "<",   lt,  1 }, { "<=",    le,    1 }, { ">", gt,  1 },   { ">=", ge, 1 },
+    { "==",  eq,  1 }, { "!=",    ne,    1 }
   };
 
   /// Default constants.
-  value_t< double > constants[] =
+  static value_t< double > constants[] =
   {
     { "e", 2.71828182845904523536 }, { "log2e", 1.44269504088896340736 },
     { "Pi", 3.14159265358979323846 }
   };
 
   /// Default variables.
-  value_t< double > variables[] =
+  static value_t< double > variables[] =
   {
     { "x", 0.0 }, { "y", 0.0 }, { "z", 0.0 }, { "w", 0.0 }
   };
 
+  /// Single precision unary function table: float libm functions.
+  static unary_function_t< float > unary_functions_f[] =
+  {
+    { "abs",   ::fabsf,  0 }, { "acos", ::acosf, 0 }, { "asin",  ::asinf,  0 }, { "atan", ::atanf, 0 },
+    { "ceil",  ::ceilf,  0 }, { "cos",  ::cosf,  0 }, { "cosh",  ::coshf,  0 }, { "exp",  ::expf,  0 },
+    { "floor", ::floorf, 0 }, { "log",  ::logf,  0 }, { "log10", ::log10f, 0 }, { "sin",  ::sinf,  0 },
+    { "sinh",  ::sinhf,  0 }, { "sqrt", ::sqrtf, 0 }, { "tan",   ::tanf,   0 }, { "inv",  inv,    0 },
+    { "-",     neg,      0 }, { "!",    lnot,   0 }
+  };
+
+  /// Single precision binary function table.
+  static binary_function_t< float > binary_functions_f[] =
+  {
+    { "^",   ::powf, 1 }, { "*",     mul,     1 }, { "/", div, 1 },   { "+", add, 1 },
+    { "-",   sub,    1 }, { "%",     ::fmodf, 1 },
+    { "add", add,    0 }, { "sub",   sub,     0 }, { "div", div, 0 }, { "mul", mul, 0 },
+    { "pow", ::powf, 0 }, { "atan2", ::atan2f, 0 },
+    { "<",   lt,     1 }, { "<=",    le,      1 }, { ">", gt,  1 },   { ">=", ge, 1 },
+    { "==",  eq,     1 }, { "!=",    ne,      1 }
+  };
+
+  /// Mixed precision unary function table: values are stored as float,
+  /// transcendental functions are evaluated in double precision; exactly
+  /// rounded operations (abs, ceil, floor, sqrt, inv, -) are left in float.
+  static unary_function_t< float > unary_functions_mixed[] =
+  {
+    { "abs",   ::fabsf,               0 }, { "acos", mixed_unary< acos >, 0 },
+    { "asin",  mixed_unary< asin >,   0 }, { "atan", mixed_unary< atan >, 0 },
+    { "ceil",  ::ceilf,               0 }, { "cos",  mixed_unary< cos >,  0 },
+    { "cosh",  mixed_unary< cosh >,   0 }, { "exp",  mixed_unary< exp >,  0 },
+    { "floor", ::floorf,              0 }, { "log",  mixed_unary< log >,  0 },
+    { "log10", mixed_unary< log10 >,  0 }, { "sin",  mixed_unary< sin >,  0 },
+    { "sinh",  mixed_unary< sinh >,   0 }, { "sqrt", ::sqrtf,             0 },
+    { "tan",   mixed_unary< tan >,    0 }, { "inv",  inv,                 0 },
+    { "-",     neg,                   0 }, { "!",    lnot,                0 }
+  };
+
+  /// Mixed precision binary function table.
+  static binary_function_t< float > binary_functions_mixed[] =
+  {
+    { "^",   mixed_binary< pow >, 1 }, { "*",     mul,                   1 },
+    { "/",   div,                 1 }, { "+",     add,                   1 },
+    { "-",   sub,                 1 }, { "%",     ::fmodf,               1 },
+    { "add", add,                 0 }, { "sub",   sub,                   0 },
+    { "div", div,                 0 }, { "mul",   mul,                   0 },
+    { "pow", mixed_binary< pow >, 0 }, { "atan2", mixed_binary< atan2 >, 0 },
+    { "<",   lt,                  1 }, { "<=",    le,                    1 },
+    { ">",   gt,                  1 }, { ">=",    ge,                    1 },
+    { "==",  eq,                  1 }, { "!=",    ne,                    1 }
+  };
+
+  /// Single precision constants.
+  static value_t< float > constants_f[] =
+  {
+    { "e", 2.71828182845904523536f }, { "log2e", 1.44269504088896340736f },
+    { "Pi", 3.14159265358979323846f }
+  };
+
+  /// Single precision variables.
+  static value_t< float > variables_f[] =
+  {
+    { "x", 0.0f }, { "y", 0.0f }, { "z", 0.0f }, { "w", 0.0f }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Default tables for value type T; defined for float and double.
+  template < class T > struct def_tables;
+
+  /// Double precision default tables.
+  template <> struct def_tables< double > {
+    /// Unary functions.
+    static unary_function_t< double >* unary( size_t& n )
+    {
+      n = sizeof( unary_functions ) / sizeof( unary_functions[ 0 ] );
+      return unary_functions;
+    }
+    /// Binary functions.
+    static binary_function_t< double >* binary( size_t& n )
+    {
+      n = sizeof( binary_functions ) / sizeof( binary_functions[ 0 ] );
+      return binary_functions;
+    }
+    /// Constants.
+    static value_t< double >* constants( size_t& n )
+    {
+      n = sizeof( mmath_plus::constants ) / sizeof( mmath_plus::constants[ 0 ] );
+      return mmath_plus::constants;
+    }
+    /// Variables.
+    static value_t< double >* variables( size_t& n )
+    {
+      n = sizeof( mmath_plus::variables ) / sizeof( mmath_plus::variables[ 0 ] );
+      return mmath_plus::variables;
+    }
+  };
+
+  /// Single precision default tables.
+  template <> struct def_tables< float > {
+    /// Unary functions.
+    static unary_function_t< float >* unary( size_t& n )
+    {
+      n = sizeof( unary_functions_f ) / sizeof( unary_functions_f[ 0 ] );
+      return unary_functions_f;
+    }
+    /// Binary functions.
+    static binary_function_t< float >* binary( size_t& n )
+    {
+      n = sizeof( binary_functions_f ) / sizeof( binary_functions_f[ 0 ] );
+      return binary_functions_f;
+    }
+    /// Constants.
+    static value_t< float >* constants( size_t& n )
+    {
+      n = sizeof( constants_f ) / sizeof( constants_f[ 0 ] );
+      return constants_f;
+    }
+    /// Variables.
+    static value_t< float >* variables( size_t& n )
+    {
+      n = sizeof( variables_f ) / sizeof( variables_f[ 0 ] );
+      return variables_f;
+    }
+  };
+
   //----------------------------------------------------------------------------
   /// Thrown when invalid assignment detected.
   class invalid_assign : public std::exception {
@@ -219,55 +369,50 @@ namespace mmath_plus {
   //----------------------------------------------------------------------------
   /// Dot product R^3-->R.
   /// (1,2,3)*(1,2,3)=1*1+2*2+3*3. 
-  template < class T >
-  struct dotprod3 : public function_i< T > {
-
-    /// Constructor.
-    dotprod3()
-      : function_i< T >( "*", 6, 1, 3 )
-    {}
-
-    /// Invoked when sum function is called: 4 parameters are read and removed
-	/// from the stack, two placed on the stack.
-    void operator()( rte< T >& rt ) const
-    {
-		const T z2 = rt.stack.top(); rt.stack.pop();
-		const T y2 = rt.stack.top(); rt.stack.pop();
-		const T x2 = rt.stack.top(); rt.stack.pop();
-		const T z1 = rt.stack.top(); rt.stack.pop();
-		const T y1 = rt.stack.top(); rt.stack.pop();
-		const T x1 = rt.stack.top(); rt.stack.pop();
-		rt.stack.push( x1*x2 + y1*y2 + z1*z2 );
-    }
-  };
+  /// Products are accumulated in type AccT.
+  template < class T, class AccT = T >
+  using dotprod3 = dotprod< T, 3, AccT >;
   
   
   //----------------------------------------------------------------------------
   /// Cross product R^3-->R^3.
   /// (1,2,3)^(4,5,6)=(2*6-3*5,-(1*6-3*4),1*5-2*4) 
-  template < class T >
-  struct crossprod3 : public function_i< T > {
+  /// Differences of products are computed in type AccT.
+  template < class T, class AccT = T >
+  struct crossprod3 : public vector_function_i< T > {
 
     /// Constructor.
     crossprod3()
-      : function_i< T >( "cross3", 6, 3, 0 ) // 6 parameters in
-                                             // 3 values out
-                                             // 0 parameters on the left side		
+      : vector_function_i< T >( "cross3", 6, 3, 0, // 6 parameters in
+                                                   // 3 values out
+                                                   // 0 parameters on the left side
+                                VECTOR_CROSS, 3 )
     {}
 
-    /// Invoked when sum function is called: 4 parameters are read and removed
-	/// from the stack, two placed on the stack.
+    /// Invoked when cross product function is called: 6 parameters are read
+	/// from the stack, the result is stored in place of the first operand.
     void operator()( rte< T >& rt ) const
     {
-		const T z2 = rt.stack.top(); rt.stack.pop();
-		const T y2 = rt.stack.top(); rt.stack.pop();
-		const T x2 = rt.stack.top(); rt.stack.pop();
-		const T z1 = rt.stack.top(); rt.stack.pop();
-		const T y1 = rt.stack.top(); rt.stack.pop();
-		const T x1 = rt.stack.top(); rt.stack.pop();
-		rt.stack.push( y1*z2 - y2*z1 );
-		rt.stack.push( x2*z1 - x1*z2 );
-		rt.stack.push( x1*y2 - x2*y1 );
+		T* a = rt.stack.top_n( 6 );
+		const T x1 = a[ 0 ], y1 = a[ 1 ], z1 = a[ 2 ];
+		const T x2 = a[ 3 ], y2 = a[ 4 ], z2 = a[ 5 ];
+		a[ 0 ] = T( AccT( y1 )*z2 - AccT( y2 )*z1 );
+		a[ 1 ] = T( AccT( x2 )*z1 - AccT( x1 )*z2 );
+		a[ 2 ] = T( AccT( x1 )*y2 - AccT( x2 )*y1 );
+		rt.stack.pop_n( 3 );
+    }
+
+    /// Evaluates cross product over columns.
+    void eval_block( T* const* s, size_t n ) const
+    {
+		for( size_t i = 0; i != n; ++i )
+		{
+			const T x1 = s[ 0 ][ i ], y1 = s[ 1 ][ i ], z1 = s[ 2 ][ i ];
+			const T x2 = s[ 3 ][ i ], y2 = s[ 4 ][ i ], z2 = s[ 5 ][ i ];
+			s[ 0 ][ i ] = T( AccT( y1 )*z2 - AccT( y2 )*z1 );
+			s[ 1 ][ i ] = T( AccT( x2 )*z1 - AccT( x1 )*z2 );
+			s[ 2 ][ i ] = T( AccT( x1 )*y2 - AccT( x2 )*y1 );
+		}
     }
   };
 
@@ -376,6 +521,22 @@ namespace mmath_plus {
         r.stack.pop();
       }
     }
+
+    /// Returns compiled body.
+    const typename rte< T >::prog_type& program() const { return proc_; }
+
+    /// Returns variable receiving the i-th value from the top of the stack
+    /// when the procedure is invoked, null if there is no such variable.
+    /// @param i parameter index
+    typename rte< T >::ValPtrT parameter( int i ) const
+    {
+      const typename rte< T >::val_p_tab_type& v = vm_p_->rte().var_tab;
+      if( i < 0 || i >= in_ || i >= int( v.size() ) )
+      {
+        return typename rte< T >::ValPtrT();
+      }
+      return v[ i ];
+    }
 	
   private:
 	executor_ptr_type vm_p_;
@@ -482,58 +643,115 @@ namespace mmath_plus {
   }
 
   //----------------------------------------------------------------------------
-  /// Generates default function table.
+  /// Adds vector versions with N components of unary and binary functions.
+  /// @param ft function table
+  /// @param uf array of unary functions
+  /// @param un number of unary functions
+  /// @param bf array of binary functions
+  /// @param bn number of binary functions
+  template < class T, int N, class AccT >
+  void add_vector_functions( typename rte< T >::fun_p_tab_type& ft,
+                             unary_function_t< T > uf[],
+                             size_t un,
+                             binary_function_t< T > bf[],
+                             size_t bn )
+  {
+	typedef typename rte< T >::fun_p_tab_type::value_type pointer_type;
+	// dot product first: (a)*(b) with vector operands is a dot product
+	ft.push_back( pointer_type( new dotprod< T, N, AccT >() ) );
+	for( size_t i = 0; i < un; ++i )
+	{
+		ft.push_back( pointer_type( new vector_unary< T, N >( uf[ i ].name, uf[ i ].f ) ) );
+	}
+	for( size_t i = 0; i < bn; ++i )
+	{
+		if( bf[ i ].left_params != 1 ) continue;
+		const std::string n( bf[ i ].name );
+		if( n != "*" ) ft.push_back( pointer_type( new vector_binary< T, N >( n, bf[ i ].f ) ) );
+		if( n == "*" )
+		{
+			ft.push_back( pointer_type( new vector_scalar< T, N, true >( n, bf[ i ].f ) ) );
+		}
+		if( n == "*" || n == "/" )
+		{
+			ft.push_back( pointer_type( new vector_scalar< T, N, false >( n, bf[ i ].f ) ) );
+		}
+	}
+  }
+
+  //----------------------------------------------------------------------------
+  /// Generates function table from unary and binary function tables, adding
+  /// the vector functions with 2, 3 and 4 components: assignment, dot
+  /// product, element-wise versions of the unary functions and binary
+  /// operators, scaling by a scalar; and the cross product.
+  /// @param uf array of unary functions
+  /// @param un number of unary functions
+  /// @param bf array of binary functions
+  /// @param bn number of binary functions
   /// @return table of functions
-  template < class T >
-  typename rte< T >::fun_p_tab_type generate_def_functions()
+  /// @note AccT is the type used to accumulate dot and cross products
+  template < class T, class AccT >
+  typename rte< T >::fun_p_tab_type generate_functions( unary_function_t< T > uf[],
+                                                       size_t un,
+                                                       binary_function_t< T > bf[],
+                                                       size_t bn )
   {
-    typename rte< T >::fun_p_tab_type ft =
-      generate_unary_functions< T >(
-         unary_functions,
-         sizeof( unary_functions ) / sizeof( unary_functions[ 0 ] ) );
+    typename rte< T >::fun_p_tab_type ft = generate_unary_functions< T >( uf, un );
 
-    typename rte< T >::fun_p_tab_type bf =
-      generate_binary_functions< T >(
-         binary_functions,
-         sizeof( binary_functions ) / sizeof( binary_functions[ 0 ] ) );
+    typename rte< T >::fun_p_tab_type bt = generate_binary_functions< T >( bf, bn );
 
-    std::copy( bf.begin(), bf.end(), std::back_inserter( ft ) );
+    std::copy( bt.begin(), bt.end(), std::back_inserter( ft ) );
 
 	typedef typename rte< T >::fun_p_tab_type::value_type pointer_type;
 	
-	ft.push_back( pointer_type( new vector_assign< double, 4 >() ) );
-	ft.push_back( pointer_type( new vector_assign< double, 3 >() ) );
-	ft.push_back( pointer_type( new vector_assign< double, 2 >() ) );
-	ft.push_back( pointer_type( new crossprod3< double >() ) );
+	ft.push_back( pointer_type( new vector_assign< T, 4 >() ) );
+	ft.push_back( pointer_type( new vector_assign< T, 3 >() ) );
+	ft.push_back( pointer_type( new vector_assign< T, 2 >() ) );
+	ft.push_back( pointer_type( new crossprod3< T, AccT >() ) );
     
-	ft.push_back( pointer_type( new dotprod3< double >() ) );
+	add_vector_functions< T, 3, AccT >( ft, uf, un, bf, bn );
+	add_vector_functions< T, 2, AccT >( ft, uf, un, bf, bn );
+	add_vector_functions< T, 4, AccT >( ft, uf, un, bf, bn );
 	
-	for( size_t i = 0; i < sizeof( binary_functions ) / sizeof( binary_functions[ 0 ] ); ++i )
-	{
-		if( binary_functions[ i ].left_params == 1 )
-		{
-			binary_function< T > f( binary_functions[ i ].f );
-			pointer_type f3d( new function< binary_function< T >, T >(
-													f, binary_functions[ i ].name,
-													2, 1,
-													binary_functions[ i ].left_params ) );
-			ft.push_back( pointer_type( new vector_op_apply< double, 3 >( f3d ) ) );
-		}
-	}
-	
-	ft.push_back( pointer_type( new scalar_assign< double >() ) );
+	ft.push_back( pointer_type( new scalar_assign< T >() ) );
 	
     return ft;
   }
 
+  //----------------------------------------------------------------------------
+  /// Generates default function table; T is float or double.
+  /// @return table of functions
+  template < class T >
+  typename rte< T >::fun_p_tab_type generate_def_functions()
+  {
+    size_t un = 0;
+    size_t bn = 0;
+    unary_function_t< T >* uf = def_tables< T >::unary( un );
+    binary_function_t< T >* bf = def_tables< T >::binary( bn );
+    return generate_functions< T, T >( uf, un, bf, bn );
+  }
+
+  //----------------------------------------------------------------------------
+  /// Generates mixed precision function table: values are float, functions
+  /// are evaluated and dot and cross products accumulated in double.
+  /// @return table of functions
+  inline rte< float >::fun_p_tab_type generate_mixed_functions()
+  {
+    const size_t un = sizeof( unary_functions_mixed ) / sizeof( unary_functions_mixed[ 0 ] );
+    const size_t bn = sizeof( binary_functions_mixed ) / sizeof( binary_functions_mixed[ 0 ] );
+    return generate_functions< float, double >( unary_functions_mixed, un,
+                                                binary_functions_mixed, bn );
+  }
+
   //----------------------------------------------------------------------------
   /// Generates default constant table.
   /// @return table of constants
   template < class T >
   typename rte< T >::val_p_tab_type generate_def_constants()
   {
-    const size_t cs = sizeof( constants ) / sizeof( constants[ 0 ] );
-    return generate_constants< T >( constants, cs );
+    size_t cs = 0;
+    value_t< T >* c = def_tables< T >::constants( cs );
+    return generate_constants< T >( c, cs );
   }
 
   //----------------------------------------------------------------------------
@@ -542,20 +760,102 @@ namespace mmath_plus {
   template < class T >
   typename rte< T >::val_p_tab_type generate_def_variables()
   {
-    const size_t vs = sizeof( variables ) / sizeof( variables[ 0 ] );
-    return generate_variables< T >( variables, vs );
+    size_t vs = 0;
+    value_t< T >* v = def_tables< T >::variables( vs );
+    return generate_variables< T >( v, vs );
   }
 
   //----------------------------------------------------------------------------
-  /// Generates default run-time environment object.
+  /// Generates default operator table to be passed to the math_parser
+  /// constructor; operators are listed from highest to lowest precedence.
+  /// @return table of operators
+  inline std::vector< operator_type > generate_def_operators()
+  {
+    typedef operator_type op_t;
+    const op_t ops[] = { // function accepting 6 parameters and returning
+                         // 3 values
+                         op_t( "cross3", 1, 0, 6, 3 ),
+                         op_t( "^", 2 ), op_t( "^", 2, 2, 2, 2 ),
+                         op_t( "^", 2, 3, 3, 3 ), op_t( "^", 2, 4, 4, 4 ),
+                         // vector * vector: dot product
+                         op_t( "*", 2, 3, 3, 1 ),
+                         op_t( "*", 2 ), op_t( "*", 2, 2, 2, 1 ),
+                         op_t( "*", 2, 4, 4, 1 ),
+                         // scalar * vector, vector * scalar
+                         op_t( "*", 2, 1, 2, 2 ), op_t( "*", 2, 2, 1, 2 ),
+                         op_t( "*", 2, 1, 3, 3 ), op_t( "*", 2, 3, 1, 3 ),
+                         op_t( "*", 2, 1, 4, 4 ), op_t( "*", 2, 4, 1, 4 ),
+                         op_t( "/", 2 ), op_t( "/", 2, 2, 2, 2 ),
+                         op_t( "/", 2, 3, 3, 3 ), op_t( "/", 2, 4, 4, 4 ),
+                         op_t( "/", 2, 2, 1, 2 ), op_t( "/", 2, 3, 1, 3 ),
+                         op_t( "/", 2, 4, 1, 4 ),
+                         op_t( "!", 1, 0, 1, 1 ),
+                         op_t( "-", 1, 0, 1, 1 ), op_t( "-", 1, 0, 2, 2 ),
+                         op_t( "-", 1, 0, 3, 3 ), op_t( "-", 1, 0, 4, 4 ),
+                         op_t( "-", 2 ),
+                         op_t( "-", 2, 3, 3, 3 ), op_t( "-", 2, 2, 2, 2 ),
+                         op_t( "-", 2, 4, 4, 4 ),
+                         op_t( "+", 2, 3, 3, 3 ), op_t( "+", 2 ),
+                         op_t( "+", 2, 2, 2, 2 ), op_t( "+", 2, 4, 4, 4 ),
+                         // comparisons and logical operators: 1 if true,
+                         // 0 if false; && and || are short-circuited
+                         op_t( "<", 2 ), op_t( "<=", 2 ),
+                         op_t( ">", 2 ), op_t( ">=", 2 ),
+                         op_t( "==", 2 ), op_t( "!=", 2 ),
+                         op_t( "&&", 2 ), op_t( "||", 2 ),
+                         op_t( "=", 2, 1, 1, 1, true ),
+                         op_t( "=", 2, 3, 3, 3, true ), // swap arguments to
+                                                        // have variable name
+                                                        // just before
+                                                        // assignment operator
+                         op_t( "=", 2, 2, 2, 2, true ),
+                         op_t( "=", 2, 4, 4, 4, true )
+                       };
+    return std::vector< operator_type >( ops, ops + sizeof( ops ) / sizeof( ops[ 0 ] ) );
+  }
+
+  //----------------------------------------------------------------------------
+  /// Returns registry holding the default functions and constants; the
+  /// registry is created on first use and shared by all the environments
+  /// returned by generate_default_rte(). T is float or double.
+  template < class T >
+  typename rte< T >::RegistryPtrT default_registry()
+  {
+    static const typename rte< T >::RegistryPtrT r(
+      new registry< T >( generate_def_functions< T >(),
+                         generate_def_constants< T >() ) );
+    return r;
+  }
+
+  //----------------------------------------------------------------------------
+  /// Returns registry holding the mixed precision functions and the single
+  /// precision constants.
+  inline rte< float >::RegistryPtrT mixed_registry()
+  {
+    static const rte< float >::RegistryPtrT r(
+      new registry< float >( generate_mixed_functions(),
+                             generate_def_constants< float >() ) );
+    return r;
+  }
+
+  //----------------------------------------------------------------------------
+  /// Generates default run-time environment object; T is float or double.
+  /// Functions and constants are shared through default_registry().
   /// @return default run-time environment
   template < class T >
   rte< T > generate_default_rte()
   {
+    return rte< T >( default_registry< T >(), generate_def_variables< T >() );
+  }
 
-    return rte< T >( generate_def_functions< T >(),
-                     generate_def_variables< T >(),
-                     generate_def_constants< T >() );
+  //----------------------------------------------------------------------------
+  /// Generates mixed precision run-time environment: single precision values
+  /// with double precision evaluation of functions and accumulation of
+  /// products.
+  /// @return mixed precision run-time environment
+  inline rte< float > generate_mixed_rte()
+  {
+    return rte< float >( mixed_registry(), generate_def_variables< float >() );
   }
 
   //============================================================================
@@ -3,7 +3,8 @@
 
 // MicroMath+ - (c) Ugo Varetto
 
-/// @file exception.h exception base class
+/// @file exception.h exception base class and error status returned by the
+/// non throwing interfaces
 
 #include <string>
 #include <ostream>
@@ -59,6 +60,80 @@ namespace mmath_plus {
               << '\t' << eb.data << '\n';
   }
 
+  //----------------------------------------------------------------------------
+  /// Error kinds.
+  enum error_kind {
+    SUCCESS,               ///< no error
+    UNMATCHED_OPENING_PAR, ///< opening parenthesis without closing one
+    UNMATCHED_CLOSING_PAR, ///< closing parenthesis without opening one
+    UNKNOWN_SYMBOL,        ///< character not part of any token e.g. '$'
+    INVALID_NAME,          ///< name starting with a number e.g. '2x'
+    UNKNOWN_OPERATOR,      ///< no operator accepting the given operands
+    NULL_TOKEN,            ///< null token passed to the compiler
+    UNKNOWN_TOKEN,         ///< name not found in the run-time environment
+    INVALID_ASSIGNMENT,    ///< assignment to a parameter
+    INVALID_ARGUMENTS,     ///< operands not matching a conditional or a loop
+                           ///< e.g. if(c,a), sum(1,1,3,k)
+    STACK_UNDERFLOW        ///< instruction reading more values than computed
+  };
+
+  /// Returns description of error kind.
+  inline const char* error_name( error_kind k )
+  {
+    switch( k )
+    {
+    case SUCCESS: return "success";
+    case UNMATCHED_OPENING_PAR: return "unmatched opening parenthesis";
+    case UNMATCHED_CLOSING_PAR: return "unmatched closing parenthesis";
+    case UNKNOWN_SYMBOL: return "unknown symbol";
+    case INVALID_NAME: return "invalid name";
+    case UNKNOWN_OPERATOR: return "unknown operator";
+    case NULL_TOKEN: return "null token";
+    case UNKNOWN_TOKEN: return "unknown token";
+    case INVALID_ASSIGNMENT: return "invalid assignment";
+    case INVALID_ARGUMENTS: return "invalid arguments";
+    case STACK_UNDERFLOW: return "stack underflow";
+    }
+    return "unknown error";
+  }
+
+  //----------------------------------------------------------------------------
+  /// Result of operations which report errors without throwing: errors are
+  /// expected e.g. when validating user input, and unwinding the stack
+  /// would cost more than the operation itself. The throwing interfaces
+  /// throw an exception carrying the same message.
+  struct status {
+    /// Error kind.
+    error_kind kind;
+    /// Offset of the error in the input string, std::string::npos if not
+    /// known.
+    std::string::size_type offset;
+    /// Message: the text causing the error.
+    std::string message;
+    /// Default constructor: no error.
+    status() : kind( SUCCESS ), offset( std::string::npos ) {}
+    /// Constructor.
+    /// @param k error kind
+    /// @param off offset in input string
+    /// @param m message
+    status( error_kind k, std::string::size_type off, const std::string& m )
+      : kind( k ), offset( off ), message( m )
+    {}
+    /// Returns true if no error occurred.
+    bool ok() const { return kind == SUCCESS; }
+  };
+
+  /// Helper function to print status.
+  /// @param os reference to output stream
+  /// @param s reference to status
+  inline std::ostream& operator<<( std::ostream& os, const status& s )
+  {
+    os << error_name( s.kind );
+    if( s.offset != std::string::npos ) os << " at offset " << s.offset;
+    if( !s.message.empty() ) os << ": " << s.message;
+    return os;
+  }
+
   //============================================================================
 
 } // namespace mmath_plus
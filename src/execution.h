@@ -69,6 +69,45 @@ namespace mmath_plus {
 
   //===========================================================================
 
+  //---------------------------------------------------------------------------
+  /// Value stack: std::stack interface on top of a contiguous array.
+  /// Multi-dimensional values occupy consecutive slots and can be read and
+  /// written in place through top_n().
+  template < class T >
+  class value_stack {
+  public:
+    /// Value type.
+    typedef T value_type;
+    /// Container type.
+    typedef std::vector< T > container_type;
+    /// Size type.
+    typedef typename container_type::size_type size_type;
+
+    /// Returns true if stack is empty.
+    bool empty() const { return c_.empty(); }
+    /// Returns number of values.
+    size_type size() const { return c_.size(); }
+    /// Returns value on top of stack.
+    T& top() { return c_.back(); }
+    /// Returns value on top of stack.
+    const T& top() const { return c_.back(); }
+    /// Pushes value on top of stack.
+    void push( const T& v ) { c_.push_back( v ); }
+    /// Removes value on top of stack.
+    void pop() { c_.pop_back(); }
+    /// Returns pointer to first of the n values on top of stack; the value
+    /// on top of stack is at position n - 1.
+    T* top_n( size_type n ) { return &c_[ c_.size() - n ]; }
+    /// Removes n values from top of stack.
+    void pop_n( size_type n ) { c_.erase( c_.end() - n, c_.end() ); }
+    /// Reserves space for n values.
+    void reserve( size_type n ) { c_.reserve( n ); }
+
+  private:
+    /// Values.
+    container_type c_;
+  };
+
   //---------------------------------------------------------------------------
   /// Holds information about value types.
   template < class T >
@@ -163,6 +202,49 @@ namespace mmath_plus {
     load_var( const shared_ptr< value< T > >& vp ) : val_p( vp ) {}
   };
 
+  //---------------------------------------------------------------------------
+  /// Loads parameter value on top of std::stack.
+  /// Parameters are variables which programs do not assign: they are read
+  /// at run time, so that changing their values does not require
+  /// recompiling, and are invariant during the evaluation of a program over
+  /// a range of rows.
+  template < class T >
+  struct load_param : load_var< T > {
+    /// Constructor.
+    /// @param vp pointer to parameter.
+    load_param( const shared_ptr< value< T > >& vp ) : load_var< T >( vp ) {}
+  };
+
+  //---------------------------------------------------------------------------
+  /// Stores the N values on top of std::stack into N variables, leaving the
+  /// values on the stack; replaces the load_var instructions followed by a
+  /// call to an assignment function.
+  template < class T >
+  struct store_vars : instruction< T > {
+    /// Pointers to variables, in the order of the values on the stack.
+    std::vector< shared_ptr< value< T > > > vars;
+    /// Assigns values to variables.
+    void exec( rte< T >& rt );
+    /// Constructor.
+    /// @param v pointers to variables.
+    store_vars( const std::vector< shared_ptr< value< T > > >& v ) : vars( v ) {}
+  };
+
+  //---------------------------------------------------------------------------
+  /// Pops the N values on top of std::stack into N variables, the value on
+  /// top of the stack being assigned to the last variable; used to bind
+  /// the arguments of inlined procedures.
+  template < class T >
+  struct pop_vars : instruction< T > {
+    /// Pointers to variables, in the order of the values on the stack.
+    std::vector< shared_ptr< value< T > > > vars;
+    /// Assigns values to variables and removes them from the stack.
+    void exec( rte< T >& rt );
+    /// Constructor.
+    /// @param v pointers to variables.
+    pop_vars( const std::vector< shared_ptr< value< T > > >& v ) : vars( v ) {}
+  };
+
   //---------------------------------------------------------------------------
   /// Calls function.
   template < class T >
@@ -177,6 +259,58 @@ namespace mmath_plus {
     call_fun( const shared_ptr< const function_i< T > >& fp ) : fun_p( fp ) {}
   };
 
+  //---------------------------------------------------------------------------
+  /// Base class of jump instructions: move the instruction pointer forward
+  /// over the next offset instructions. Jumps implement conditional
+  /// expressions: only the instructions of the branch taken are executed.
+  /// A negative offset -n moves the instruction pointer backward, to execute
+  /// again the n instructions ending with the jump: the loops compiled
+  /// from sum and prod end with such a jump.
+  template < class T >
+  struct branch : instruction< T > {
+    /// Number of instructions skipped, negative for backward jumps.
+    const int offset;
+    /// Constructor.
+    /// @param off number of instructions skipped
+    branch( int off ) : offset( off ) {}
+  };
+
+  //---------------------------------------------------------------------------
+  /// Jumps unconditionally; ends the first branch of a conditional, the
+  /// instructions skipped compute the values of the other branch.
+  /// The values computed by the first branch are left on the stack in place
+  /// of the values computed by the skipped instructions: stack_effect()
+  /// reports them as read, so that the stack depth computed instruction by
+  /// instruction is the actual depth at the end of the conditional.
+  /// Backward jumps carry no value: the body of a loop leaves the stack as
+  /// it found it.
+  template < class T >
+  struct jump : branch< T > {
+    /// Number of values computed by each branch.
+    const int values;
+    /// Moves the instruction pointer.
+    void exec( rte< T >& rt );
+    /// Constructor.
+    /// @param off number of instructions skipped
+    /// @param v number of values computed by each branch
+    jump( int off, int v ) : branch< T >( off ), values( v ) {}
+  };
+
+  //---------------------------------------------------------------------------
+  /// Removes the value on top of std::stack and jumps if the value is zero,
+  /// or if it is not zero.
+  template < class T >
+  struct jump_if : branch< T > {
+    /// If true jumps when the value is not zero, else when it is zero.
+    const bool when;
+    /// Reads the condition and moves the instruction pointer.
+    void exec( rte< T >& rt );
+    /// Constructor.
+    /// @param off number of instructions skipped
+    /// @param w true to jump when the value is not zero
+    jump_if( int off, bool w ) : branch< T >( off ), when( w ) {}
+  };
+
   //===========================================================================
 
   //---------------------------------------------------------------------------
@@ -205,12 +339,38 @@ namespace mmath_plus {
 
   //===========================================================================
 
+  //---------------------------------------------------------------------------
+  /// Immutable function and constant tables shared by run-time environments,
+  /// e.g. the builtin functions; created once and referenced by every
+  /// environment, including the environments of procedures.
+  template < class ValT > struct registry {
+    /// Function table type
+    typedef std::vector< shared_ptr< function_i< ValT > > > fun_p_tab_type;
+    /// Value table type
+    typedef std::vector< shared_ptr< value< ValT > > > val_p_tab_type;
+
+    /// Functions.
+    const fun_p_tab_type fun_tab;
+
+    /// Constants.
+    const val_p_tab_type const_tab;
+
+    /// Constructor.
+    /// @param functions functions
+    /// @param constants constants
+    registry( const fun_p_tab_type& functions, const val_p_tab_type& constants )
+      : fun_tab( functions ), const_tab( constants )
+    {}
+  };
+
   //---------------------------------------------------------------------------
   /// Run-time environment.
   /// Used to store:
-  ///   - functions
+  ///   - functions, searched before the functions of the shared registry
   ///   - variables
-  ///   - constants
+  ///   - parameters, read-only variables whose values can be changed
+  ///     without recompiling
+  ///   - constants, searched before the constants of the shared registry
   ///   - program (could be stored outside the RTE)
   ///   - value std::stack
   ///   - execution std::stack
@@ -229,11 +389,17 @@ namespace mmath_plus {
     /// Program type
     typedef std::vector< InstrPtrT > prog_type;
     /// Value stack type
-    typedef std::stack< ValT, std::vector< ValT > > stack_type;
+    typedef value_stack< ValT > stack_type;
     /// Execution stack type 
     typedef std::stack< typename prog_type::size_type,
 						std::vector< typename prog_type::size_type > >
 						exe_stack_type;
+    /// Shared registry pointer type
+    typedef shared_ptr< const registry< ValT > > RegistryPtrT;
+
+    /// Shared functions and constants, may be null.
+    RegistryPtrT base;
+
     /// Functions.
     fun_p_tab_type fun_tab;
 
@@ -243,6 +409,9 @@ namespace mmath_plus {
     /// Constants.
     val_p_tab_type const_tab;
 
+    /// Parameters.
+    val_p_tab_type param_tab;
+
     /// Program.
     prog_type*     prog_p;
 
@@ -272,6 +441,18 @@ namespace mmath_plus {
            const_tab( constants ), prog_p( 0 ), ip( 0 )
     {}
 
+    /// Constructor.
+    /// @param b shared functions and constants
+    /// @param vars variables
+    /// @param functions functions not found in the registry
+    /// @param constants constants not found in the registry
+    rte( const RegistryPtrT& b, val_p_tab_type vars,
+         fun_p_tab_type functions = fun_p_tab_type(),
+         val_p_tab_type constants = val_p_tab_type() )
+         : base( b ), fun_tab( functions ), var_tab( vars ),
+           const_tab( constants ), prog_p( 0 ), ip( 0 )
+    {}
+
     /// Returns pointer to function given function name and number of
     /// arguments.
     /// @param s function name
@@ -283,24 +464,9 @@ namespace mmath_plus {
     function_p( const std::string& s, int rargs = -1,
 				int largs = 0 ) const
     {
-      typename fun_p_tab_type::const_iterator i;
-      if( rargs < 0 )
-      {
-        for( i = fun_tab.begin(); i != fun_tab.end(); ++i )
-        {
-          if( ( *i )->name == s ) return *i;
-        }
-      }
-      else
-      {
-        for( i = fun_tab.begin(); i != fun_tab.end(); ++i )
-        {
-          if( ( *i )->name == s && (*i)->rvalues_in == rargs
-							  && (*i)->lvalues_in == largs ) return *i;
-        }
-      }
-      typedef typename fun_p_tab_type::value_type v;
-      return v();
+      typename fun_p_tab_type::value_type f( find_function( fun_tab, s, rargs, largs ) );
+      if( !f && base ) f = find_function( base->fun_tab, s, rargs, largs );
+      return f;
     }
 
     /// Returns pointer to variable.
@@ -317,6 +483,37 @@ namespace mmath_plus {
       return v();
     }
 
+    /// Returns pointer to parameter.
+    /// @param name parameter's name
+    /// @return pointer to parameter, null if not found
+    typename val_p_tab_type::value_type parameter_p( const std::string& name ) const
+    {
+      typename val_p_tab_type::const_iterator i;
+      for( i = param_tab.begin(); i != param_tab.end(); ++i )
+      {
+        if( ( *i )->name == name ) return *i;
+      }
+      typedef typename val_p_tab_type::value_type v;
+      return v();
+    }
+
+    /// Sets value of parameter, adding the parameter if not found; programs
+    /// reading the parameter read the new value at the next execution.
+    /// @param name parameter's name
+    /// @param v value
+    /// @return pointer to parameter
+    typename val_p_tab_type::value_type set_parameter( const std::string& name, ValT v )
+    {
+      ValPtrT p = parameter_p( name );
+      if( !p )
+      {
+        p = ValPtrT( new value< ValT >( name ) );
+        param_tab.push_back( p );
+      }
+      p->val = v;
+      return p;
+    }
+
     /// Returns pointer to constant.
     /// @param name constant's name
     /// @return pointer to constant
@@ -326,11 +523,44 @@ namespace mmath_plus {
       for( i = const_tab.begin(); i != const_tab.end(); ++i )
       {
         if( ( *i )->name == name ) return *i;
+      }
+      if( base )
+      {
+        for( i = base->const_tab.begin(); i != base->const_tab.end(); ++i )
+        {
+          if( ( *i )->name == name ) return *i;
+        }
       }
 	  typedef typename val_p_tab_type::value_type v;	
       return v();
     }	
-	
+
+  private:
+    /// Returns pointer to function in table given function name and number
+    /// of arguments; see function_p().
+    static typename fun_p_tab_type::value_type
+    find_function( const fun_p_tab_type& tab, const std::string& s,
+                   int rargs, int largs )
+    {
+      typename fun_p_tab_type::const_iterator i;
+      if( rargs < 0 )
+      {
+        for( i = tab.begin(); i != tab.end(); ++i )
+        {
+          if( ( *i )->name == s ) return *i;
+        }
+      }
+      else
+      {
+        for( i = tab.begin(); i != tab.end(); ++i )
+        {
+          if( ( *i )->name == s && (*i)->rvalues_in == rargs
+							  && (*i)->lvalues_in == largs ) return *i;
+        }
+      }
+      typedef typename fun_p_tab_type::value_type v;
+      return v();
+    }
   };
 
 
@@ -346,6 +576,174 @@ namespace mmath_plus {
   template < class T >
   void load_var< T >::exec( rte< T >& rt ) { rt.stack.push( val_p->val ); }
 
+  /// Assigns values on top of std::stack to variables.
+  template < class T >
+  void store_vars< T >::exec( rte< T >& rt )
+  {
+    const T* v = rt.stack.top_n( vars.size() );
+    for( typename std::vector< shared_ptr< value< T > > >::size_type i = 0;
+         i != vars.size();
+         ++i )
+    {
+      vars[ i ]->val = v[ i ];
+    }
+  }
+
+  /// Moves values on top of std::stack into variables.
+  template < class T >
+  void pop_vars< T >::exec( rte< T >& rt )
+  {
+    const T* v = rt.stack.top_n( vars.size() );
+    for( typename std::vector< shared_ptr< value< T > > >::size_type i = 0;
+         i != vars.size();
+         ++i )
+    {
+      vars[ i ]->val = v[ i ];
+    }
+    rt.stack.pop_n( vars.size() );
+  }
+
+  /// Skips the next instructions; the instruction pointer is incremented
+  /// after the instruction is executed.
+  template < class T >
+  inline void jump< T >::exec( rte< T >& rt ) { rt.ip += this->offset; }
+
+  /// Removes condition from std::stack and skips the next instructions if
+  /// the condition is zero (or not zero).
+  template < class T >
+  inline void jump_if< T >::exec( rte< T >& rt )
+  {
+    const bool c = rt.stack.top() != T();
+    rt.stack.pop();
+    if( c == when ) rt.ip += this->offset;
+  }
+
+  //---------------------------------------------------------------------------
+  /// Binds the parameters read by a program to the parameters with the same
+  /// names in a run-time environment, e.g. to evaluate a program compiled
+  /// once with the parameters of different models; instructions are
+  /// replaced, not modified, since they may be shared with other programs.
+  /// @param program program
+  /// @param rt run-time environment
+  /// @return number of parameters bound
+  template < class T >
+  size_t rebind_parameters( typename rte< T >::prog_type& program, const rte< T >& rt )
+  {
+    size_t n = 0;
+    for( size_t i = 0; i != program.size(); ++i )
+    {
+      const load_param< T >* lp = dynamic_cast< const load_param< T >* >( ptr( program[ i ] ) );
+      if( !lp ) continue;
+      const typename rte< T >::ValPtrT p = rt.parameter_p( lp->val_p->name );
+      if( !p ) continue;
+      if( ptr( p ) != ptr( lp->val_p ) )
+      {
+        program[ i ] = typename rte< T >::InstrPtrT( new load_param< T >( p ) );
+      }
+      ++n;
+    }
+    return n;
+  }
+
+  //---------------------------------------------------------------------------
+  /// Computes number of values read from and written to the stack by an
+  /// instruction. Adding the stack effects of a program in sequence gives
+  /// the stack depth after each instruction, conditionals and loops included
+  /// (see jump).
+  /// @param in instruction
+  /// @param[out] pop number of values read
+  /// @param[out] push number of values written
+  /// @return false if instruction is not known
+  template < class T >
+  bool stack_effect( const instruction< T >* in, int& pop, int& push )
+  {
+    pop = 0;
+    push = 1;
+    if( dynamic_cast< const load_val< T >* >( in )
+        || dynamic_cast< const load_var< T >* >( in ) ) return true;
+    if( const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in ) )
+    {
+      pop = cf->fun_p->values_in;
+      push = cf->fun_p->values_out;
+      return true;
+    }
+    if( const store_vars< T >* sv = dynamic_cast< const store_vars< T >* >( in ) )
+    {
+      pop = push = int( sv->vars.size() );
+      return true;
+    }
+    if( const pop_vars< T >* pv = dynamic_cast< const pop_vars< T >* >( in ) )
+    {
+      pop = int( pv->vars.size() );
+      push = 0;
+      return true;
+    }
+    // the values carried by a jump replace the values of the branch skipped
+    if( const jump< T >* j = dynamic_cast< const jump< T >* >( in ) )
+    {
+      pop = j->values;
+      push = 0;
+      return true;
+    }
+    if( dynamic_cast< const jump_if< T >* >( in ) )
+    {
+      pop = 1;
+      push = 0;
+      return true;
+    }
+    return false;
+  }
+
+  //---------------------------------------------------------------------------
+  /// Computes the maximum number of values held by the stack while a program
+  /// runs on an empty stack, from the stack effect of its instructions;
+  /// functions are expected not to use more stack than the larger of the
+  /// number of values they read and write, as all builtin functions do.
+  /// Executors reserve this space before running a program so that the value
+  /// stack never grows during execution.
+  /// @param program program
+  /// @return maximum stack depth, 0 if an instruction is not known or reads
+  /// more values than are on the stack (see stack_underflow())
+  template < class T >
+  size_t max_stack_depth(
+    const std::vector< shared_ptr< instruction< T > > >& program )
+  {
+    int depth = 0;
+    int max_depth = 0;
+    for( size_t i = 0; i != program.size(); ++i )
+    {
+      int pop = 0;
+      int push = 0;
+      if( !stack_effect( ptr( program[ i ] ), pop, push ) || pop > depth ) return 0;
+      depth += push - pop;
+      max_depth = std::max( max_depth, depth );
+    }
+    return size_t( max_depth );
+  }
+
+  //---------------------------------------------------------------------------
+  /// Finds the first instruction reading more values than are on the stack
+  /// when a program runs on an empty stack; instructions whose stack effect
+  /// is not known are assumed to be balanced.
+  /// @param program program
+  /// @return index of the instruction, program size if the stack never
+  /// underflows
+  template < class T >
+  size_t stack_underflow(
+    const std::vector< shared_ptr< instruction< T > > >& program )
+  {
+    int depth = 0;
+    for( size_t i = 0; i != program.size(); ++i )
+    {
+      int pop = 0;
+      int push = 0;
+      if( !stack_effect( ptr( program[ i ] ), pop, push ) ) continue;
+      if( pop > depth ) return i;
+      depth += push - pop;
+    }
+    return program.size();
+  }
+
   //===========================================================================
 
 } // namespace mmath_plus
@@ -0,0 +1,163 @@
+#ifndef EXPRESSION_SET_H__
+#define EXPRESSION_SET_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file expression_set.h definition of expression_set class: compiles a set
+/// of named expressions into a single program
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "compiler.h"
+#include "execution.h"
+#include "math_parser.h"
+#include "optimizer.h"
+#include "exception.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Set of named expressions compiled into one program which evaluates all
+  /// the expressions at once: subexpressions shared by different
+  /// expressions are computed once and the value of expression i is left at
+  /// position i of the stack, i.e. the program returns size() values which
+  /// can be written to size() output arrays by a batch_executor in a single
+  /// pass over the input.
+  /// Expressions are evaluated in order: an expression reads the variables
+  /// assigned by the previous ones.
+  /// Sets which cannot be merged (see common_subexpression_eliminator) are
+  /// compiled by concatenating the programs of the expressions.
+  /// @code
+  /// expression_set< double > es;
+  /// es.add( "r", "sqrt(x*x+y*y)" );
+  /// es.add( "u", "x/sqrt(x*x+y*y)" );
+  /// es.add( "v", "y/sqrt(x*x+y*y)" );
+  /// rte< double >::prog_type p = es.compile( mp, c, rt );
+  /// @endcode
+  template < class T > class expression_set {
+  public:
+
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+
+    /// Class name.
+    static const std::string CLS_NAME;
+
+    //--------------------------------------------------------------------------
+    /// Thrown when an expression does not return a value or its stack
+    /// effect cannot be computed.
+    class exception : public exception_base {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      exception( const std::string& fun,
+                 unsigned long lineno,
+                 const std::string& data = "" )
+        : exception_base( NS_NAME, expression_set::CLS_NAME, fun, lineno, data )
+      {}
+    };
+
+    /// Adds expression.
+    /// @param name name
+    /// @param source source code
+    void add( const std::string& name, const std::string& source )
+    {
+      exprs_.push_back( std::make_pair( name, source ) );
+    }
+
+    /// Returns number of expressions.
+    size_t size() const { return exprs_.size(); }
+
+    /// Returns name of expression i.
+    const std::string& name( size_t i ) const { return exprs_[ i ].first; }
+
+    /// Returns source code of expression i.
+    const std::string& source( size_t i ) const { return exprs_[ i ].second; }
+
+    /// Compiles expressions.
+    /// @param mp parser
+    /// @param c compiler
+    /// @param rt run-time environment used to resolve names
+    /// @return program leaving the value of expression i at stack position i
+    prog_type compile( const math_parser& mp, compiler< T >& c,
+                       rte< T >& rt ) const
+    {
+      std::vector< prog_type > programs( exprs_.size() );
+      const function_signatures< T > functions( rt );
+      for( size_t i = 0; i != exprs_.size(); ++i )
+      {
+        programs[ i ] = c.compile( mp.parse( exprs_[ i ].second, &functions ), rt );
+      }
+      prog_type merged;
+      if( eliminate_common_subexpressions< T >( programs, merged ) ) return merged;
+      for( size_t i = 0; i != programs.size(); ++i ) append( i, programs[ i ], merged );
+      return merged;
+    }
+
+  private:
+
+    /// Appends program of expression i to merged program, removing all the
+    /// values left on the stack except the top one.
+    void append( size_t i, const prog_type& program, prog_type& merged ) const
+    {
+      typedef typename rte< T >::ValPtrT ValPtrT;
+      typedef typename rte< T >::InstrPtrT InstrPtrT;
+      int depth = 0;
+      for( size_t k = 0; k != program.size(); ++k )
+      {
+        int pop = 0;
+        int push = 0;
+        if( !stack_effect( ptr( program[ k ] ), pop, push ) )
+        {
+          throw exception( "compile", __LINE__, "unknown instruction in " + name( i ) );
+        }
+        depth += push - pop;
+      }
+      if( depth <= 0 )
+      {
+        throw exception( "compile", __LINE__,
+                         "expression " + name( i ) + " does not return any value" );
+      }
+      merged.insert( merged.end(), program.begin(), program.end() );
+      if( depth == 1 ) return;
+      const ValPtrT top( new value< T >( "" ) );
+      std::vector< ValPtrT > rest;
+      for( int k = 1; k != depth; ++k ) rest.push_back( ValPtrT( new value< T >( "" ) ) );
+      merged.push_back( InstrPtrT( new pop_vars< T >( std::vector< ValPtrT >( 1, top ) ) ) );
+      merged.push_back( InstrPtrT( new pop_vars< T >( rest ) ) );
+      merged.push_back( InstrPtrT( new load_var< T >( top ) ) );
+    }
+
+    /// ( name, source ) pairs.
+    std::vector< std::pair< std::string, std::string > > exprs_;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Definition of class name variable.
+  template < class T >
+  const std::string expression_set< T >::CLS_NAME( "expression_set" );
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // EXPRESSION_SET_H__
@@ -0,0 +1,266 @@
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file integrate_tool.cpp command line program integrating an expression
+/// over an interval or a box with adaptive cubature
+
+
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+
+#include "compiler.h"
+#include "execution.h"
+#include "def_rte.h"
+#include "math_parser.h"
+#include "cubature.h"
+#include "tool_utility.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+
+/// Global instance of MemTracer class; it prints by default to std::clog stream
+MemTracer NewTrace;
+#endif
+
+//-----------------------------------------------------------------------------
+
+using namespace mmath_plus;
+using std::vector;
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::ostream;
+
+//-----------------------------------------------------------------------------
+/// Program configuration.
+struct config {
+  /// Integrand.
+  string expr;
+  /// Integration variables.
+  vector< string > vars;
+  /// Bounds, one per variable.
+  vector< double > lo, hi;
+  /// Absolute and relative tolerance.
+  double abs_tol, rel_tol;
+  /// Maximum number of evaluations.
+  size_t max_evaluations;
+  /// Parameters: ( name, value ) pairs.
+  vector< std::pair< string, double > > params;
+  /// Number of threads, 0 for one per hardware thread.
+  unsigned threads;
+  /// Number of regions split at each step.
+  size_t round;
+  /// Number of nodes evaluated at once.
+  size_t block;
+  /// Evaluation precision.
+  precision prec;
+  /// Constructor: default values.
+  config() : abs_tol( 0 ), rel_tol( 1e-8 ), max_evaluations( 10000000 ),
+             threads( 0 ), round( CUBATURE_ROUND ),
+             block( batch_executor< double >::DEFAULT_BLOCK ), prec( DOUBLE )
+  {}
+};
+
+//-----------------------------------------------------------------------------
+/// Parses name=lo,hi integration range.
+void parse_range( const string& s, config& cfg )
+{
+  const string::size_type p = s.find( '=' );
+  const string::size_type q = s.find( ',', p );
+  if( p != string::npos && q != string::npos )
+  {
+    char* e = 0;
+    const double lo = std::strtod( s.c_str() + p + 1, &e );
+    if( e == s.c_str() + q )
+    {
+      const double hi = std::strtod( s.c_str() + q + 1, &e );
+      const string name = trim( s.substr( 0, p ) );
+      if( std::find( cfg.vars.begin(), cfg.vars.end(), name ) != cfg.vars.end() )
+      {
+        throw std::runtime_error( "duplicate integration variable " + name );
+      }
+      if( e != s.c_str() + q + 1 && !*e )
+      {
+        cfg.vars.push_back( name );
+        cfg.lo.push_back( lo );
+        cfg.hi.push_back( hi );
+        return;
+      }
+    }
+  }
+  throw std::runtime_error( "invalid range " + s );
+}
+
+//-----------------------------------------------------------------------------
+/// Throws if the integrand reads a variable other than the integration
+/// variables without assigning it: its value would always be 0.
+template < class T >
+void check_variables( const config& cfg, const typename rte< T >::prog_type& program )
+{
+  typedef typename rte< T >::prog_type prog_type;
+  vector< string > bound( cfg.vars );
+  for( typename prog_type::const_iterator i = program.begin(); i != program.end(); ++i )
+  {
+    const store_vars< T >* sv = dynamic_cast< const store_vars< T >* >( ptr( *i ) );
+    const pop_vars< T >* pv = dynamic_cast< const pop_vars< T >* >( ptr( *i ) );
+    const vector< typename rte< T >::ValPtrT >* v = sv ? &sv->vars : pv ? &pv->vars : 0;
+    for( size_t k = 0; v && k != v->size(); ++k ) bound.push_back( ( *v )[ k ]->name );
+  }
+  for( typename prog_type::const_iterator i = program.begin(); i != program.end(); ++i )
+  {
+    const load_var< T >* lv = dynamic_cast< const load_var< T >* >( ptr( *i ) );
+    if( lv && !dynamic_cast< const load_param< T >* >( lv )
+        && std::find( bound.begin(), bound.end(), lv->val_p->name ) == bound.end() )
+    {
+      throw std::runtime_error( "variable " + lv->val_p->name
+                                + " is not an integration variable, use -x or -P" );
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+/// Integrates the expression and writes one CSV line: value, error,
+/// number of evaluations and of regions, 1 if converged.
+/// @param cfg configuration
+/// @param rt run-time environment
+/// @param os output stream
+/// @return number of evaluations
+template < class T >
+size_t integrate( const config& cfg, rte< T > rt, ostream& os )
+{
+  for( size_t i = 0; i != cfg.vars.size(); ++i )
+  {
+    if( !rt.variable_p( cfg.vars[ i ] ) )
+    {
+      rt.var_tab.push_back( typename rte< T >::ValPtrT( new value< T >( cfg.vars[ i ] ) ) );
+    }
+  }
+  // parameters replace the default variables with the same name
+  for( size_t i = 0; i != cfg.params.size(); ++i )
+  {
+    const string& name = cfg.params[ i ].first;
+    if( std::find( cfg.vars.begin(), cfg.vars.end(), name ) != cfg.vars.end() )
+    {
+      throw std::runtime_error( "parameter " + name + " is an integration variable" );
+    }
+    for( size_t v = 0; v != rt.var_tab.size(); ++v )
+    {
+      if( rt.var_tab[ v ]->name == name ) rt.var_tab.erase( rt.var_tab.begin() + v-- );
+    }
+    rt.set_parameter( name, T( cfg.params[ i ].second ) );
+  }
+  vector< T > lo( cfg.lo.begin(), cfg.lo.end() );
+  vector< T > hi( cfg.hi.begin(), cfg.hi.end() );
+  const vector< operator_type > ops = generate_def_operators();
+  math_parser mp( ops, math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< T > c( compiler< T >::COUNT_ARGS, compiler< T >::DONT_CREATE_VARS );
+  rte< T > crt( rt );
+  const function_signatures< T > functions( crt );
+  check_variables< T >( cfg, compiler< T >( c ).compile( mp.parse( cfg.expr, &functions ), crt ) );
+  const cubature_result< T > r =
+    integrate_expression( mp, c, rt, cfg.expr, cfg.vars, &lo[ 0 ], &hi[ 0 ],
+                          T( cfg.abs_tol ), T( cfg.rel_tol ), cfg.max_evaluations,
+                          cfg.threads, cfg.round, cfg.block );
+  os << std::setprecision( std::numeric_limits< T >::max_digits10 )
+     << r.value << ',' << r.error << ',' << r.evaluations << ',' << r.regions
+     << ',' << ( r.converged ? 1 : 0 ) << '\n';
+  return r.evaluations;
+}
+
+//-----------------------------------------------------------------------------
+/// Prints usage.
+void print_usage()
+{
+  cout << "usage: mmint [options] -e <integrand> -x <name=lo,hi> ...\n"
+       << "  -e <expr>         integrand\n"
+       << "  -x <name=lo,hi>   integration variable and bounds, one to three\n"
+       << "  -a <tolerance>    absolute tolerance (default 0)\n"
+       << "  -r <tolerance>    relative tolerance (default 1e-8)\n"
+       << "  -m <n>            maximum evaluations (default 10000000)\n"
+       << "  -P <name=value>   parameter, can be repeated; the integrand reads\n"
+       << "                    only integration variables and parameters\n"
+       << "  -t <threads>      threads (default: one per core)\n"
+       << "  -n <regions>      regions split at each step (default "
+       << CUBATURE_ROUND << ")\n"
+       << "  -b <nodes>        nodes evaluated at once (default "
+       << batch_executor< double >::DEFAULT_BLOCK << ")\n"
+       << "  -p double|float|mixed  evaluation precision (default double)\n"
+       << "Writes value,error,evaluations,regions,converged; the integral\n"
+       << "over an interval uses the Gauss-Kronrod 15 point rule, over a box\n"
+       << "the Genz-Malik degree 7 rule. Evaluations/s are reported on\n"
+       << "stderr." << endl;
+}
+
+/// Entry point.
+int main( int argc, char** argv )
+{
+  config cfg;
+  try
+  {
+    for( int i = 1; i < argc; ++i )
+    {
+      const string a = argv[ i ];
+      const bool has_value = i + 1 < argc;
+      if( a == "-e" && has_value ) cfg.expr = argv[ ++i ];
+      else if( a == "-x" && has_value ) parse_range( argv[ ++i ], cfg );
+      else if( a == "-a" && has_value ) cfg.abs_tol = std::atof( argv[ ++i ] );
+      else if( a == "-r" && has_value ) cfg.rel_tol = std::atof( argv[ ++i ] );
+      else if( a == "-m" && has_value ) cfg.max_evaluations = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-P" && has_value ) cfg.params.push_back( parse_parameter( argv[ ++i ] ) );
+      else if( a == "-t" && has_value ) cfg.threads = unsigned( std::atol( argv[ ++i ] ) );
+      else if( a == "-n" && has_value ) cfg.round = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-b" && has_value ) cfg.block = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-p" && has_value ) cfg.prec = parse_precision( argv[ ++i ] );
+      else
+      {
+        print_usage();
+        return a == "-h" ? 0 : 1;
+      }
+    }
+    if( cfg.expr.empty() || cfg.vars.empty() )
+    {
+      print_usage();
+      return 1;
+    }
+    const std::chrono::steady_clock::time_point t =
+                                            std::chrono::steady_clock::now();
+    size_t evaluations = 0;
+    if( cfg.prec == DOUBLE )
+    {
+      evaluations = integrate( cfg, generate_default_rte< double >(), cout );
+    }
+    else if( cfg.prec == FLOAT )
+    {
+      evaluations = integrate( cfg, generate_default_rte< float >(), cout );
+    }
+    else evaluations = integrate( cfg, generate_mixed_rte(), cout );
+    cout.flush();
+    const double s = std::chrono::duration< double >(
+                       std::chrono::steady_clock::now() - t ).count();
+    cerr << evaluations << " evaluations in " << s << " s: "
+         << ( s > 0 ? double( evaluations ) / s : 0 ) << " evaluations/s" << endl;
+  }
+  catch( const exception_base& eb )
+  {
+    cerr << eb;
+    return 1;
+  }
+  catch( const std::exception& e )
+  {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
@@ -16,17 +16,8 @@
 
 namespace mmath_plus {
 
-  namespace mm = mmath_plus;
-  using std::sort;
-  using std::equal;
-  using std::unique;
-  using std::back_insert_iterator;
-  using std::back_inserter;
-  using std::remove_copy;
   using std::string;
   using std::vector;
-  using std::not_equal_to;
-  using std::pair;
   
   //============================================================================
 
@@ -47,9 +38,6 @@ namespace mmath_plus {
 	/// Whitespace.
 	const std::string::value_type math_parser::BLANK = ' ';
 
-		/// Separator in RPN expression.
-	const std::string::value_type math_parser::RPN_SEPARATOR = ' ';
-
 	/// Opening parenthesis.
 	const std::string::value_type math_parser::OPEN_ARG_PAR = '[';
 
@@ -57,677 +45,437 @@ namespace mmath_plus {
 	const std::string::value_type math_parser::CLOSE_ARG_PAR = ']';
 
   //----------------------------------------------------------------------------
-  /// Number to string conversion
-  template < class T > string ltoa( T n, string::size_type s = 4 )
+  /// Returns true if character can be part of a name or number.
+  inline bool name_char( char c )
   {
-	std::stringstream ss;
-	string ls( s, '0' );
-	ss << n;
-	ss >> ls;
-	return ls;
+    return isalnum( (unsigned char)( c ) ) || c == '_' || c == '.';
   }
-    
-  //----------------------------------------------------------------------------
 
   //============================================================================
 
   //----------------------------------------------------------------------------
-   
-  vector< math_parser::TokenPtr > math_parser::parse( const string& expr )
+
+  operator_trie::operator_trie( const vector< operator_type >& ops )
+    : ops_( ops ), nodes_( 1 )
   {
-    tokens_.clear();
-    
-    expr_ = expr;
-    
-    if( !validate() ) return tokens_;
+    for( size_t i = 0; i != ops_.size(); ++i )
+    {
+      const string& name = ops_[ i ].name();
+      int n = 0;
+      for( string::size_type c = 0; c != name.size(); ++c )
+      {
+        int next = child( n, name[ c ] );
+        if( next < 0 )
+        {
+          next = int( nodes_.size() );
+          nodes_[ n ].edges.push_back( std::make_pair( name[ c ], next ) );
+          nodes_.push_back( trie_node() );
+        }
+        n = next;
+      }
+      nodes_[ n ].ops.push_back( i );
+      // new group if no previous overload has the same number of operands
+      size_t o = 0;
+      const vector< size_t >& overloads = nodes_[ n ].ops;
+      while( ops_[ overloads[ o ] ].operands() != ops_[ i ].operands() ) ++o;
+      if( overloads[ o ] != i ) continue;
+      group g;
+      g.name = name;
+      g.operands = ops_[ i ].operands();
+      g.precedence = int( groups_.size() );
+      g.swap = ops_[ i ].swap();
+      nodes_[ n ].groups.push_back( groups_.size() );
+      groups_.push_back( g );
+    }
+  }
 
-    wrap();
-    
-    remove_blanks();
-       
-    to_rpn();
-    
-    create_tokens();
-    
-    return tokens_;
+  //----------------------------------------------------------------------------
+
+  string::size_type operator_trie::match( const string& s,
+                                          string::size_type p ) const
+  {
+    string::size_type m = 0;
+    int n = 0;
+    for( string::size_type i = p; i != s.size(); ++i )
+    {
+      n = child( n, s[ i ] );
+      if( n < 0 ) break;
+      if( !nodes_[ n ].ops.empty() ) m = i - p + 1;
+    }
+    return m;
   }
 
   //----------------------------------------------------------------------------
-   
-  void math_parser::remove_blanks()
+
+  const operator_type* operator_trie::overload( const string& name,
+                                                int largs, int rargs ) const
   {
-    if( debug_ ) *os_p_ << "remove_blanks {" << '\n' << " " << expr_ << '\n'; 
-        
-    tmp_expr_.resize( expr_.size() );
-    string::iterator end =
-      remove_copy( expr_.begin(), expr_.end(), tmp_expr_.begin(), BLANK );
+    const int n = node( name );
+    if( n < 0 ) return 0;
+    const vector< size_t >& overloads = nodes_[ n ].ops;
+    for( size_t i = 0; i != overloads.size(); ++i )
+    {
+      const operator_type& o = ops_[ overloads[ i ] ];
+      if( o.largs() == largs && o.rargs() == rargs && o.outvals() >= 0 ) return &o;
+    }
+    return 0;
+  }
 
-    expr_.assign( tmp_expr_.begin(), end );
-    
+  //============================================================================
 
-    if( debug_ ) *os_p_ << "} remove_blanks" << '\n' << " " << expr_ << '\n';
+  //----------------------------------------------------------------------------
+   
+  vector< math_parser::TokenPtr > math_parser::parse( const string& expr,
+                                                      const signatures* functions ) const
+  {
+    Tokens tokens;
+    const status s = parse( expr, tokens, functions );
+    if( !s.ok() ) raise( s );
+    return tokens;
   }
 
+
   //----------------------------------------------------------------------------
    
-  bool math_parser::validate()
+  status math_parser::parse( const string& expr, Tokens& tokens,
+                             const signatures* functions ) const
   {
-    // Check for unmatched parentheses.
-    for( string::const_iterator i = expr_.begin(); i != expr_.end(); ++i )
-    {
-      if( *i == OPENPAR )
-      {
-        if( forward_parenthesis_match( i, expr_.end(), OPENPAR, CLOSEPAR )
-            == expr_.end() )
-        {
-          throw unmatched_opening_par( "validate", __LINE__, 
-                  string( string::const_iterator( expr_.begin() ), ++i ) );
-          return false; // <-- in case exception handling is disabled
-        }
-        continue;
-      }
-      if( *i == CLOSEPAR )
-      {
-        if( backward_parenthesis_match( 
-                  string::const_reverse_iterator( i ),
-                  expr_.rend(),
-                  OPENPAR, CLOSEPAR ) ==
-                             string::const_reverse_iterator( expr_.rend() ) )
-        {
-          throw unmatched_closing_par( "validate", __LINE__, 
-                     string( string::const_iterator( expr_.begin() ), ++i ) );
-          return false; // <-- in case exception handling is disabled
-          break;
-        }
-        continue;
-      }
-    }
+    context ctx( expr, functions );
+    tokens.clear();
+    
+    if( validate( ctx ) ) to_rpn( ctx );
 
-    tmp_expr_ = expr_;
+    if( !ctx.error.ok() ) return ctx.error;
+
+    tokens.swap( ctx.tokens );
     
-    // replace numbers with blanks
-    range_type r = search_number( tmp_expr_.begin(), tmp_expr_.end(), tmp_expr_.begin() );
-    while( r.first != tmp_expr_.end() )
-    {
-      tmp_expr_.replace( r.first - tmp_expr_.begin(),
-                         r.second - r.first + 1, r.second - r.first + 1, BLANK );
-       r = search_number( tmp_expr_.begin(), tmp_expr_.end(), tmp_expr_.begin() );
-    }
+    return ctx.error;
+  }
 
-    // replace operators with blanks
-    for( vector< operator_type >::const_iterator it =operators_.begin();
-         it != operators_.end();
-         ++it )
+  //----------------------------------------------------------------------------
+   
+  void math_parser::raise( const status& s ) const
+  {
+    switch( s.kind )
     {
-        string::size_type b;
-        while( ( b = tmp_expr_.find( it->name() ) ) != string::npos )
-        {
-            tmp_expr_.replace( b, it->name().size(), it->name().size(), BLANK );
-        }     
+    case UNMATCHED_OPENING_PAR:
+      throw unmatched_opening_par( "parse", __LINE__, s.message );
+    case UNMATCHED_CLOSING_PAR:
+      throw unmatched_closing_par( "parse", __LINE__, s.message );
+    case UNKNOWN_SYMBOL:
+      throw unknown_symbol( "parse", __LINE__, s.message );
+    case INVALID_NAME:
+      throw invalid_name( "parse", __LINE__, s.message );
+    case UNKNOWN_OPERATOR:
+      throw unknown_operator( "parse", __LINE__, s.message );
+    default:
+      throw exception( "parse", __LINE__, s.message );
     }
-    
-    // replace function names with blanks
-    r = search_function( tmp_expr_.begin(), tmp_expr_.end() );
-    while( r.first != tmp_expr_.end() )
+  }
+
+  //----------------------------------------------------------------------------
+   
+  string::size_type math_parser::offset( const string& expr, const string& s )
+  {
+    if( s.empty() ) return string::npos;
+    // search the expression without blanks, then map offsets back to the
+    // input
+    string stripped;
+    vector< string::size_type > pos;
+    for( string::size_type i = 0; i != expr.size(); ++i )
     {
-      const string::size_type start = r.first - tmp_expr_.begin();
-      const string::size_type p = tmp_expr_.find( OPENPAR, start );
-      const string::size_type size = p - start;
-      tmp_expr_.replace( start, size, size, BLANK );                         
-       r = search_function( tmp_expr_.begin(), tmp_expr_.end() );
+      if( expr[ i ] == BLANK ) continue;
+      stripped += expr[ i ];
+      pos.push_back( i );
     }
-
-    // replace variables and constants with blanks
-    r = search_name( tmp_expr_.begin(), tmp_expr_.end() );
-    while( r.first != tmp_expr_.end() )
+    const bool first = name_char( s[ 0 ] );
+    const bool last = name_char( s[ s.size() - 1 ] );
+    for( string::size_type p = stripped.find( s );
+         p != string::npos;
+         p = stripped.find( s, p + 1 ) )
     {
-      tmp_expr_.replace( r.first - tmp_expr_.begin(),
-                         r.second - r.first + 1, r.second - r.first + 1, BLANK );
-       r = search_name( tmp_expr_.begin(), tmp_expr_.end() );
+      const string::size_type e = p + s.size();
+      if( first && p != 0 && name_char( stripped[ p - 1 ] ) ) continue;
+      if( last && e != stripped.size() && name_char( stripped[ e ] ) ) continue;
+      return pos[ p ];
     }
+    return string::npos;
+  }
 
-       
-    // replace parentheses and argument separator with blanks
-    for( string::iterator si = tmp_expr_.begin(); si != tmp_expr_.end(); ++si )
+  //----------------------------------------------------------------------------
+   
+  bool math_parser::validate( context& ctx ) const
+  {
+    // positions of the opening parentheses not yet closed
+    vector< string::size_type > open;
+    const string& e = ctx.input;
+    for( string::size_type i = 0; i != e.size(); ++i )
     {
-      if( *si == OPENPAR  || *si == CLOSEPAR || *si == ARGS_SEPARATOR )
+      if( e[ i ] == OPENPAR ) open.push_back( i );
+      else if( e[ i ] == CLOSEPAR )
       {
-        *si = BLANK;
+        if( open.empty() )
+        {
+          error( ctx, UNMATCHED_CLOSING_PAR, i, e.substr( 0, i + 1 ) );
+          return false;
+        }
+        open.pop_back();
       }
     }
+    if( open.empty() ) return true;
+    error( ctx, UNMATCHED_OPENING_PAR, open.front(), e.substr( 0, open.front() + 1 ) );
+    return false;
+  }
 
-    // check if there is anything that is not a blank
-    if( mm::find_if(
-          tmp_expr_.begin(), tmp_expr_.end(), 
-          bind2nd( not_equal_to< string::value_type >(), BLANK ) )
-          != tmp_expr_.end() )
+  //----------------------------------------------------------------------------
+  namespace {
+  /*
+   * Returns the end of the number starting at position b: digits with at
+   * most one decimal point, optionally followed by an exponent.
+   * e.g. 12 1.2 .2 1.E-3 2e5
+   */
+  string::size_type number_end( const string& s, string::size_type b )
+  {
+    string::size_type i = b;
+    while( i != s.size() && isdigit( (unsigned char)( s[ i ] ) ) ) ++i;
+    if( i != s.size() && s[ i ] == '.' )
     {
-      throw unknown_symbol( "validate", __LINE__, tmp_expr_ );
-      return false; 
+      ++i;
+      while( i != s.size() && isdigit( (unsigned char)( s[ i ] ) ) ) ++i;
     }
-    
-    return true; 
+    if( i == s.size() || toupper( (unsigned char)( s[ i ] ) ) != 'E' ) return i;
+    string::size_type e = i + 1;
+    if( e != s.size() && ( s[ e ] == '+' || s[ e ] == '-' ) ) ++e;
+    if( e == s.size() || !isdigit( (unsigned char)( s[ e ] ) ) ) return i;
+    while( e != s.size() && isdigit( (unsigned char)( s[ e ] ) ) ) ++e;
+    return e;
+  }
   }
 
   //----------------------------------------------------------------------------
    
-  void math_parser::wrap()
+  void math_parser::to_rpn( context& ctx ) const
   {
-    if( debug_ ) *os_p_ << "wrap {" << '\n' << " " << expr_ << '\n';
-    
-    vector< range_type > range_vec;
+    if( debug_ ) *os_p_ << "to_rpn {" << '\n' << " " << ctx.input << '\n';
 
-    // wrap numbers
-    range_type r = search_number( expr_.begin(), expr_.end(), expr_.begin() );
-    while( r.second != expr_.end() )
+    const string& e = ctx.input;
+    // true if an operand is expected: operators found are prefix operators
+    bool expect_operand = true;
+    string::size_type i = 0;
+    while( ctx.error.ok() && i != e.size() )
     {
-      if( (r.first == expr_.begin()) || (r.second == expr_.end() - 1) )
-	  {
-        string::const_iterator it = add_parentheses( r );
-		r = search_number( it, expr_.end(), expr_.begin() );
-		continue;
-	  }
-      // (1.2)
-      if( *( r.first - 1 ) == OPENPAR && *( r.second + 1 ) == CLOSEPAR )
+      const string::value_type c = e[ i ];
+      if( c == BLANK )
       {
-        r = search_number( r.second + 1, expr_.end(), expr_.begin() );
+        ++i;
         continue;
       }
-
-      // (1.2,
-      if( *( r.first - 1 ) == OPENPAR && *( r.second + 1 ) == ARGS_SEPARATOR )
+      if( c == ARGS_SEPARATOR || c == CLOSEPAR )
       {
-        r = search_number( r.second + 1, expr_.end(), expr_.begin() );
+        // operator without right operand e.g. (x+)
+        if( expect_operand && !ctx.operators.empty() && ctx.operators.back().is_operator() )
+        {
+          ctx.operands.push_back( operand( ctx.tokens.size(), 0 ) );
+        }
+        apply_operators( ctx );
+        if( c == CLOSEPAR && ctx.error.ok() ) close_parenthesis( ctx );
+        expect_operand = c == ARGS_SEPARATOR;
+        ++i;
         continue;
       }
-
-      // ,1.2)
-      if( *( r.first - 1 ) == ARGS_SEPARATOR && *( r.second + 1 ) == CLOSEPAR )
+      // operator: symbols matched by the trie or names e.g. cross3
+      string::size_type n = i;
+      while( n != e.size() && ( isalnum( (unsigned char)( e[ n ] ) ) || e[ n ] == '_' ) ) ++n;
+      const bool name = n != i && !isdigit( (unsigned char)( c ) );
+      const string::size_type m = name ? ( operators_.contains( e.substr( i, n - i ) ) ? n - i : 0 )
+                                       : operators_.match( e, i );
+      if( m )
       {
-        r = search_number( r.second + 1, expr_.end(), expr_.begin() );
+        push_operator( ctx, e.substr( i, m ), i, expect_operand );
+        expect_operand = true;
+        i += m;
         continue;
       }
-
-      if( debug_ ) *os_p_ << "number " << *r.first << " " << *r.second << '\n';
-      string::const_iterator it = add_parentheses( r );
-      r = search_number( it, expr_.end(), expr_.begin() );
-    }
-
-    // wrap constants and variables
-    r = search_name( expr_.begin(), expr_.end() );
-    while( r.second != expr_.end() )
-    {
-    
-	 if( r.first == expr_.begin() || r.second == expr_.end() - 1 )
-	  {
-        string::const_iterator it = add_parentheses( r );
-		r = search_name( expr_.begin(), expr_.end() );
-		continue;
-	  }
-      // (x)
-      if( *( r.first - 1 ) == OPENPAR && *( r.second + 1 ) == CLOSEPAR )
+      const bool number =
+        isdigit( (unsigned char)( c ) )
+        || ( c == '.' && i + 1 != e.size() && isdigit( (unsigned char)( e[ i + 1 ] ) ) );
+      if( !name && !number && c != OPENPAR )
       {
-        r = search_name( r.second + 1, expr_.end() );
-        continue;
+        error( ctx, UNKNOWN_SYMBOL, i, string( 1, c ) );
+        break;
       }
-
-      // (x,
-      if( *( r.first - 1 ) == OPENPAR && *( r.second + 1 ) == ARGS_SEPARATOR )
+      // operand following an operand: a separate value
+      if( !expect_operand ) apply_operators( ctx );
+      if( c == OPENPAR || ( name && n != e.size() && e[ n ] == OPENPAR ) )
       {
-        r = search_name( r.second + 1, expr_.end() );
+        // parenthesis or arguments of a function
+        pending p;
+        p.kind = c == OPENPAR ? pending::PARENTHESIS : pending::CALL;
+        p.name = e.substr( i, n - i );
+        p.precedence = 0;
+        p.swap = false;
+        p.offset = i;
+        p.operands = ctx.operands.size();
+        p.first = ctx.tokens.size();
+        ctx.operators.push_back( p );
+        expect_operand = true;
+        i = c == OPENPAR ? i + 1 : n + 1;
         continue;
       }
-
-      // ,x)
-      if( *( r.first - 1 ) == ARGS_SEPARATOR && *( r.second + 1 ) == CLOSEPAR )
+      if( number )
       {
-        r = search_name( r.second + 1, expr_.end() );
-        continue;
+        n = number_end( e, i );
+        if( n != e.size() && name_char( e[ n ] ) )
+        {
+          // e.g. 2x
+          string::size_type l = n;
+          while( l != e.size() && name_char( e[ l ] ) ) ++l;
+          error( ctx, INVALID_NAME, i, e.substr( i, l - i ) );
+          break;
+        }
+        ctx.tokens.push_back( TokenPtr( new value_token( e.substr( i, n - i ) ) ) );
       }
-
-      if( debug_ ) *os_p_ << "variable " << *r.first << " " << *r.second << '\n';
-      string::const_iterator it = add_parentheses( r );
-      r = search_name( it, expr_.end() );
+      else ctx.tokens.push_back( TokenPtr( new name_token( e.substr( i, n - i ) ) ) );
+      ctx.operands.push_back( operand( ctx.tokens.size() - 1, 1 ) );
+      expect_operand = false;
+      i = n;
     }
+    if( ctx.error.ok() && expect_operand && !ctx.operators.empty() )
+    {
+      ctx.operands.push_back( operand( ctx.tokens.size(), 0 ) );
+    }
+    apply_operators( ctx );
 
-    // wrap functions
-    string fname;
-    r = search_function( expr_.begin(), expr_.end() );
-     	  
-    while( r.second != expr_.end() )
-    {    
-    		    
-	  if( r.first == expr_.begin() || r.second == expr_.end() - 1 )
-	  {
-        string::const_iterator it = add_parentheses( r );
-		r = search_function( expr_.begin(), expr_.end() );
-		continue;
-	  }	
-      // (sin(x))
-      if( *( r.first - 1 ) == OPENPAR && *( r.second + 1 ) == CLOSEPAR )
-      {
-		string::size_type op = expr_.find( OPENPAR, r.first - expr_.begin() );
-        r = search_function( expr_.begin() + op, expr_.end() );
-        continue;
-      }
-
-      // (sin(x),
-      if( *( r.first - 1 ) == OPENPAR && *( r.second + 1 ) == ARGS_SEPARATOR )
-      {
-		string::size_type op = expr_.find( OPENPAR, r.first - expr_.begin() );
-        r = search_function( expr_.begin() + op, expr_.end() );
-        continue;
-      }
-
-      // ,sin(x))
-      if( *( r.first - 1 ) == ARGS_SEPARATOR && *( r.second + 1 ) == CLOSEPAR )
+    if( debug_ )
+    {
+      for( Tokens::const_iterator t = ctx.tokens.begin(); t != ctx.tokens.end(); ++t )
       {
-        string::size_type op = expr_.find( OPENPAR, r.first - expr_.begin() );
-        r = search_function( expr_.begin() + op, expr_.end() );
-        continue;
+        *os_p_ << ' ' << ( *t )->str;
       }
-
-      if( debug_ ) *os_p_ << "function " << *r.first << " " << *r.second << '\n';
-      string::const_iterator it = add_parentheses( r );
-      r = search_function( expr_.begin(), expr_.end() );
+      *os_p_ << '\n' << "} to_rpn" << '\n';
     }
-
-    if( debug_ ) *os_p_ << "} wrap" << '\n';
-      
   }
-  
+
   //----------------------------------------------------------------------------
-  namespace {  
-  /*
-   * 1) find first character that is not ')', if character not ']' return
-   * 2) find matching opening '['
-   * 3) read arguments between '[' and ']'
-   * 4) return last argument read
-   */  
-  int get_out_values( const std::string& s,
-  					  std::string::size_type e,
-  					  const std::string::value_type CLOSE_PAR,
-  					  const std::string::value_type OPEN_ARG_PAR,
-  					  const std::string::value_type CLOSE_ARG_PAR )
+   
+  void math_parser::push_operator( context& ctx, const string& name,
+                                   string::size_type offset, bool prefix ) const
   {
-   	
-  	while( s[ e ] == CLOSE_PAR ) --e;
-  	if( s[ e ] != CLOSE_ARG_PAR ) return -1;
-  	const std::string::size_type c = s.rfind( OPEN_ARG_PAR, e );
-  	if( c == std::string::npos ) return -1;
-  	
-  	std::istringstream is( std::string( s.begin() + c + 1, s.begin() + e ) );
-  	int i = -1;
-  	while( is ) is >> i;
-  	return i;
-  
-  }  
+    // operators without a group with the given number of operands take the
+    // precedence of the other group and are reported when applied
+    const int operands = prefix ? 1 : 2;
+    const operator_trie::group* g = operators_.group_of( name, operands );
+    if( !g ) g = operators_.group_of( name, 3 - operands );
+    pending p;
+    p.kind = prefix ? pending::PREFIX : pending::INFIX;
+    p.name = name;
+    p.precedence = g->precedence;
+    p.swap = g->swap;
+    p.offset = offset;
+    p.operands = 0;
+    p.first = 0;
+    // operators of the same group are applied from left to right
+    while( !prefix && ctx.error.ok() && !ctx.operators.empty()
+           && ctx.operators.back().is_operator()
+           && ctx.operators.back().precedence <= p.precedence )
+    {
+      apply_operator( ctx );
+    }
+    ctx.operators.push_back( p );
   }
-  
+
   //----------------------------------------------------------------------------
    
-  void math_parser::postfix_operators()
+  void math_parser::apply_operator( context& ctx ) const
   {
-    if( debug_ ) *os_p_ << "postfix_operators {" << '\n' << " " << expr_ << '\n';
-
-    typedef string::size_type s_t;
-    
-    vector< operator_type >::const_iterator op_it = operators_.begin();
-    
-    const s_t invalid = string::npos;
-      
-
-    for( ; op_it != operators_.end(); ++op_it )
+    const pending& p = ctx.operators.back();
+    const operand right = ctx.operands.back();
+    ctx.operands.pop_back();
+    operand left( right.first, 0 );
+    if( p.kind == pending::INFIX )
+    {
+      left = ctx.operands.back();
+      ctx.operands.pop_back();
+    }
+    int values = 1;
+    if( count_args_ )
     {
-      pair< s_t, s_t > op( invalid, invalid );
-      s_t start = 0;
-      
-	 
-      // find operator
-      op.first = expr_.find( op_it->name() );
-      
-      while( op.first != string::npos )
+      const operator_type* o = operators_.overload( p.name, left.values, right.values );
+      if( !o )
       {
-	  
-		pair< s_t, s_t > left_operand( invalid, invalid );
-        pair< s_t, s_t > right_operand( invalid, invalid );
-                
-        // last char of operator name
-        op.second = op.first + op_it->name().size() - 1;
-
-        if( op.second  == expr_.size() - 1 ) break;
-        
-        start = op.second + 1;
-
-        if( expr_[ op.second + 1 ] == CLOSEPAR
-            || expr_[ op.second + 1 ] == OPEN_ARG_PAR )
-        {
-          op.first = expr_.find( op_it->name(), start ); 
-          if( op.first == string::npos ) break;
-          continue;
-        }
-        // find left operand
-        if( op.first != 0 && expr_[ op.first - 1 ] == CLOSEPAR )
-        {
-          // find matching opening parenthesis
-          left_operand.first =
-              backward_parenthesis_match( expr_, op.first - 1, OPENPAR, CLOSEPAR );
-          left_operand.second = op.first - 1;
-          /// @warning NO check, parentheses MUST already have been checked
-        }
-
-        // find right operand
-        if(  ( op.second <expr_.size() - 1 ) &&
-            expr_[ op.second + 1 ] == OPENPAR )
-        {
-          // find matching closing parenthesis
-          right_operand.second =
-              forward_parenthesis_match( expr_, op.second + 1, OPENPAR, CLOSEPAR );
-          right_operand.first = op.second + 1;
-          /// @warning NO check, parentheses MUST already have been checked         
-        }
-
-
-		// Problem (?) : ((1,2)) is assumed to be a single argument.
-
-        int args_num = 0;
-        const bool has_left_operand  = left_operand.first != invalid;
-        const bool has_right_operand = right_operand.first != invalid;
-        
-        if( has_left_operand  ) ++args_num;
-        if( has_right_operand ) ++args_num;
-         
-        // check number of arguments supported by operator
-        if( op_it->operands() != args_num )
-        {
-          op.first = expr_.find( op_it->name(), start );
-          if( op.first == string::npos ) break;
-          continue;
-        }
-
-	    string::size_type op_expr_size = op.second - op.first + 1;
-        
-        // record width of operator expression:
-        // "(left)+(right)"
-        //  ^----span----^
-        pair< s_t, s_t > span( op );
-
-        // create new string (x)+(y) --> ((x)(y)+) 
-        if( has_left_operand )
-        {
-          span.first = left_operand.first;
-          op_expr_size += left_operand.second - left_operand.first + 1;
-        }
-
-        if( has_right_operand )
-        {
-          span.second = right_operand.second;
-          op_expr_size += right_operand.second - right_operand.first + 1;
-        }
-
-        string op_expr( "" );
-
-        string op_str = expr_.substr( op.first, op.second - op.first + 1 );
-        
-        // count number of left and right arguments
-        if( count_args_ )
-        {
-          std::iterator_traits<
-              string::const_iterator >::difference_type rargs = 0;
-          std::iterator_traits<
-              string::const_iterator >::difference_type largs = 0;
-					
-
-          if( has_left_operand )
-		  {
-		  	
-		  	largs = get_out_values( expr_,
-		  						   left_operand.second,
-		  						   CLOSEPAR, OPEN_ARG_PAR, CLOSE_ARG_PAR );
-		  		   
-		  	if( largs < 0 )
-		  	{
-		  		largs = mm::count_if(
-                          expr_.begin() + left_operand.first + 1,
-                          expr_.begin() + left_operand.second,
-                          argument( OPENPAR, CLOSEPAR, ARGS_SEPARATOR ) ) + 1;
-		  	}					    
-
-		  }
-		  
-		  if( has_right_operand )
-          {
-          	rargs = get_out_values( expr_,
-		  						   right_operand.second,
-		  						   CLOSEPAR, OPEN_ARG_PAR, CLOSE_ARG_PAR );
-		  						   
-  			if( rargs < 0 )
-  			{
-  				rargs = mm::count_if(
-							expr_.begin() + right_operand.first + 1,
-							expr_.begin() + right_operand.second,
-							argument( OPENPAR, CLOSEPAR, ARGS_SEPARATOR ) ) + 1;
-  			}			   
-
-          }
-
-		  vector< operator_type >::const_iterator oi = operators_.begin();
-		  int ret_values = -1;
-		  for( ; oi != operators_.end(); ++oi )
-		  {
-			if( oi->name() == op_it->name() && oi->largs() == largs
-				&& oi->rargs() == rargs && oi->outvals() >= 0  )
-			{
-				ret_values = oi->outvals();
-				break;
-			}
-		  } 
-		
-		  if( ret_values < 0 )
-		  {
-			struct ex : public std::exception {
-			
-				std::string msg;
-				ex( const std::string& s ) : msg( s ) {} 
-				const char* what() const throw()
-				{
-					return msg.c_str();
-				}
-				~ex() throw() {}
-			};
-			
-			std::ostringstream m;
-			typedef unsigned long ulong; // issue with gcc 3.4.2 MinGW
-										// << unsigned long( i ) causes an error
-										// issue with MS VS .NET 2003 no overload
-							            // for operator <<( ostream&, std::size_t ) ???
-			m << "operator " << op_str
-			  << OPEN_ARG_PAR << ulong( largs ) << ' ' 
-			  << ulong( rargs ) << ' ' << '?' << CLOSE_ARG_PAR
-			  << " not found";
-			throw ex( m.str() );
-		  
-		  }			
-		  std::ostringstream os;
-		  typedef unsigned long ulong; // issue with gcc 3.4.2 MinGW
-									  // << unsigned long( i ) causes an error
-									  // issue with MS VS .NET 2003 no overload
-							          // for operator <<( ostream&, std::size_t ) ???
-		  os << op_str << OPEN_ARG_PAR << ' ' << ulong( largs ) << ' ' 
-			 << ulong( rargs ) << ' ' << ret_values << ' ' << CLOSE_ARG_PAR;
-		  op_str = os.str();
-		}
-		 	
-        op_expr += OPENPAR; // "("
-
-	    if( debug_ ) *os_p_ << " op_expr: " << op_expr << '\n';
-        
-        string  left_operand_str( "" );
-        string right_operand_str( "" );
-
-        if( has_left_operand ) // (x)+(y) -> left = (x)
-        {
-          left_operand_str =
-                expr_.substr( left_operand.first,
-                              left_operand.second - left_operand.first + 1 );
-		      if( debug_ ) *os_p_ << " op_expr: " << op_expr << '\n';
-			  if( debug_ ) *os_p_ << " left op: " << left_operand_str << '\n';
-        }
-
-        if( has_right_operand ) // (x)+(y) -> right = (y)
-        {
-          right_operand_str =
-                expr_.substr( right_operand.first,
-                              right_operand.second - right_operand.first + 1 );
-		      if( debug_ ) *os_p_ << " op_expr: "  << op_expr << '\n';
-			  if( debug_ ) *os_p_ << " right op: " << right_operand_str << '\n';
-        }
-
-        // swap left and right operands
-        const bool swap_args = op_it->swap();
-        if( swap_args )
-        {
-          op_expr = right_operand_str + ',' + left_operand_str + ' ' + op_str;
-                    
-        }
-        else
-        {
-           op_expr += left_operand_str + ',' + right_operand_str + ' ' + op_str;                     
-        }
-
-	    if( debug_ ) *os_p_ << " op_expr: " << op_expr << '\n';
-
-        // "((x)(y))" or "((y)(x))"
-        op_expr += CLOSEPAR;
-	      if( debug_ ) *os_p_ << " op_expr: " << op_expr << '\n';
-        
-		
-	    // replace operator expression inside expr_
-        expr_.replace( span.first, span.second - span.first + 1, op_expr );
-		       
-        // search for next opearator with same name
-        op.first = expr_.find( op_it->name(), start );
-        if( op.first == string::npos ) break;  
+        std::ostringstream m;
+        m << "operator " << p.name
+          << OPEN_ARG_PAR << left.values << ' ' << right.values << ' ' << '?'
+          << CLOSE_ARG_PAR << " not found";
+        error( ctx, UNKNOWN_OPERATOR, p.offset, m.str() );
+        return;
       }
+      values = o->outvals();
+    }
+    // swap left and right operands: right operand tokens first
+    if( p.swap )
+    {
+      std::rotate( ctx.tokens.begin() + left.first, ctx.tokens.begin() + right.first,
+                   ctx.tokens.end() );
     }
-    if( debug_ ) *os_p_ << " } postfix_operators" << '\n' << " " << expr_ << '\n';
+    ctx.tokens.push_back( TokenPtr( count_args_
+      ? new operator_token( p.name, left.values, right.values, values )
+      : new operator_token( p.name, -1, -1, -1 ) ) );
+    ctx.operands.push_back( operand( left.first, values ) );
+    ctx.operators.pop_back();
   }
 
-
-    
   //----------------------------------------------------------------------------
-  void math_parser::postfix_functions()
+   
+  void math_parser::apply_operators( context& ctx ) const
   {
-    if( debug_ ) *os_p_ << "postfix_functions {" << '\n' << " " << expr_ << '\n';
-
-    typedef string::size_type s_t;
-
-    range_type r = search_function( expr_.begin(), expr_.end() );
-    while( r.second != expr_.end() )
+    while( ctx.error.ok() && !ctx.operators.empty() && ctx.operators.back().is_operator() )
     {
-      const pair< s_t, s_t > span( r.first - expr_.begin(),
-                                   r.second -  expr_.begin() );  
-
-      pair< s_t, s_t > name( span );
-      pair< s_t, s_t > parentheses( span );
-      s_t open_par = find( expr_.begin() + span.first, expr_.end(),
-                           OPENPAR ) - expr_.begin();
-
-      name.second = open_par - 1;
-      parentheses.first = open_par;
-
-      string fun =
-        expr_.substr( parentheses.first,
-                      parentheses.second - parentheses.first + 1 );
-
-      if( swap_args_ )
-      {
-        swap_function_args( fun, range_type( fun.begin(), --fun.end() ));
-      }
-
-
-	  const string fun_name =
-					expr_.substr( name.first, name.second - name.first + 1 ); 	
-      fun += fun_name;
+      apply_operator( ctx );
+    }
+  }
 
-      // count number of arguments
-      if( count_args_ )
+  //----------------------------------------------------------------------------
+   
+  void math_parser::close_parenthesis( context& ctx ) const
+  {
+    const pending& p = ctx.operators.back();
+    const vector< operand >::iterator b = ctx.operands.begin() + p.operands;
+    int values = 0;
+    for( vector< operand >::const_iterator i = b; i != ctx.operands.end(); ++i )
+    {
+      values += i->values;
+    }
+    if( p.kind == pending::CALL )
+    {
+      // reverse order of arguments
+      if( swap_args_ && ctx.operands.end() - b > 1 )
       {
-        std::iterator_traits<
-            string::const_iterator >::difference_type args = 0;
-        if( parentheses.second - parentheses.first > 1 )
+        Tokens args;
+        args.reserve( ctx.tokens.size() - p.first );
+        size_t end = ctx.tokens.size();
+        for( vector< operand >::const_iterator i = ctx.operands.end(); i != b; )
         {
-		
-		  args = get_out_values( expr_, span.second, CLOSEPAR,
-								 OPEN_ARG_PAR, CLOSE_ARG_PAR );
-		  if( args < 0 )
-		  {	
-			args = mm::count_if( expr_.begin() + open_par + 1,
-								 expr_.begin() + span.second,
-								 argument( OPENPAR, CLOSEPAR, ARGS_SEPARATOR ) )
-								 + 1;
-		  }
+          --i;
+          args.insert( args.end(), ctx.tokens.begin() + i->first, ctx.tokens.begin() + end );
+          end = i->first;
         }
-		
-        fun += OPEN_ARG_PAR;
-        fun += ltoa( int( args ) );
-		fun += CLOSE_ARG_PAR;
+        std::copy( args.begin(), args.end(), ctx.tokens.begin() + p.first );
       }
-
-      expr_.replace( span.first, span.second - span.first + 1, fun );
-
-      r = search_function( expr_.begin(), expr_.end() );
+      const int args = values;
+      // if(c,a,b) generates the values of a branch, the compiler checks
+      // that both branches generate the same number of values
+      const int out = p.name == "if" ? ( ctx.operands.end() - b > 2 ? b[ 1 ].values : 1 )
+                      : ctx.functions ? ctx.functions->values( p.name, args ) : -1;
+      ctx.tokens.push_back( TokenPtr( count_args_
+        ? static_cast< token* >( new function_token( p.name, args, out ) )
+        : new name_token( p.name ) ) );
+      values = out < 0 ? 1 : out;
     }
-    if( debug_ ) *os_p_ << "} postfix_functions" << '\n' << " " << expr_ << '\n';
-  }
-
-  //----------------------------------------------------------------------------
-  namespace {
-  /// Check if two adjacent characters are equal to specified character.
-  class equals {
-	  string::value_type _v;
-  public:
-	  equals( string::value_type v ) : _v( v ) 
-	  {}
-	  bool operator()( string::value_type v1, string::value_type v2 )
-	  {
-		  return v1 == v2 && v1 == _v;
-	  }
-  };
-
-  /// Return true if character is parenthesis or separator (e.g. ',').
-  class to_remove {
-    const string::value_type OPENPAR;
-    const string::value_type CLOSEPAR;
-    const string::value_type ARGS_SEPARATOR;
-  public:
-    to_remove( string::value_type op,
-               string::value_type cp,
-               string::value_type as )
-               : OPENPAR( op ), CLOSEPAR( cp ), ARGS_SEPARATOR( as )
-    {}
-    bool operator ()( string::value_type ch ) const
-    {
-      return ch == OPENPAR || ch == CLOSEPAR || ch == ARGS_SEPARATOR;
-    }  
-  };
-  }
-  
-  void math_parser::to_rpn()
-  {
-    if( debug_ ) *os_p_ << "to_rpn {" << '\n' << " " << expr_ << '\n';
-
-	postfix_operators();
-	
-	postfix_functions(); 
-	
-	mm::replace_if( expr_.begin(), expr_.end(),
-                to_remove( OPENPAR, CLOSEPAR, ARGS_SEPARATOR),
-                           RPN_SEPARATOR );
-    string::iterator end = unique( expr_.begin(), expr_.end(),
-									                 equals( RPN_SEPARATOR ) );
-    expr_.erase( end, expr_.end() );
-    if( debug_ ) *os_p_ << "} to_rpn" << '\n' << " " << expr_ << '\n';
+    const size_t first = p.first;
+    ctx.operands.erase( b, ctx.operands.end() );
+    ctx.operators.pop_back();
+    ctx.operands.push_back( operand( first, values ) );
   }
  
   //============================================================================
@@ -96,15 +96,131 @@ namespace mmath_plus {
 
    };
 
+  //----------------------------------------------------------------------------
+  /// Operator table compiled into a trie of operator names: the longest
+  /// operator starting at a position of an expression is found in a single
+  /// left-to-right scan, e.g. '**' is not matched as two '*' and '<' is not
+  /// matched inside '<='.
+  /// Overloads with the same name and number of operands form a group; the
+  /// precedence of a group is the position of its first overload in the
+  /// table, 0 being the highest.
+  class operator_trie {
+  public:
+    /// Overloads with the same name and number of operands.
+    struct group {
+      /// Operator name.
+      std::string name;
+      /// Number of operands.
+      int operands;
+      /// Precedence, 0 is the highest.
+      int precedence;
+      /// Swap left and right operands ?.
+      bool swap;
+    };
+
+    /// Constructor.
+    /// @param ops operator table, from highest to lowest precedence
+    explicit operator_trie( const std::vector< operator_type >& ops );
+
+    /// Returns length of the longest operator name starting at position p.
+    /// @param s string
+    /// @param p position in s
+    /// @return length, 0 if no operator starts at p
+    std::string::size_type match( const std::string& s,
+                                  std::string::size_type p ) const;
+
+    /// Returns true if name is the name of an operator.
+    bool contains( const std::string& name ) const
+    {
+      const int n = node( name );
+      return n >= 0 && !nodes_[ n ].ops.empty();
+    }
+
+    /// Returns group of an operator.
+    /// @param name operator name
+    /// @param operands number of operands: 1 prefix, 2 infix
+    /// @return pointer to group, NULL if not found
+    const group* group_of( const std::string& name, int operands ) const
+    {
+      const int n = node( name );
+      if( n < 0 ) return 0;
+      const std::vector< size_t >& g = nodes_[ n ].groups;
+      for( size_t i = 0; i != g.size(); ++i )
+      {
+        if( groups_[ g[ i ] ].operands == operands ) return &groups_[ g[ i ] ];
+      }
+      return 0;
+    }
+
+    /// Returns overload of an operator accepting left and right operands of
+    /// the given dimensions and returning at least one value.
+    /// @param name operator name
+    /// @param largs dimension of left operand
+    /// @param rargs dimension of right operand
+    /// @return pointer to overload, NULL if not found
+    const operator_type* overload( const std::string& name,
+                                   int largs, int rargs ) const;
+
+    /// Returns groups, from highest to lowest precedence.
+    const std::vector< group >& groups() const { return groups_; }
+
+    /// Returns operator table.
+    const std::vector< operator_type >& operators() const { return ops_; }
+
+  private:
+    /// Trie node: one node per prefix of an operator name.
+    struct trie_node {
+      /// ( character, child node index ) pairs.
+      std::vector< std::pair< std::string::value_type, int > > edges;
+      /// Index in operator table of the overloads named by the prefix.
+      std::vector< size_t > ops;
+      /// Index of the groups named by the prefix.
+      std::vector< size_t > groups;
+    };
+
+    /// Returns index of child of node n for character c, -1 if none.
+    int child( int n, std::string::value_type c ) const
+    {
+      const std::vector< std::pair< std::string::value_type, int > >& e =
+                                                            nodes_[ n ].edges;
+      for( size_t i = 0; i != e.size(); ++i ) if( e[ i ].first == c ) return e[ i ].second;
+      return -1;
+    }
+
+    /// Returns index of node of a name, -1 if name is not a prefix of an
+    /// operator name.
+    int node( const std::string& name ) const
+    {
+      int n = 0;
+      for( std::string::size_type i = 0; i != name.size() && n >= 0; ++i )
+      {
+        n = child( n, name[ i ] );
+      }
+      return n;
+    }
+
+    /// Operator table.
+    std::vector< operator_type > ops_;
+
+    /// Trie, root first.
+    std::vector< trie_node > nodes_;
+
+    /// Groups.
+    std::vector< group > groups_;
+  };
+
   //============================================================================
 
   //----------------------------------------------------------------------------
   /// Math parser: extracts tokens associated to a mathematical expression.
   /// The flow of operations is:
-  ///   - error checking
-  ///   - conversion of operators into functions (optional)
-  ///   - conversion to rpn
-  ///   - extraction of tokens.
+  ///   - check of parentheses
+  ///   - conversion to rpn: numbers, names, functions and operators are
+  ///     recognised in a single left-to-right scan and tokens are emitted
+  ///     in postfix order as soon as the operands of an operator are
+  ///     known, operators being applied by precedence (shunting-yard).
+  /// Operands not separated by an operator are separate values, as if
+  /// separated by ','.
   /// The parser can optionally compute the number of arguments for operators
   /// and functions and make the information available in the output std::string.
   /// IN: x + 1.E-3 - atan2( y, z )
@@ -195,6 +311,22 @@ namespace mmath_plus {
       {}
     };
 
+    //--------------------------------------------------------------------------
+    /// Thrown when no operator accepts the given number of operands.
+    /// E.g. '(1,2)+3' if +[2 1] is not defined
+    class unknown_operator : public exception {
+    public:
+      /// Constructor.
+      /// @param fun name of function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      unknown_operator( const std::string& fun,
+                        unsigned long lineno,
+                        const std::string& data = "" )
+        : exception( fun, lineno, data )
+      {}
+    };
+
     /// Utility constant.
     static const bool DEBUG             = true;
     /// Utility constant.
@@ -280,8 +412,22 @@ namespace mmath_plus {
 				 {}
     };
 
+    //--------------------------------------------------------------------------
+    /// Signatures of the functions called by expressions, used to count the
+    /// values of function calls used as operands e.g. zyx(x,y,z)*2; calls
+    /// of functions not known generate one value.
+    struct signatures {
+      /// Returns number of values returned by a function.
+      /// @param name function name
+      /// @param args number of argument values
+      /// @return number of values, -1 if the function is not known
+      virtual int values( const std::string& name, int args ) const = 0;
+      /// Virtual destructor.
+      virtual ~signatures() {}
+    };
+
     /// Constructor.
-    /// @param operators const reference to operator table
+    /// @param operators operator table, compiled into a trie
     /// @param swap_args swap function arguments ?
     /// @param count_args count arguments  and operands ?
     /// @param debug if debug is true then log messages are printed to the given
@@ -303,10 +449,36 @@ namespace mmath_plus {
 	typedef std::vector< TokenPtr > Tokens;
 	
     /// Parsing function.
+    /// The state of the parsing is kept in a context local to each call: as
+    /// long as the parser is not modified, parse() can be called
+    /// concurrently from different threads, with debug output disabled.
     /// @param expr const reference to expression to parse
+    /// @param functions signatures of the functions called, may be null
     /// @return instruction array
-    Tokens parse( const std::string& expr );
+    /// @throw exception if the expression is not valid
+    Tokens parse( const std::string& expr, const signatures* functions = 0 ) const;
+
+    /// Parsing function, does not throw.
+    /// @param expr const reference to expression to parse
+    /// @param[out] tokens tokens, empty in case of error
+    /// @param functions signatures of the functions called, may be null
+    /// @return status; the offset of errors is an offset in expr
+    status parse( const std::string& expr, Tokens& tokens,
+                  const signatures* functions = 0 ) const;
+
+    /// Returns offset in an expression of the first occurrence of a string
+    /// which is not part of a longer name or number; used to locate errors
+    /// detected after the expression has been rewritten, e.g. names not
+    /// found by the compiler.
+    /// @param expr expression passed to parse()
+    /// @param s string
+    /// @return offset, std::string::npos if not found
+    static std::string::size_type offset( const std::string& expr,
+                                          const std::string& s );
 	
+    /// Get operators.
+    const operator_trie& operators() const { return operators_; }
+
     /// Get value of debug_ flag.
     bool debug() const { return debug_; }
 
@@ -325,32 +497,73 @@ namespace mmath_plus {
     /// Set value of count_args_ flag.
     void count_args( bool count_args ) { count_args_ = count_args;  }
 
-    /// Get reference to expression.
-    const std::string& expr() const { return expr_; }
-
   private:
 
-    /// Debug stream.
-    std::ostream* os_p_;
+    /// Sequence of tokens computing a number of values.
+    struct operand {
+      /// Index of the first token.
+      size_t first;
+      /// Number of values.
+      int values;
+      /// Constructor.
+      /// @param f index of the first token
+      /// @param v number of values
+      operand( size_t f, int v ) : first( f ), values( v ) {}
+    };
 
-    /// Expression.
-    std::string expr_;
+    /// Operator or opening parenthesis waiting for its operands.
+    struct pending {
+      /// Entry kinds: operators before parentheses.
+      enum kind_type { PREFIX, INFIX, PARENTHESIS, CALL };
+      /// Entry kind.
+      kind_type kind;
+      /// Operator or function name.
+      std::string name;
+      /// Precedence of operator, 0 is the highest.
+      int precedence;
+      /// Swap left and right operands ?.
+      bool swap;
+      /// Offset in expression.
+      std::string::size_type offset;
+      /// Number of operands when the parenthesis was opened.
+      size_t operands;
+      /// Number of tokens when the parenthesis was opened.
+      size_t first;
+      /// Returns true if entry is an operator.
+      bool is_operator() const { return kind == PREFIX || kind == INFIX; }
+    };
 
-    /// Temporary buffer.
-    std::string tmp_expr_;
+    /// State of a call to parse().
+    struct context {
+      /// Constructor.
+      /// @param e expression passed to parse()
+      /// @param f signatures of the functions called, may be null
+      context( const std::string& e, const signatures* f )
+        : input( e ), functions( f ) {}
+      /// Expression passed to parse().
+      const std::string& input;
+      /// Signatures of the functions called, may be null.
+      const signatures* functions;
+      /// Tokens, in RPN order.
+      Tokens tokens;
+      /// Operands not yet consumed by an operator or parenthesis.
+      std::vector< operand > operands;
+      /// Operators and parentheses waiting for their operands.
+      std::vector< pending > operators;
+      /// First error found.
+      status error;
+    };
 
-    /// Mapping between operators and functions e.g. + --> add().
-    const std::vector< operator_type >& operators_;
+    /// Debug stream.
+    std::ostream* os_p_;
 
-    /// Tokens.
-    std::vector< TokenPtr > tokens_;
+    /// Operators, with precedence and number of operands.
+    operator_trie operators_;
 
     /// Debug enabled when debug == true.
     bool   debug_;
 
-    /// If swap_args_ == true arguments of each operator are swapped and
-    /// function arguments are reverse ordered.
-    /// a + b/c --> a b c / + if swap_args_ == false; c b / a + otherwise.
+    /// If swap_args_ == true function arguments are reverse ordered.
     /// f( x, y ) --> x y f if swap_args_ == false; y x f otherwise.
     bool   swap_args_;
 
@@ -370,9 +583,6 @@ namespace mmath_plus {
     /// Whitespace.
     static const std::string::value_type BLANK;// = ' ';
 
-	  /// Separator in RPN expression.
-    static const std::string::value_type RPN_SEPARATOR;// = ' ';
-
     /// Opening parenthesis.
     static const std::string::value_type OPEN_ARG_PAR;// = '[';
 
@@ -382,405 +592,46 @@ namespace mmath_plus {
   // Internal functions. //
   private:
 
-    /// Remove blanks from expression.
-    void remove_blanks();
-
-    /// Validate expression.
-    bool validate();
-
-    /// (a)+(b) --> ((a)(b)+).
-    void postfix_operators();
-
-    /// (sin(x)) --> ((x)sin).
-    void postfix_functions();
-
-    /// Convert to RPN.
-    void to_rpn();
-
-    //--------------------------------------------------------------------------
-    /// Creates token array by splitting the RPN expression into an array of
-    /// strings.
-    void create_tokens()
+    /// Records error unless an error was already recorded.
+    /// @param ctx parsing context
+    /// @param k error kind
+    /// @param offset offset in expression passed to parse()
+    /// @param m message
+    static void error( context& ctx, error_kind k,
+                       std::string::size_type offset, const std::string& m )
     {
-      std::istringstream is( expr_.data() );
-      std::string s;
-      while( is )
-      {
-        is >> s;
-        if( s.empty() ) break;
-        if( count_args_
-            && s.find( OPEN_ARG_PAR ) != std::string::npos
-            && s[ s.size() - 1 ] != CLOSE_ARG_PAR )
-        {
-		 
-		  std::vector< std::string > sv;
-		  std::string s2 = " ";
-		  while( is && s2[ s2.size() - 1 ] != CLOSE_ARG_PAR ) 
-		  {
-			is >> s2;
-			if( is.good() ) sv.push_back( s2 );			
-		  }
-		  for( size_t i = 0; i < sv.size(); ++i )
-		  {
-			s += BLANK;
-			s += sv[ i ];
-		  } 	
-        }
-        TokenPtr t( create_token( s ) );
-        if( t != 0 ) tokens_.push_back( t );
-        if( debug_ )
-        {
-          *os_p_ << s << "\t\t";
-          switch( t->type )
-          {
-          case UNKNOWN:  *os_p_ << "UNKNOWN";
-                         break;
-          case VALUE:    *os_p_ << "VALUE";
-                         break;
-          case NAME:     *os_p_ << "NAME";
-                         break;
-          case FUNCTION: *os_p_ << "FUNCTION";
-                         break;
-          case OPERATOR: *os_p_ << "OPERATOR";
-                         break;
-          default:       break;
-        }
-          *os_p_ << '\n';
-        }
-        s.clear();
-      }
+      if( ctx.error.ok() ) ctx.error = status( k, offset, m );
     }
 
-    //--------------------------------------------------------------------------
-    /// Creates token from std::string.
-    /// @param s input std::string
-    /// @return token pointer
-    token* create_token( const std::string& s )
-    {
-
-      if( count_args_ )
-      {
-		const std::string::size_type i = s.find( OPEN_ARG_PAR );
-		if(  i != std::string::npos )
-		{
-			const std::string name = s.substr( 0, i );
-			std::string::size_type c = s.find( CLOSE_ARG_PAR, i );
-			if( c == std::string::npos ) return new token( s );
-			
-			std::istringstream is( std::string( s.begin() + i + 1, s.begin() + c ) );
-			std::vector< int > values; values.reserve( 3 );
-			int v;
-			while( is ) 
-			{
-				is >> v;
-				if( is ) values.push_back( v ); 
-			}
-			
-			switch( values.size() )
-			{
-				case 1:
-					{
-						return new function_token( name, values[ 0 ], -1 );
-					}
-					break;
-				case 2:
-					{
-						return new function_token( 
-											name, values[ 0 ], values[ 1 ] );
-					}
-					break;
-				case 3:
-					{
-						return new operator_token( name, values[ 0 ],
-											   values[ 1 ], values[ 2 ] );
-					}
-					break;
-				default:
-					return 0; 				
-			}
-			
-		}
-
-	  }
-      else
-      {
-        std::vector< operator_type >::const_iterator i;
-        for( i = operators_.begin(); i != operators_.end(); ++i )
-        {
-          if( i->name() == s ) return new operator_token( s, -1 , -1, -1 );
-        }
-      }
-
-      range_type r = search_number( s.begin(), s.end(), s.begin() );
-      if( r.first != s.end() ) return new value_token( s );
-
-      r = search_name( s.begin(), s.end() );
-      if( r.first != s.end() ) return new name_token( s );
+    /// Throws the exception matching an error.
+    void raise( const status& s ) const;
 
-      if( !count_args_ )
-      {
-        for( std::vector< operator_type >::const_iterator i =operators_.begin();
-             i != operators_.end(); ++i )
-        {
-          if( i->name() == s ) return new operator_token( s, -1, -1, -1 );
-        }
-      }
+    /// Checks that parentheses are matched.
+    bool validate( context& ctx ) const;
 
-      return new token( s );
+    /// Converts expression to RPN in a single scan.
+    void to_rpn( context& ctx ) const;
 
-    }
+    /// Pushes operator, applying the operators on the stack with a higher
+    /// or equal precedence first if infix.
+    /// @param ctx parsing context
+    /// @param name operator name
+    /// @param offset offset in expression
+    /// @param prefix true if operator has no left operand
+    void push_operator( context& ctx, const std::string& name,
+                        std::string::size_type offset, bool prefix ) const;
 
-    /// Wraps every number, identifier and function with parentheses.
-    void wrap();
+    /// Applies operator on top of the stack to its operands.
+    void apply_operator( context& ctx ) const;
 
-	/// Is RPN separator ?.
-    /// @param v1 character
-    /// @param v2 character
-	bool is_rpn_separator( std::string::value_type v1, std::string::value_type v2 );
+    /// Applies the operators on the stack up to the innermost open
+    /// parenthesis.
+    void apply_operators( context& ctx ) const;
 
-    //--------------------------------------------------------------------------
-    /// Wraps characters between r.first and r.second with parentheses.
-    /// @param r identifying part of expression to wrap
-    /// @return iterator pointing to first element after closing parenthesis
-    std::string::const_iterator add_parentheses( const range_type& r )
-    {
-      // range starts after end of sequence return ( end, end )
-      if( r.first == expr_.end()  || r.second == expr_.end() )
-      {
-        return expr_.end();
-      }
-
-      // return expr_.end() ? this happens when parenthesis is added at last
-      // position in sequence
-      bool ret_end = false;
-      // if closing parenthesis to be added at last position then
-      // return expr_.end() after adding parentheses
-      if( r.second == expr_.end() - 1 ) ret_end = true;
-      // "("
-      std::string op_expr( 1, OPENPAR );
-      // "(x"
-      op_expr.append( r.first, r.second + 1 );
-      // "(x)"
-      op_expr += CLOSEPAR;
-      // compute position of first character after replaced expression
-      const std::string::difference_type offset =
-                                       r.first - expr_.begin() + op_expr.size();
-      // replace expression with wrapped version:  "x" -->"(x)"
-      expr_ =expr_.replace(
-                  r.first - expr_.begin(), r.second - r.first + 1, op_expr );
-      // right parenthesis == last character in std::string
-      if( ret_end ) return expr_.end();
-      // return position of character after closing parenthesis
-      return ( expr_.begin() + offset );
-    }
-
-    //--------------------------------------------------------------------------
-    /// Returns iterators pointing to first and last character of function
-    /// including opening and closing parentheses.
-    /// cos(x) --> first iterator points to 'c' second iterator points to ')'.
-    /// A function can have the same format as variables but must have an
-    /// opening parenthesis immediately after the function name; the opening
-    /// parenthesis must have a matching closing parenthesis.
-    /// @param b start position
-    /// @param e one past end position
-    /// @return iterators pointing to first and last character of function
-    range_type search_function( const std::string::const_iterator& b,
-                                const std::string::const_iterator& e ) const
-    {
-      // search for first and last character of sequence matching a name i.e.
-      range_type r = search_range( b, e, match_name() );
-      // if not found return range_type( e, e ) as returned by function
-      // search_range
-      if( r.first == e ) return r;
-      // range found and second character == opening parenthesis
-      if( r.second != e && *r.second == OPENPAR )
-      {
-      	
-    		std::string fname( r.first, r.second ); 
-  		if( mmath_plus::find_if( operators_.begin(), operators_.end(), findop( fname ) ) != operators_.end() )
-  		{
-  			return search_function( r.second, e );	
-  		}
-        // get position of matching closing parenthesis
-        r.second = forward_parenthesis_match( r.second, e,  OPENPAR, CLOSEPAR );
-        return r;
-      }
-      // a name was found but no opening parenthesis after it so continue
-      // searching
-	  return search_function( r.second, e );
-    }
-
-	
-    //--------------------------------------------------------------------------
-    /// Returns iterators pointing to first and last character of variable name.
-    /// var_name --> first iterator points to 'v' second iterator points to 'e'.
-    /// A variable name can start with '_' or a letter and can have any
-    /// number of letters, digits or underbars.
-    /// @param b start position
-    /// @param e one past end position
-    /// @return iterators pointing to first and last character of variable
-    range_type search_name( const std::string::const_iterator& b,
-                            const std::string::const_iterator& e ) const
-    {
-      // search for first and last character of name
-      range_type r = search_range( b, e, match_name() );
-      // it nothing found return ( e, e )
-      if( r.first == e ) return r;
-
-      // if name found and there is no opening parenthesis after it
-      if( r.second == e || *r.second != OPENPAR )
-      {
-      	std::string fname( r.first, r.second ); 
-  		if( mmath_plus::find_if( operators_.begin(), operators_.end(), findop( fname ) ) != operators_.end() )
-  		{
-  			return search_name( r.second, e );	
-  		}
-        // return range
-        return range_type( r.first, --r.second );
-      }
-
-      // a name was found but with a parenthesis after it
-	    return search_name( r.second, e );
-    }
-
-    //--------------------------------------------------------------------------
-    /// Returns iterators pointing to first and last character of number.
-    /// 1.3E-08 --> first iterator points to '1' second iterator points to '8'.
-    /// A number must:
-    ///     - start with a digit or decimal point
-    ///     - end with a digit
-    ///     - have one and only one 'E'
-    ///     - have one and only one decimal point before 'E' but not
-    ///       adjacent to 'E'
-    ///     - have at least one digit after 'E'
-    ///     - have at most one '+' or '-' character just after 'E'
-    /// @param b start position
-    /// @param e one past end position
-    /// @param start position of first element of expression
-    /// @return iterators pointing to first and last character of number
-    range_type search_number( const std::string::const_iterator& b,
-                              const std::string::const_iterator& e,
-                              const std::string::const_iterator& start ) const
-    {
-      if( b == e ) return range_type( e, e );
-      range_type r = search_range( b, e, match_number() );
-      // nothing found
-      if( r.first == e ) return r;
-      // check if name after number
-      range_type rn = search_name( r.second, e );
-      if(  rn.first == r.second && rn.first != e )
-      {
-        // e.g. 2x
-        throw invalid_name( "search_number", __LINE__,
-                            std::string( r.first, ++rn.second ) );
-        return range_type( e, e );
-      }
-      // first character in start position
-      if( r.first == start ) return range_type( r.first, --r.second );
-
-      // match_number can validate numbers like 1.2E or 1.2E+
-      // check if name before number e.g. x2
-      range_type nr = search_range( r.first - 1, r.second, match_name() );
-      // if number is within name perform new search
-      if( nr.first != r.second ) return search_number( r.second, e, start );
-
-      // get last character validated by match_number
-      const std::string::value_type last = *( r.second - 1 );
-      // if last character validated by match_number is not a digit
-      // i.e. it is 'E', '+' or '-'
-      if( ( r.first != r.second ) && !isdigit( last ) )
-      {
-        // if number of digits > 1 then if last validated character is not a
-        // number continue searching; if only one character has bee validated
-        // by match_number then it has to be a single digit number
-        return search_range( r.second, e , match_number() );
-      }
-      // if last character is a digit or a decimal point
-      if( isdigit(last) || last == match_number::DOT )
-      {
-        // part of a name ?
-        // number could be part of a variable name e.g. x2x
-        // if first character non at beginning of sequence
-        if( r.first != start )
-        {
-          // search forward for name starting one character before starting
-          // of number: x2x --> start from x
-          range_type v = search_name( r.first - 1, e );
-          // if there is a name starting at first - 1 then the matched
-          // number is part of a variable: x2x --> found '2' which is part
-          // of variable 'x2x'
-          if( v.first < r.second )
-          {
-            return search_number( r.second, e, start );
-          }
-        }
-        // number is not part of a name
-        return range_type( r.first, --r.second );
-      }
-      return search_number( r.second, e, start );
-    }
-
-    /// Function object used to find operators
-	struct findop {
-                /// Operator name
-	    		const std::string& name;
-	    		/// Constructor
-                /// @param s operator name
-                findop( const std::string& s ) : name( s ) {}
-	    		/// @param o reference to operator instance
-                /// @return <code>true</code> if operator name matches name of passed operator instance
-                bool operator()( const operator_type& o ) { return o.name() == name; }    
-    };
-
-public:
-
-    /// Reverses std::list of function arguments.
-    /// @param expr_ expression
-    /// @param pr range containing std::list of parameters to reverse
-    void swap_function_args( std::string& expr_, range_type pr )
-    {
-      if( *pr.first == OPENPAR && *pr.second == CLOSEPAR )
-      {
-        ++pr.first; --pr.second;
-        swap_function_args( expr_, pr );
-        return;
-      }
-      // find argument range list
-      std::list< range_type > ri;
-      std::for_each( pr.first,
-                pr.second + 1,
-                extract_argument< std::list< range_type> >(
-                                        ri, range_type( pr.first, pr.second ),
-                                        OPENPAR, CLOSEPAR, ARGS_SEPARATOR ) );
-
-      // if argument range std::list size == 1 return
-      if( ri.size() < 2 ) return;
-
-      // call function on every argument range
-      for( std::list< range_type >::iterator i = ri.begin();
-           i != ri.end();
-           ++i )
-      {
-        swap_function_args( expr_, *i );
-      }
-
-      tmp_expr_.clear();
-      tmp_expr_ = "";
-      // create std::string with arguments in reverse order
-      for( std::list< range_type >::reverse_iterator j = ri.rbegin();
-           j != ri.rend();
-           ++j )
-      {
-        if( j != ri.rbegin() ) tmp_expr_ += ARGS_SEPARATOR;
-        tmp_expr_ += expr_.substr( j->first - expr_.begin(),
-                                   j->second - j->first + 1 );
-      }
-
-      expr_.replace( pr.first - expr_.begin(),
-                     pr.second - pr.first + 1, tmp_expr_ );
-
-      if( debug_ ) *os_p_ << expr_ << '\n';
-    }
+    /// Replaces the operands of the innermost parenthesis with a single
+    /// operand, followed by the function token if the parenthesis opens
+    /// the arguments of a function.
+    void close_parenthesis( context& ctx ) const;
   };
 
 
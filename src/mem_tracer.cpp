@@ -3,40 +3,367 @@
 /// @file mem_tracer.cpp implementation of MemTracer class used to for tracking memory usage
 
 #include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 #include "mem_tracer.h"
 
 bool MemTracer::Ready = false;
 
+namespace {
+
+/// Maximum number of call sites; allocations from further call sites are
+/// attributed to the last one.
+const unsigned MAX_SITES = 1024;
+
+/// Size of the per-thread call site cache, a power of two: the cache is an
+/// open addressing table holding every call site used by the thread, so
+/// that the global table is locked only the first time a thread allocates
+/// at a call site.
+const unsigned CACHE_SIZE = 2 * MAX_SITES;
+
+/// Call site.
+struct Site
+{
+    /// Name of source file
+    char const * file;
+    /// Line
+    int line;
+    /// Name of function
+    const char* fun;
+};
+
+/// Allocation and deallocation counters of a call site.
+struct Counters
+{
+    /// Number of allocations
+    std::atomic< std::size_t > allocs;
+    /// Allocated bytes
+    std::atomic< std::size_t > bytes;
+    /// Number of deallocations
+    std::atomic< std::size_t > frees;
+    /// Deallocated bytes
+    std::atomic< std::size_t > freed;
+};
+
+/// Per-thread counters; zero initialized and never destroyed, the
+/// counters are written by the owning thread only.
+struct ThreadTable
+{
+    /// Counters of each call site; index 0 holds the totals
+    Counters site[ MAX_SITES ];
+    /// Allocations to skip before the next sampled allocation
+    unsigned countdown;
+    /// Call site cache
+    struct
+    {
+        char const * file;
+        int line;
+        const char* fun;
+        unsigned index;
+    } cache[ CACHE_SIZE ];
+    /// Number of cache entries in use
+    unsigned cached;
+    /// Next table in the list of live threads
+    ThreadTable* next;
+    /// True when in the list of live threads
+    bool linked;
+    /// True after the thread exited: counters are added to the shared table
+    bool retired;
+    /// Number of active Forbid( true ) calls
+    unsigned forbidden;
+};
+
+/// Header preceding each memory chunk; it keeps the alignment of malloc.
+struct alignas( alignof( std::max_align_t ) ) Header
+{
+    /// Size of chunk
+    std::size_t size;
+    /// Call site index, 0 if allocation not sampled
+    unsigned site;
+    /// Number of allocations represented by a sampled allocation, 0 if the
+    /// allocation was not recorded
+    unsigned weight;
+};
+
+/// Call sites; index 0 unused.
+Site sites[ MAX_SITES ];
+
+/// Number of call sites, including index 0.
+std::atomic< unsigned > siteCount( 1 );
+
+/// Sampling rate.
+std::atomic< unsigned > sampling( 1 );
+
+/// Serializes registration of call sites and threads and dumps.
+std::mutex mutex;
+
+/// Live threads.
+ThreadTable* threads = 0;
+
+/// Counters of exited threads.
+Counters retired[ MAX_SITES ];
+
+/// Counters of current thread.
+thread_local ThreadTable table;
+
+/// Moves counters of current thread to the shared table on thread exit.
+struct ThreadGuard
+{
+    /// Destructor: unlink thread table and add counters to shared table
+    ~ThreadGuard()
+    {
+        ThreadTable& t = table;
+        std::lock_guard< std::mutex > lock( mutex );
+        ThreadTable** p = &threads;
+        while( *p != &t ) p = &( *p )->next;
+        *p = t.next;
+        const std::memory_order r = std::memory_order_relaxed;
+        for( unsigned i = 0; i != MAX_SITES; ++i )
+        {
+            retired[ i ].allocs.fetch_add( t.site[ i ].allocs.load( r ), r );
+            retired[ i ].bytes.fetch_add( t.site[ i ].bytes.load( r ), r );
+            retired[ i ].frees.fetch_add( t.site[ i ].frees.load( r ), r );
+            retired[ i ].freed.fetch_add( t.site[ i ].freed.load( r ), r );
+        }
+        t.retired = true;
+    }
+};
+
+/// Guard of current thread.
+thread_local ThreadGuard guard;
+
 //----------------------------------------------------------------------------
-void MemTracer::Add( void* p, char const * file, int line, const char* fun, std::size_t s )
+/// Returns counters of current thread, linking them to the list of live
+/// threads on first use.
+ThreadTable& Table()
 {
-    if( lockCount_ > 0 ) return;
-    MemTracer::Lock lock( *this );
-    map_[ p ] = Entry( file, line, fun, s );
-    amem_ += s;
+    ThreadTable& t = table;
+    if( t.linked ) return t;
+    // registers the guard destructor
+    static_cast< void >( &guard );
+    std::lock_guard< std::mutex > lock( mutex );
+    t.next = threads;
+    threads = &t;
+    t.linked = true;
+    return t;
 }
 
 //----------------------------------------------------------------------------
-void MemTracer::Remove ( void* p )
+/// Adds n operations of s bytes to counter of a call site.
+void Count( ThreadTable& t, unsigned site, std::size_t n, std::size_t s, bool alloc )
+{
+    const std::memory_order r = std::memory_order_relaxed;
+    if( t.retired )
+    {
+        Counters& c = retired[ site ];
+        ( alloc ? c.allocs : c.frees ).fetch_add( n, r );
+        ( alloc ? c.bytes : c.freed ).fetch_add( n * s, r );
+        return;
+    }
+    // single writer: no read-modify-write needed
+    Counters& c = t.site[ site ];
+    std::atomic< std::size_t >& count = alloc ? c.allocs : c.frees;
+    std::atomic< std::size_t >& bytes = alloc ? c.bytes : c.freed;
+    count.store( count.load( r ) + n, r );
+    bytes.store( bytes.load( r ) + n * s, r );
+}
+
+//----------------------------------------------------------------------------
+/// Returns true if strings are equal; string literals of different
+/// translation units can have different addresses.
+inline bool Same( const char* a, const char* b )
+{
+    return a == b || ( a && b && !std::strcmp( a, b ) );
+}
+
+//----------------------------------------------------------------------------
+/// Returns index of call site, registering it if not found.
+unsigned Register( char const * file, int line, const char* fun )
+{
+    std::lock_guard< std::mutex > lock( mutex );
+    const unsigned n = siteCount.load( std::memory_order_relaxed );
+    for( unsigned i = 1; i != n; ++i )
+    {
+        if( sites[ i ].line == line && Same( sites[ i ].file, file )
+            && Same( sites[ i ].fun, fun ) ) return i;
+    }
+    if( n == MAX_SITES ) return MAX_SITES - 1;
+    Site& s = sites[ n ];
+    if( n == MAX_SITES - 1 )
+    {
+        s.file = "(other)";
+        s.line = 0;
+        s.fun = 0;
+    }
+    else
+    {
+        s.file = file;
+        s.line = line;
+        s.fun = fun;
+    }
+    siteCount.store( n + 1, std::memory_order_release );
+    return n;
+}
+
+//----------------------------------------------------------------------------
+/// Returns index of call site.
+unsigned SiteIndex( ThreadTable& t, char const * file, int line, const char* fun )
+{
+    std::size_t h = ( reinterpret_cast< std::size_t >( file ) / 8
+                      ^ reinterpret_cast< std::size_t >( fun ) / 8
+                      ^ std::size_t( line ) * 31 ) & ( CACHE_SIZE - 1 );
+    // linear probing, entries are never removed
+    for( ; t.cache[ h ].index; h = ( h + 1 ) & ( CACHE_SIZE - 1 ) )
+    {
+        if( t.cache[ h ].file == file && t.cache[ h ].line == line
+            && t.cache[ h ].fun == fun ) return t.cache[ h ].index;
+    }
+    const unsigned i = Register( file, line, fun );
+    // the cache is kept at most three quarters full; call sites beyond
+    // that, i.e. names of the same site at different addresses, are looked
+    // up in the global table
+    if( t.cached < CACHE_SIZE / 4 * 3 )
+    {
+        t.cache[ h ].file = file;
+        t.cache[ h ].line = line;
+        t.cache[ h ].fun = fun;
+        t.cache[ h ].index = i;
+        ++t.cached;
+    }
+    return i;
+}
+
+//----------------------------------------------------------------------------
+/// Values of a call site summed over all threads.
+struct Row
+{
+    unsigned site;
+    std::size_t allocs;
+    std::size_t bytes;
+    std::size_t frees;
+    std::size_t freed;
+    /// Live bytes
+    std::size_t Live() const { return bytes > freed ? bytes - freed : 0; }
+    /// Live allocations
+    std::size_t LiveAllocs() const { return allocs > frees ? allocs - frees : 0; }
+};
+
+/// Adds counters to row.
+void Add( Row& row, const Counters& c )
 {
-    if( lockCount_ > 0 ) return;
+    const std::memory_order r = std::memory_order_relaxed;
+    row.allocs += c.allocs.load( r );
+    row.bytes += c.bytes.load( r );
+    row.frees += c.frees.load( r );
+    row.freed += c.freed.load( r );
+}
 
-    MemTracer::Lock lock( *this );
+/// Orders rows by live bytes, largest first.
+bool MoreLive( const Row& a, const Row& b )
+{
+    return a.Live() > b.Live() || ( a.Live() == b.Live() && a.allocs > b.allocs );
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------
+void* MemTracer::Allocate( std::size_t size, char const * file, int line, const char* fun )
+{
+    Header* h = static_cast< Header* >( std::malloc( sizeof( Header ) + size ) );
+    if( !h ) return 0;
+    h->size = size;
+    h->site = 0;
+    h->weight = 0;
+    if( Ready )
+    {
+        ThreadTable& t = Table();
+        if( t.forbidden )
+        {
+            std::fprintf( stderr, "MemTracer: forbidden allocation of %lu bytes"
+                          " at %s:%d (%s)\n", static_cast< unsigned long >( size ),
+                          file, line, fun ? fun : "?" );
+            std::abort();
+        }
+        Count( t, 0, 1, size, true );
+        h->weight = 1;
+        if( !t.countdown )
+        {
+            // sampled: weight is the number of allocations it represents
+            const unsigned n = sampling.load( std::memory_order_relaxed );
+            h->site = SiteIndex( t, file, line, fun );
+            h->weight = n;
+            Count( t, h->site, n, size, true );
+            t.countdown = n;
+        }
+        --t.countdown;
+    }
+    return h + 1;
+}
 
-    iterator it = map_.find (p);
-    if( it != map_.end() )
+//----------------------------------------------------------------------------
+void MemTracer::Release( void* p )
+{
+    if( !p ) return;
+    Header* h = static_cast< Header* >( p ) - 1;
+    if( Ready && h->weight )
     {
-    	dmem_ += it->second.Size();
-        map_.erase( it );
+        ThreadTable& t = Table();
+        Count( t, 0, 1, h->size, false );
+        if( h->site ) Count( t, h->site, h->weight, h->size, false );
     }
-    
+    std::free( h );
+}
+
+//----------------------------------------------------------------------------
+std::size_t MemTracer::ThreadAllocations()
+{
+    return Table().site[ 0 ].allocs.load( std::memory_order_relaxed );
 }
 
 //----------------------------------------------------------------------------
-MemTracer::MemTracer ( std::ostream& os ) 
-: lockCount_(0), os_( os ), amem_( 0 ), dmem_( 0 )
+void MemTracer::Forbid( bool f )
+{
+    ThreadTable& t = Table();
+    if( f ) ++t.forbidden;
+    else if( t.forbidden ) --t.forbidden;
+}
+
+//----------------------------------------------------------------------------
+/// Overloaded operator new called from outside mmath_plus.
+/// @param size byte size of memory chunk to allocate
+void* operator new( std::size_t size )
+{
+    void* p = MemTracer::Allocate( size, "?", 0, 0 );
+    if( !p ) throw std::bad_alloc();
+    return p;
+}
+
+/// Overloaded delete operator.
+void operator delete( void* p ) noexcept
 {
+    MemTracer::Release( p );
+}
+
+/// Overloaded sized delete operator.
+void operator delete( void* p, std::size_t ) noexcept
+{
+    MemTracer::Release( p );
+}
+
+//----------------------------------------------------------------------------
+MemTracer::MemTracer ( std::ostream& os, unsigned s )
+: os_( os )
+{
+    const char* e = std::getenv( "MMP_TRACE_SAMPLING" );
+    if( e && std::atoi( e ) > 0 ) s = unsigned( std::atoi( e ) );
+    Sampling( s );
     Ready = true;
 }
 
@@ -47,33 +374,81 @@ MemTracer::~MemTracer ()
     Dump();
 }
 
+//----------------------------------------------------------------------------
+void MemTracer::Sampling( unsigned n )
+{
+    sampling.store( n ? n : 1, std::memory_order_relaxed );
+}
+
+//----------------------------------------------------------------------------
+unsigned MemTracer::Sampling() const
+{
+    return sampling.load( std::memory_order_relaxed );
+}
+
 //----------------------------------------------------------------------------
 void MemTracer::Dump ()
+{
+    Dump( os_ );
+}
+
+//----------------------------------------------------------------------------
+void MemTracer::Dump ( std::ostream& os ) const
 {
 	typedef unsigned long ulong;// *issue with MinGW gcc 3.4.2
 							    // << unsigned long( i ) causes an error
 							    // *issue with MS VS .NET 2003 no overload
-							    // for operator <<( ostream&, std::size_t ) ???  
-	os_ << "\nAllocated Memory:   " << ulong( amem_ ) << " bytes";
-	os_ << "\nDeallocated Memory: " << ulong( dmem_ ) << " bytes" << std::endl;
-    if( map_.size () != 0 )
+							    // for operator <<( ostream&, std::size_t ) ???
+    // rows are not allocated with new: printing can allocate memory and
+    // record allocations
+    Row* rows = static_cast< Row* >( std::calloc( MAX_SITES, sizeof( Row ) ) );
+    if( !rows ) return;
+    unsigned n = 0;
     {
-        os_ << ulong( map_.size () ) << " memory leaks detected\n";
-        for( iterator it = map_.begin (); it != map_.end (); ++it )
+        std::lock_guard< std::mutex > lock( mutex );
+        n = siteCount.load( std::memory_order_acquire );
+        for( unsigned i = 0; i != n; ++i )
         {
-            char const * file = it->second.File ();
-            const int line = it->second.Line ();
-            const char* fun = it->second.Fun();
-            const std::size_t size = it->second.Size();
-            
-            os_ << "File: " << file << ','
-                << " Line: " << line << ','
-                << " Size: " << ulong( size );
-            if( fun ) os_ <<  ", Function: " << fun;
-            os_ << std::endl;
-            
+            rows[ i ].site = i;
+            Add( rows[ i ], retired[ i ] );
+            for( const ThreadTable* t = threads; t; t = t->next )
+            {
+                Add( rows[ i ], t->site[ i ] );
+            }
         }
-        os_.flush(); 
-    }    
+    }
+    const Row& total = rows[ 0 ];
+    os << "\nAllocated Memory:   " << ulong( total.bytes ) << " bytes in "
+       << ulong( total.allocs ) << " allocations";
+    os << "\nDeallocated Memory: " << ulong( total.freed ) << " bytes in "
+       << ulong( total.frees ) << " deallocations";
+    os << "\nLive Memory:        " << ulong( total.Live() ) << " bytes in "
+       << ulong( total.LiveAllocs() ) << " allocations" << std::endl;
+    if( total.LiveAllocs() && !Ready )
+    {
+        os << ulong( total.LiveAllocs() ) << " memory leaks detected\n";
+    }
+    std::sort( rows + 1, rows + n, MoreLive );
+    if( n > 1 )
+    {
+        os << "Call sites";
+        if( Sampling() > 1 ) os << " (1 allocation out of " << Sampling() << " sampled)";
+        os << ":\n";
+    }
+    for( unsigned i = 1; i != n; ++i )
+    {
+        const Row& r = rows[ i ];
+        // after destruction only call sites with live memory are reported
+        if( !r.allocs || ( !Ready && !r.LiveAllocs() ) ) continue;
+        const Site& s = sites[ r.site ];
+        os << "File: " << s.file << ','
+           << " Line: " << s.line << ','
+           << " Live: " << ulong( r.Live() ) << " bytes in "
+           << ulong( r.LiveAllocs() ) << " allocations,"
+           << " Allocations: " << ulong( r.allocs );
+        if( s.fun ) os << ", Function: " << s.fun;
+        os << '\n';
+    }
+    os.flush();
+    std::free( rows );
 }
-
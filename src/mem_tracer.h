@@ -6,108 +6,88 @@
 /// @file mem_tracer.h declaration of MemTracer class used to for tracking memory usage
 
 
-#include <map>
+#include <cstddef>
 #include <iostream>
-/// Memory tracer. Modified version of code found on <em>www.relisoft.com</em>
-/// Usage: store each pointer into map when memory allocated;
-/// remove pointer from map when memory deallocated;
-/// at destruction time it checks if map size is zero i.e. number of allocations ==
-/// number of deallocations in the destructor.
-/// In case map size not zero it prints a list of lines where non-deallocated memory was allocated.
+/// Memory tracer: aggregates allocations by call site, i.e. by the file,
+/// line and function passed to the overloaded operator new in dbgnew.h.
+/// Each memory chunk is preceded by a header holding its size and call
+/// site; each thread counts the allocations and deallocations it performs
+/// into its own per call site table, so recording does not take any lock:
+/// a lock is taken only the first time a thread allocates memory, sees a
+/// new call site or exits, and when tables are dumped.
+/// One allocation out of every Sampling() allocations is attributed to its
+/// call site, the per call site values reported are scaled by the sampling
+/// rate; totals are always exact.
+/// There must be one instance per program, named NewTrace (see dbgnew.h);
+/// at destruction time it prints totals and the call sites of memory not
+/// yet deallocated.
 class MemTracer {
-private:
-    /// Memory allocation entry
-    class Entry
-    {
-    public:
-        /// Constructor
-        /// @param file source file where allocation occurred
-        /// @param line line at which allocation occurred
-        /// @param fun function in which allocation occurred
-        /// @size number of allocated bytes 
-        Entry( char const* file, int line, const char* fun, std::size_t size )
-            : file_ (file), line_ (line), fun_( fun ), size_( size )
-        {}
-        /// Default constructor
-        Entry ()
-            : file_ (0), line_ (0), fun_( 0 ), size_( 0 )
-        {}
-        /// Returns the name of the file where allocation occurred 
-        char const* File () const { return file_; }
-        /// Returns the line at which allocation occurred
-        int Line () const { return line_; }
-        /// Returns the name of the function in which allocation occurred
-        const char* Fun() const { return fun_; }
-        /// Returns the number of allocated bytes
-        std::size_t Size () const { return size_; }
-    private:
-        /// Name of file where allocation occurred
-        char const * file_;
-        /// Line at which allocation occurred
-        int line_;
-        /// Name of function in which allocation occurred
-        const char* fun_;
-        /// Number of allocated bytes
-        std::size_t size_;
-    };
-    /// Locker class used to serialize access to tracer
-    class Lock
-    {
-    public:
-        /// Constructor: lock tracer upon construction
-        /// @param tracer controlled tracer
-        Lock (MemTracer& tracer)
-            : tracer_ (tracer)
-        {
-            tracer_.lock ();
-        }
-        /// Destructor: release tracer upon destruction
-        ~Lock ()
-        {
-            tracer_.unlock ();
-        }
-    private:
-        /// Reference to controlled tracer object
-        MemTracer& tracer_;
-    };
-    /// Entry Map iterator type
-    typedef std::map< void*, Entry >::iterator iterator;
-    friend class Lock;
 public:
     /// Constructor
     /// @param os output stream used to log the results
-    MemTracer ( std::ostream& os = std::clog );
+    /// @param sampling record call site of one allocation every sampling
+    ///        allocations; overridden by the MMP_TRACE_SAMPLING environment
+    ///        variable
+    MemTracer ( std::ostream& os = std::clog, unsigned sampling = 1 );
     /// Default destructor: reports memory usage
     ~MemTracer ();
-    /// Add memory allocation data into memory usage map
-    /// @param p address of first byte of allocated memory
+    /// Allocates memory chunk and records allocation
+    /// @param size number of bytes to allocate
     /// @param file name of source file where allocation occurred
     /// @param line line at which allocation occurred
     /// @param fun name of function in which allocation occurred
-    /// @param size number of allocated bytes
-    void Add ( void* p, char const * file, int line, const char* fun, std::size_t size );
-    /// Remove memory allocation data from map
-    void Remove (void* p);
-    /// Print memory usage report
+    /// @return address of first byte of allocated memory, NULL if memory
+    ///         cannot be allocated
+    static void* Allocate ( std::size_t size, char const * file, int line, const char* fun );
+    /// Releases memory chunk returned by Allocate and records deallocation
+    /// @param p address of first byte of allocated memory
+    static void Release ( void* p );
+    /// Returns the number of allocations performed so far by the calling
+    /// thread; comparing two values tells whether code run in between
+    /// allocated memory
+    static std::size_t ThreadAllocations ();
+    /// Forbids or allows allocations in the calling thread; while forbidden
+    /// any allocation prints its call site to stderr and aborts the program.
+    /// Calls nest: allocations are allowed again after as many Forbid( false )
+    /// as Forbid( true ) calls
+    /// @param f true to forbid allocations
+    static void Forbid ( bool f );
+    /// Sets sampling rate
+    /// @param n record call site of one allocation every n allocations
+    void Sampling ( unsigned n );
+    /// Returns sampling rate
+    unsigned Sampling () const;
+    /// Print memory usage report to the stream passed to the constructor
     void Dump ();
+    /// Print memory usage report: totals, then live bytes and allocation
+    /// counts of each call site, largest live bytes first; can be called at
+    /// any time from any thread
+    /// @param os output stream
+    void Dump ( std::ostream& os ) const;
     /// Set to true after initialization
     static bool Ready;
 private:
-    /// Temporary non-thread-safe implementation of lock method
-    void lock()   { lockCount_++; }
-    /// Temporary non-thread-safe implementation of unlock method
-    void unlock() { lockCount_--; }
+    /// Copy forbidden
+    MemTracer ( const MemTracer& );
+    /// Assignment forbidden
+    MemTracer& operator=( const MemTracer& );
 private:
-    /// Memory address to memory usage entry map
-    std::map< void*, Entry > map_;
-    /// Lock count: used by MemTracer::lock() and MemTracer::unlock() methods
-    /// to serialize access to instances of MemTracer class
-    int lockCount_;
     /// Output stream
     std::ostream& os_;
-    /// Allocated memory in bytes
-    std::size_t amem_;
-    /// Deallocated memory in bytes
-    std::size_t dmem_;
+};
+
+/// Forbids allocations in the calling thread for the lifetime of the object,
+/// e.g. around the steady-state execution of a compiled program.
+class NoAllocation {
+public:
+    /// Constructor: forbids allocations
+    NoAllocation () { MemTracer::Forbid( true ); }
+    /// Destructor: allows allocations again
+    ~NoAllocation () { MemTracer::Forbid( false ); }
+private:
+    /// Copy forbidden
+    NoAllocation ( const NoAllocation& );
+    /// Assignment forbidden
+    NoAllocation& operator=( const NoAllocation& );
 };
 #endif /*TRACER_H_*/
@@ -0,0 +1,576 @@
+#ifndef OPTIMIZER_H__
+#define OPTIMIZER_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file optimizer.h optimization passes over compiled programs
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <string>
+
+#include "execution.h"
+#include "def_rte.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Dead code elimination: removes the instructions whose results are
+  /// neither returned nor stored into live variables.
+  /// The returned values are the values on top of the stack when the
+  /// program ends; the other values left on the stack are discarded:
+  /// assignments whose values are not used are replaced with pop_vars
+  /// instructions, assignments to variables overwritten before being read
+  /// are removed.
+  /// Calls to procedures are always kept since procedures may update their
+  /// own variables. Programs containing instructions other than loads,
+  /// function calls, store_vars and pop_vars or assignments not compiled
+  /// into store_vars instructions are left unchanged.
+  template < class T >
+  class dead_code_eliminator {
+  public:
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+    /// Variable pointer type.
+    typedef typename rte< T >::ValPtrT ValPtrT;
+
+    /// Constructor: all variables are live when the program ends.
+    /// @param results number of values returned on top of the stack
+    explicit dead_code_eliminator( size_t results )
+      : results_( results ), all_live_( true )
+    {}
+
+    /// Constructor.
+    /// @param results number of values returned on top of the stack
+    /// @param live variables read after the program ends
+    dead_code_eliminator( size_t results, const std::vector< ValPtrT >& live )
+      : results_( results ), all_live_( false )
+    {
+      for( size_t i = 0; i != live.size(); ++i ) live_.push_back( ptr( live[ i ] ) );
+    }
+
+    /// Optimizes program in place.
+    /// @param program program
+    /// @return number of removed instructions
+    size_t operator()( prog_type& program ) const
+    {
+      const size_t n = program.size();
+      std::vector< node > nodes( n );
+      stack_type final;
+      store_map last_store;
+      if( !analyze( program, nodes, final, last_store ) ) return 0;
+      // values left on the stack, the top results_ ones are returned
+      std::vector< bool > marked( n, false );
+      // stores whose variables are read, other stores only pass values
+      std::vector< bool > stored( n, false );
+      std::vector< size_t > work;
+      const size_t first = final.size() - std::min( results_, final.size() );
+      for( size_t i = first; i != final.size(); ++i ) mark( final[ i ].first, marked, work );
+      for( typename store_map::const_iterator i = last_store.begin();
+           i != last_store.end();
+           ++i )
+      {
+        if( i->second < 0 || !live( i->first ) ) continue;
+        stored[ i->second ] = true;
+        mark( size_t( i->second ), marked, work );
+      }
+      for( size_t i = 0; i != n; ++i ) if( nodes[ i ].impure ) mark( i, marked, work );
+      // propagate; values of kept instructions read by removed instructions
+      // are popped by converting assignments or by keeping the reader
+      std::vector< bool > discard( n, false );
+      bool changed = true;
+      while( changed )
+      {
+        propagate( nodes, marked, stored, work );
+        changed = false;
+        for( size_t i = 0; i != n; ++i )
+        {
+          if( !marked[ i ] ) continue;
+          const node& d = nodes[ i ];
+          bool unused = true;
+          for( size_t k = 0; k != d.readers.size(); ++k )
+          {
+            const int r = d.readers[ k ];
+            if( r >= 0 ? marked[ r ] : d.outputs[ k ] >= first ) unused = false;
+          }
+          discard[ i ] = d.store && unused && !d.readers.empty();
+          if( discard[ i ] ) continue;
+          for( size_t k = 0; k != d.readers.size(); ++k )
+          {
+            const int r = d.readers[ k ];
+            if( r >= 0 && !marked[ r ] )
+            {
+              mark( size_t( r ), marked, work );
+              changed = true;
+            }
+          }
+        }
+      }
+      prog_type p;
+      p.reserve( n );
+      for( size_t i = 0; i != n; ++i )
+      {
+        if( !marked[ i ] || ( nodes[ i ].store && !stored[ i ] ) ) continue;
+        if( !discard[ i ] )
+        {
+          p.push_back( program[ i ] );
+          continue;
+        }
+        const store_vars< T >* sv =
+          static_cast< const store_vars< T >* >( ptr( program[ i ] ) );
+        p.push_back( typename rte< T >::InstrPtrT( new pop_vars< T >( sv->vars ) ) );
+      }
+      const size_t removed = n - p.size();
+      program.swap( p );
+      return removed;
+    }
+
+  private:
+    /// Stack of ( instruction, output index ) pairs.
+    typedef std::vector< std::pair< size_t, size_t > > stack_type;
+    /// Last instruction storing each variable.
+    typedef std::map< const value< T >*, int > store_map;
+
+    /// Instruction dependencies.
+    struct node {
+      /// Instructions computing the values read from the stack.
+      std::vector< size_t > inputs;
+      /// Instructions reading each value written to the stack, -1 if the
+      /// value is left on the stack.
+      std::vector< int > readers;
+      /// Position of each value left on the stack.
+      std::vector< size_t > outputs;
+      /// Instruction storing the variable read by load_var, -1 if the
+      /// variable is not assigned before.
+      int source;
+      /// True if instruction is a store_vars instruction.
+      bool store;
+      /// True if instruction must be kept.
+      bool impure;
+      /// Constructor.
+      node() : source( -1 ), store( false ), impure( false ) {}
+    };
+
+    /// Builds dependencies; returns false if program cannot be analyzed.
+    /// @param program program
+    /// @param[out] nodes dependencies of each instruction
+    /// @param[out] stack values left on the stack
+    /// @param[out] last_store last instruction storing each variable
+    static bool analyze( const prog_type& program, std::vector< node >& nodes,
+                         stack_type& stack, store_map& last_store )
+    {
+      for( size_t i = 0; i != program.size(); ++i )
+      {
+        const instruction< T >* in = ptr( program[ i ] );
+        node& d = nodes[ i ];
+        size_t pop = 0;
+        size_t push = 1;
+        std::vector< const value< T >* > writes;
+        if( dynamic_cast< const load_val< T >* >( in ) ) {}
+        else if( const load_var< T >* lv = dynamic_cast< const load_var< T >* >( in ) )
+        {
+          typename store_map::const_iterator s = last_store.find( ptr( lv->val_p ) );
+          d.source = s == last_store.end() ? -1 : s->second;
+        }
+        else if( const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in ) )
+        {
+          // assignments read the previous instructions
+          if( cf->fun_p->name == "=" ) return false;
+          pop = size_t( cf->fun_p->values_in );
+          push = size_t( cf->fun_p->values_out );
+          d.impure = dynamic_cast< const procedure< T >* >( ptr( cf->fun_p ) ) != 0;
+        }
+        else if( const store_vars< T >* sv = dynamic_cast< const store_vars< T >* >( in ) )
+        {
+          pop = push = sv->vars.size();
+          for( size_t k = 0; k != sv->vars.size(); ++k ) writes.push_back( ptr( sv->vars[ k ] ) );
+          d.store = true;
+        }
+        else if( const pop_vars< T >* pv = dynamic_cast< const pop_vars< T >* >( in ) )
+        {
+          pop = pv->vars.size();
+          push = 0;
+          for( size_t k = 0; k != pv->vars.size(); ++k ) writes.push_back( ptr( pv->vars[ k ] ) );
+        }
+        else return false;
+        if( stack.size() < pop ) return false;
+        for( size_t k = stack.size() - pop; k != stack.size(); ++k )
+        {
+          d.inputs.push_back( stack[ k ].first );
+          nodes[ stack[ k ].first ].readers[ stack[ k ].second ] = int( i );
+        }
+        stack.resize( stack.size() - pop );
+        d.readers.assign( push, -1 );
+        d.outputs.assign( push, 0 );
+        for( size_t k = 0; k != push; ++k ) stack.push_back( std::make_pair( i, k ) );
+        for( size_t k = 0; k != writes.size(); ++k ) last_store[ writes[ k ] ] = int( i );
+      }
+      for( size_t k = 0; k != stack.size(); ++k )
+      {
+        nodes[ stack[ k ].first ].outputs[ stack[ k ].second ] = k;
+      }
+      return true;
+    }
+
+    /// Marks instruction as live.
+    static void mark( size_t i, std::vector< bool >& marked, std::vector< size_t >& work )
+    {
+      if( marked[ i ] ) return;
+      marked[ i ] = true;
+      work.push_back( i );
+    }
+
+    /// Marks the instructions computing the values and storing the
+    /// variables read by marked instructions.
+    static void propagate( const std::vector< node >& nodes,
+                           std::vector< bool >& marked,
+                           std::vector< bool >& stored,
+                           std::vector< size_t >& work )
+    {
+      while( !work.empty() )
+      {
+        const node& d = nodes[ work.back() ];
+        work.pop_back();
+        for( size_t k = 0; k != d.inputs.size(); ++k ) mark( d.inputs[ k ], marked, work );
+        if( d.source < 0 ) continue;
+        stored[ d.source ] = true;
+        mark( size_t( d.source ), marked, work );
+      }
+    }
+
+    /// Returns true if variable is read after the program ends.
+    bool live( const value< T >* v ) const
+    {
+      return all_live_ || std::find( live_.begin(), live_.end(), v ) != live_.end();
+    }
+
+    /// Number of returned values.
+    size_t results_;
+    /// True if all variables are live when the program ends.
+    bool all_live_;
+    /// Variables read after the program ends.
+    std::vector< const value< T >* > live_;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Removes dead code from program; all variables are live when the
+  /// program ends.
+  /// @param program program
+  /// @param results number of values returned on top of the stack
+  /// @return number of removed instructions
+  template < class T >
+  size_t eliminate_dead_code( typename rte< T >::prog_type& program, size_t results )
+  {
+    return dead_code_eliminator< T >( results )( program );
+  }
+
+  //----------------------------------------------------------------------------
+  /// Common subexpression elimination: merges a set of programs into one
+  /// program computing each distinct value once.
+  /// Programs are evaluated in order, each reading the variables assigned
+  /// by the previous ones: the merged program leaves the value on top of
+  /// the stack of program i at stack position i, stores the final values
+  /// of the assigned variables and discards the other values.
+  /// Values are numbered by hashing: two calls to the same function with the
+  /// same input values compute the same value, the inputs of + and * are
+  /// sorted; loads of assigned variables read the assigned values.
+  /// Values used more than once are stored into temporary variables which
+  /// are not part of any variable table.
+  /// Functions are assumed to have no side effects; programs calling
+  /// procedures or the assignment operator, or containing instructions
+  /// other than loads, function calls, store_vars and pop_vars, cannot be
+  /// merged.
+  template < class T >
+  class common_subexpression_eliminator {
+  public:
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+    /// Variable pointer type.
+    typedef typename rte< T >::ValPtrT ValPtrT;
+    /// Instruction pointer type.
+    typedef typename rte< T >::InstrPtrT InstrPtrT;
+
+    /// Merges programs.
+    /// @param programs programs, each leaving at least one value on the stack
+    /// @param[out] merged merged program
+    /// @return false if programs cannot be merged, merged is not modified
+    bool operator()( const std::vector< prog_type >& programs,
+                     prog_type& merged ) const
+    {
+      graph g;
+      std::vector< int > roots;
+      // current value of assigned variables, in order of first assignment
+      std::vector< std::pair< ValPtrT, int > > vars;
+      for( size_t p = 0; p != programs.size(); ++p )
+      {
+        std::vector< int > stack;
+        if( !g.number( programs[ p ], stack, vars ) || stack.empty() ) return false;
+        roots.push_back( stack.back() );
+      }
+      std::vector< std::pair< ValPtrT, int > > stores;
+      for( size_t i = 0; i != vars.size(); ++i )
+      {
+        const node& d = g.nodes[ g.values[ vars[ i ].second ].first ];
+        const load_var< T >* lv = dynamic_cast< const load_var< T >* >( ptr( d.instr ) );
+        // skip x = x
+        if( !lv || ptr( lv->val_p ) != ptr( vars[ i ].first ) ) stores.push_back( vars[ i ] );
+      }
+      for( size_t i = 0; i != stores.size(); ++i ) roots.push_back( stores[ i ].second );
+      g.count_uses( roots );
+      prog_type p;
+      for( size_t i = 0; i != roots.size(); ++i ) g.emit_value( roots[ i ], p );
+      if( !stores.empty() )
+      {
+        std::vector< ValPtrT > v;
+        for( size_t i = 0; i != stores.size(); ++i ) v.push_back( stores[ i ].first );
+        p.push_back( InstrPtrT( new pop_vars< T >( v ) ) );
+      }
+      merged.swap( p );
+      return true;
+    }
+
+  private:
+    /// Instruction computing one or more values.
+    struct node {
+      /// Instruction: load_val, load_var or call_fun.
+      InstrPtrT instr;
+      /// Input values.
+      std::vector< int > inputs;
+      /// First output value.
+      int first;
+      /// Number of output values.
+      int outputs;
+      /// True if node is a load instruction, emitted at each use.
+      bool leaf;
+      /// True if node has been emitted.
+      bool emitted;
+    };
+
+    /// Value graph.
+    struct graph {
+      /// Nodes.
+      std::vector< node > nodes;
+      /// ( node, output index ) of each value.
+      std::vector< std::pair< int, int > > values;
+      /// Number of uses of each value.
+      std::vector< int > uses;
+      /// Temporary variable holding each value, if any.
+      std::vector< ValPtrT > temps;
+      /// Value of each constant, indexed by bit pattern.
+      std::map< std::string, int > constants;
+      /// Initial value of each variable.
+      std::map< const value< T >*, int > variables;
+      /// First value of each call.
+      std::map< std::pair< const function_i< T >*, std::vector< int > >, int > calls;
+
+      /// Adds node, returns its first value.
+      int add_node( const InstrPtrT& in, const std::vector< int >& inputs,
+               int outputs, bool leaf )
+      {
+        node d = { in, inputs, int( values.size() ), outputs, leaf, false };
+        for( int k = 0; k != outputs; ++k )
+        {
+          values.push_back( std::make_pair( int( nodes.size() ), k ) );
+        }
+        nodes.push_back( d );
+        return d.first;
+      }
+
+      /// Numbers the values computed by a program.
+      /// @param program program
+      /// @param[out] stack values left on the stack
+      /// @param vars current values of assigned variables
+      /// @return false if program cannot be numbered
+      bool number( const prog_type& program, std::vector< int >& stack,
+                   std::vector< std::pair< ValPtrT, int > >& vars )
+      {
+        typedef binary_function< T > bf_type;
+        for( size_t i = 0; i != program.size(); ++i )
+        {
+          const instruction< T >* in = ptr( program[ i ] );
+          if( const load_val< T >* lv = dynamic_cast< const load_val< T >* >( in ) )
+          {
+            const std::string key( reinterpret_cast< const char* >( &lv->val ), sizeof( T ) );
+            typename std::map< std::string, int >::const_iterator c = constants.find( key );
+            const int v = c != constants.end() ? c->second
+                          : ( constants[ key ] = add_node( program[ i ], std::vector< int >(), 1, true ) );
+            stack.push_back( v );
+          }
+          else if( const load_var< T >* lv = dynamic_cast< const load_var< T >* >( in ) )
+          {
+            const value< T >* var = ptr( lv->val_p );
+            int v = -1;
+            for( size_t k = 0; k != vars.size(); ++k )
+            {
+              if( ptr( vars[ k ].first ) == var ) v = vars[ k ].second;
+            }
+            if( v < 0 )
+            {
+              typename std::map< const value< T >*, int >::const_iterator c = variables.find( var );
+              v = c != variables.end() ? c->second
+                  : ( variables[ var ] = add_node( program[ i ], std::vector< int >(), 1, true ) );
+            }
+            stack.push_back( v );
+          }
+          else if( const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( in ) )
+          {
+            const function_i< T >* f = ptr( cf->fun_p );
+            if( f->name == "=" || dynamic_cast< const procedure< T >* >( f ) ) return false;
+            const size_t n = size_t( f->values_in );
+            if( stack.size() < n ) return false;
+            std::vector< int > inputs( stack.end() - n, stack.end() );
+            stack.resize( stack.size() - n );
+            const function< bf_type, T >* b = dynamic_cast< const function< bf_type, T >* >( f );
+            if( b && ( b->fun.f == &add< T > || b->fun.f == &mul< T > ) )
+            {
+              std::sort( inputs.begin(), inputs.end() );
+            }
+            const std::pair< const function_i< T >*, std::vector< int > > key( f, inputs );
+            typename std::map< std::pair< const function_i< T >*, std::vector< int > >, int >
+              ::const_iterator c = calls.find( key );
+            const int v = c != calls.end() ? c->second
+                          : ( calls[ key ] = add_node( program[ i ], inputs, f->values_out, false ) );
+            for( int k = 0; k != f->values_out; ++k ) stack.push_back( v + k );
+          }
+          else
+          {
+            const store_vars< T >* sv = dynamic_cast< const store_vars< T >* >( in );
+            const pop_vars< T >* pv = dynamic_cast< const pop_vars< T >* >( in );
+            if( !sv && !pv ) return false;
+            const std::vector< ValPtrT >& v = sv ? sv->vars : pv->vars;
+            if( stack.size() < v.size() ) return false;
+            const size_t base = stack.size() - v.size();
+            for( size_t k = 0; k != v.size(); ++k )
+            {
+              size_t j = 0;
+              while( j != vars.size() && ptr( vars[ j ].first ) != ptr( v[ k ] ) ) ++j;
+              if( j == vars.size() ) vars.push_back( std::make_pair( v[ k ], 0 ) );
+              vars[ j ].second = stack[ base + k ];
+            }
+            if( pv ) stack.resize( base );
+          }
+        }
+        return true;
+      }
+
+      /// Counts the uses of the values reachable from roots.
+      void count_uses( const std::vector< int >& roots )
+      {
+        uses.assign( values.size(), 0 );
+        temps.resize( values.size() );
+        std::vector< bool > visited( nodes.size(), false );
+        std::vector< int > work;
+        for( size_t i = 0; i != roots.size(); ++i )
+        {
+          ++uses[ roots[ i ] ];
+          work.push_back( values[ roots[ i ] ].first );
+        }
+        while( !work.empty() )
+        {
+          const int n = work.back();
+          work.pop_back();
+          if( visited[ n ] ) continue;
+          visited[ n ] = true;
+          const std::vector< int >& in = nodes[ n ].inputs;
+          for( size_t k = 0; k != in.size(); ++k )
+          {
+            ++uses[ in[ k ] ];
+            work.push_back( values[ in[ k ] ].first );
+          }
+        }
+      }
+
+      /// Emits the instructions pushing a value on the stack.
+      void emit_value( int v, prog_type& p )
+      {
+        node& d = nodes[ values[ v ].first ];
+        if( d.leaf )
+        {
+          p.push_back( d.instr );
+          return;
+        }
+        if( !d.emitted )
+        {
+          emit_node( d, p );
+          if( d.outputs == 1 )
+          {
+            if( uses[ v ] == 1 ) return;
+            // first use: store and leave the value on the stack
+            temps[ v ] = ValPtrT( new value< T >( "" ) );
+            p.push_back( InstrPtrT( new store_vars< T >( std::vector< ValPtrT >( 1, temps[ v ] ) ) ) );
+            return;
+          }
+          std::vector< ValPtrT > t;
+          for( int k = 0; k != d.outputs; ++k )
+          {
+            temps[ d.first + k ] = ValPtrT( new value< T >( "" ) );
+            t.push_back( temps[ d.first + k ] );
+          }
+          p.push_back( InstrPtrT( new pop_vars< T >( t ) ) );
+        }
+        p.push_back( InstrPtrT( new load_var< T >( temps[ v ] ) ) );
+      }
+
+      /// Emits the instructions computing the outputs of a node; the
+      /// outputs of a node with multiple outputs read in order by a single
+      /// input sequence are left on the stack.
+      void emit_node( node& d, prog_type& p )
+      {
+        d.emitted = true;
+        const std::vector< int >& in = d.inputs;
+        for( size_t j = 0; j != in.size(); )
+        {
+          node& s = nodes[ values[ in[ j ] ].first ];
+          bool consecutive = !s.leaf && !s.emitted && s.outputs > 1
+                             && in[ j ] == s.first && j + s.outputs <= in.size();
+          for( int k = 0; consecutive && k != s.outputs; ++k )
+          {
+            consecutive = in[ j + k ] == s.first + k && uses[ s.first + k ] == 1;
+          }
+          if( consecutive )
+          {
+            emit_node( s, p );
+            j += s.outputs;
+          }
+          else emit_value( in[ j++ ], p );
+        }
+        p.push_back( d.instr );
+      }
+    };
+  };
+
+  //----------------------------------------------------------------------------
+  /// Merges programs sharing common subexpressions.
+  /// @param programs programs
+  /// @param[out] merged merged program, leaving the value on top of the
+  /// stack of program i at stack position i
+  /// @return false if programs cannot be merged
+  template < class T >
+  bool eliminate_common_subexpressions(
+         const std::vector< typename rte< T >::prog_type >& programs,
+         typename rte< T >::prog_type& merged )
+  {
+    return common_subexpression_eliminator< T >()( programs, merged );
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // OPTIMIZER_H__
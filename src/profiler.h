@@ -0,0 +1,441 @@
+#ifndef PROFILER_H__
+#define PROFILER_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file profiler.h definition of profiling executor and profile data
+
+#include <vector>
+#include <map>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#if !defined( MMP_PROFILE_NANOSECONDS ) && defined( __GNUC__ ) \
+    && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#include <x86intrin.h>
+#define MMP_PROFILE_RDTSC
+#elif !defined( MMP_PROFILE_NANOSECONDS ) && defined( _MSC_VER ) \
+    && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+#include <intrin.h>
+#define MMP_PROFILE_RDTSC
+#else
+#include <chrono>
+#endif
+
+#include "execution.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Time source used by the profiler: cycles read through rdtsc where
+  /// available, nanoseconds from a steady clock otherwise.
+  /// #define MMP_PROFILE_NANOSECONDS to always use the steady clock.
+  struct profile_clock {
+    /// Tick type.
+    typedef unsigned long long ticks_type;
+    /// Unit name used in reports.
+    static const char* unit()
+    {
+#ifdef MMP_PROFILE_RDTSC
+      return "cycles";
+#else
+      return "ns";
+#endif
+    }
+    /// Returns current tick count.
+    static ticks_type now()
+    {
+#ifdef MMP_PROFILE_RDTSC
+      return __rdtsc();
+#else
+      return ticks_type( std::chrono::duration_cast< std::chrono::nanoseconds >(
+               std::chrono::steady_clock::now().time_since_epoch() ).count() );
+#endif
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Returns a short description of an instruction: function name for
+  /// function calls, instruction kind for loads.
+  /// @param i reference to instruction
+  template < class T >
+  std::string instruction_name( const instruction< T >& i )
+  {
+    if( const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( &i ) )
+    {
+      return cf->fun_p->name;
+    }
+    if( dynamic_cast< const load_val< T >* >( &i ) ) return "load_val";
+    if( const load_param< T >* lp = dynamic_cast< const load_param< T >* >( &i ) )
+    {
+      return "load_param " + lp->val_p->name;
+    }
+    if( const load_var< T >* lv = dynamic_cast< const load_var< T >* >( &i ) )
+    {
+      return "load_var " + lv->val_p->name;
+    }
+    if( const store_vars< T >* sv = dynamic_cast< const store_vars< T >* >( &i ) )
+    {
+      std::string n( "store_vars" );
+      for( size_t k = 0; k != sv->vars.size(); ++k ) n += " " + sv->vars[ k ]->name;
+      return n;
+    }
+    if( const pop_vars< T >* pv = dynamic_cast< const pop_vars< T >* >( &i ) )
+    {
+      std::string n( "pop_vars" );
+      for( size_t k = 0; k != pv->vars.size(); ++k ) n += " " + pv->vars[ k ]->name;
+      return n;
+    }
+    if( const jump< T >* j = dynamic_cast< const jump< T >* >( &i ) )
+    {
+      std::ostringstream os;
+      os << "jump " << ( j->offset < 0 ? "" : "+" ) << j->offset;
+      return os.str();
+    }
+    if( const jump_if< T >* j = dynamic_cast< const jump_if< T >* >( &i ) )
+    {
+      std::ostringstream os;
+      os << ( j->when ? "jump_if_not_zero +" : "jump_if_zero +" ) << j->offset;
+      return os.str();
+    }
+    return "instruction";
+  }
+
+  //----------------------------------------------------------------------------
+  /// Profile data shared by one or more profiling executors.
+  /// Counters are recorded per (scope, instruction index) where scope is
+  /// the label assigned to each executor, e.g. the name of a procedure;
+  /// the top-level program has an empty scope.
+  /// Time spent inside a procedure is recorded both in the instruction
+  /// calling the procedure (inclusive) and in the procedure's own scope;
+  /// percentages are computed against the time spent in the top-level scope.
+  class profiler {
+  public:
+    /// Tick type.
+    typedef profile_clock::ticks_type ticks_type;
+
+    /// Counters associated to a single instruction.
+    struct counter {
+      /// Number of times the instruction was executed.
+      ticks_type calls;
+      /// Cumulative ticks.
+      ticks_type ticks;
+      /// Constructor.
+      counter() : calls( 0 ), ticks( 0 ) {}
+    };
+
+    /// Per-program record.
+    struct record {
+      /// Scope label.
+      std::string scope;
+      /// Address of first instruction, used to detect program changes.
+      const void* first;
+      /// Instruction names, filled by the executor.
+      std::vector< std::string > names;
+      /// Per-instruction counters.
+      std::vector< counter > counters;
+      /// Constructor.
+      record() : first( 0 ) {}
+    };
+
+    /// Aggregated entry used in reports.
+    struct entry {
+      /// Scope label.
+      std::string scope;
+      /// Instruction index or -1 for per-name entries.
+      long ip;
+      /// Instruction or function name.
+      std::string name;
+      /// Number of calls.
+      ticks_type calls;
+      /// Cumulative ticks.
+      ticks_type ticks;
+    };
+
+    /// Constructor.
+    /// @param enabled initial state
+    profiler( bool enabled = true ) : enabled_( enabled ) {}
+
+    /// Returns true if profiling is enabled.
+    bool enabled() const { return enabled_; }
+
+    /// Enables/disables profiling.
+    void enabled( bool e ) { enabled_ = e; }
+
+    /// Returns record associated to program; the record is created the first
+    /// time a (scope, program) pair is seen and reset whenever the program
+    /// content changes.
+    /// @param scope scope label
+    /// @param prog program address, used as key only
+    /// @param size number of instructions in program
+    /// @param first address of first instruction
+    record& get( const std::string& scope, const void* prog, size_t size,
+                 const void* first )
+    {
+      record& r = records_[ key_type( scope, prog ) ];
+      if( r.counters.size() != size || r.first != first )
+      {
+        r.scope = scope;
+        r.first = first;
+        r.counters.assign( size, counter() );
+        r.names.assign( size, std::string() );
+      }
+      return r;
+    }
+
+    /// Clears all counters.
+    void reset() { records_.clear(); }
+
+    /// Returns per-instruction entries sorted by cumulative ticks.
+    std::vector< entry > instructions() const
+    {
+      std::vector< entry > ev;
+      for( const_iterator i = records_.begin(); i != records_.end(); ++i )
+      {
+        const record& r = i->second;
+        for( size_t ip = 0; ip != r.counters.size(); ++ip )
+        {
+          if( !r.counters[ ip ].calls ) continue;
+          entry e = { r.scope, long( ip ), r.names[ ip ],
+                      r.counters[ ip ].calls, r.counters[ ip ].ticks };
+          ev.push_back( e );
+        }
+      }
+      std::sort( ev.begin(), ev.end(), by_ticks() );
+      return ev;
+    }
+
+    /// Returns entries aggregated by (scope, name) sorted by cumulative ticks.
+    std::vector< entry > functions() const
+    {
+      typedef std::map< std::pair< std::string, std::string >, entry > M;
+      M m;
+      for( const_iterator i = records_.begin(); i != records_.end(); ++i )
+      {
+        const record& r = i->second;
+        for( size_t ip = 0; ip != r.counters.size(); ++ip )
+        {
+          if( !r.counters[ ip ].calls ) continue;
+          const entry init = { r.scope, -1, r.names[ ip ], 0, 0 };
+          entry& e = m.insert( M::value_type(
+                       std::make_pair( r.scope, r.names[ ip ] ), init ) ).first->second;
+          e.calls += r.counters[ ip ].calls;
+          e.ticks += r.counters[ ip ].ticks;
+        }
+      }
+      std::vector< entry > ev;
+      for( M::const_iterator i = m.begin(); i != m.end(); ++i )
+      {
+        ev.push_back( i->second );
+      }
+      std::sort( ev.begin(), ev.end(), by_ticks() );
+      return ev;
+    }
+
+    /// Returns total number of ticks spent in top-level scope.
+    ticks_type total() const
+    {
+      ticks_type t = 0;
+      for( const_iterator i = records_.begin(); i != records_.end(); ++i )
+      {
+        if( !i->second.scope.empty() ) continue;
+        for( size_t ip = 0; ip != i->second.counters.size(); ++ip )
+        {
+          t += i->second.counters[ ip ].ticks;
+        }
+      }
+      return t;
+    }
+
+    /// Prints per-function and per-instruction tables sorted by cost.
+    /// @param os output stream
+    void print( std::ostream& os ) const
+    {
+      const double t = double( total() );
+      os << "PROFILE (" << profile_clock::unit() << ")\n";
+      os << "FUNCTIONS\n";
+      print_entries( os, functions(), t, false );
+      os << "INSTRUCTIONS\n";
+      print_entries( os, instructions(), t, true );
+    }
+
+    /// Writes one tab separated line per instruction:
+    /// scope ip name calls ticks; the first line is a header.
+    /// An empty scope is written as '-'.
+    /// @param os output stream
+    void dump( std::ostream& os ) const
+    {
+      os << "scope\tip\tname\tcalls\t" << profile_clock::unit() << '\n';
+      const std::vector< entry > ev = instructions();
+      for( size_t i = 0; i != ev.size(); ++i )
+      {
+        os << ( ev[ i ].scope.empty() ? "-" : ev[ i ].scope ) << '\t'
+           << ev[ i ].ip << '\t' << ev[ i ].name << '\t'
+           << ev[ i ].calls << '\t' << ev[ i ].ticks << '\n';
+      }
+    }
+
+  private:
+    /// Record key: scope and program address.
+    typedef std::pair< std::string, const void* > key_type;
+    /// Record iterator.
+    typedef std::map< key_type, record >::const_iterator const_iterator;
+
+    /// Sorts entries by decreasing tick count.
+    struct by_ticks {
+      /// Comparison.
+      bool operator()( const entry& e1, const entry& e2 ) const
+      {
+        return e1.ticks > e2.ticks;
+      }
+    };
+
+    /// Prints entries as a table.
+    static void print_entries( std::ostream& os,
+                               const std::vector< entry >& ev,
+                               double total, bool print_ip )
+    {
+      for( size_t i = 0; i != ev.size(); ++i )
+      {
+        const std::string label = ev[ i ].scope.empty() ? ev[ i ].name
+                                    : ev[ i ].scope + ':' + ev[ i ].name;
+        os << std::setw( 8 ) << std::fixed << std::setprecision( 2 )
+           << ( total > 0 ? 100.0 * double( ev[ i ].ticks ) / total : 0.0 )
+           << "% " << std::setw( 14 ) << ev[ i ].ticks
+           << std::setw( 10 ) << ev[ i ].calls << "  ";
+        if( print_ip ) os << '[' << ev[ i ].ip << "] ";
+        os << label << '\n';
+      }
+      os.unsetf( std::ios::floatfield );
+    }
+
+    /// Records.
+    std::map< key_type, record > records_;
+    /// Enabled flag.
+    bool enabled_;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Virtual machine recording per-instruction call counts and cumulative
+  /// ticks into a profiler object.
+  /// When no profiler is set or the profiler is disabled the run() function
+  /// executes the same loop as vm< RteT >::run() after a single check and
+  /// does not allocate memory either; recording may allocate.
+  template < class RteT > class profiling_vm : public executor< RteT > {
+  public:
+
+    /// Type alias for program.
+    typedef typename executor< RteT >::prog_type prog_type;
+
+    /// Type alias for value type.
+    typedef typename executor< RteT >::value_type value_type;
+
+    /// Constructor.
+    /// @param rt reference to run-time environment
+    /// @param p profiler, can be shared among executors
+    /// @param scope label used to identify the executed program in reports
+    profiling_vm( const RteT& rt,
+                  const shared_ptr< profiler >& p = shared_ptr< profiler >(),
+                  const std::string& scope = "" )
+      : rte_( rt ), profiler_( p ), scope_( scope )
+    {}
+
+    /// Destructor.
+    virtual ~profiling_vm() {}
+
+    /// Returns reference to run-time environment.
+    const RteT& rte() const { return rte_; }
+
+    /// Returns reference to run-time environment.
+    virtual RteT& rte() { return rte_; }
+
+    /// Returns constant reference to instruction array.
+    const prog_type* prog() const { return rte_.prog_p; }
+
+    /// Sets run-time environment.
+    void rte( const RteT& rt ) { rte_ = rt; }
+
+    /// Sets instruction array and reserves stack space for its execution.
+    void prog( prog_type* pr ) { rte_.prog_p = pr; reserve(); }
+
+    /// Returns profiler.
+    const shared_ptr< profiler >& get_profiler() const { return profiler_; }
+
+    /// Sets profiler.
+    void set_profiler( const shared_ptr< profiler >& p ) { profiler_ = p; }
+
+    /// Iterates through instruction array and executes each instruction,
+    /// recording the time spent in each instruction if profiling enabled.
+    /// @param i entry point
+    void run( typename prog_type::size_type i = 0 )
+    {
+      const prog_type& prog = *rte_.prog_p;
+      const typename prog_type::size_type end = prog.size();
+      rte_.ip = i;
+      if( !profiler_ || !profiler_->enabled() )
+      {
+        while( rte_.ip != end )
+        {
+          prog[ rte_.ip ]->exec( rte_ );
+          ++rte_.ip;
+        }
+        return;
+      }
+      profiler::record& r = profiler_->get( scope_, &prog, end,
+                                    end ? ptr( prog[ 0 ] ) : 0 );
+      profiler::counter* c = r.counters.empty() ? 0 : &r.counters[ 0 ];
+      while( rte_.ip != end )
+      {
+        const typename prog_type::size_type ip = rte_.ip;
+        const profile_clock::ticks_type t = profile_clock::now();
+        prog[ ip ]->exec( rte_ );
+        c[ ip ].ticks += profile_clock::now() - t;
+        ++c[ ip ].calls;
+        ++rte_.ip;
+      }
+      for( typename prog_type::size_type n = 0; n != end; ++n )
+      {
+        if( r.names[ n ].empty() ) r.names[ n ] = instruction_name( *prog[ n ] );
+      }
+    }
+
+  private:
+
+    /// Reserves stack space for the execution of the current program, as
+    /// vm< RteT > does.
+    void reserve()
+    {
+      if( rte_.prog_p ) rte_.stack.reserve( max_stack_depth( *rte_.prog_p ) );
+    }
+
+    /// Run-time environment.
+    RteT rte_;
+    /// Profiler.
+    shared_ptr< profiler > profiler_;
+    /// Scope label.
+    std::string scope_;
+  };
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // PROFILER_H__
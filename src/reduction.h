@@ -0,0 +1,430 @@
+#ifndef REDUCTION_H__
+#define REDUCTION_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file reduction.h streaming reductions of the values computed by batch
+/// executors: statistics and histograms accumulated one block at a time
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "compiler.h"
+#include "execution.h"
+#include "math_parser.h"
+#include "batch.h"
+#include "expression_set.h"
+#include "optimizer.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Summation algorithms.
+  enum summation {
+    NAIVE_SUM,   ///< Running sum.
+    KAHAN_SUM,   ///< Compensated (Kahan-Babuska) running sum.
+    PAIRWISE_SUM ///< Pairwise sum of each block, block sums added pairwise.
+  };
+
+  //----------------------------------------------------------------------------
+  /// Reduction of a sequence of values, each one identified by its row
+  /// index: number of values, sum, mean, minimum and maximum with the row
+  /// at which they first occur, and optionally a histogram. Values are added
+  /// one block at a time, e.g. the results of a block evaluated by a
+  /// batch_executor (see batch_executor::fold()), so that the values never
+  /// need to be stored; partial reductions of consecutive ranges of rows,
+  /// e.g. computed by different threads, are combined with merge().
+  /// NaN values are counted by nans() and excluded from all the other
+  /// statistics.
+  /// The sum of the same values added in the same blocks and merged in the
+  /// same order does not depend on the thread computing each partial
+  /// reduction; KAHAN_SUM and PAIRWISE_SUM bound the rounding error to a
+  /// few ulps (KAHAN_SUM) or O(log n) ulps (PAIRWISE_SUM) instead of O(n).
+  template < class T > class reduction {
+  public:
+    /// Constructor.
+    /// @param s summation algorithm
+    explicit reduction( summation s = KAHAN_SUM )
+      : summation_( s ), count_( 0 ), nans_( 0 ), sum_( T() ), comp_( T() ),
+        min_( T() ), max_( T() ), argmin_( 0 ), argmax_( 0 ), levels_( 0 ),
+        lo_( T() ), hi_( T() ), below_( 0 ), above_( 0 )
+    {}
+
+    /// Enables histogram: n bins of equal width covering [lo, hi).
+    /// @param lo lower bound
+    /// @param hi upper bound
+    /// @param n number of bins
+    void histogram( T lo, T hi, size_t n )
+    {
+      lo_ = lo;
+      hi_ = hi;
+      bins_.assign( n, 0 );
+    }
+
+    /// Adds block of values.
+    /// @param v values
+    /// @param n number of values
+    /// @param first row index of the first value
+    void add( const T* v, size_t n, size_t first )
+    {
+      size_t count = 0;
+      for( size_t i = 0; i != n; ++i )
+      {
+        const T x = v[ i ];
+        if( x != x ) continue;
+        if( !count_ && !count ) { min_ = max_ = x; argmin_ = argmax_ = first + i; }
+        if( x < min_ ) { min_ = x; argmin_ = first + i; }
+        if( x > max_ ) { max_ = x; argmax_ = first + i; }
+        ++count;
+      }
+      count_ += count;
+      nans_ += n - count;
+      // NaN values are added as zero
+      switch( summation_ )
+      {
+      case NAIVE_SUM:
+        for( size_t i = 0; i != n; ++i ) sum_ += v[ i ] == v[ i ] ? v[ i ] : T();
+        break;
+      case KAHAN_SUM:
+        for( size_t i = 0; i != n; ++i ) compensated( v[ i ] == v[ i ] ? v[ i ] : T() );
+        break;
+      case PAIRWISE_SUM:
+        push( pairwise( v, n ), 0 );
+        break;
+      }
+      if( bins_.empty() ) return;
+      const T scale = T( bins_.size() ) / ( hi_ - lo_ );
+      for( size_t i = 0; i != n; ++i )
+      {
+        const T x = v[ i ];
+        if( x != x ) continue;
+        if( x < lo_ ) ++below_;
+        else if( x >= hi_ ) ++above_;
+        else ++bins_[ std::min( size_t( ( x - lo_ ) * scale ), bins_.size() - 1 ) ];
+      }
+    }
+
+    /// Adds partial reduction of the rows following the rows added so far;
+    /// r must have the same summation algorithm and histogram bins.
+    /// @param r partial reduction
+    void merge( const reduction& r )
+    {
+      if( r.count_ )
+      {
+        if( !count_ || r.min_ < min_ ) { min_ = r.min_; argmin_ = r.argmin_; }
+        if( !count_ || r.max_ > max_ ) { max_ = r.max_; argmax_ = r.argmax_; }
+      }
+      count_ += r.count_;
+      nans_ += r.nans_;
+      switch( summation_ )
+      {
+      case NAIVE_SUM:
+        sum_ += r.sum_;
+        break;
+      case KAHAN_SUM:
+        compensated( r.sum_ );
+        compensated( r.comp_ );
+        break;
+      case PAIRWISE_SUM:
+        for( unsigned l = 0; l != LEVELS; ++l )
+        {
+          if( r.levels_ & ( level_mask( 1 ) << l ) ) push( r.level_[ l ], l );
+        }
+        break;
+      }
+      below_ += r.below_;
+      above_ += r.above_;
+      for( size_t b = 0; b != std::min( bins_.size(), r.bins_.size() ); ++b )
+      {
+        bins_[ b ] += r.bins_[ b ];
+      }
+    }
+
+    /// Returns summation algorithm.
+    summation algorithm() const { return summation_; }
+
+    /// Returns number of values, NaN values excluded.
+    size_t count() const { return count_; }
+
+    /// Returns number of NaN values.
+    size_t nans() const { return nans_; }
+
+    /// Returns sum.
+    T sum() const
+    {
+      if( summation_ == KAHAN_SUM ) return sum_ + comp_;
+      if( summation_ != PAIRWISE_SUM ) return sum_;
+      // earlier rows are in the higher levels
+      T s = T();
+      for( unsigned l = LEVELS; l != 0; --l )
+      {
+        if( levels_ & ( level_mask( 1 ) << ( l - 1 ) ) ) s += level_[ l - 1 ];
+      }
+      return s;
+    }
+
+    /// Returns mean, NaN if there are no values.
+    T mean() const { return count_ ? sum() / T( count_ ) : nan(); }
+
+    /// Returns minimum, NaN if there are no values.
+    T min() const { return count_ ? min_ : nan(); }
+
+    /// Returns maximum, NaN if there are no values.
+    T max() const { return count_ ? max_ : nan(); }
+
+    /// Returns row of the first occurrence of the minimum.
+    size_t argmin() const { return argmin_; }
+
+    /// Returns row of the first occurrence of the maximum.
+    size_t argmax() const { return argmax_; }
+
+    /// Returns histogram bins, empty if histogram not enabled.
+    const std::vector< size_t >& bins() const { return bins_; }
+
+    /// Returns number of values below the histogram range.
+    size_t below() const { return below_; }
+
+    /// Returns number of values above the histogram range.
+    size_t above() const { return above_; }
+
+  private:
+    /// Bit set type of pairwise sum levels.
+    typedef unsigned long long level_mask;
+
+    /// Maximum number of pairwise sum levels.
+    static const unsigned LEVELS = 64;
+
+    /// Returns quiet NaN.
+    static T nan() { return std::numeric_limits< T >::quiet_NaN(); }
+
+    /// Adds value to compensated sum.
+    void compensated( T x )
+    {
+      const T t = sum_ + x;
+      if( std::abs( sum_ ) >= std::abs( x ) ) comp_ += ( sum_ - t ) + x;
+      else comp_ += ( x - t ) + sum_;
+      sum_ = t;
+    }
+
+    /// Adds partial sum at given pairwise level, adding equal levels as
+    /// in a binary counter.
+    /// @param s sum
+    /// @param l level
+    void push( T s, unsigned l )
+    {
+      for( ; levels_ & ( level_mask( 1 ) << l ); ++l )
+      {
+        s = level_[ l ] + s;
+        levels_ &= ~( level_mask( 1 ) << l );
+        // the last level accumulates
+        if( l + 1 == LEVELS ) break;
+      }
+      level_[ l ] = s;
+      levels_ |= level_mask( 1 ) << l;
+    }
+
+    /// Returns pairwise sum of values, NaN values added as zero.
+    static T pairwise( const T* v, size_t n )
+    {
+      if( n <= 8 )
+      {
+        T s = T();
+        for( size_t i = 0; i != n; ++i ) s += v[ i ] == v[ i ] ? v[ i ] : T();
+        return s;
+      }
+      return pairwise( v, n / 2 ) + pairwise( v + n / 2, n - n / 2 );
+    }
+
+    /// Summation algorithm.
+    summation summation_;
+    /// Number of values, NaN values excluded.
+    size_t count_;
+    /// Number of NaN values.
+    size_t nans_;
+    /// Sum.
+    T sum_;
+    /// Compensation term of KAHAN_SUM.
+    T comp_;
+    /// Minimum.
+    T min_;
+    /// Maximum.
+    T max_;
+    /// Row of minimum.
+    size_t argmin_;
+    /// Row of maximum.
+    size_t argmax_;
+    /// Pairwise sums, one per level: level l sums 2^l blocks.
+    T level_[ LEVELS ];
+    /// Levels in use.
+    level_mask levels_;
+    /// Histogram lower bound.
+    T lo_;
+    /// Histogram upper bound.
+    T hi_;
+    /// Number of values below lo_.
+    size_t below_;
+    /// Number of values not below hi_.
+    size_t above_;
+    /// Histogram bins.
+    std::vector< size_t > bins_;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Creates the workers of a multithreaded evaluation: each worker holds a
+  /// copy of the run-time environment with copies of its variables and a
+  /// program compiled against it, so that threads do not share values.
+  /// Programs are compiled by the calling thread, which receives the
+  /// compilation errors. Procedures are not safe to call concurrently: if
+  /// the program calls one, a single worker is created.
+  /// @param rt run-time environment
+  /// @param threads maximum number of workers
+  /// @param compile called with each new worker, compiles its program
+  ///        against its environment and sets up its evaluator
+  /// @return one to threads workers
+  template < class WorkerT, class T, class CompileT >
+  std::vector< shared_ptr< WorkerT > >
+  create_workers( const rte< T >& rt, unsigned threads, CompileT compile )
+  {
+    std::vector< shared_ptr< WorkerT > > workers;
+    for( unsigned t = 0; t == 0 || t < threads; ++t )
+    {
+      shared_ptr< WorkerT > w( new WorkerT );
+      w->rt = rt;
+      for( size_t v = 0; v != w->rt.var_tab.size(); ++v )
+      {
+        w->rt.var_tab[ v ] = typename rte< T >::ValPtrT(
+          new value< T >( rt.var_tab[ v ]->name, rt.var_tab[ v ]->val ) );
+      }
+      compile( *w );
+      workers.push_back( w );
+      for( typename rte< T >::prog_type::const_iterator i = w->program.begin();
+           t == 0 && i != w->program.end();
+           ++i )
+      {
+        const call_fun< T >* cf = dynamic_cast< const call_fun< T >* >( ptr( *i ) );
+        if( cf && dynamic_cast< const procedure< T >* >( ptr( cf->fun_p ) ) ) return workers;
+      }
+    }
+    return workers;
+  }
+
+  //----------------------------------------------------------------------------
+  /// Default number of rows of the partial reductions of reduce_expressions().
+  static const size_t REDUCTION_CHUNK = 1 << 16;
+
+  //----------------------------------------------------------------------------
+  /// Evaluates a set of expressions over the rows of input columns and
+  /// reduces the values of each expression, without storing them.
+  /// The rows are split into chunks of the same size reduced separately by
+  /// worker threads, and the partial reductions are merged in row order:
+  /// the results do not depend on the number of threads. Each thread
+  /// evaluates its own copy of the program (see create_workers()).
+  /// @code
+  /// std::vector< std::pair< std::string, column< double > > > cols;
+  /// cols.push_back( std::make_pair( "x", column< double >( &x[ 0 ] ) ) );
+  /// std::vector< reduction< double > > r =
+  ///   reduce_expressions( mp, c, rt, exprs, cols, x.size(),
+  ///                       reduction< double >( PAIRWISE_SUM ) );
+  /// @endcode
+  /// @param mp parser
+  /// @param c compiler
+  /// @param rt run-time environment used to resolve names
+  /// @param exprs expressions, each one reduced to its top of stack value
+  /// @param columns input columns, bound to the variables with the same name
+  /// @param rows number of rows
+  /// @param init empty reduction, copied for each expression and chunk
+  /// @param threads number of threads, 0 for one per hardware thread
+  /// @param chunk number of rows of each partial reduction
+  /// @param block number of rows evaluated at once
+  /// @return one reduction per expression
+  template < class T >
+  std::vector< reduction< T > >
+  reduce_expressions( const math_parser& mp, const compiler< T >& c,
+                      const rte< T >& rt, const std::vector< std::string >& exprs,
+                      const std::vector< std::pair< std::string, column< T > > >& columns,
+                      size_t rows, const reduction< T >& init, unsigned threads = 0,
+                      size_t chunk = REDUCTION_CHUNK,
+                      size_t block = batch_executor< T >::DEFAULT_BLOCK )
+  {
+    typedef typename rte< T >::prog_type prog_type;
+    // program, environment and executor private to a thread
+    struct worker {
+      rte< T > rt;
+      prog_type program;
+      shared_ptr< batch_executor< T > > executor;
+    };
+    if( !chunk ) chunk = REDUCTION_CHUNK;
+    const size_t chunks = ( rows + chunk - 1 ) / chunk;
+    if( !threads ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+    threads = unsigned( std::max( size_t( 1 ), std::min( size_t( threads ), chunks ) ) );
+    const std::vector< shared_ptr< worker > > workers =
+      create_workers< worker >( rt, threads, [ & ]( worker& w )
+      {
+        compiler< T > lc( c );
+        expression_set< T > es;
+        for( size_t e = 0; e != exprs.size(); ++e ) es.add( exprs[ e ], exprs[ e ] );
+        w.program = es.compile( mp, lc, w.rt );
+        dead_code_eliminator< T >( es.size(),
+          std::vector< typename rte< T >::ValPtrT >() )( w.program );
+        w.executor = shared_ptr< batch_executor< T > >(
+          new batch_executor< T >( w.program, block ) );
+        for( size_t k = 0; k != columns.size(); ++k )
+        {
+          w.executor->bind( w.rt, columns[ k ].first, columns[ k ].second );
+        }
+      } );
+    std::vector< std::vector< reduction< T > > >
+      partial( chunks, std::vector< reduction< T > >( exprs.size(), init ) );
+    std::atomic< size_t > next( 0 );
+    const auto run = [ & ]( worker& w )
+    {
+      for( size_t k = next.fetch_add( 1 ); k < chunks; k = next.fetch_add( 1 ) )
+      {
+        std::vector< reduction< T > >& r = partial[ k ];
+        w.executor->fold( k * chunk, std::min( chunk, rows - k * chunk ),
+                          [ &r ]( size_t first, size_t n, const T* const* v )
+                          {
+                            for( size_t e = 0; e != r.size(); ++e ) r[ e ].add( v[ e ], n, first );
+                          } );
+      }
+    };
+    std::vector< std::thread > pool;
+    for( size_t t = 1; t != workers.size(); ++t )
+    {
+      pool.push_back( std::thread( run, std::ref( *workers[ t ] ) ) );
+    }
+    run( *workers[ 0 ] );
+    for( size_t t = 0; t != pool.size(); ++t ) pool[ t ].join();
+    std::vector< reduction< T > > result( exprs.size(), init );
+    for( size_t k = 0; k != chunks; ++k )
+    {
+      for( size_t e = 0; e != result.size(); ++e ) result[ e ].merge( partial[ k ][ e ] );
+    }
+    return result;
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // REDUCTION_H__
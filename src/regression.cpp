@@ -0,0 +1,809 @@
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file regression.cpp regression tests, run by ctest; prints the checks
+/// failed and returns the number of failures
+
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <fstream>
+#include <cstdio>
+
+#include "compiler.h"
+#include "execution.h"
+#include "vm.h"
+#include "def_rte.h"
+#include "math_parser.h"
+#include "validation.h"
+#include "roots.h"
+#include "batch.h"
+#include "optimizer.h"
+#include "expression_set.h"
+#include "reduction.h"
+#include "column_file.h"
+#include "static_expr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+
+/// Global instance of MemTracer class; it prints by default to std::clog stream
+MemTracer NewTrace;
+#endif
+
+//-----------------------------------------------------------------------------
+
+using namespace mmath_plus;
+using std::vector;
+using std::string;
+using std::cerr;
+using std::endl;
+
+/// Number of checks failed.
+static int failures = 0;
+
+/// Reports failed check.
+#define CHECK( c ) check( c, #c, __LINE__ )
+
+/// Counts and reports failed check.
+void check( bool c, const char* text, int line )
+{
+  if( c ) return;
+  cerr << "regression.cpp:" << line << ": check failed: " << text << endl;
+  ++failures;
+}
+
+//-----------------------------------------------------------------------------
+/// Parses, compiles and runs an expression with argument count enabled.
+/// @param expr expression
+/// @param rt run-time environment
+/// @param[out] result values left on the stack, first value first
+/// @return compilation status
+status evaluate( const string& expr, rte< double >& rt, vector< double >& result )
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  rte< double >::prog_type program;
+  const status s = compile_expression( mp, c, expr, rt, program );
+  result.clear();
+  if( !s.ok() ) return s;
+  vm< rte< double > > m( rt );
+  m.prog( &program );
+  m.run();
+  for( ; !m.rte().stack.empty(); m.rte().stack.pop() )
+  {
+    result.insert( result.begin(), m.rte().stack.top() );
+  }
+  return s;
+}
+
+/// Returns true if expression compiles and evaluates to the given values.
+bool evaluates_to( const string& expr, rte< double >& rt, const vector< double >& values )
+{
+  vector< double > result;
+  if( !evaluate( expr, rt, result ).ok() || result.size() != values.size() ) return false;
+  for( size_t i = 0; i != values.size(); ++i )
+  {
+    if( std::abs( result[ i ] - values[ i ] ) > 1e-12 ) return false;
+  }
+  return true;
+}
+
+/// Runs program.
+/// @param rt run-time environment
+/// @param program program
+/// @param n number of values returned
+/// @return n values on top of the stack, first value first
+vector< double > run( rte< double >& rt, rte< double >::prog_type& program, size_t n )
+{
+  vector< double > result;
+  vm< rte< double > > m( rt );
+  m.prog( &program );
+  m.run();
+  for( ; result.size() != n && !m.rte().stack.empty(); m.rte().stack.pop() )
+  {
+    result.insert( result.begin(), m.rte().stack.top() );
+  }
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+/// Assignments used as operands: the swapped operands of = are one
+/// argument.
+void test_assignment_operand()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.variable_p( "x" )->val = 4;
+  rt.variable_p( "y" )->val = 0;
+  CHECK( evaluates_to( "sqrt(y=x)", rt, vector< double >( 1, 2 ) ) );
+  CHECK( rt.variable_p( "y" )->val == 4 );
+  CHECK( evaluates_to( "1+(y=x)", rt, vector< double >( 1, 5 ) ) );
+}
+
+/// Unary operators applied to the result of unary operators.
+void test_nested_unary_operators()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.variable_p( "x" )->val = 3;
+  rt.variable_p( "y" )->val = 5;
+  CHECK( evaluates_to( "--x", rt, vector< double >( 1, 3 ) ) );
+  CHECK( evaluates_to( "1+--x", rt, vector< double >( 1, 4 ) ) );
+  CHECK( evaluates_to( "-(-x)", rt, vector< double >( 1, 3 ) ) );
+  vector< double > xy( 1, 3 );
+  xy.push_back( 5 );
+  CHECK( evaluates_to( "--(x,y)", rt, xy ) );
+}
+
+/// Conditionals used as operands generate the values of their branches.
+void test_conditional_operand()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.variable_p( "x" )->val = 3;
+  rt.variable_p( "y" )->val = 5;
+  vector< double > r( 1, 10 );
+  r.push_back( 6 );
+  CHECK( evaluates_to( "2*if(x<y,(y,x),(x,y))", rt, r ) );
+  CHECK( evaluates_to( "if(x>y,(x,y),(y,x))*2", rt, r ) );
+  CHECK( evaluates_to( "1+if(x>y,x,y)", rt, vector< double >( 1, 6 ) ) );
+  vector< double > result;
+  CHECK( evaluate( "2*if(x<y,(y,x),x)", rt, result ).kind == INVALID_ARGUMENTS );
+}
+
+/// Precedence, associativity and value counts of operands, computed in a
+/// single scan.
+void test_operator_precedence()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.variable_p( "x" )->val = 3;
+  rt.variable_p( "y" )->val = 5;
+  rt.variable_p( "z" )->val = 7;
+  CHECK( evaluates_to( "x-y+z", rt, vector< double >( 1, 5 ) ) );
+  CHECK( evaluates_to( "x/y*z", rt, vector< double >( 1, 3. / 35 ) ) );
+  CHECK( evaluates_to( "2^3^2", rt, vector< double >( 1, 64 ) ) );
+  CHECK( evaluates_to( "-x^2", rt, vector< double >( 1, -9 ) ) );
+  CHECK( evaluates_to( "2*-x", rt, vector< double >( 1, -6 ) ) );
+  CHECK( evaluates_to( "y--x", rt, vector< double >( 1, 8 ) ) );
+  vector< double > r( 1, 8 );
+  r.push_back( 12 );
+  r.push_back( 16 );
+  CHECK( evaluates_to( "((x,y,z)+(1,1,1))*2", rt, r ) );
+  CHECK( evaluates_to( "2*((x,y,z)+(1,1,1))", rt, r ) );
+  vector< double > result;
+  CHECK( evaluate( "x+", rt, result ).kind == UNKNOWN_OPERATOR );
+  CHECK( evaluate( "1/((x,y,z)/2)", rt, result ).kind == UNKNOWN_OPERATOR );
+}
+
+/// Calls of functions returning vectors used as operands: component
+/// selection, element-wise functions, dot products and scaling.
+void test_vector_operands()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.variable_p( "x" )->val = 1;
+  rt.variable_p( "y" )->val = 2;
+  rt.variable_p( "z" )->val = 3;
+  vector< double > r( 1, 6 );
+  r.push_back( 4 );
+  r.push_back( 2 );
+  CHECK( evaluates_to( "zyx(x,y,z)*2", rt, r ) );
+  CHECK( evaluates_to( "2*zyx(x,y,z)", rt, r ) );
+  CHECK( evaluates_to( "zyx(x,y,z)+zyx(x,y,z)", rt, r ) );
+  CHECK( evaluates_to( "xy(x,y,z)*xy(z,y,x)", rt, vector< double >( 1, 7 ) ) );
+  CHECK( evaluates_to( "zyx(x,y,z)*(1,1,1)", rt, vector< double >( 1, 6 ) ) );
+  vector< double > s( 1, std::sin( 1. ) + 1 );
+  s.push_back( std::sin( 2. ) + 1 );
+  s.push_back( std::sin( 3. ) + 1 );
+  CHECK( evaluates_to( "sin((x,y,z))+(1,1,1)", rt, s ) );
+  vector< double > t( 1, 4 );
+  t.push_back( 3 );
+  t.push_back( 2 );
+  CHECK( evaluates_to( "(1,1,1)+zyx(x,y,z)", rt, t ) );
+  // procedure returning two values
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  rte< double >::val_p_tab_type args;
+  args.push_back( rte< double >::ValPtrT( new value< double >( "b" ) ) );
+  args.push_back( rte< double >::ValPtrT( new value< double >( "a" ) ) );
+  rte< double > prt( rt.base, args, rt.fun_tab );
+  procedure< double >::executor_ptr_type ex( new vm< rte< double > >( prt ) );
+  rt.fun_tab.push_back( rte< double >::FunPtrT( new procedure< double >(
+    c.compile( mp.parse( "(b,a)" ), prt ), ex, "sw", 2, 2 ) ) );
+  vector< double > sw;
+  CHECK( evaluate( "sw(x,y)", rt, sw ).ok() && sw.size() == 2 );
+  if( sw.size() == 2 )
+  {
+    CHECK( evaluates_to( "sw(x,y)*(1,10)", rt, vector< double >( 1, sw[ 0 ] + 10 * sw[ 1 ] ) ) );
+  }
+  // values miscounted by the parser are rejected by the compiler
+  rte< double >::prog_type program;
+  CHECK( c.compile( mp.parse( "zyx(x,y,z)*2" ), rt, program ).kind == INVALID_ARGUMENTS );
+}
+
+/// Dead code elimination keeps the values returned and the final values of
+/// the variables: programs with overwritten and unused assignments and
+/// values discarded below the results.
+void test_dead_code_elimination()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  const char* exprs[] = { "(a=x*2,a=y+1,a*3)", "(b=x+y,sin(x),b*2)",
+                          "(x*y,a=z,zyx(x,y,z))", "(a=x,b=a+y,(x,y,z)*2)",
+                          "(a=x,b=y*2,a+1)" };
+  const size_t results[] = { 1, 1, 3, 3, 1 };
+  const size_t removed[] = { 4, 2, 3, 0, 4 };
+  for( int k = 0; k != 5; ++k )
+  {
+    rte< double > rt = generate_default_rte< double >();
+    rt.variable_p( "x" )->val = 1;
+    rt.variable_p( "y" )->val = 2;
+    rt.variable_p( "z" )->val = 3;
+    const rte< double >::ValPtrT a( new value< double >( "a" ) );
+    const rte< double >::ValPtrT b( new value< double >( "b" ) );
+    rt.var_tab.push_back( a );
+    rt.var_tab.push_back( b );
+    rte< double >::prog_type program;
+    CHECK( compile_expression( mp, c, exprs[ k ], rt, program ).ok() );
+    rte< double >::prog_type optimized( program );
+    // the last program: only a is read after the end
+    const size_t n = k == 4
+      ? dead_code_eliminator< double >( results[ k ],
+                                        vector< rte< double >::ValPtrT >( 1, a ) )( optimized )
+      : eliminate_dead_code< double >( optimized, results[ k ] );
+    CHECK( n == removed[ k ] && optimized.size() + n == program.size() );
+    const vector< double > r = run( rt, program, results[ k ] );
+    const double va = a->val;
+    const double vb = b->val;
+    a->val = b->val = 0;
+    CHECK( r.size() == results[ k ] && run( rt, optimized, results[ k ] ) == r );
+    CHECK( a->val == va && ( k == 4 ? b->val == 0 : b->val == vb ) );
+  }
+}
+
+/// Expression sets leave the values and the variables of the programs of
+/// their expressions run in order, merged or, with conditionals,
+/// concatenated.
+void test_expression_set()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  const char* exprs[][ 4 ] = {
+    { "sqrt(x*x+y*y)", "x/sqrt(y*y+x*x)", "(a=x*y)+1", "a*2+sqrt(x*x+y*y)" },
+    { "a=x+1", "if(a>y,a,y)", "(b=a*y)+y*a", "b-a" } };
+  for( int k = 0; k != 2; ++k )
+  {
+    rte< double > rt = generate_default_rte< double >();
+    rt.variable_p( "x" )->val = 3;
+    rt.variable_p( "y" )->val = 4;
+    const rte< double >::ValPtrT a( new value< double >( "a" ) );
+    const rte< double >::ValPtrT b( new value< double >( "b" ) );
+    rt.var_tab.push_back( a );
+    rt.var_tab.push_back( b );
+    expression_set< double > es;
+    vector< rte< double >::prog_type > programs( 4 );
+    vector< double > values;
+    size_t size = 0;
+    for( int i = 0; i != 4; ++i )
+    {
+      es.add( "", exprs[ k ][ i ] );
+      CHECK( compile_expression( mp, c, exprs[ k ][ i ], rt, programs[ i ] ).ok() );
+      size += programs[ i ].size();
+      values.push_back( run( rt, programs[ i ], 1 ).back() );
+    }
+    const double va = a->val;
+    const double vb = b->val;
+    a->val = b->val = 0;
+    rte< double >::prog_type merged;
+    // sets with conditionals cannot be merged
+    CHECK( eliminate_common_subexpressions< double >( programs, merged ) == ( k == 0 ) );
+    CHECK( k != 0 || merged.size() < size );
+    rte< double >::prog_type program = es.compile( mp, c, rt );
+    CHECK( run( rt, program, 4 ) == values );
+    CHECK( a->val == va && b->val == vb );
+  }
+}
+
+/// Conditionals evaluated with masks by the batch executor give the values
+/// computed row by row by the vm: blocks where no row, some rows or all
+/// the rows take a branch.
+void test_masked_conditionals()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  rte< double > rt = generate_default_rte< double >();
+  // blocks of 8 rows: x < 0, mixed, x > 0
+  const size_t rows = 32;
+  double x[ rows ];
+  for( size_t i = 0; i != rows; ++i ) x[ i ] = i < 8 ? -1. - i : double( i ) - 12;
+  const char* exprs[] = { "if(x>0,if(x>5&&x<9,x*2,x||0),-x)",
+                          "if(x>100||x<-100,1,(x>2)&&(x<7))",
+                          "if(x<0||x>16,if(x<-4,1,2),if(x>3&&x<12,3,4))+x" };
+  for( int k = 0; k != 3; ++k )
+  {
+    rte< double >::prog_type program = c.compile( mp.parse( exprs[ k ] ), rt );
+    batch_executor< double > be( program, 8 );
+    CHECK( !be.row_mode() );
+    be.bind( rt.variable_p( "x" ), column< double >( x ) );
+    vector< double > r( rows );
+    double* out[] = { &r[ 0 ] };
+    be.run( 0, rows, out );
+    be.unbind();
+    bool same = true;
+    for( size_t i = 0; i != rows; ++i )
+    {
+      rt.variable_p( "x" )->val = x[ i ];
+      same = same && run( rt, program, 1 ) == vector< double >( 1, r[ i ] );
+    }
+    CHECK( same );
+  }
+}
+
+/// Rows selected by a predicate and values of an expression evaluated on
+/// the selected rows only, compared with the vm row by row.
+void test_selection()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  rte< double > rt = generate_default_rte< double >();
+  const size_t rows = 100;
+  double x[ rows ];
+  for( size_t i = 0; i != rows; ++i ) x[ i ] = double( i ) / 4 - 12;
+  const column< double > cx( x );
+  rte< double >::prog_type predicate = c.compile( mp.parse( "sin(x)>0.5||x<-10" ), rt );
+  rte< double >::prog_type program = c.compile( mp.parse( "sqrt(abs(x))*2+x" ), rt );
+  batch_executor< double > pb( predicate, 16 );
+  batch_executor< double > be( program, 16 );
+  pb.bind( rt.variable_p( "x" ), cx );
+  be.bind( rt.variable_p( "x" ), cx );
+  // selection appended in two calls
+  vector< size_t > sel;
+  const size_t n = pb.select( 0, 50, sel );
+  CHECK( pb.select( 50, rows - 50, sel ) + n == sel.size() );
+  vector< double > r( sel.size() + 1 );
+  double* out[] = { &r[ 0 ] };
+  be.run_selection( sel.data(), sel.size(), out );
+  pb.unbind();
+  be.unbind();
+  vector< size_t > expected;
+  bool same = true;
+  for( size_t i = 0; i != rows; ++i )
+  {
+    rt.variable_p( "x" )->val = x[ i ];
+    if( run( rt, predicate, 1 ).back() == 0 ) continue;
+    same = same && expected.size() < sel.size()
+           && run( rt, program, 1 ).back() == r[ expected.size() ];
+    expected.push_back( i );
+  }
+  CHECK( !expected.empty() && expected.size() < rows );
+  CHECK( sel == expected && same );
+}
+
+/// Reductions: summation algorithms, merge of partial reductions,
+/// histograms and results independent of the number of threads.
+void test_reduction()
+{
+  // 10^6 times 0.1 in blocks of 1000 values
+  const vector< double > tenth( 1000, 0.1 );
+  const summation algorithms[] = { NAIVE_SUM, KAHAN_SUM, PAIRWISE_SUM };
+  double sums[ 3 ];
+  for( int k = 0; k != 3; ++k )
+  {
+    reduction< double > r( algorithms[ k ] );
+    for( size_t b = 0; b != 1000; ++b ) r.add( &tenth[ 0 ], tenth.size(), b * 1000 );
+    CHECK( r.count() == 1000000 && r.min() == 0.1 && r.max() == 0.1 && r.argmax() == 0 );
+    sums[ k ] = r.sum();
+  }
+  CHECK( sums[ 0 ] != 100000 );
+  CHECK( sums[ 1 ] == 100000 );
+  CHECK( std::abs( sums[ 2 ] - 100000 ) < 1e-9 );
+  // partial reductions of consecutive rows merged
+  vector< double > v( 1000 );
+  for( size_t i = 0; i != v.size(); ++i ) v[ i ] = std::sin( double( i ) );
+  reduction< double > all;
+  reduction< double > first;
+  reduction< double > second;
+  all.histogram( -1, 1, 8 );
+  first.histogram( -1, 1, 8 );
+  second.histogram( -1, 1, 8 );
+  all.add( &v[ 0 ], 400, 0 );
+  all.add( &v[ 400 ], 600, 400 );
+  first.add( &v[ 0 ], 400, 0 );
+  second.add( &v[ 400 ], 600, 400 );
+  first.merge( second );
+  const size_t argmin = std::min_element( v.begin(), v.end() ) - v.begin();
+  const size_t argmax = std::max_element( v.begin(), v.end() ) - v.begin();
+  CHECK( first.count() == all.count() && first.sum() == all.sum() );
+  CHECK( first.argmin() == argmin && all.argmin() == argmin );
+  CHECK( first.argmax() == argmax && all.argmax() == argmax );
+  CHECK( first.min() == v[ argmin ] && first.max() == v[ argmax ] );
+  CHECK( first.bins() == all.bins() && all.bins().size() == 8 );
+  // histogram bins of width 2 over [0, 10), NaN values excluded
+  const double h[] = { -1, 0, 1.9, 2, 5, 9.99, 10, 12, std::nan( "" ) };
+  reduction< double > r;
+  r.histogram( 0, 10, 5 );
+  r.add( h, 9, 0 );
+  const size_t bins[] = { 2, 1, 1, 0, 1 };
+  CHECK( r.count() == 8 && r.nans() == 1 && r.below() == 1 && r.above() == 2 );
+  CHECK( r.bins() == vector< size_t >( bins, bins + 5 ) );
+  // one and four threads
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  const compiler< double > c( compiler< double >::COUNT_ARGS,
+                              compiler< double >::DONT_CREATE_VARS );
+  const rte< double > rt = generate_default_rte< double >();
+  const size_t rows = 100000;
+  vector< double > x( rows );
+  for( size_t i = 0; i != rows; ++i ) x[ i ] = double( i ) / rows;
+  vector< std::pair< string, column< double > > > cols;
+  cols.push_back( std::make_pair( string( "x" ), column< double >( &x[ 0 ] ) ) );
+  vector< string > exprs;
+  exprs.push_back( "x*0.1" );
+  exprs.push_back( "sin(100*x)" );
+  reduction< double > init( PAIRWISE_SUM );
+  init.histogram( -1, 1, 10 );
+  const vector< reduction< double > > r1 =
+    reduce_expressions( mp, c, rt, exprs, cols, rows, init, 1, 1000 );
+  const vector< reduction< double > > r4 =
+    reduce_expressions( mp, c, rt, exprs, cols, rows, init, 4, 1000 );
+  CHECK( r1.size() == 2 && r4.size() == 2 );
+  for( size_t e = 0; e != r1.size() && e != r4.size(); ++e )
+  {
+    CHECK( r1[ e ].count() == rows && r1[ e ].sum() == r4[ e ].sum() );
+    CHECK( r1[ e ].min() == r4[ e ].min() && r1[ e ].argmin() == r4[ e ].argmin() );
+    CHECK( r1[ e ].max() == r4[ e ].max() && r1[ e ].argmax() == r4[ e ].argmax() );
+    CHECK( r1[ e ].bins() == r4[ e ].bins() );
+  }
+}
+
+/// Errors are located at their offset in the expression passed to the
+/// parser, blanks included.
+void test_error_offsets()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.set_parameter( "p", 1 );
+  const struct {
+    const char* expr;
+    error_kind kind;
+    string::size_type offset;
+  } errors[] = {
+    { " ( x + 1", UNMATCHED_OPENING_PAR, 1 },
+    { "x + 1 )  ", UNMATCHED_CLOSING_PAR, 6 },
+    { "  x  $ 1", UNKNOWN_SYMBOL, 5 },
+    { "x +  2y", INVALID_NAME, 5 },
+    { "x  <> y", UNKNOWN_OPERATOR, 4 },
+    { "  x   +   q", UNKNOWN_TOKEN, 10 },
+    { "1 + ( p = x )", INVALID_ASSIGNMENT, 6 },
+    { "  2 * if( x < y, ( y, x ), x )", INVALID_ARGUMENTS, 6 } };
+  for( size_t i = 0; i != sizeof( errors ) / sizeof( errors[ 0 ] ); ++i )
+  {
+    vector< double > result;
+    const status s = evaluate( errors[ i ].expr, rt, result );
+    if( s.kind == errors[ i ].kind && s.offset == errors[ i ].offset ) continue;
+    cerr << "'" << errors[ i ].expr << "': " << s << endl;
+    CHECK( s.kind == errors[ i ].kind && s.offset == errors[ i ].offset );
+  }
+}
+
+/// Appends little endian unsigned integer of n bytes.
+void append_uint( string& s, unsigned long long v, size_t n )
+{
+  for( size_t i = 0; i != n; ++i, v >>= 8 ) s += char( v & 0xff );
+}
+
+/// Writes bytes to file.
+void write_file( const string& path, const string& bytes )
+{
+  std::ofstream os( path.c_str(), std::ios::out | std::ios::binary );
+  os.write( bytes.data(), std::streamsize( bytes.size() ) );
+}
+
+/// Returns true if the columns of a file hold the given values.
+template < class E >
+bool columns_equal( const column_file& f, const vector< const E* >& data )
+{
+  if( f.columns().size() != data.size() ) return false;
+  vector< double > v( f.rows() );
+  for( size_t i = 0; i != data.size(); ++i )
+  {
+    if( f.columns()[ i ].type != element_type_of< E >::value ) return false;
+    f.get< double >( i ).read( 0, v.size(), &v[ 0 ] );
+    for( size_t r = 0; r != v.size(); ++r ) if( v[ r ] != data[ i ][ r ] ) return false;
+  }
+  return true;
+}
+
+/// Columnar files written by write_column_file() and files mixing float
+/// and double columns are read back; truncated headers and columns are
+/// rejected.
+void test_column_file()
+{
+  const string path( "mmregress_columns.bin" );
+  const double x[] = { 1, 2.5, -3 };
+  const double y[] = { 0.1, 0.2, 0.3 };
+  const float u[] = { 0.5f, -1.25f, 1e-3f };
+  vector< string > names;
+  names.push_back( "x" );
+  names.push_back( "y" );
+  vector< const double* > xy;
+  xy.push_back( x );
+  xy.push_back( y );
+  write_column_file( path, names, xy, 3 );
+  {
+    const column_file f( path );
+    CHECK( f.rows() == 3 && f.find( "y" ) == 1 && f.find( "u" ) == -1 );
+    CHECK( columns_equal( f, xy ) );
+  }
+  write_column_file( path, vector< string >( 1, "u" ), vector< const float* >( 1, u ), 3 );
+  {
+    const column_file f( path );
+    CHECK( f.rows() == 3 && f.find( "u" ) == 0 );
+    CHECK( columns_equal( f, vector< const float* >( 1, u ) ) );
+  }
+  // float column u at offset 64, double column x at offset 80
+  string bytes( column_file::MAGIC, sizeof( column_file::MAGIC ) );
+  append_uint( bytes, 3, 8 );
+  append_uint( bytes, 2, 4 );
+  append_uint( bytes, FLOAT32, 4 );
+  append_uint( bytes, 1, 4 );
+  bytes += 'u';
+  append_uint( bytes, 64, 8 );
+  append_uint( bytes, FLOAT64, 4 );
+  append_uint( bytes, 1, 4 );
+  bytes += 'x';
+  append_uint( bytes, 80, 8 );
+  bytes.resize( 64 );
+  bytes.append( reinterpret_cast< const char* >( u ), sizeof( u ) );
+  bytes.resize( 80 );
+  bytes.append( reinterpret_cast< const char* >( x ), sizeof( x ) );
+  write_file( path, bytes );
+  {
+    const column_file f( path );
+    CHECK( f.rows() == 3 && f.columns().size() == 2 );
+    CHECK( f.columns().size() == 2 && f.columns()[ 0 ].type == FLOAT32
+           && f.columns()[ 1 ].type == FLOAT64 );
+    vector< double > v( 3 );
+    f.get< double >( 0 ).read( 0, 3, &v[ 0 ] );
+    CHECK( v[ 0 ] == u[ 0 ] && v[ 1 ] == u[ 1 ] && v[ 2 ] == u[ 2 ] );
+    f.get< double >( 1 ).read( 0, 3, &v[ 0 ] );
+    CHECK( std::equal( v.begin(), v.end(), x ) );
+  }
+  // every truncation cuts the header or the last column
+  size_t rejected = 0;
+  for( size_t n = 0; n != bytes.size(); ++n )
+  {
+    write_file( path, bytes.substr( 0, n ) );
+    try
+    {
+      const column_file f( path );
+    }
+    catch( const column_file::exception& )
+    {
+      ++rejected;
+    }
+  }
+  CHECK( rejected == bytes.size() );
+  // column extent beyond the end of the file
+  bytes[ 8 ] = 4;
+  write_file( path, bytes );
+  bool thrown = false;
+  try
+  {
+    const column_file f( path );
+  }
+  catch( const column_file::exception& )
+  {
+    thrown = true;
+  }
+  CHECK( thrown );
+  std::remove( path.c_str() );
+}
+
+/// Expressions parsed at compile time evaluate as the run-time parser:
+/// precedence and associativity of the default operators.
+void test_static_expr()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rt.variable_p( "x" )->val = 3;
+  rt.variable_p( "y" )->val = 5;
+  rt.variable_p( "z" )->val = 7;
+  constexpr auto f0 = MMP_STATIC_EXPR( "x/y*z" );
+  constexpr auto f1 = MMP_STATIC_EXPR( "2^3^2" );
+  constexpr auto f2 = MMP_STATIC_EXPR( "-x^2" );
+  constexpr auto f3 = MMP_STATIC_EXPR( "x-y+z" );
+  constexpr auto f4 = MMP_STATIC_EXPR( "sqrt(x*x+y*y)-z/y" );
+  constexpr auto f5 = MMP_STATIC_EXPR_VARS( "a,b", "atan2(b,a)*2-b" );
+  CHECK( evaluates_to( "x/y*z", rt, vector< double >( 1, f0( 3., 5., 7. ) ) ) );
+  CHECK( evaluates_to( "2^3^2", rt, vector< double >( 1, f1() ) ) );
+  CHECK( evaluates_to( "-x^2", rt, vector< double >( 1, f2( 3. ) ) ) );
+  CHECK( evaluates_to( "x-y+z", rt, vector< double >( 1, f3( 3., 5., 7. ) ) ) );
+  CHECK( evaluates_to( "sqrt(x*x+y*y)-z/y", rt, vector< double >( 1, f4( 3., 5., 7. ) ) ) );
+  CHECK( evaluates_to( "atan2(y,x)*2-y", rt, vector< double >( 1, f5( 3., 5. ) ) ) );
+}
+
+/// Loop counters are not created as variables of the run-time environment.
+void test_loop_counter_variables()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::CREATE_VARS );
+  rte< double > rt = generate_default_rte< double >();
+  const size_t variables = rt.var_tab.size();
+  rte< double >::prog_type program;
+  CHECK( compile_expression( mp, c, "sum(k,1,3,k)", rt, program ).ok() );
+  CHECK( rt.var_tab.size() == variables );
+  CHECK( compile_expression( mp, c, "a+sum(k,1,3,k*a)", rt, program ).ok() );
+  CHECK( rt.var_tab.size() == variables + 1 && rt.variable_p( "a" ) && !rt.variable_p( "k" ) );
+  rt.variable_p( "a" )->val = 2;
+  vm< rte< double > > m( rt );
+  m.prog( &program );
+  m.run();
+  CHECK( m.rte().stack.size() == 1 && m.rte().stack.top() == 14 );
+}
+
+/// Variables created by an expression are not seen by the other expressions
+/// validated.
+void test_validation_variables()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  const compiler< double > c( compiler< double >::COUNT_ARGS,
+                              compiler< double >::CREATE_VARS );
+  const rte< double > rt = generate_default_rte< double >();
+  vector< string > exprs;
+  exprs.push_back( "(a=x)+1" );
+  exprs.push_back( "(a=y)+1" );
+  const vector< validation > v = validate_expressions( mp, c, rt, exprs, 1 );
+  CHECK( v.size() == 2 && v[ 0 ].compiled() && v[ 1 ].compiled() );
+  CHECK( v.size() == 2 && v[ 0 ].instructions == v[ 1 ].instructions );
+  CHECK( !rt.variable_p( "a" ) );
+}
+
+/// Roots along rays hitting and missing the unit sphere, whose hit
+/// parameters are known.
+void test_ray_roots()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  rte< double > rt = generate_default_rte< double >();
+  const rte< double >::prog_type f = c.compile( mp.parse( "x*x+y*y+z*z-1" ), rt );
+  const rte< double >::prog_type g =
+    c.compile( mp.parse( "(x*x+y*y+z*z-1,2*x,2*y,2*z)" ), rt );
+  // rays parallel to z starting at z = -5 on a grid covering the sphere
+  const size_t side = 21;
+  const size_t rays = side * side;
+  vector< double > o( 3 * rays ), d( 3 * rays ), t0( rays, 0 ), t1( rays, 10 ), t( rays );
+  size_t expected = 0;
+  for( size_t i = 0; i != rays; ++i )
+  {
+    o[ 3 * i ] = 1.2 * ( double( i % side ) / ( side - 1 ) * 2 - 1 );
+    o[ 3 * i + 1 ] = 1.2 * ( double( i / side ) / ( side - 1 ) * 2 - 1 );
+    o[ 3 * i + 2 ] = -5;
+    d[ 3 * i + 2 ] = 1;
+    expected += o[ 3 * i ] * o[ 3 * i ] + o[ 3 * i + 1 ] * o[ 3 * i + 1 ] < 1;
+  }
+  const root_method methods[] = { BISECTION, ILLINOIS, NEWTON };
+  for( int k = 0; k != 6; ++k )
+  {
+    ray_roots< double > rr( rt, k < 3 ? f : g );
+    const size_t hits = rr.solve( &o[ 0 ], &d[ 0 ], &t0[ 0 ], &t1[ 0 ], rays, &t[ 0 ],
+                                  methods[ k % 3 ], 1e-10, 4 );
+    CHECK( hits == expected );
+    bool exact = true;
+    for( size_t i = 0; i != rays; ++i )
+    {
+      const double q = o[ 3 * i ] * o[ 3 * i ] + o[ 3 * i + 1 ] * o[ 3 * i + 1 ];
+      exact = exact && ( q < 1 ? std::abs( t[ i ] - ( 5 - std::sqrt( 1 - q ) ) ) < 1e-8
+                               : t[ i ] != t[ i ] );
+    }
+    CHECK( exact );
+  }
+  // coordinate variable not in the run-time environment
+  ray_roots< double > rr( rt, f, batch_executor< double >::DEFAULT_BLOCK, "u" );
+  bool thrown = false;
+  try
+  {
+    rr.solve( &o[ 0 ], &d[ 0 ], &t0[ 0 ], &t1[ 0 ], rays, &t[ 0 ] );
+  }
+  catch( const ray_roots< double >::invalid_field& )
+  {
+    thrown = true;
+  }
+  CHECK( thrown );
+}
+
+/// Parameters cannot be bound to columns, in block and in row mode.
+void test_bind_parameter()
+{
+  const math_parser mp( generate_def_operators(),
+                        math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< double > c( compiler< double >::COUNT_ARGS,
+                        compiler< double >::DONT_CREATE_VARS );
+  rte< double > rt = generate_default_rte< double >();
+  rt.set_parameter( "p", 2 );
+  const double values[] = { 1, 2, 3 };
+  const char* exprs[] = { "x*p", "sum(k,1,3,k*p)" };
+  for( int k = 0; k != 2; ++k )
+  {
+    const rte< double >::prog_type program = c.compile( mp.parse( exprs[ k ] ), rt );
+    batch_executor< double > be( program );
+    CHECK( be.row_mode() == ( k == 1 ) );
+    bool thrown = false;
+    try
+    {
+      be.bind( rt.parameter_p( "p" ), column< double >( values ) );
+    }
+    catch( const batch_executor< double >::invalid_program& )
+    {
+      thrown = true;
+    }
+    CHECK( thrown );
+  }
+}
+
+/// Programs reading more values than computed are rejected.
+void test_stack_underflow()
+{
+  rte< double > rt = generate_default_rte< double >();
+  rte< double >::prog_type program;
+  program.push_back( rte< double >::InstrPtrT( new load_val< double >( 1 ) ) );
+  program.push_back( rte< double >::InstrPtrT(
+                       new call_fun< double >( rt.function_p( "+", 1, 1 ) ) ) );
+  CHECK( stack_underflow( program ) == 1 );
+  CHECK( max_stack_depth( program ) == 0 );
+  program.insert( program.begin(), program.front() );
+  CHECK( stack_underflow( program ) == program.size() );
+  CHECK( max_stack_depth( program ) == 2 );
+}
+
+//-----------------------------------------------------------------------------
+/// Entry point.
+int main( int, char** )
+{
+  try
+  {
+    test_assignment_operand();
+    test_nested_unary_operators();
+    test_conditional_operand();
+    test_operator_precedence();
+    test_vector_operands();
+    test_error_offsets();
+    test_static_expr();
+    test_dead_code_elimination();
+    test_expression_set();
+    test_masked_conditionals();
+    test_selection();
+    test_reduction();
+    test_column_file();
+    test_loop_counter_variables();
+    test_validation_variables();
+    test_ray_roots();
+    test_bind_parameter();
+    test_stack_underflow();
+  }
+  catch( const exception_base& eb )
+  {
+    cerr << eb;
+    ++failures;
+  }
+  if( failures ) cerr << failures << " checks failed" << endl;
+  return failures;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,368 @@
+#ifndef ROOTS_H__
+#define ROOTS_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file roots.h root finding along rays: first crossing of the zero level
+/// set of a compiled scalar field, computed for many rays at once
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+#include "execution.h"
+#include "batch.h"
+#include "exception.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Root refinement methods.
+  enum root_method {
+    BISECTION, ///< Halves the bracket at each step.
+    ILLINOIS,  ///< Regula falsi, halving the value at an endpoint kept twice.
+    NEWTON     ///< Newton step along the ray, bisection when it leaves the
+               ///< bracket; requires the gradient of the field.
+  };
+
+  //----------------------------------------------------------------------------
+  /// Finds the first crossing of the zero level set of a scalar field
+  /// f( x, y, z ) along rays o + t d, t in [t0, t1], e.g. the intersection of
+  /// rays with an implicit surface.
+  /// The field is a compiled program leaving f on the stack, or f and its
+  /// gradient fx, fy, fz (in this order) when the gradient is available.
+  /// All the rays advance in lock-step: at each step the points of the rays
+  /// still searching are evaluated at once by a batch_executor, then the
+  /// rays which converged are retired and the remaining ones compacted, so
+  /// that each step evaluates only the rays left.
+  /// The crossing is first bracketed by sampling the field at samples + 1
+  /// evenly spaced points of [t0, t1]: the first interval over which f
+  /// changes sign is refined with the selected method until its width or
+  /// the last step is not greater than the tolerance. Rays along which f
+  /// does not change sign, or is NaN, miss: their hit parameter is NaN.
+  /// @code
+  /// compiler< double > c( compiler< double >::COUNT_ARGS, compiler< double >::CREATE_VARS );
+  /// rte< double >::prog_type field = c.compile( mp.parse( "x^2+y^2+z^2-1" ), rt );
+  /// ray_roots< double > rr( rt, field );
+  /// size_t hits = rr.solve( origins, directions, t0, t1, rays, t, ILLINOIS );
+  /// @endcode
+  /// Memory is allocated only when solving more rays than ever before.
+  /// @warning the solver references the program: the program must outlive
+  /// the solver.
+  template < class T > class ray_roots {
+  public:
+
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+
+    /// Class name.
+    static const std::string CLS_NAME;
+
+    //--------------------------------------------------------------------------
+    /// Thrown when the field does not compute one or four values or a
+    /// coordinate variable is not found in the run-time environment.
+    class invalid_field : public exception_base {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      invalid_field( const std::string& fun,
+                     unsigned long lineno,
+                     const std::string& data = "" )
+        : exception_base( NS_NAME, ray_roots::CLS_NAME, fun, lineno, data )
+      {}
+    };
+
+    //--------------------------------------------------------------------------
+    /// Constructor.
+    /// @param rt run-time environment the field was compiled against
+    /// @param field program computing f, or f, fx, fy, fz
+    /// @param block maximum number of points evaluated at once
+    /// @param x name of variable holding the x coordinate
+    /// @param y name of variable holding the y coordinate
+    /// @param z name of variable holding the z coordinate
+    ray_roots( const rte< T >& rt, const prog_type& field,
+               size_t block = batch_executor< T >::DEFAULT_BLOCK,
+               const std::string& x = "x",
+               const std::string& y = "y",
+               const std::string& z = "z" )
+      : rt_( &rt ), executor_( field, block ), evaluations_( 0 )
+    {
+      if( executor_.results() != 1 && executor_.results() != 4 )
+      {
+        throw invalid_field( "ray_roots", __LINE__,
+                             "field must compute f or f, fx, fy, fz" );
+      }
+      names_[ 0 ] = x;
+      names_[ 1 ] = y;
+      names_[ 2 ] = z;
+      out_.resize( executor_.results() );
+    }
+
+    /// Returns true if the field computes its gradient.
+    bool gradient() const { return executor_.results() == 4; }
+
+    /// Returns number of points evaluated since construction.
+    size_t evaluations() const { return evaluations_; }
+
+    /// Computes the hit parameter of each ray: the value of t at the first
+    /// crossing of the zero level set, NaN if the ray misses.
+    /// NEWTON falls back to ILLINOIS when the field does not compute its
+    /// gradient.
+    /// @param origins ray origins: x, y, z of each ray
+    /// @param directions ray directions: x, y, z of each ray
+    /// @param t0 start of the interval searched along each ray
+    /// @param t1 end of the interval searched along each ray
+    /// @param rays number of rays
+    /// @param[out] t hit parameters
+    /// @param m refinement method
+    /// @param tol absolute tolerance on t
+    /// @param samples number of intervals sampled to bracket the crossing
+    /// @param max_steps maximum number of refinement steps; the rays not
+    ///        converged after max_steps steps get the last estimate
+    /// @return number of rays hitting the level set
+    /// @throw invalid_field if a coordinate variable is not found
+    size_t solve( const T* origins, const T* directions,
+                  const T* t0, const T* t1, size_t rays, T* t,
+                  root_method m = ILLINOIS, T tol = T( 1e-6 ),
+                  unsigned samples = 1, unsigned max_steps = 64 )
+    {
+      if( m == NEWTON && !gradient() ) m = ILLINOIS;
+      if( !samples ) samples = 1;
+      reserve( rays );
+      o_ = origins;
+      d_ = directions;
+      // bracketing: rays crossing the level set inside a sampled interval
+      // are moved to the refinement lanes
+      size_t n = 0;
+      size_t crossing = 0;
+      for( size_t r = 0; r != rays; ++r )
+      {
+        t[ r ] = std::numeric_limits< T >::quiet_NaN();
+        x_[ r ] = t0[ r ];
+        if( t1[ r ] > t0[ r ] ) lanes_[ n++ ] = r;
+      }
+      evaluate( n );
+      for( size_t i = 0; i != n; ++i )
+      {
+        a_[ lanes_[ i ] ] = t0[ lanes_[ i ] ];
+        fa_[ lanes_[ i ] ] = f_[ i ];
+      }
+      for( unsigned k = 1; k <= samples && n; ++k )
+      {
+        for( size_t i = 0; i != n; ++i )
+        {
+          const size_t r = lanes_[ i ];
+          x_[ r ] = k == samples ? t1[ r ]
+                    : t0[ r ] + ( t1[ r ] - t0[ r ] ) * T( k ) / T( samples );
+        }
+        evaluate( n );
+        size_t kept = 0;
+        for( size_t i = 0; i != n; ++i )
+        {
+          const size_t r = lanes_[ i ];
+          const T fa = fa_[ r ];
+          const T fb = f_[ i ];
+          if( fa == T() )
+          {
+            t[ r ] = a_[ r ];
+          }
+          else if( ( fa < T() && fb >= T() ) || ( fa > T() && fb <= T() ) )
+          {
+            b_[ r ] = x_[ r ];
+            fb_[ r ] = fb;
+            side_[ r ] = 0;
+            bracketed_[ crossing++ ] = r;
+          }
+          else
+          {
+            a_[ r ] = x_[ r ];
+            fa_[ r ] = fb;
+            lanes_[ kept++ ] = r;
+          }
+        }
+        n = kept;
+      }
+      // refinement: first estimate from the bracket
+      std::copy( bracketed_.begin(), bracketed_.begin() + crossing, lanes_.begin() );
+      n = crossing;
+      for( size_t i = 0; i != n; ++i )
+      {
+        const size_t r = lanes_[ i ];
+        x_[ r ] = m == ILLINOIS ? falsi( r ) : T( 0.5 ) * ( a_[ r ] + b_[ r ] );
+      }
+      for( unsigned s = 0; s != max_steps && n; ++s )
+      {
+        evaluate( n );
+        size_t kept = 0;
+        for( size_t i = 0; i != n; ++i )
+        {
+          const size_t r = lanes_[ i ];
+          const T x = x_[ r ];
+          const T fx = f_[ i ];
+          if( fx != fx )
+          {
+            continue;
+          }
+          if( fx == T() )
+          {
+            t[ r ] = x;
+            continue;
+          }
+          // the endpoint with the sign of fx is replaced by x; Illinois
+          // halves the value at the other endpoint if kept twice in a row
+          if( ( fx < T() ) == ( fa_[ r ] < T() ) )
+          {
+            a_[ r ] = x;
+            fa_[ r ] = fx;
+            if( side_[ r ] < 0 ) fb_[ r ] *= T( 0.5 );
+            side_[ r ] = -1;
+          }
+          else
+          {
+            b_[ r ] = x;
+            fb_[ r ] = fx;
+            if( side_[ r ] > 0 ) fa_[ r ] *= T( 0.5 );
+            side_[ r ] = 1;
+          }
+          T next = T( 0.5 ) * ( a_[ r ] + b_[ r ] );
+          if( m == ILLINOIS ) next = falsi( r );
+          else if( m == NEWTON )
+          {
+            const size_t j = 3 * r;
+            const T df = gx_[ i ] * d_[ j ] + gy_[ i ] * d_[ j + 1 ] + gz_[ i ] * d_[ j + 2 ];
+            const T nx = x - fx / df;
+            // also rejects infinite and NaN steps
+            if( nx > a_[ r ] && nx < b_[ r ] ) next = nx;
+          }
+          if( b_[ r ] - a_[ r ] <= tol || std::abs( next - x ) <= tol )
+          {
+            t[ r ] = next;
+            continue;
+          }
+          x_[ r ] = next;
+          lanes_[ kept++ ] = r;
+        }
+        n = kept;
+      }
+      for( size_t i = 0; i != n; ++i ) t[ lanes_[ i ] ] = x_[ lanes_[ i ] ];
+      size_t hits = 0;
+      for( size_t r = 0; r != rays; ++r ) hits += t[ r ] == t[ r ];
+      return hits;
+    }
+
+  private:
+
+    /// Grows the buffers to hold the given number of rays and binds the
+    /// coordinate variables to the point buffers.
+    void reserve( size_t rays )
+    {
+      if( rays <= lanes_.size() && !lanes_.empty() ) return;
+      lanes_.resize( rays );
+      bracketed_.resize( rays );
+      side_.resize( rays );
+      x_.resize( rays );
+      a_.resize( rays );
+      b_.resize( rays );
+      fa_.resize( rays );
+      fb_.resize( rays );
+      px_.resize( rays );
+      py_.resize( rays );
+      pz_.resize( rays );
+      f_.resize( rays );
+      out_[ 0 ] = f_.data();
+      if( gradient() )
+      {
+        gx_.resize( rays );
+        gy_.resize( rays );
+        gz_.resize( rays );
+        out_[ 1 ] = gx_.data();
+        out_[ 2 ] = gy_.data();
+        out_[ 3 ] = gz_.data();
+      }
+      const T* const p[] = { px_.data(), py_.data(), pz_.data() };
+      for( int k = 0; k != 3; ++k )
+      {
+        if( !executor_.bind( *rt_, names_[ k ], column< T >( p[ k ] ) ) )
+        {
+          lanes_.clear();
+          throw invalid_field( "solve", __LINE__,
+                               "variable " + names_[ k ] + " not found" );
+        }
+      }
+    }
+
+    /// Evaluates the field at x_ along the rays of the first n lanes; the
+    /// values of lane i are written at index i.
+    void evaluate( size_t n )
+    {
+      for( size_t i = 0; i != n; ++i )
+      {
+        const size_t j = 3 * lanes_[ i ];
+        const T x = x_[ lanes_[ i ] ];
+        px_[ i ] = o_[ j ] + x * d_[ j ];
+        py_[ i ] = o_[ j + 1 ] + x * d_[ j + 1 ];
+        pz_[ i ] = o_[ j + 2 ] + x * d_[ j + 2 ];
+      }
+      executor_.run( 0, n, out_.data() );
+      evaluations_ += n;
+    }
+
+    /// Returns the regula falsi estimate of the bracket of ray r.
+    T falsi( size_t r ) const
+    {
+      return ( a_[ r ] * fb_[ r ] - b_[ r ] * fa_[ r ] ) / ( fb_[ r ] - fa_[ r ] );
+    }
+
+  private:
+    /// Run-time environment holding the coordinate variables.
+    const rte< T >* rt_;
+    /// Names of the coordinate variables.
+    std::string names_[ 3 ];
+    /// Executor evaluating the field.
+    batch_executor< T > executor_;
+    /// Number of points evaluated.
+    size_t evaluations_;
+    /// Ray origins and directions of the current solve.
+    const T* o_;
+    const T* d_;
+    /// Rays still searching, compacted at each step.
+    std::vector< size_t > lanes_;
+    /// Rays whose crossing is bracketed.
+    std::vector< size_t > bracketed_;
+    /// Endpoint replaced by the last step: -1 a, 1 b, 0 none.
+    std::vector< int > side_;
+    /// Per ray: current estimate, bracket and field at its endpoints.
+    std::vector< T > x_, a_, b_, fa_, fb_;
+    /// Per lane: points evaluated, field and gradient.
+    std::vector< T > px_, py_, pz_, f_, gx_, gy_, gz_;
+    /// Output arrays of the executor.
+    std::vector< T* > out_;
+  };
+
+  /// Definition of class name variable.
+  template < class T >
+  const std::string ray_roots< T >::CLS_NAME( "ray_roots" );
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // ROOTS_H__
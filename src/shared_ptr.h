@@ -9,6 +9,10 @@
 
 #include <cassert>
 
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
 #ifdef MMP_DEBUG_MEMORY
 #include "dbgnew.h"
 #define new new( __FILE__, __LINE__, __FUNCTION__ )
@@ -16,13 +20,29 @@
 
 namespace mmath_plus {
 
-/// Increment integer; kept as an external function for future support of
-/// atomic increment. 
-inline int increment( int* pi ) { assert( pi ); return ++*pi; }
+/// Atomically increments integer: pointers to objects shared by different
+/// threads, e.g. the functions of a registry, can be copied concurrently.
+inline int increment( int* pi )
+{
+  assert( pi );
+#if defined( _MSC_VER )
+  return _InterlockedIncrement( reinterpret_cast< volatile long* >( pi ) );
+#else
+  return __atomic_add_fetch( pi, 1, __ATOMIC_RELAXED );
+#endif
+}
 
-/// Decrement integer; kept as an external function for future support of
-/// atomic increment. 
-inline int decrement( int* pi ) { assert( pi ); return --*pi; }
+/// Atomically decrements integer; the object is released by the thread
+/// which sees the count reaching zero.
+inline int decrement( int* pi )
+{
+  assert( pi );
+#if defined( _MSC_VER )
+  return _InterlockedDecrement( reinterpret_cast< volatile long* >( pi ) );
+#else
+  return __atomic_sub_fetch( pi, 1, __ATOMIC_ACQ_REL );
+#endif
+}
 
 
 /// Implementation of simple ref counted smart pointer with the minimal amount of functionality
@@ -0,0 +1,463 @@
+#ifndef SPHERE_TRACE_H__
+#define SPHERE_TRACE_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file sphere_trace.h multithreaded sphere tracing of signed distance
+/// expressions: renders the zero level set of a compiled distance field
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "compiler.h"
+#include "execution.h"
+#include "math_parser.h"
+#include "batch.h"
+#include "reduction.h"
+#include "shared_ptr.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Pinhole camera looking from eye at target.
+  template < class T >
+  struct camera {
+    /// Position.
+    T eye[ 3 ];
+    /// Point at the center of the image.
+    T target[ 3 ];
+    /// Up direction, need not be orthogonal to the view direction.
+    T up[ 3 ];
+    /// Vertical field of view in degrees.
+    T fov;
+    /// Default constructor: looks at the origin from ( 0, 0, -4 ), y up.
+    camera() : fov( 45 )
+    {
+      eye[ 0 ] = eye[ 1 ] = target[ 0 ] = target[ 1 ] = target[ 2 ] = T();
+      up[ 0 ] = up[ 2 ] = T();
+      eye[ 2 ] = T( -4 );
+      up[ 1 ] = T( 1 );
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Sphere tracing settings.
+  template < class T >
+  struct trace_options {
+    /// Maximum number of steps along each ray.
+    size_t max_steps;
+    /// Rays are stopped at this distance from the eye.
+    T far;
+    /// A ray hits the surface where the distance is less than epsilon
+    /// times the distance travelled.
+    T epsilon;
+    /// Each step advances by the distance times this factor; values less
+    /// than 1 allow tracing fields which overestimate the distance.
+    T step_scale;
+    /// Pixels traced at once by a thread.
+    size_t packet;
+    /// Number of points evaluated at once by the batch executor.
+    size_t block;
+    /// Constructor: default values.
+    trace_options() : max_steps( 128 ), far( 100 ), epsilon( T( 1e-4 ) ),
+                      step_scale( 1 ), packet( 4096 ),
+                      block( batch_executor< T >::DEFAULT_BLOCK )
+    {}
+  };
+
+  //----------------------------------------------------------------------------
+  /// Work done by a sphere tracer.
+  struct trace_stats {
+    /// Number of pixels hitting the surface.
+    size_t hits;
+    /// Number of steps of all the rays.
+    size_t steps;
+    /// Number of points evaluated, including normals.
+    size_t evaluations;
+    /// Default constructor.
+    trace_stats() : hits( 0 ), steps( 0 ), evaluations( 0 ) {}
+  };
+
+  //----------------------------------------------------------------------------
+  /// Traces packets of pixels of an image: the rays of a packet march in
+  /// lock-step, each step evaluating the distance at the points of all the
+  /// rays still marching through a batch_executor, after which the rays
+  /// hitting the surface or leaving the scene are retired and the remaining
+  /// ones compacted. The normal at each hit is the gradient of the field,
+  /// computed by the program when it leaves d, dx, dy, dz on the stack or
+  /// else by central differences evaluated for all the hits of the packet
+  /// at once; pixels are shaded with a diffuse light.
+  /// Memory is allocated at construction only.
+  /// @warning the tracer references the program and the variables of the
+  /// run-time environment: they must outlive the tracer.
+  template < class T > class packet_tracer {
+  public:
+
+    /// Program type.
+    typedef typename rte< T >::prog_type prog_type;
+
+    /// Class name.
+    static const std::string CLS_NAME;
+
+    //--------------------------------------------------------------------------
+    /// Thrown when the field does not compute one or four values.
+    class invalid_field : public exception_base {
+    public:
+      /// Constructor.
+      /// @param fun function throwing exception
+      /// @param lineno line number at which exception is thrown
+      /// @param data message
+      invalid_field( const std::string& fun,
+                     unsigned long lineno,
+                     const std::string& data = "" )
+        : exception_base( NS_NAME, packet_tracer::CLS_NAME, fun, lineno, data )
+      {}
+    };
+
+    //--------------------------------------------------------------------------
+    /// Constructor.
+    /// @param rt run-time environment holding variables x, y, z
+    /// @param field program computing d, or d, dx, dy, dz
+    /// @param cam camera
+    /// @param width image width
+    /// @param height image height
+    /// @param opt settings
+    packet_tracer( const rte< T >& rt, const prog_type& field,
+                   const camera< T >& cam, size_t width, size_t height,
+                   const trace_options< T >& opt )
+      : executor_( field, opt.block ), opt_( opt ), width_( width ),
+        height_( height )
+    {
+      if( executor_.results() != 1 && executor_.results() != 4 )
+      {
+        throw invalid_field( "packet_tracer", __LINE__,
+                             "field must compute d or d, dx, dy, dz" );
+      }
+      if( !opt_.packet ) opt_.packet = 1;
+      const size_t n = opt_.packet;
+      lanes_.resize( n );
+      hits_.resize( n );
+      t_.resize( n );
+      dir_.resize( 3 * n );
+      hit_.resize( n );
+      normal_.resize( 3 * n );
+      // normals by central differences evaluate six points per hit
+      const size_t points = gradient() ? n : 6 * n;
+      px_.resize( points );
+      py_.resize( points );
+      pz_.resize( points );
+      d_.resize( points );
+      out_.assign( executor_.results(), 0 );
+      out_[ 0 ] = d_.data();
+      if( gradient() )
+      {
+        gx_.resize( n );
+        gy_.resize( n );
+        gz_.resize( n );
+        out_[ 1 ] = gx_.data();
+        out_[ 2 ] = gy_.data();
+        out_[ 3 ] = gz_.data();
+      }
+      executor_.bind( rt, "x", column< T >( px_.data() ) );
+      executor_.bind( rt, "y", column< T >( py_.data() ) );
+      executor_.bind( rt, "z", column< T >( pz_.data() ) );
+      // orthonormal camera frame scaled by the field of view
+      T w[ 3 ] = { cam.target[ 0 ] - cam.eye[ 0 ], cam.target[ 1 ] - cam.eye[ 1 ],
+                   cam.target[ 2 ] - cam.eye[ 2 ] };
+      normalize( w );
+      T u[ 3 ];
+      cross( w, cam.up, u );
+      normalize( u );
+      T v[ 3 ];
+      cross( u, w, v );
+      const T h = T( std::tan( cam.fov * 3.14159265358979323846 / 360 ) );
+      const T a = height_ ? T( width_ ) / T( height_ ) : T( 1 );
+      for( int k = 0; k != 3; ++k )
+      {
+        eye_[ k ] = cam.eye[ k ];
+        forward_[ k ] = w[ k ];
+        right_[ k ] = u[ k ] * h * a;
+        up_[ k ] = v[ k ] * h;
+      }
+      light_[ 0 ] = T( -1 );
+      light_[ 1 ] = T( 2 );
+      light_[ 2 ] = T( -1.5 );
+      normalize( light_ );
+    }
+
+    /// Returns true if the field computes its gradient.
+    bool gradient() const { return executor_.results() == 4; }
+
+    /// Returns number of pixels traced at once.
+    size_t packet() const { return opt_.packet; }
+
+    /// Traces pixels [first, first + n) of the image, in row-major order,
+    /// n not greater than packet(); writes r, g, b values of pixel i at
+    /// rgb[ 3 * i ].
+    /// @param first index of first pixel
+    /// @param n number of pixels
+    /// @param rgb image
+    /// @param[in,out] stats work done
+    void trace( size_t first, size_t n, unsigned char* rgb, trace_stats& stats )
+    {
+      for( size_t i = 0; i != n; ++i )
+      {
+        const size_t p = first + i;
+        const T sx = ( T( 2 ) * ( T( p % width_ ) + T( 0.5 ) ) ) / T( width_ ) - T( 1 );
+        const T sy = T( 1 ) - ( T( 2 ) * ( T( p / width_ ) + T( 0.5 ) ) ) / T( height_ );
+        T* d = &dir_[ 3 * i ];
+        for( int k = 0; k != 3; ++k ) d[ k ] = forward_[ k ] + sx * right_[ k ] + sy * up_[ k ];
+        normalize( d );
+        t_[ i ] = T();
+        hit_[ i ] = 0;
+        lanes_[ i ] = i;
+      }
+      // march
+      size_t m = n;
+      size_t hits = 0;
+      for( size_t s = 0; s != opt_.max_steps && m; ++s )
+      {
+        for( size_t j = 0; j != m; ++j )
+        {
+          const size_t i = lanes_[ j ];
+          const T* d = &dir_[ 3 * i ];
+          px_[ j ] = eye_[ 0 ] + t_[ i ] * d[ 0 ];
+          py_[ j ] = eye_[ 1 ] + t_[ i ] * d[ 1 ];
+          pz_[ j ] = eye_[ 2 ] + t_[ i ] * d[ 2 ];
+        }
+        executor_.run( 0, m, out_.data() );
+        stats.evaluations += m;
+        stats.steps += m;
+        size_t kept = 0;
+        for( size_t j = 0; j != m; ++j )
+        {
+          const size_t i = lanes_[ j ];
+          const T dist = d_[ j ];
+          if( std::abs( dist ) < opt_.epsilon * std::max( t_[ i ], T( 1 ) ) )
+          {
+            hit_[ i ] = 1;
+            if( gradient() )
+            {
+              normal_[ 3 * i ] = gx_[ j ];
+              normal_[ 3 * i + 1 ] = gy_[ j ];
+              normal_[ 3 * i + 2 ] = gz_[ j ];
+            }
+            hits_[ hits++ ] = i;
+            continue;
+          }
+          t_[ i ] += dist * opt_.step_scale;
+          // also retires NaN distances
+          if( !( t_[ i ] < opt_.far ) ) continue;
+          lanes_[ kept++ ] = i;
+        }
+        m = kept;
+      }
+      if( !gradient() ) differences( hits_.data(), hits, stats );
+      for( size_t i = 0; i != n; ++i ) shade( i, rgb + 3 * i );
+      stats.hits += hits;
+    }
+
+  private:
+
+    /// Computes the normals of n hits by central differences.
+    void differences( const size_t* hits, size_t n, trace_stats& stats )
+    {
+      for( size_t j = 0; j != n; ++j )
+      {
+        const size_t i = hits[ j ];
+        const T* d = &dir_[ 3 * i ];
+        const T p[ 3 ] = { eye_[ 0 ] + t_[ i ] * d[ 0 ], eye_[ 1 ] + t_[ i ] * d[ 1 ],
+                           eye_[ 2 ] + t_[ i ] * d[ 2 ] };
+        const T h = opt_.epsilon * std::max( t_[ i ], T( 1 ) );
+        for( int k = 0; k != 6; ++k )
+        {
+          const size_t q = 6 * j + k;
+          const T e = k & 1 ? -h : h;
+          px_[ q ] = p[ 0 ] + ( k / 2 == 0 ? e : T() );
+          py_[ q ] = p[ 1 ] + ( k / 2 == 1 ? e : T() );
+          pz_[ q ] = p[ 2 ] + ( k / 2 == 2 ? e : T() );
+        }
+      }
+      executor_.run( 0, 6 * n, out_.data() );
+      stats.evaluations += 6 * n;
+      for( size_t j = 0; j != n; ++j )
+      {
+        T* g = &normal_[ 3 * hits[ j ] ];
+        for( int k = 0; k != 3; ++k ) g[ k ] = d_[ 6 * j + 2 * k ] - d_[ 6 * j + 2 * k + 1 ];
+      }
+    }
+
+    /// Shades pixel i: diffuse light on hits, vertical gradient on misses.
+    void shade( size_t i, unsigned char* rgb ) const
+    {
+      T c[ 3 ];
+      if( hit_[ i ] )
+      {
+        T g[ 3 ] = { normal_[ 3 * i ], normal_[ 3 * i + 1 ], normal_[ 3 * i + 2 ] };
+        normalize( g );
+        const T l = g[ 0 ] * light_[ 0 ] + g[ 1 ] * light_[ 1 ] + g[ 2 ] * light_[ 2 ];
+        const T k = T( 0.15 ) + T( 0.85 ) * ( l > T() ? l : T() );
+        c[ 0 ] = T( 0.95 ) * k;
+        c[ 1 ] = T( 0.8 ) * k;
+        c[ 2 ] = T( 0.6 ) * k;
+      }
+      else
+      {
+        const T y = T( 0.5 ) + T( 0.5 ) * dir_[ 3 * i + 1 ];
+        c[ 0 ] = c[ 1 ] = T( 0.1 ) + T( 0.2 ) * y;
+        c[ 2 ] = T( 0.15 ) + T( 0.3 ) * y;
+      }
+      for( int k = 0; k != 3; ++k )
+      {
+        const T v = c[ k ] == c[ k ] ? std::min( std::max( c[ k ], T() ), T( 1 ) ) : T();
+        rgb[ k ] = static_cast< unsigned char >( v * T( 255 ) + T( 0.5 ) );
+      }
+    }
+
+    /// Normalizes vector, leaving null vectors unchanged.
+    static void normalize( T* v )
+    {
+      const T l = T( std::sqrt( v[ 0 ] * v[ 0 ] + v[ 1 ] * v[ 1 ] + v[ 2 ] * v[ 2 ] ) );
+      if( l > T() ) for( int k = 0; k != 3; ++k ) v[ k ] /= l;
+    }
+
+    /// Computes cross product r = a x b.
+    static void cross( const T* a, const T* b, T* r )
+    {
+      r[ 0 ] = a[ 1 ] * b[ 2 ] - a[ 2 ] * b[ 1 ];
+      r[ 1 ] = a[ 2 ] * b[ 0 ] - a[ 0 ] * b[ 2 ];
+      r[ 2 ] = a[ 0 ] * b[ 1 ] - a[ 1 ] * b[ 0 ];
+    }
+
+  private:
+    /// Executor evaluating the field.
+    batch_executor< T > executor_;
+    /// Settings.
+    trace_options< T > opt_;
+    /// Image size.
+    size_t width_, height_;
+    /// Eye position, view direction and image plane axes.
+    T eye_[ 3 ], forward_[ 3 ], right_[ 3 ], up_[ 3 ];
+    /// Direction towards the light.
+    T light_[ 3 ];
+    /// Rays still marching, compacted at each step.
+    std::vector< size_t > lanes_;
+    /// Rays hitting the surface.
+    std::vector< size_t > hits_;
+    /// Per ray: distance travelled, direction, hit flag and normal.
+    std::vector< T > t_, dir_;
+    std::vector< char > hit_;
+    std::vector< T > normal_;
+    /// Per lane: points evaluated, distance and gradient.
+    std::vector< T > px_, py_, pz_, d_, gx_, gy_, gz_;
+    /// Output arrays of the executor.
+    std::vector< T* > out_;
+  };
+
+  /// Definition of class name variable.
+  template < class T >
+  const std::string packet_tracer< T >::CLS_NAME( "packet_tracer" );
+
+  //----------------------------------------------------------------------------
+  /// Renders the surface where a signed distance expression over x, y, z is
+  /// zero: packets of pixels are traced by worker threads (see
+  /// packet_tracer), each one evaluating its own copy of the program (see
+  /// create_workers()).
+  /// @code
+  /// std::vector< unsigned char > rgb;
+  /// render_distance( mp, c, rt, "sqrt(x*x+y*y+z*z)-1", camera< double >(),
+  ///                  640, 480, rgb );
+  /// @endcode
+  /// @param mp parser
+  /// @param c compiler
+  /// @param rt run-time environment holding variables x, y, z
+  /// @param distance expression computing d, or vector d, dx, dy, dz
+  /// @param cam camera
+  /// @param width image width
+  /// @param height image height
+  /// @param[out] rgb image: r, g, b bytes of each pixel, row by row from the
+  ///        top
+  /// @param opt settings
+  /// @param threads number of threads, 0 for one per hardware thread
+  /// @return work done
+  template < class T >
+  trace_stats render_distance( const math_parser& mp, const compiler< T >& c,
+                               const rte< T >& rt, const std::string& distance,
+                               const camera< T >& cam, size_t width, size_t height,
+                               std::vector< unsigned char >& rgb,
+                               const trace_options< T >& opt = trace_options< T >(),
+                               unsigned threads = 0 )
+  {
+    typedef typename rte< T >::prog_type prog_type;
+    // program, environment and tracer private to a thread
+    struct worker {
+      rte< T > rt;
+      prog_type program;
+      shared_ptr< packet_tracer< T > > tracer;
+      trace_stats stats;
+    };
+    rgb.resize( 3 * width * height );
+    const size_t pixels = width * height;
+    const size_t packet = opt.packet ? opt.packet : 1;
+    const size_t packets = ( pixels + packet - 1 ) / packet;
+    if( !threads ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+    threads = unsigned( std::max( size_t( 1 ), std::min( size_t( threads ), packets ) ) );
+    const std::vector< shared_ptr< worker > > workers =
+      create_workers< worker >( rt, threads, [ & ]( worker& w )
+      {
+        compiler< T > lc( c );
+        const function_signatures< T > functions( w.rt );
+        w.program = lc.compile( mp.parse( distance, &functions ), w.rt );
+        w.tracer = shared_ptr< packet_tracer< T > >(
+          new packet_tracer< T >( w.rt, w.program, cam, width, height, opt ) );
+      } );
+    std::atomic< size_t > next( 0 );
+    const auto run = [ & ]( worker& w )
+    {
+      for( size_t k = next.fetch_add( 1 ); k < packets; k = next.fetch_add( 1 ) )
+      {
+        const size_t first = k * packet;
+        w.tracer->trace( first, std::min( packet, pixels - first ),
+                         &rgb[ 3 * first ], w.stats );
+      }
+    };
+    std::vector< std::thread > pool;
+    for( size_t t = 1; t != workers.size(); ++t )
+    {
+      pool.push_back( std::thread( run, std::ref( *workers[ t ] ) ) );
+    }
+    run( *workers[ 0 ] );
+    for( size_t t = 0; t != pool.size(); ++t ) pool[ t ].join();
+    trace_stats stats;
+    for( size_t t = 0; t != workers.size(); ++t )
+    {
+      stats.hits += workers[ t ]->stats.hits;
+      stats.steps += workers[ t ]->stats.steps;
+      stats.evaluations += workers[ t ]->stats.evaluations;
+    }
+    return stats;
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // SPHERE_TRACE_H__
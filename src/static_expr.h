@@ -0,0 +1,586 @@
+#ifndef STATIC_EXPR_H__
+#define STATIC_EXPR_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file static_expr.h compile-time parsing of expressions fixed at build
+/// time into inlined function objects (requires C++17)
+///
+/// Usage:
+/// <pre>
+///   constexpr auto f = MMP_STATIC_EXPR( "sqrt(x*x+y*y)" );
+///   const double r = f( 3.0, 4.0 ); // 5
+///   constexpr auto g = MMP_STATIC_EXPR_VARS( "a,b", "atan2(b,a)*180/Pi" );
+/// </pre>
+/// Expressions use the arithmetic operators of generate_def_operators() with
+/// the same precedence as math_parser: ^ * / unary- - + (highest first), each
+/// one left associative; i.e. a/b*c is a/(b*c) as in the run-time parser.
+/// Comparison and logical operators and if() are not supported.
+/// Unary minus is also accepted at the beginning of an expression.
+/// Function and constant names are the ones of the default tables in
+/// def_rte.h; variables are bound by position to the arguments of the
+/// function object: x, y, z, w by default, as in generate_default_rte().
+/// Syntax errors are reported as compile-time errors pointing at the throw
+/// expression in the parser, whose message describes the error.
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+#include "exception.h"
+#include "math_parser.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  /// Compile-time expressions.
+  namespace static_expr {
+
+  //----------------------------------------------------------------------------
+  /// Thrown by parse() when invoked at run time; at compile time the throw
+  /// expression makes the evaluation non-constant and the compiler reports
+  /// it together with the message.
+  class parse_error : public exception_base {
+  public:
+    /// Constructor.
+    /// @param fun function throwing exception
+    /// @param lineno line number at which exception is thrown
+    /// @param data message
+    parse_error( const std::string& fun,
+                 unsigned long lineno,
+                 const std::string& data = "" )
+      : exception_base( NS_NAME, "static_expr", fun, lineno, data )
+    {}
+  };
+
+  //----------------------------------------------------------------------------
+  /// Default variable names, same order as def_rte.h variable table.
+  constexpr const char* DEFAULT_VARIABLES = "x,y,z,w";
+
+  /// Function identifiers.
+  enum function_id {
+    // unary functions, same names as def_rte.h unary_functions
+    ABS, ACOS, ASIN, ATAN, CEIL, COS, COSH, EXP, FLOOR, LOG, LOG10, SIN,
+    SINH, SQRT, TAN, INV, NEG,
+    // binary functions, same names as def_rte.h binary_functions
+    ADD, SUB, MUL, DIV, POW, ATAN2
+  };
+
+  /// Function table entry.
+  struct function_entry {
+    const char* name; ///< Function name
+    function_id id;   ///< Function identifier
+    int args;         ///< Number of arguments
+  };
+
+  /// Named functions.
+  constexpr function_entry FUNCTIONS[] =
+  {
+    { "abs",   ABS,   1 }, { "acos", ACOS, 1 }, { "asin",  ASIN,  1 },
+    { "atan",  ATAN,  1 }, { "ceil", CEIL, 1 }, { "cos",   COS,   1 },
+    { "cosh",  COSH,  1 }, { "exp",  EXP,  1 }, { "floor", FLOOR, 1 },
+    { "log",   LOG,   1 }, { "log10", LOG10, 1 }, { "sin", SIN,   1 },
+    { "sinh",  SINH,  1 }, { "sqrt", SQRT, 1 }, { "tan",   TAN,   1 },
+    { "inv",   INV,   1 },
+    { "add",   ADD,   2 }, { "sub",  SUB,  2 }, { "div",   DIV,   2 },
+    { "mul",   MUL,   2 }, { "pow",  POW,  2 }, { "atan2", ATAN2, 2 }
+  };
+
+  /// Named constant.
+  struct constant_entry {
+    const char* name; ///< Constant name
+    double val;       ///< Constant value
+  };
+
+  /// Named constants, same values as def_rte.h constants.
+  constexpr constant_entry CONSTANTS[] =
+  {
+    { "e", 2.71828182845904523536 }, { "log2e", 1.44269504088896340736 },
+    { "Pi", 3.14159265358979323846 }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Node type.
+  enum node_kind { CONSTANT, VARIABLE, UNARY, BINARY };
+
+  /// Expression tree node; children are referenced by index.
+  struct node {
+    node_kind kind = CONSTANT; ///< Node type
+    function_id fun = ADD;     ///< Function, UNARY and BINARY only
+    int index = 0;             ///< Variable index, VARIABLE only
+    double val = 0;            ///< Value, CONSTANT only
+    int left = -1;             ///< First operand
+    int right = -1;            ///< Second operand
+  };
+
+  /// Parsed expression: a tree stored in a fixed size array, an expression
+  /// of N characters cannot have more than N nodes.
+  template < std::size_t N >
+  struct program {
+    node nodes[ N ] = {}; ///< Nodes
+    int size = 0;         ///< Number of nodes
+    int root = -1;        ///< Root node
+    int variables = 0;    ///< One plus highest variable index referenced
+  };
+
+  //----------------------------------------------------------------------------
+  /// Recursive descent parser; one function per precedence level of the
+  /// default operator table.
+  template < std::size_t N >
+  class parser {
+  public:
+    /// Constructor.
+    /// @param s expression
+    /// @param v comma separated variable names
+    constexpr parser( const char* s, const char* v ) : s_( s ), v_( v ) {}
+
+    /// Parses whole expression.
+    constexpr program< N > parse()
+    {
+      p_.root = sum();
+      skip_blanks();
+      if( s_[ i_ ] == ')' ) throw parse_error( "parse", __LINE__, "unmatched closing parenthesis" );
+      if( s_[ i_ ] == '=' ) throw parse_error( "parse", __LINE__, "assignment not supported" );
+      if( s_[ i_ ] ) throw parse_error( "parse", __LINE__, "unknown symbol" );
+      return p_;
+    }
+
+  private:
+    /// '+': lowest precedence.
+    constexpr int sum()
+    {
+      int l = difference();
+      while( next( '+' ) ) l = add( BINARY, ADD, l, difference() );
+      return l;
+    }
+
+    /// Binary '-'.
+    constexpr int difference()
+    {
+      int l = negation();
+      while( next( '-' ) ) l = add( BINARY, SUB, l, negation() );
+      return l;
+    }
+
+    /// Unary '-'.
+    constexpr int negation()
+    {
+      if( next( '-' ) ) return add( UNARY, NEG, negation() );
+      return quotient();
+    }
+
+    /// '/'.
+    constexpr int quotient()
+    {
+      int l = product();
+      while( next( '/' ) ) l = add( BINARY, DIV, l, product() );
+      return l;
+    }
+
+    /// '*'.
+    constexpr int product()
+    {
+      int l = power();
+      while( next( '*' ) ) l = add( BINARY, MUL, l, power() );
+      return l;
+    }
+
+    /// '^': highest precedence, left associative as in math_parser.
+    constexpr int power()
+    {
+      int l = primary();
+      while( next( '^' ) ) l = add( BINARY, POW, l, primary() );
+      return l;
+    }
+
+    /// Number, constant, variable, function call or parenthesized expression.
+    constexpr int primary()
+    {
+      skip_blanks();
+      const char c = s_[ i_ ];
+      if( c == '(' )
+      {
+        ++i_;
+        const int n = sum();
+        if( !next( ')' ) ) throw parse_error( "primary", __LINE__, "unmatched opening parenthesis" );
+        return n;
+      }
+      if( digit( c ) || c == '.' ) return number();
+      if( !alpha( c ) ) throw parse_error( "primary", __LINE__, "operand expected" );
+      const int b = i_;
+      while( alpha( s_[ i_ ] ) || digit( s_[ i_ ] ) ) ++i_;
+      const int e = i_;
+      if( next( '(' ) ) return call( b, e );
+      const int v = variable( b, e );
+      if( v >= 0 )
+      {
+        node n;
+        n.kind = VARIABLE;
+        n.index = v;
+        if( v >= p_.variables ) p_.variables = v + 1;
+        return add( n );
+      }
+      for( const constant_entry& k : CONSTANTS )
+      {
+        if( equal( b, e, k.name ) ) return constant( k.val );
+      }
+      throw parse_error( "primary", __LINE__, "unknown symbol" );
+    }
+
+    /// Function call, name in [b, e), opening parenthesis already read.
+    constexpr int call( int b, int e )
+    {
+      for( const function_entry& f : FUNCTIONS )
+      {
+        if( !equal( b, e, f.name ) ) continue;
+        const int a = sum();
+        if( f.args == 1 )
+        {
+          if( !next( ')' ) ) throw parse_error( "call", __LINE__, "one argument expected" );
+          return add( UNARY, f.id, a );
+        }
+        if( !next( ',' ) ) throw parse_error( "call", __LINE__, "two arguments expected" );
+        const int a2 = sum();
+        if( !next( ')' ) ) throw parse_error( "call", __LINE__, "two arguments expected" );
+        return add( BINARY, f.id, a, a2 );
+      }
+      throw parse_error( "call", __LINE__, "unknown function" );
+    }
+
+    /// Number in the format accepted by math_parser: 1, 1.2, .5, 1.2E-3.
+    /// Values whose mantissa has at most 15 significant digits and whose
+    /// decimal exponent is at most 22 in magnitude are correctly rounded;
+    /// other values may differ from strtod() in the last digit.
+    constexpr int number()
+    {
+      unsigned long long m = 0;
+      int digits = 0;
+      int exp10 = 0;
+      for( ; digit( s_[ i_ ] ); ++i_ ) accumulate( m, digits, exp10, s_[ i_ ], false );
+      if( s_[ i_ ] == '.' )
+      {
+        ++i_;
+        for( ; digit( s_[ i_ ] ); ++i_ ) accumulate( m, digits, exp10, s_[ i_ ], true );
+      }
+      if( s_[ i_ ] == 'e' || s_[ i_ ] == 'E' )
+      {
+        ++i_;
+        bool neg = false;
+        if( s_[ i_ ] == '+' || s_[ i_ ] == '-' ) neg = s_[ i_++ ] == '-';
+        if( !digit( s_[ i_ ] ) ) throw parse_error( "number", __LINE__, "invalid exponent" );
+        int x = 0;
+        for( ; digit( s_[ i_ ] ); ++i_ ) if( x < 10000 ) x = 10 * x + ( s_[ i_ ] - '0' );
+        exp10 += neg ? -x : x;
+      }
+      if( alpha( s_[ i_ ] ) ) throw parse_error( "number", __LINE__, "invalid name" );
+      double v = double( m );
+      if( exp10 >= 0 && exp10 <= 22 ) v *= pow10( exp10 );
+      else if( exp10 < 0 && exp10 >= -22 ) v /= pow10( -exp10 );
+      else if( exp10 > 0 ) for( int k = 0; k != exp10 && v < 1E308; ++k ) v *= 10;
+      else for( int k = 0; k != -exp10 && v != 0; ++k ) v /= 10;
+      return constant( v );
+    }
+
+    /// Adds digit to mantissa; digits beyond the 19th only change exponent.
+    static constexpr void accumulate( unsigned long long& m, int& digits,
+                                      int& exp10, char c, bool fraction )
+    {
+      if( digits < 19 )
+      {
+        m = 10 * m + ( c - '0' );
+        if( m ) ++digits;
+        if( fraction ) --exp10;
+      }
+      else if( !fraction ) ++exp10;
+    }
+
+    /// Returns 10^n, exact for n <= 22.
+    static constexpr double pow10( int n )
+    {
+      double p = 1;
+      for( int k = 0; k != n; ++k ) p *= 10;
+      return p;
+    }
+
+    /// Returns position of variable in variable list or -1.
+    constexpr int variable( int b, int e ) const
+    {
+      int idx = 0;
+      const char* v = v_;
+      while( *v )
+      {
+        int k = 0;
+        while( v[ k ] && v[ k ] != ',' ) ++k;
+        if( k == e - b )
+        {
+          int j = 0;
+          while( j != k && v[ j ] == s_[ b + j ] ) ++j;
+          if( j == k ) return idx;
+        }
+        v += v[ k ] ? k + 1 : k;
+        ++idx;
+      }
+      return -1;
+    }
+
+    /// Returns true if characters in [b, e) equal n.
+    constexpr bool equal( int b, int e, const char* n ) const
+    {
+      int k = 0;
+      while( n[ k ] && b + k != e && n[ k ] == s_[ b + k ] ) ++k;
+      return !n[ k ] && b + k == e;
+    }
+
+    /// Adds constant node.
+    constexpr int constant( double v )
+    {
+      node n;
+      n.val = v;
+      return add( n );
+    }
+
+    /// Adds function node.
+    constexpr int add( node_kind k, function_id f, int l, int r = -1 )
+    {
+      node n;
+      n.kind = k;
+      n.fun = f;
+      n.left = l;
+      n.right = r;
+      return add( n );
+    }
+
+    /// Adds node.
+    constexpr int add( const node& n )
+    {
+      if( p_.size == int( N ) ) throw parse_error( "add", __LINE__, "expression too complex" );
+      p_.nodes[ p_.size ] = n;
+      return p_.size++;
+    }
+
+    /// Skips blanks and consumes c if it is the next character.
+    constexpr bool next( char c )
+    {
+      skip_blanks();
+      if( s_[ i_ ] != c ) return false;
+      ++i_;
+      return true;
+    }
+
+    /// Skips blanks.
+    constexpr void skip_blanks()
+    {
+      while( s_[ i_ ] == ' ' || s_[ i_ ] == '\t' ) ++i_;
+    }
+
+    /// Returns true if c is a decimal digit.
+    static constexpr bool digit( char c ) { return c >= '0' && c <= '9'; }
+
+    /// Returns true if c can start a name.
+    static constexpr bool alpha( char c )
+    {
+      return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || c == '_';
+    }
+
+    /// Expression.
+    const char* s_;
+    /// Comma separated variable names.
+    const char* v_;
+    /// Current position.
+    int i_ = 0;
+    /// Parsed program.
+    program< N > p_;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Parses expression; evaluated at compile time when the result is used in
+  /// a constant expression.
+  /// @param s expression
+  /// @param v comma separated variable names
+  template < std::size_t N >
+  constexpr program< N > parse( const char ( &s )[ N ],
+                                const char* v = DEFAULT_VARIABLES )
+  {
+    return parser< N >( s, v ).parse();
+  }
+
+  //----------------------------------------------------------------------------
+  /// Applies unary function.
+  template < function_id F, class T >
+  constexpr T apply( T a )
+  {
+    using std::abs;  using std::acos;  using std::asin;  using std::atan;
+    using std::ceil; using std::cos;   using std::cosh;  using std::exp;
+    using std::floor; using std::log;  using std::log10; using std::sin;
+    using std::sinh; using std::sqrt;  using std::tan;
+    if constexpr( F == ABS ) return abs( a );
+    else if constexpr( F == ACOS ) return acos( a );
+    else if constexpr( F == ASIN ) return asin( a );
+    else if constexpr( F == ATAN ) return atan( a );
+    else if constexpr( F == CEIL ) return ceil( a );
+    else if constexpr( F == COS ) return cos( a );
+    else if constexpr( F == COSH ) return cosh( a );
+    else if constexpr( F == EXP ) return exp( a );
+    else if constexpr( F == FLOOR ) return floor( a );
+    else if constexpr( F == LOG ) return log( a );
+    else if constexpr( F == LOG10 ) return log10( a );
+    else if constexpr( F == SIN ) return sin( a );
+    else if constexpr( F == SINH ) return sinh( a );
+    else if constexpr( F == SQRT ) return sqrt( a );
+    else if constexpr( F == TAN ) return tan( a );
+    else if constexpr( F == INV ) return T( 1 ) / a;
+    else return -a;
+  }
+
+  /// Applies binary function.
+  template < function_id F, class T >
+  constexpr T apply( T a, T b )
+  {
+    using std::atan2; using std::pow;
+    if constexpr( F == ADD ) return a + b;
+    else if constexpr( F == SUB ) return a - b;
+    else if constexpr( F == MUL ) return a * b;
+    else if constexpr( F == DIV ) return a / b;
+    else if constexpr( F == POW ) return pow( a, b );
+    else return atan2( a, b );
+  }
+
+  //----------------------------------------------------------------------------
+  /// Constant leaf.
+  struct constant {
+    double val; ///< Value
+    /// Evaluates node.
+    template < class T > constexpr T operator()( const T* ) const { return T( val ); }
+  };
+
+  /// Variable leaf.
+  template < int I >
+  struct variable {
+    /// Evaluates node.
+    template < class T > constexpr T operator()( const T* v ) const { return v[ I ]; }
+  };
+
+  /// Unary function node.
+  template < function_id F, class A >
+  struct unary {
+    A a; ///< Operand
+    /// Evaluates node.
+    template < class T > constexpr T operator()( const T* v ) const
+    {
+      return apply< F >( a( v ) );
+    }
+  };
+
+  /// Binary function node.
+  template < function_id F, class A, class B >
+  struct binary {
+    A a; ///< First operand
+    B b; ///< Second operand
+    /// Evaluates node.
+    template < class T > constexpr T operator()( const T* v ) const
+    {
+      return apply< F >( a( v ), b( v ) );
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Builds typed tree rooted at node I of the program returned by l;
+  /// l is a captureless lambda, calling it inside a constant expression
+  /// makes the parsed program available as a template argument.
+  template < int I, class L >
+  constexpr auto build( L l )
+  {
+    constexpr node n = l().nodes[ I ];
+    if constexpr( n.kind == CONSTANT ) return constant{ n.val };
+    else if constexpr( n.kind == VARIABLE ) return variable< n.index >();
+    else if constexpr( n.kind == UNARY )
+    {
+      using a_type = decltype( build< n.left >( l ) );
+      return unary< n.fun, a_type >{ build< n.left >( l ) };
+    }
+    else
+    {
+      using a_type = decltype( build< n.left >( l ) );
+      using b_type = decltype( build< n.right >( l ) );
+      return binary< n.fun, a_type, b_type >{ build< n.left >( l ),
+                                              build< n.right >( l ) };
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /// Function object evaluating a compile-time expression.
+  template < class Tree, int V >
+  class expression {
+  public:
+    /// Number of variables: the function object requires at least this
+    /// number of arguments.
+    static constexpr int VARIABLES = V;
+
+    /// Constructor.
+    constexpr explicit expression( const Tree& t ) : tree_( t ) {}
+
+    /// Evaluates expression with variables read from array.
+    template < class T >
+    constexpr T eval( const T* v ) const { return tree_( v ); }
+
+    /// Evaluates expression; arguments are assigned to variables in order.
+    /// Evaluation is performed in float if all arguments are float, in the
+    /// common type of arguments and double otherwise.
+    template < class... A >
+    constexpr auto operator()( A... a ) const
+    {
+      static_assert( sizeof...( A ) >= std::size_t( V ),
+                     "too few arguments for expression variables" );
+      typedef typename std::conditional<
+                sizeof...( A ) != 0 && ( ... && std::is_same< A, float >::value ),
+                float,
+                typename std::common_type< A..., double >::type >::type value_type;
+      const value_type v[ sizeof...( A ) + 1 ] = { value_type( a )..., value_type() };
+      return tree_( v );
+    }
+
+  private:
+    /// Expression tree.
+    Tree tree_;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Creates function object from lambda returning parsed program.
+  template < class L >
+  constexpr auto make( L l )
+  {
+    constexpr auto p = l();
+    using tree_type = decltype( build< p.root >( l ) );
+    return expression< tree_type, p.variables >( build< p.root >( l ) );
+  }
+
+  } // namespace static_expr
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+/// Compile-time expression with default variables x, y, z, w.
+#define MMP_STATIC_EXPR( S ) \
+  ::mmath_plus::static_expr::make( \
+    []{ return ::mmath_plus::static_expr::parse( S ); } )
+
+/// Compile-time expression with variables listed in comma separated string.
+#define MMP_STATIC_EXPR_VARS( V, S ) \
+  ::mmath_plus::static_expr::make( \
+    []{ return ::mmath_plus::static_expr::parse( S, V ); } )
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // STATIC_EXPR_H__
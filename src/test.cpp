@@ -17,6 +17,7 @@
 #include "vm.h"
 #include "def_rte.h"
 #include "math_parser.h"
+#include "profiler.h"
 
 #ifdef MMP_DEBUG_MEMORY
 #include "dbgnew.h"
@@ -62,8 +63,18 @@ static const string DEFINE_FUNCTION          = "defun";
 static const string LIST                     = "list";
 /// Print list of supported functions
 static const string VALUES                   = "vals";
-/// Print list of supported functions
+/// Quit.
 static const string QUIT                     = "quit";
+/// Switch profiling on/off.
+static const string TOGGLE_PROFILE           = "profile";
+/// Print profile data in machine readable format.
+static const string PROFILE_DUMP             = "pdump";
+/// Set parameter value and run last program again.
+static const string SET_PARAMETER            = "param";
+#ifdef MMP_DEBUG_MEMORY
+/// Print memory usage by call site.
+static const string MEMORY_DUMP              = "memory";
+#endif
 
 /// Functor to print content of function_i*; used to print the content of
 /// a vector of function_i* elements to an output stream.
@@ -119,6 +130,7 @@ struct opfun2str
 /// @param args arguments
 /// @param out number of output values placed on the stack
 /// @param largs number of values on the left side
+/// @param prof profiler shared with the executor running the function
 template < class T >
 void add_user_def_function( math_parser& mp,
                             rte< T >& r,
@@ -126,10 +138,10 @@ void add_user_def_function( math_parser& mp,
                             const string& n,
                             const vector< string >& args,
                             int out,
-						    int largs = 0 )                            
+						    int largs = 0,
+                            const shared_ptr< profiler >& prof = 
+                                                    shared_ptr< profiler >() )
 {
-  typename rte< T >::fun_p_tab_type functions = generate_def_functions< T >();
-  typename rte< T >::val_p_tab_type constants = generate_def_constants< T >();
   typename rte< T >::val_p_tab_type variables;
   typedef typename rte< T >::val_p_tab_type::value_type vptype;
   typedef typename rte< T >::fun_p_tab_type::value_type fptype;
@@ -157,12 +169,13 @@ void add_user_def_function( math_parser& mp,
     variables.push_back( vptype( new value< T >( *i ) ) );
   }
   
-  // create local run-time environment
-  rte< T > rt( functions, variables, constants );
+  // create local run-time environment: functions and constants are shared
+  // with the caller's registry, only the parameters are allocated
+  rte< T > rt( r.base, variables );
   
   // use the pointer defined inside procedure
   typedef typename procedure<T>::executor_ptr_type exptype;
-  exptype ex_p( new vm< rte< T > >( rt ) ); 
+  exptype ex_p( new profiling_vm< rte< T > >( rt, prof, n ) ); 
   
   // declare program type which will hold the sequence of instructions
   // generated by the compiler
@@ -185,6 +198,34 @@ void add_user_def_function( math_parser& mp,
 
 void print_usage();
 
+//-----------------------------------------------------------------------------
+/// Runs program and prints the values left on the stack.
+/// @param m virtual machine
+/// @param prof profiler used by m
+/// @param program program
+void run( profiling_vm< rte< double > >& m, profiler& prof,
+          rte< double >::prog_type& program )
+{
+  prof.reset();
+  m.prog( &program );
+  m.run();
+
+  if( prof.enabled() ) prof.print( cout );
+
+  if( !m.rte().stack.empty() )
+  {
+    // print result i.e. value on top of stack
+    cout << '\n' << "RESULT: ";
+    while( !m.rte().stack.empty() )
+    {
+      cout << m.rte().stack.top() << ' ';
+      // remove value on top of stack
+      m.rte().stack.pop();
+    }
+    cout << endl;
+  }
+}
+
 
 //-----------------------------------------------------------------------------
 /// Test parser, compiler and VM.
@@ -193,33 +234,15 @@ void test_vm() {
     
   typedef mmath_plus::operator_type op_t;
  
-  // define operators for parser
-  op_t ops_array[] = { // example of function accepting 6 parameters and returning
-  	                   // 3 values
-  					   op_t( "cross3", 1, 0, 6, 3 ),
-					   op_t( "^", 2 ), op_t( "*", 2, 3, 3, 1 ),
-					   op_t( "*", 2 ), op_t( "/", 2 ),
-					   op_t( "-", 1, 0, 1, 1 ), op_t( "-", 2 ),
-					   op_t( "-", 2, 3, 3, 3 ),
-					   op_t( "+", 2, 3, 3, 3 ), op_t( "+", 2 ),
-				       op_t( "=", 2, 1, 1, 1, true ),  
-					   op_t( "=", 2, 3, 3, 3, true ) // 2 arguments, swap arguments
-													 // to have variable name just
-													 // before assignment operator
-													 // x = 2 --> 2 x =
-													 // This makes it easy to find
-													 // the variable when the assignment
-													 // operator is found. 
-					 }; 	
- 
+  // default operators for parser, check generate_def_operators() for
+  // an example of function accepting 6 parameters and returning 3 values
+  // (cross3) and of assignment operators with swapped arguments.
   // anything in the form 'function_name( x1, x2,..., xn)' is assumed to be
   // a function accepting n arguments and returning 1 value.
   // It is possible to define functions accepting N arguments and returning M
   // values as operators; in this case the functions will have to be declared together with
-  // the operators list if parse-time argument check is required, check the cross3 function
-  // above.
-  
-  vector< op_t > ops( ops_array, ops_array + sizeof( ops_array ) / sizeof( op_t ) );
+  // the operators list if parse-time argument check is required.
+  vector< op_t > ops( generate_def_operators() );
 
   // generate default run-time environment
   // the default run time environment supports all the standard C math functions.
@@ -236,10 +259,15 @@ void test_vm() {
   // create compiler and virtual machine for execution
   compiler< double > c( compiler< double >::COUNT_ARGS,
                         compiler< double >::CREATE_VARS );
-  vm< rte< double > > m( rt );
+  // profiling is disabled by default: run() only checks the flag
+  shared_ptr< profiler > prof( new profiler( false ) );
+  profiling_vm< rte< double > > m( rt, prof );
     
   // expression
   string expr;
+
+  // last program, run again when a parameter changes
+  rte< double >::prog_type program;
   
   cout << "==============================================" << '\n';
   
@@ -278,6 +306,7 @@ void test_vm() {
           cout << "COUNT ARGUMENTS     " << mp.count_args() << endl;
           cout << "COUNT FUN ARGUMENTS " << c.count_args()  << endl;
           cout << "DEBUG               " << mp.debug()      << endl;
+          cout << "PROFILE             " << prof->enabled() << endl;
         }
         else if( command == DEFINE_FUNCTION )
         {
@@ -296,12 +325,44 @@ void test_vm() {
           copy( ii, istream_iterator< string >(), back_inserter( in_args ) );
           cout << "TYPE BODY OF FUNCTION ON NEXT LINE" << endl;          
           getline( cin, expr );
-          add_user_def_function( mp, rt, expr, fname, in_args, out_args );
+          add_user_def_function( mp, rt, expr, fname, in_args, out_args,
+                                 0, prof );
+        }
+        else if( command == TOGGLE_PROFILE )
+        {
+          prof->enabled( !prof->enabled() );
+          cout << "PROFILE " << boolalpha << prof->enabled() << endl;
+        }
+        else if( command == PROFILE_DUMP )
+        {
+          prof->dump( cout );
+        }
+        else if( command == SET_PARAMETER )
+        {
+          cout << "SET PARAMETER Enter <name> <value>" << endl
+               << " example: k 0.5" << endl;
+          getline( cin, expr );
+          std::istringstream is( expr.c_str() );
+          string name;
+          double v = 0;
+          if( !( is >> name >> v ) ) throw string( "wrong parameter: " + expr );
+          rt.set_parameter( name, v );
+          // parameters are read at run time: no need to recompile
+          if( !program.empty() ) run( m, *prof, program );
+        }
+#ifdef MMP_DEBUG_MEMORY
+        else if( command == MEMORY_DUMP )
+        {
+          NewTrace.Dump( cout );
         }
+#endif
         else if( command == LIST )
         {
             cout <<  "==========================" << '\n';
             cout << "FUNCTIONS" << '\n' << "==========================" << '\n';
+            std::transform( rt.base->fun_tab.begin(), rt.base->fun_tab.end(),
+                            std::ostream_iterator< std::string >( cout, "\n" ),
+                            opfun2str() );
             std::transform( rt.fun_tab.begin(), rt.fun_tab.end(),
                             std::ostream_iterator< std::string >( cout, "\n" ),
                             opfun2str() );
@@ -320,9 +381,17 @@ void test_vm() {
                             opfun2str() );
             cout << "==========================" << '\n';
             cout << "CONSTANTS" << '\n' << "==========================" << '\n';
+            std::transform( rt.base->const_tab.begin(), rt.base->const_tab.end(),
+                            std::ostream_iterator< std::string >( cout, "\n" ),
+                            opfun2str() );
             std::transform( rt.const_tab.begin(), rt.const_tab.end(),
                             std::ostream_iterator< std::string >( cout, "\n" ),
                             opfun2str() );
+            cout << "==========================" << '\n';
+            cout << "PARAMETERS" << '\n' << "==========================" << '\n';
+            std::transform( rt.param_tab.begin(), rt.param_tab.end(),
+                            std::ostream_iterator< std::string >( cout, "\n" ),
+                            opfun2str() );
         }
         else
         {
@@ -333,9 +402,6 @@ void test_vm() {
 		continue;
       }
 
-      // program
-      rte< double >::prog_type program;
-
       // parse
       math_parser::Tokens vt = mp.parse( expr );
       
@@ -343,21 +409,7 @@ void test_vm() {
       program = c.compile( vt, rt);
       
       // run program
-      m.prog( &program );
-      m.run();
-      
-      if( !m.rte().stack.empty() )
-      {
-        // print result i.e. value on top of stack
-        cout << '\n' << "RESULT: "; 
-		while( !m.rte().stack.empty() )
-		{
-			cout << m.rte().stack.top() << ' ';
-			// remove value on top of stack
-			m.rte().stack.pop();
-		}
-		cout << endl;
-      }
+      run( m, *prof, program );
       cout << "==============================================" << '\n';
     }
     catch( math_parser::unmatched_opening_par& uo_p )
@@ -384,6 +436,12 @@ void test_vm() {
         cout << us_p << '\n';
         continue;
     }
+    catch( math_parser::unknown_operator& uo_p )
+    {
+        cout << "unknown operator" << '\n';
+        cout << uo_p << '\n';
+        continue;
+    }
     catch( compiler< double >::unknown_token& ut_p )
     {
         cout << "unknown token" << '\n';
@@ -395,6 +453,18 @@ void test_vm() {
         cout << "null token" << '\n';
         cout << nt_p << '\n';
         continue;
+    }
+    catch( compiler< double >::invalid_assignment& ia_p )
+    {
+        cout << "parameter cannot be assigned" << '\n';
+        cout << ia_p << '\n';
+        continue;
+    }
+    catch( compiler< double >::invalid_arguments& ia_p )
+    {
+        cout << "invalid arguments of conditional" << '\n';
+        cout << ia_p << '\n';
+        continue;
     }
 	catch( string& s )
 	{
@@ -434,7 +504,17 @@ void print_usage()
     cout << COMMAND_CHAR << LIST
         << "\t\tlist supported operators & functions" << endl;
     cout << COMMAND_CHAR << VALUES
-        << "\t\tlist variables and constants" << endl;    
+        << "\t\tlist variables, constants and parameters" << endl;    
+    cout << COMMAND_CHAR << TOGGLE_PROFILE
+        << "\t\ttoggle profiling" << endl;
+    cout << COMMAND_CHAR << PROFILE_DUMP
+        << "\t\tprint profile data of last run (tab separated)" << endl;
+    cout << COMMAND_CHAR << SET_PARAMETER
+        << "\t\tset parameter and run last expression again" << endl;
+#ifdef MMP_DEBUG_MEMORY
+    cout << COMMAND_CHAR << MEMORY_DUMP
+        << "\t\tprint memory usage by call site" << endl;
+#endif
     cout << COMMAND_CHAR << QUIT << "\t\tquit" << endl;      
 }
 
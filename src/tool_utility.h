@@ -0,0 +1,76 @@
+#ifndef TOOL_UTILITY_H__
+#define TOOL_UTILITY_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file tool_utility.h parsing of the command line options shared by the
+/// command line programs (mmbatch, mmtrace, mmint)
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <utility>
+#include <stdexcept>
+#include <cstdlib>
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  /// Evaluation precision: double, float or float with double accumulation
+  /// (see generate_mixed_rte()).
+  enum precision { DOUBLE, FLOAT, MIXED };
+
+  //----------------------------------------------------------------------------
+  /// Splits string at each occurrence of separator.
+  inline std::vector< std::string > split( const std::string& s, char sep )
+  {
+    std::vector< std::string > v;
+    std::istringstream is( s );
+    std::string t;
+    while( std::getline( is, t, sep ) ) v.push_back( t );
+    return v;
+  }
+
+  /// Removes leading and trailing blanks.
+  inline std::string trim( const std::string& s )
+  {
+    const std::string::size_type b = s.find_first_not_of( " \t\r" );
+    if( b == std::string::npos ) return "";
+    const std::string::size_type e = s.find_last_not_of( " \t\r" );
+    return s.substr( b, e - b + 1 );
+  }
+
+  /// Parses name=value parameter definition.
+  /// @throw std::runtime_error if value is not a number
+  inline std::pair< std::string, double > parse_parameter( const std::string& s )
+  {
+    const std::string::size_type p = s.find( '=' );
+    char* e = 0;
+    const double v = p == std::string::npos ? 0 : std::strtod( s.c_str() + p + 1, &e );
+    if( p == std::string::npos || e == s.c_str() + p + 1 || *e )
+    {
+      throw std::runtime_error( "invalid parameter " + s );
+    }
+    return std::make_pair( trim( s.substr( 0, p ) ), v );
+  }
+
+  /// Parses precision name: double, float or mixed.
+  /// @throw std::runtime_error if name is not known
+  inline precision parse_precision( const std::string& s )
+  {
+    if( s == "double" ) return DOUBLE;
+    if( s == "float" ) return FLOAT;
+    if( s == "mixed" ) return MIXED;
+    throw std::runtime_error( "unknown precision " + s );
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+
+#endif // TOOL_UTILITY_H__
@@ -0,0 +1,345 @@
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file trace_tool.cpp command line program rendering the zero level set
+/// of a signed distance expression over x, y, z into a PPM or PNG image
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+#include <cstdlib>
+
+#include "compiler.h"
+#include "execution.h"
+#include "def_rte.h"
+#include "math_parser.h"
+#include "sphere_trace.h"
+#include "tool_utility.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+
+/// Global instance of MemTracer class; it prints by default to std::clog stream
+MemTracer NewTrace;
+#endif
+
+//-----------------------------------------------------------------------------
+
+using namespace mmath_plus;
+using std::vector;
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::ostream;
+
+//-----------------------------------------------------------------------------
+/// Program configuration.
+struct config {
+  /// Distance expression.
+  string expr;
+  /// Output file, "-" for standard output; PNG if the name ends in .png.
+  string output;
+  /// Image size.
+  size_t width, height;
+  /// Camera position and target.
+  double eye[ 3 ], target[ 3 ];
+  /// Vertical field of view in degrees.
+  double fov;
+  /// Parameters: ( name, value ) pairs.
+  vector< std::pair< string, double > > params;
+  /// Tracing settings.
+  trace_options< double > opt;
+  /// Evaluation precision.
+  precision prec;
+  /// Number of threads, 0 for one per hardware thread.
+  unsigned threads;
+  /// Constructor: default values.
+  config() : output( "-" ), width( 640 ), height( 480 ), fov( 45 ),
+             prec( DOUBLE ), threads( 0 )
+  {
+    const camera< double > c;
+    for( int k = 0; k != 3; ++k )
+    {
+      eye[ k ] = c.eye[ k ];
+      target[ k ] = c.target[ k ];
+    }
+  }
+};
+
+//-----------------------------------------------------------------------------
+/// Parses n comma separated numbers.
+void parse_numbers( const string& s, size_t n, double* v )
+{
+  const vector< string > f = split( s, ',' );
+  for( size_t i = 0; i != f.size() && f.size() == n; ++i )
+  {
+    char* e = 0;
+    v[ i ] = std::strtod( f[ i ].c_str(), &e );
+    if( e == f[ i ].c_str() || *e ) break;
+    if( i + 1 == n ) return;
+  }
+  throw std::runtime_error( "invalid value " + s );
+}
+
+//-----------------------------------------------------------------------------
+/// Writes binary PPM image.
+void write_ppm( ostream& os, size_t width, size_t height,
+                const vector< unsigned char >& rgb )
+{
+  os << "P6\n" << width << ' ' << height << "\n255\n";
+  os.write( reinterpret_cast< const char* >( rgb.data() ), rgb.size() );
+}
+
+/// Appends 32 bit big endian value.
+void put32( vector< unsigned char >& b, unsigned long v )
+{
+  for( int s = 24; s >= 0; s -= 8 ) b.push_back( static_cast< unsigned char >( v >> s ) );
+}
+
+/// Writes PNG chunk: length, type, data and CRC of type and data.
+void write_png_chunk( ostream& os, const char* type,
+                      const vector< unsigned char >& data )
+{
+  static unsigned long table[ 256 ];
+  if( !table[ 1 ] )
+  {
+    for( unsigned long n = 0; n != 256; ++n )
+    {
+      unsigned long c = n;
+      for( int k = 0; k != 8; ++k ) c = c & 1 ? 0xedb88320UL ^ ( c >> 1 ) : c >> 1;
+      table[ n ] = c;
+    }
+  }
+  vector< unsigned char > b;
+  put32( b, data.size() );
+  b.insert( b.end(), type, type + 4 );
+  b.insert( b.end(), data.begin(), data.end() );
+  unsigned long crc = 0xffffffffUL;
+  for( size_t i = 4; i != b.size(); ++i ) crc = table[ ( crc ^ b[ i ] ) & 0xff ] ^ ( crc >> 8 );
+  put32( b, crc ^ 0xffffffffUL );
+  os.write( reinterpret_cast< const char* >( b.data() ), b.size() );
+}
+
+/// Writes PNG image, 8 bit RGB; the pixels are stored in uncompressed
+/// deflate blocks, which any decoder reads.
+void write_png( ostream& os, size_t width, size_t height,
+                const vector< unsigned char >& rgb )
+{
+  static const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  os.write( reinterpret_cast< const char* >( signature ), sizeof( signature ) );
+  vector< unsigned char > header;
+  put32( header, width );
+  put32( header, height );
+  // 8 bit depth, truecolor, deflate, adaptive filtering, no interlace
+  const unsigned char h[] = { 8, 2, 0, 0, 0 };
+  header.insert( header.end(), h, h + sizeof( h ) );
+  write_png_chunk( os, "IHDR", header );
+  // scanlines, each one preceded by filter type 0
+  vector< unsigned char > raw;
+  raw.reserve( height * ( 3 * width + 1 ) );
+  for( size_t y = 0; y != height; ++y )
+  {
+    raw.push_back( 0 );
+    raw.insert( raw.end(), rgb.begin() + 3 * width * y, rgb.begin() + 3 * width * ( y + 1 ) );
+  }
+  // zlib stream of stored blocks followed by Adler-32 checksum
+  vector< unsigned char > z;
+  z.push_back( 0x78 );
+  z.push_back( 0x01 );
+  const size_t max_block = 65535;
+  size_t i = 0;
+  do
+  {
+    const size_t n = std::min( max_block, raw.size() - i );
+    z.push_back( i + n == raw.size() ? 1 : 0 );
+    z.push_back( static_cast< unsigned char >( n ) );
+    z.push_back( static_cast< unsigned char >( n >> 8 ) );
+    z.push_back( static_cast< unsigned char >( ~n ) );
+    z.push_back( static_cast< unsigned char >( ~n >> 8 ) );
+    z.insert( z.end(), raw.begin() + i, raw.begin() + i + n );
+    i += n;
+  } while( i != raw.size() );
+  unsigned long a = 1, b = 0;
+  for( size_t k = 0; k != raw.size(); ++k )
+  {
+    a = ( a + raw[ k ] ) % 65521;
+    b = ( b + a ) % 65521;
+  }
+  put32( z, ( b << 16 ) | a );
+  write_png_chunk( os, "IDAT", z );
+  write_png_chunk( os, "IEND", vector< unsigned char >() );
+}
+
+//-----------------------------------------------------------------------------
+/// Renders the distance expression.
+/// @param cfg configuration
+/// @param rt run-time environment
+/// @param[out] rgb image
+/// @return work done
+template < class T >
+trace_stats render( const config& cfg, rte< T > rt, vector< unsigned char >& rgb )
+{
+  const char* names[] = { "x", "y", "z" };
+  for( int k = 0; k != 3; ++k )
+  {
+    if( !rt.variable_p( names[ k ] ) )
+    {
+      rt.var_tab.push_back( typename rte< T >::ValPtrT( new value< T >( names[ k ] ) ) );
+    }
+  }
+  for( size_t i = 0; i != cfg.params.size(); ++i )
+  {
+    rt.set_parameter( cfg.params[ i ].first, T( cfg.params[ i ].second ) );
+  }
+  camera< T > cam;
+  for( int k = 0; k != 3; ++k )
+  {
+    cam.eye[ k ] = T( cfg.eye[ k ] );
+    cam.target[ k ] = T( cfg.target[ k ] );
+  }
+  cam.fov = T( cfg.fov );
+  trace_options< T > opt;
+  opt.max_steps = cfg.opt.max_steps;
+  opt.far = T( cfg.opt.far );
+  opt.epsilon = T( cfg.opt.epsilon );
+  opt.step_scale = T( cfg.opt.step_scale );
+  opt.packet = cfg.opt.packet;
+  opt.block = cfg.opt.block;
+  const vector< operator_type > ops = generate_def_operators();
+  math_parser mp( ops, math_parser::DONT_SWAP_ARGS, math_parser::COUNT_ARGS );
+  compiler< T > c( compiler< T >::COUNT_ARGS, compiler< T >::DONT_CREATE_VARS );
+  return render_distance( mp, c, rt, cfg.expr, cam, cfg.width, cfg.height, rgb,
+                          opt, cfg.threads );
+}
+
+//-----------------------------------------------------------------------------
+/// Prints usage.
+void print_usage()
+{
+  const trace_options< double > opt;
+  cout << "usage: mmtrace [options] -e <distance>\n"
+       << "  -e <expr>         signed distance over x, y, z, or vector\n"
+       << "                    (d,dx,dy,dz) with its gradient\n"
+       << "  -o <file>         output file (default stdout); PNG if the\n"
+       << "                    name ends in .png, else binary PPM\n"
+       << "  -s <w,h>          image size (default 640,480)\n"
+       << "  -E <x,y,z>        eye position (default 0,0,-4)\n"
+       << "  -L <x,y,z>        point looked at (default 0,0,0)\n"
+       << "  -v <degrees>      vertical field of view (default 45)\n"
+       << "  -P <name=value>   parameter, can be repeated\n"
+       << "  -m <steps>        maximum steps per ray (default "
+       << opt.max_steps << ")\n"
+       << "  -d <distance>     maximum distance from the eye (default "
+       << opt.far << ")\n"
+       << "  -r <epsilon>      hit threshold relative to the distance\n"
+       << "                    travelled (default " << opt.epsilon << ")\n"
+       << "  -k <scale>        step scale, less than 1 for fields\n"
+       << "                    overestimating the distance (default 1)\n"
+       << "  -n <pixels>       pixels traced at once (default "
+       << opt.packet << ")\n"
+       << "  -b <points>       points evaluated at once (default "
+       << opt.block << ")\n"
+       << "  -t <threads>      threads (default: one per core)\n"
+       << "  -p double|float|mixed  evaluation precision (default double)\n"
+       << "Pixels/s, steps and evaluations are reported on stderr." << endl;
+}
+
+/// Entry point.
+int main( int argc, char** argv )
+{
+  config cfg;
+  try
+  {
+    for( int i = 1; i < argc; ++i )
+    {
+      const string a = argv[ i ];
+      const bool has_value = i + 1 < argc;
+      if( a == "-e" && has_value ) cfg.expr = argv[ ++i ];
+      else if( a == "-o" && has_value ) cfg.output = argv[ ++i ];
+      else if( a == "-s" && has_value )
+      {
+        double s[ 2 ];
+        parse_numbers( argv[ ++i ], 2, s );
+        cfg.width = size_t( s[ 0 ] );
+        cfg.height = size_t( s[ 1 ] );
+      }
+      else if( a == "-E" && has_value ) parse_numbers( argv[ ++i ], 3, cfg.eye );
+      else if( a == "-L" && has_value ) parse_numbers( argv[ ++i ], 3, cfg.target );
+      else if( a == "-v" && has_value ) cfg.fov = std::atof( argv[ ++i ] );
+      else if( a == "-P" && has_value ) cfg.params.push_back( parse_parameter( argv[ ++i ] ) );
+      else if( a == "-m" && has_value ) cfg.opt.max_steps = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-d" && has_value ) cfg.opt.far = std::atof( argv[ ++i ] );
+      else if( a == "-r" && has_value ) cfg.opt.epsilon = std::atof( argv[ ++i ] );
+      else if( a == "-k" && has_value ) cfg.opt.step_scale = std::atof( argv[ ++i ] );
+      else if( a == "-n" && has_value ) cfg.opt.packet = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-b" && has_value ) cfg.opt.block = size_t( std::atol( argv[ ++i ] ) );
+      else if( a == "-t" && has_value ) cfg.threads = unsigned( std::atol( argv[ ++i ] ) );
+      else if( a == "-p" && has_value ) cfg.prec = parse_precision( argv[ ++i ] );
+      else
+      {
+        print_usage();
+        return a == "-h" ? 0 : 1;
+      }
+    }
+    if( cfg.expr.empty() || !cfg.width || !cfg.height )
+    {
+      print_usage();
+      return 1;
+    }
+    const bool png = cfg.output.size() > 4
+                     && cfg.output.compare( cfg.output.size() - 4, 4, ".png" ) == 0;
+    const std::chrono::steady_clock::time_point t =
+                                            std::chrono::steady_clock::now();
+    vector< unsigned char > rgb;
+    trace_stats stats;
+    if( cfg.prec == DOUBLE )
+    {
+      stats = render( cfg, generate_default_rte< double >(), rgb );
+    }
+    else if( cfg.prec == FLOAT )
+    {
+      stats = render( cfg, generate_default_rte< float >(), rgb );
+    }
+    else stats = render( cfg, generate_mixed_rte(), rgb );
+    const double s = std::chrono::duration< double >(
+                       std::chrono::steady_clock::now() - t ).count();
+    // opened once the expression has compiled: no empty image on errors
+    std::ofstream ofs;
+    if( cfg.output != "-" )
+    {
+      ofs.open( cfg.output.c_str(), std::ios::out | std::ios::binary );
+      if( !ofs ) throw std::runtime_error( "cannot open " + cfg.output );
+    }
+    ostream& os = cfg.output != "-" ? static_cast< ostream& >( ofs ) : cout;
+    if( png ) write_png( os, cfg.width, cfg.height, rgb );
+    else write_ppm( os, cfg.width, cfg.height, rgb );
+    os.flush();
+    const size_t pixels = cfg.width * cfg.height;
+    cerr << pixels << " pixels, " << stats.hits << " hits, " << stats.steps
+         << " steps, " << stats.evaluations << " evaluations in " << s << " s: "
+         << ( s > 0 ? double( pixels ) / s : 0 ) << " pixels/s, "
+         << ( s > 0 ? double( stats.evaluations ) / s : 0 ) << " evaluations/s"
+         << endl;
+  }
+  catch( const exception_base& eb )
+  {
+    cerr << eb;
+    return 1;
+  }
+  catch( const std::exception& e )
+  {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,119 @@
+#ifndef VALIDATION_H__
+#define VALIDATION_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file validation.h parallel validation of sets of expressions
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "compiler.h"
+#include "execution.h"
+#include "math_parser.h"
+#include "exception.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Result of the validation of an expression.
+  struct validation {
+    /// Parse or compile status; the offset of errors is an offset in the
+    /// expression.
+    status error;
+    /// Number of instructions of the compiled program, 0 if not compiled.
+    size_t instructions;
+    /// Constructor.
+    validation() : instructions( 0 ) {}
+    /// Returns true if the expression was parsed and compiled.
+    bool compiled() const { return error.ok(); }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Parses and compiles each expression against the names defined in a
+  /// run-time environment, spreading the expressions across worker threads.
+  /// The parser is shared by all threads and must not have debug output
+  /// enabled; each thread compiles into its own copy of the compiler and of
+  /// the run-time environment, whose variable table is restored after each
+  /// expression, i.e. variables created by an expression are not seen by the
+  /// others.
+  /// @code
+  /// compiler< double > c( compiler< double >::COUNT_ARGS,
+  ///                       compiler< double >::DONT_CREATE_VARS );
+  /// std::vector< validation > v =
+  ///   validate_expressions( mp, c, generate_default_rte< double >(), exprs );
+  /// @endcode
+  /// @param mp parser
+  /// @param c compiler
+  /// @param rt run-time environment used to resolve names
+  /// @param exprs expressions
+  /// @param threads number of threads, 0 for one per hardware thread
+  /// @return one validation per expression, in the same order as exprs
+  template < class T >
+  std::vector< validation >
+  validate_expressions( const math_parser& mp, const compiler< T >& c,
+                        const rte< T >& rt,
+                        const std::vector< std::string >& exprs,
+                        unsigned threads = 0 )
+  {
+    std::vector< validation > results( exprs.size() );
+    // expressions are taken in chunks from a shared counter: short and long
+    // expressions are balanced across threads
+    const size_t CHUNK = 64;
+    std::atomic< size_t > next( 0 );
+    const auto worker = [ & ]()
+    {
+      compiler< T > lc( c );
+      rte< T > lrt( rt );
+      const size_t variables = lrt.var_tab.size();
+      typename rte< T >::prog_type program;
+      for( size_t b = next.fetch_add( CHUNK ); b < exprs.size();
+           b = next.fetch_add( CHUNK ) )
+      {
+        const size_t e = std::min( b + CHUNK, exprs.size() );
+        for( size_t i = b; i != e; ++i )
+        {
+          results[ i ].error =
+            compile_expression( mp, lc, exprs[ i ], lrt, program );
+          if( results[ i ].compiled() ) results[ i ].instructions = program.size();
+          lrt.var_tab.resize( variables );
+        }
+      }
+    };
+    if( !threads ) threads = std::max( 1u, std::thread::hardware_concurrency() );
+    threads = unsigned( std::min( size_t( threads ),
+                                  ( exprs.size() + CHUNK - 1 ) / CHUNK ) );
+    if( threads < 2 )
+    {
+      worker();
+      return results;
+    }
+    std::vector< std::thread > pool;
+    for( unsigned t = 1; t != threads; ++t ) pool.push_back( std::thread( worker ) );
+    worker();
+    for( size_t t = 0; t != pool.size(); ++t ) pool[ t ].join();
+    return results;
+  }
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // VALIDATION_H__
@@ -0,0 +1,293 @@
+#ifndef VECTOR_FUNCTIONS_H__
+#define VECTOR_FUNCTIONS_H__
+
+// MicroMath+ - (c) Ugo Varetto
+
+/// @file vector_functions.h functions operating in place on vector values
+/// with 2, 3 or 4 components
+
+#include <string>
+
+#include "execution.h"
+
+#ifdef MMP_DEBUG_MEMORY
+#include "dbgnew.h"
+#define new new( __FILE__, __LINE__, __FUNCTION__ )
+#endif
+
+//==============================================================================
+
+namespace mmath_plus {
+
+  //============================================================================
+
+  //----------------------------------------------------------------------------
+  /// Vector function kinds.
+  enum vector_function_kind {
+    VECTOR_UNARY,        ///< f(a) applied to each component
+    VECTOR_BINARY,       ///< f(a, b) applied to each pair of components
+    VECTOR_SCALAR_LEFT,  ///< f(s, b) applied to each component of b
+    VECTOR_SCALAR_RIGHT, ///< f(a, s) applied to each component of a
+    VECTOR_DOT,          ///< dot product
+    VECTOR_CROSS,        ///< cross product
+    VECTOR_SWIZZLE       ///< component selection
+  };
+
+  //----------------------------------------------------------------------------
+  /// Base class of functions operating on vector values; a vector value with
+  /// N components occupies N consecutive stack slots, first component first.
+  /// Executors that do not use the value stack (e.g. batch_executor) call
+  /// eval_block() to evaluate the function over columns of values.
+  template < class T >
+  struct vector_function_i : function_i< T > {
+    /// Function kind.
+    const vector_function_kind kind;
+    /// Number of components.
+    const int lanes;
+    /// Scalar function, VECTOR_UNARY only.
+    T ( *const unary )( T );
+    /// Scalar function, VECTOR_BINARY and VECTOR_SCALAR_* only.
+    T ( *const binary )( T, T );
+
+    /// Constructor.
+    /// @param n name
+    /// @param in number of input values
+    /// @param out number of output values
+    /// @param lin number of input values on the left side of operators
+    /// @param k kind
+    /// @param l number of components
+    /// @param uf scalar unary function
+    /// @param bf scalar binary function
+    vector_function_i( const std::string& n, int in, int out, int lin,
+                       vector_function_kind k, int l,
+                       T ( *uf )( T ) = 0, T ( *bf )( T, T ) = 0 )
+      : function_i< T >( n, in, out, lin ), kind( k ), lanes( l ),
+        unary( uf ), binary( bf )
+    {}
+
+    /// Evaluates function over n rows: s[ k ] points to the n values of
+    /// the k-th input, results are stored in s[ 0 ] ... s[ values_out - 1 ].
+    /// s must hold max( values_in, values_out ) pointers.
+    virtual void eval_block( T* const* s, size_t n ) const = 0;
+  };
+
+  //----------------------------------------------------------------------------
+  /// Unary function applied to each component: -(1,2,3) == (-1,-2,-3).
+  template < class T, int N >
+  struct vector_unary : vector_function_i< T > {
+    /// Constructor.
+    /// @param n name
+    /// @param f scalar function
+    vector_unary( const std::string& n, T ( *f )( T ) )
+      : vector_function_i< T >( n, N, N, 0, VECTOR_UNARY, N, f )
+    {}
+    /// Replaces each component with f(component).
+    void operator()( rte< T >& rt ) const
+    {
+      T* a = rt.stack.top_n( N );
+      for( int i = 0; i != N; ++i ) a[ i ] = this->unary( a[ i ] );
+    }
+    /// Evaluates function over columns.
+    void eval_block( T* const* s, size_t n ) const
+    {
+      for( int l = 0; l != N; ++l )
+      {
+        T* a = s[ l ];
+        for( size_t i = 0; i != n; ++i ) a[ i ] = this->unary( a[ i ] );
+      }
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Binary function applied to each pair of components:
+  /// (1,2,3) + (4,5,6) == (1+4,2+5,3+6).
+  template < class T, int N >
+  struct vector_binary : vector_function_i< T > {
+    /// Constructor.
+    /// @param n name
+    /// @param f scalar function
+    vector_binary( const std::string& n, T ( *f )( T, T ) )
+      : vector_function_i< T >( n, 2 * N, N, N, VECTOR_BINARY, N, 0, f )
+    {}
+    /// Stores results in place of first operand.
+    void operator()( rte< T >& rt ) const
+    {
+      T* a = rt.stack.top_n( 2 * N );
+      for( int i = 0; i != N; ++i ) a[ i ] = this->binary( a[ i ], a[ N + i ] );
+      rt.stack.pop_n( N );
+    }
+    /// Evaluates function over columns.
+    void eval_block( T* const* s, size_t n ) const
+    {
+      for( int l = 0; l != N; ++l )
+      {
+        T* a = s[ l ];
+        const T* b = s[ N + l ];
+        for( size_t i = 0; i != n; ++i ) a[ i ] = this->binary( a[ i ], b[ i ] );
+      }
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Binary function applied to a scalar and each component of a vector:
+  /// 2 * (1,2,3) == (2,4,6) if LEFT, (1,2,3) / 2 == (0.5,1,1.5) otherwise.
+  template < class T, int N, bool LEFT >
+  struct vector_scalar : vector_function_i< T > {
+    /// Constructor.
+    /// @param n name
+    /// @param f scalar function
+    vector_scalar( const std::string& n, T ( *f )( T, T ) )
+      : vector_function_i< T >( n, N + 1, N, LEFT ? 1 : N,
+                                LEFT ? VECTOR_SCALAR_LEFT : VECTOR_SCALAR_RIGHT,
+                                N, 0, f )
+    {}
+    /// Stores results in place of operands.
+    void operator()( rte< T >& rt ) const
+    {
+      T* a = rt.stack.top_n( N + 1 );
+      if( LEFT )
+      {
+        const T s = a[ 0 ];
+        for( int i = 0; i != N; ++i ) a[ i ] = this->binary( s, a[ i + 1 ] );
+      }
+      else
+      {
+        const T s = a[ N ];
+        for( int i = 0; i != N; ++i ) a[ i ] = this->binary( a[ i ], s );
+      }
+      rt.stack.pop();
+    }
+    /// Evaluates function over columns.
+    void eval_block( T* const* s, size_t n ) const
+    {
+      if( LEFT )
+      {
+        // the scalar column is overwritten by the first component
+        for( size_t i = 0; i != n; ++i )
+        {
+          const T v = s[ 0 ][ i ];
+          for( int l = 0; l != N; ++l ) s[ l ][ i ] = this->binary( v, s[ l + 1 ][ i ] );
+        }
+      }
+      else
+      {
+        const T* v = s[ N ];
+        for( int l = 0; l != N; ++l )
+        {
+          T* a = s[ l ];
+          for( size_t i = 0; i != n; ++i ) a[ i ] = this->binary( a[ i ], v[ i ] );
+        }
+      }
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Dot product R^N-->R.
+  /// (1,2,3)*(1,2,3)=1*1+2*2+3*3.
+  /// Products are accumulated in type AccT.
+  template < class T, int N, class AccT = T >
+  struct dotprod : vector_function_i< T > {
+    /// Constructor.
+    dotprod()
+      : vector_function_i< T >( "*", 2 * N, 1, N, VECTOR_DOT, N )
+    {}
+    /// Replaces operands with their dot product.
+    void operator()( rte< T >& rt ) const
+    {
+      T* a = rt.stack.top_n( 2 * N );
+      AccT d = AccT( a[ 0 ] ) * a[ N ];
+      for( int i = 1; i != N; ++i ) d += AccT( a[ i ] ) * a[ N + i ];
+      a[ 0 ] = T( d );
+      rt.stack.pop_n( 2 * N - 1 );
+    }
+    /// Evaluates function over columns.
+    void eval_block( T* const* s, size_t n ) const
+    {
+      for( size_t i = 0; i != n; ++i )
+      {
+        AccT d = AccT( s[ 0 ][ i ] ) * s[ N ][ i ];
+        for( int l = 1; l != N; ++l ) d += AccT( s[ l ][ i ] ) * s[ N + l ][ i ];
+        s[ 0 ][ i ] = T( d );
+      }
+    }
+  };
+
+  //----------------------------------------------------------------------------
+  /// Component selection: the function name lists the selected components,
+  /// x y z w being the first, second, third and fourth component.
+  /// zyx(1,2,3) == (3,2,1); xy(1,2,3) == (1,2); xxxx(1,2) == (1,1,1,1).
+  template < class T >
+  struct swizzle : vector_function_i< T > {
+    /// Returns true if name is a valid selection of components of a vector
+    /// value with n components.
+    static bool valid( const std::string& name, int n )
+    {
+      if( n < 2 || n > 4 || name.empty() || name.size() > 4 ) return false;
+      for( std::string::size_type i = 0; i != name.size(); ++i )
+      {
+        const int c = component( name[ i ] );
+        if( c < 0 || c >= n ) return false;
+      }
+      return true;
+    }
+    /// Constructor.
+    /// @param n name, must be valid
+    /// @param in number of components of input vector
+    swizzle( const std::string& n, int in )
+      : vector_function_i< T >( n, in, int( n.size() ), 0, VECTOR_SWIZZLE, in )
+    {
+      for( std::string::size_type i = 0; i != n.size(); ++i )
+      {
+        index[ i ] = component( n[ i ] );
+      }
+    }
+    /// Replaces input with selected components.
+    void operator()( rte< T >& rt ) const
+    {
+      const int in = this->values_in;
+      const int out = this->values_out;
+      const T* a = rt.stack.top_n( in );
+      T v[ 4 ];
+      for( int i = 0; i != out; ++i ) v[ i ] = a[ index[ i ] ];
+      rt.stack.pop_n( in );
+      for( int i = 0; i != out; ++i ) rt.stack.push( v[ i ] );
+    }
+    /// Evaluates function over columns.
+    void eval_block( T* const* s, size_t n ) const
+    {
+      const int out = this->values_out;
+      T v[ 4 ];
+      for( size_t i = 0; i != n; ++i )
+      {
+        for( int k = 0; k != out; ++k ) v[ k ] = s[ index[ k ] ][ i ];
+        for( int k = 0; k != out; ++k ) s[ k ][ i ] = v[ k ];
+      }
+    }
+    /// Index of selected components.
+    int index[ 4 ];
+
+  private:
+    /// Returns component index for x, y, z, w or -1.
+    static int component( char c )
+    {
+      switch( c )
+      {
+      case 'x': return 0;
+      case 'y': return 1;
+      case 'z': return 2;
+      case 'w': return 3;
+      default: return -1;
+      }
+    }
+  };
+
+  //============================================================================
+
+} // namespace mmath_plus
+
+//==============================================================================
+#ifdef MMP_DEBUG_MEMORY
+#undef new
+#endif
+
+#endif // VECTOR_FUNCTIONS_H__
@@ -20,6 +20,16 @@ namespace mmath_plus {
   //----------------------------------------------------------------------------
   /// Simple virtual machine implementation.
   /// Run-time value stack is accessible through the stack() function.
+  ///
+  /// Execution does not allocate memory: when the program is set, stack
+  /// space is reserved for the maximum depth of the program (see
+  /// max_stack_depth()), builtin functions work in place on the stack and
+  /// procedures reserve the stack of their own virtual machine when created.
+  /// The guarantee holds as long as the values left on the stack by a run are
+  /// removed before the next one and user defined functions do not allocate;
+  /// a program with instructions whose stack effect is not known allocates
+  /// during the first runs only. Errors reported through exceptions do
+  /// allocate.
   template < class RteT > class vm : public executor< RteT > {
   public:
 
@@ -48,8 +58,8 @@ namespace mmath_plus {
     /// Sets run-time environment.
     void rte( const RteT& rt) { rte_ = rt; }
 
-    /// Sets instruction array.
-    void prog( prog_type* pr ) { rte_.prog_p = pr; }
+    /// Sets instruction array and reserves stack space for its execution.
+    void prog( prog_type* pr ) { rte_.prog_p = pr; reserve(); }
 
     /// Iterates through instruction array and execute each instruction.
     /// The run-time environment's instruction pointer is incremented
@@ -73,6 +83,12 @@ namespace mmath_plus {
 
   private:
 
+    /// Reserves stack space for the execution of the current program.
+    void reserve()
+    {
+      if( rte_.prog_p ) rte_.stack.reserve( max_stack_depth( *rte_.prog_p ) );
+    }
+
     /// Run-time environment.
     RteT rte_;
   };